@@ -4,7 +4,37 @@
 #include "log.h"
 #include "colors.h"
 #include "constants.h"
+#include "tree.h"
 
-void Akinator(const char *const data_base);
+struct AkinatorOptions
+{
+    bool compress;
+
+    size_t versions;  // kept tree versions, 0 keeps the tree mutable
+
+    const char *checkpoint;           // periodic checkpoint file, NULL for none
+    double      checkpoint_interval;  // seconds
+    size_t      checkpoint_budget;    // node changes that force an earlier checkpoint
+
+    bool profile;   // load visit counters from <data_base>.profile and save them on exit
+    bool relayout;  // place hot paths together in memory, implies profile
+
+    size_t beam_width;  // candidates kept through uncertain answers, 0 for the default
+
+    const char *feed;    // change feed the learned answers are appended to, NULL for none
+    const char *follow;  // change feed to replay instead of learning, NULL for none
+
+    bool no_save;  // never write the learned answers to data/saved
+};
+
+int ParseAkinatorOptions(int *argc, char **argv[], AkinatorOptions *options);
+
+bool IsReadOnlyDataBase(const char *const data_base);
+
+Tree LoadKnowledgeBase(const char *const data_base, const AkinatorOptions *options);
+
+void Akinator(const char *const data_base, const AkinatorOptions *options = NULL);
+
+void SaveProgress(Tree *tree);
 
 #endif //AKINATOR_H
\ No newline at end of file
@@ -0,0 +1,33 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+const size_t ARENA_CHUNK_SIZE = 64 * 1024;
+
+struct ArenaChunk
+{
+    ArenaChunk *next;
+
+    size_t used;
+    size_t capacity;
+};
+
+struct Arena
+{
+    ArenaChunk *chunks;
+
+    size_t allocated;
+};
+
+Arena *ArenaCtor(void);
+
+void ArenaDtor(Arena *arena);
+
+void *ArenaAlloc(Arena *arena, const size_t size);
+
+void *ArenaAllocAligned(Arena *arena, const size_t size, const size_t align);
+
+char *ArenaStrdup(Arena *arena, const char *const str);
+
+#endif //ARENA_H
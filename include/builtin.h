@@ -0,0 +1,15 @@
+#ifndef BUILTIN_H
+#define BUILTIN_H
+
+#include "tree.h"
+
+const char *const BUILTIN_DATA_BASE = "@builtin";
+
+// Generated at build time from data/data.txt by kbgen.out, see obj/builtin_kb.cpp.
+extern const char   BUILTIN_STRINGS[];
+extern const Node   BUILTIN_NODES[];
+extern const size_t BUILTIN_NODES_COUNT;
+
+Tree BuiltinTree(void);
+
+#endif //BUILTIN_H
@@ -0,0 +1,58 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <pthread.h>
+#include <stdio.h>
+
+#include "tree.h"
+
+const size_t QUERY_CACHE_CAPACITY = 256;
+const size_t QUERY_CACHE_WAYS     = 4;
+const size_t QUERY_CACHE_PATHS    = 2;
+
+// Directions and node generations from the root down to the leaf of one looked up label.
+struct CachedPath
+{
+    size_t depth;
+
+    data_t   *directions;
+    uint64_t *gens;        // depth + 1 of them
+
+    uint64_t label_gen;  // of the leaf label, see LabelGeneration
+};
+
+struct CacheEntry
+{
+    char    *key;
+    uint64_t key_hash;
+
+    size_t     n_paths;
+    CachedPath paths[QUERY_CACHE_PATHS];
+
+    char *text;
+
+    uint64_t used;
+};
+
+struct QueryCache
+{
+    size_t      n_sets;
+    CacheEntry *entries;
+
+    uint64_t tick;
+
+    pthread_rwlock_t lock;
+};
+
+QueryCache *QueryCacheCtor(size_t capacity = QUERY_CACHE_CAPACITY);
+
+void QueryCacheDtor(QueryCache *cache);
+
+void NormalizeQuery(char *query);
+
+bool QueryCacheLookup(QueryCache *cache, Tree *const tree, const char *const key, FILE *out_file);
+
+int QueryCachePut(QueryCache *cache, Tree *const tree, const char *const key,
+                  const Stack *const paths, size_t n_paths, const char *const text);
+
+#endif //CACHE_H
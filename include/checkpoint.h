@@ -0,0 +1,62 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <pthread.h>
+#include <stdio.h>
+
+#include "tree.h"
+#include "akinator.h"
+
+const double CHECKPOINT_DEFAULT_INTERVAL = 60;
+const int    CHECKPOINT_POLL_MS          = 10;
+
+struct CheckpointStats
+{
+    size_t written;
+    size_t skipped;  // nothing changed since the previous checkpoint
+    size_t failed;
+
+    uint64_t max_pause_ns;  // game loop stopped to pin, start, join or release
+    uint64_t sum_pause_ns;
+    size_t   pauses;
+
+    uint64_t max_write_ns;
+};
+
+// The snapshot is the pinned root: learning copies the paths it changes, so the
+// writer thread reads nodes nobody edits. Only the game loop touches refs.
+struct Checkpointer
+{
+    Tree *tree;
+
+    const char *file_name;
+
+    uint64_t interval_ns;
+    uint64_t budget;  // node changes that force a checkpoint before the interval, 0 for none
+
+    uint64_t last_ns;
+    uint64_t last_gen;
+    uint64_t last_hash;
+
+    pthread_t thread;
+    bool      running;
+    int       done;
+
+    Tree     snapshot;
+    int      status;
+    uint64_t write_ns;
+
+    CheckpointStats stats;
+};
+
+Checkpointer *CheckpointerCtor(Tree *tree, const AkinatorOptions *options);
+
+void CheckpointerDtor(Checkpointer *checkpointer);
+
+int CheckpointTick(Checkpointer *checkpointer);
+
+int CheckpointTimeoutMs(const Checkpointer *checkpointer);
+
+void CheckpointReport(const Checkpointer *checkpointer, FILE *out_file);
+
+#endif //CHECKPOINT_H
@@ -0,0 +1,56 @@
+#ifndef CLASSIFIER_H
+#define CLASSIFIER_H
+
+#include <stdint.h>
+
+#include "tree.h"
+
+const size_t CLASSIFY_BATCH = 256;
+
+enum AttributeValue
+{
+    VALUE_NO      = 0,
+    VALUE_YES     = 1,
+    VALUE_MISSING = 2
+};
+
+struct DecisionProgram
+{
+    int32_t *attribute;
+    int32_t *next;
+    int32_t *answer;
+
+    size_t n_steps;
+    size_t max_depth;
+
+    char  **attributes;
+    size_t  n_attributes;
+
+    char  **answers;
+    size_t  n_answers;
+};
+
+struct Columns
+{
+    uint8_t **values;
+
+    size_t n_records;
+
+    char    *buffer;
+    uint8_t *constant;
+    uint8_t *missing;
+};
+
+DecisionProgram CompileTree(Tree *const tree);
+
+void DecisionProgramDtor(DecisionProgram *program);
+
+int ReadColumns(const DecisionProgram *program, const char *const file_name, Columns *columns);
+
+void ColumnsDtor(Columns *columns);
+
+int ClassifyRecords(const DecisionProgram *program, const Columns *columns, int32_t *result);
+
+int ClassifyCommand(int argc, char *argv[]);
+
+#endif //CLASSIFIER_H
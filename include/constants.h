@@ -1,9 +1,14 @@
 #ifndef CONST_H
 #define CONST_H
 
+#define STRINGIFY_(x) #x
+#define STRINGIFY(x)  STRINGIFY_(x)
+
+#define SHORT_ANS_WIDTH 7  // a macro, so scanf formats can spell it with STRINGIFY
+
 const int MAX_STR_LEN       = 2000;
 const int MAX_DATA_LEN      = 1000;
 const int FMT_STR_LEN       = 100;
-const int MAX_SHORT_ANS_LEN = 8;
+const int MAX_SHORT_ANS_LEN = SHORT_ANS_WIDTH + 1;
 
 #endif //CONST_H
\ No newline at end of file
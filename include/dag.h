@@ -0,0 +1,22 @@
+#ifndef DAG_H
+#define DAG_H
+
+#include "tree.h"
+
+struct DagReport
+{
+    size_t nodes;
+    size_t unique_nodes;
+
+    size_t labels;
+    size_t unique_labels;
+
+    size_t bytes_before;
+    size_t bytes_after;
+};
+
+int TreeCompress(Tree *tree, DagReport *report = NULL);
+
+int CompressReportCommand(int argc, char *argv[]);
+
+#endif //DAG_H
@@ -0,0 +1,21 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <stdio.h>
+
+#include "tree.h"
+
+const size_t EXPORT_CHUNK_SIZE = 64 * 1024;
+
+enum ExportFormat
+{
+    EXPORT_CSV,
+    EXPORT_JSONL,
+    EXPORT_TSV
+};
+
+int TreeExportLeaves(Tree *const tree, FILE *out_file, ExportFormat format);
+
+int ExportCommand(int argc, char *argv[]);
+
+#endif //EXPORT_H
@@ -0,0 +1,63 @@
+#ifndef FUZZY_H
+#define FUZZY_H
+
+#include <stdint.h>
+
+#include "tree.h"
+
+const size_t   FUZZY_MAX_LEN      = 64;  // codepoints of a query, one word of Myers' bit vectors
+const size_t   FUZZY_MAX_DISTANCE = 8;
+const size_t   FUZZY_BUCKETS      = FUZZY_MAX_LEN + FUZZY_MAX_DISTANCE + 2;  // the last one holds every longer label
+const uint32_t FUZZY_DIRECT       = 0x800;  // up to two UTF-8 bytes: ASCII, Latin and Cyrillic
+
+const size_t FUZZY_DISTANCE    = 2;  // for "did you mean"
+const size_t FUZZY_MAX_MATCHES = 5;
+
+const size_t BENCH_FUZZY_LABELS  = 1000000;
+const size_t BENCH_FUZZY_QUERIES = 100;
+
+// Leaf labels as case-folded codepoints, grouped by length. Labels are stored in the index,
+// so matches stay valid until the next build.
+struct LabelIndex
+{
+    uint64_t root_hash;  // of the tree last indexed, 0 for none
+
+    size_t    n_labels;
+    char     *text;        // labels back to back
+    size_t   *text_at;
+    uint32_t *symbols;     // folded codepoints back to back
+    size_t   *symbols_at;  // n_labels + 1 of them
+    uint64_t *masks;       // a hashed bit for every codepoint a label has
+
+    size_t buckets[FUZZY_BUCKETS + 1];  // first label of each length
+
+    uint64_t peq[FUZZY_DIRECT];  // positions of each codepoint in the query being looked up
+};
+
+struct FuzzyMatch
+{
+    const char *label;
+
+    size_t distance;
+    size_t length;    // in codepoints
+};
+
+LabelIndex *LabelIndexCtor(void);
+
+void LabelIndexDtor(LabelIndex *index);
+
+int LabelIndexBuild(LabelIndex *index, const char *const *labels, const size_t count);
+
+int LabelIndexSync(LabelIndex *index, Tree *const tree);
+
+// Whether FuzzyLookup takes the query: one to FUZZY_MAX_LEN codepoints.
+bool IsFuzzyQuery(const char *const query);
+
+size_t FuzzyLookup(LabelIndex *index, const char *const query, size_t max_distance,
+                   FuzzyMatch *matches, const size_t max_matches);
+
+int FuzzyCommand(int argc, char *argv[]);
+
+int BenchFuzzyCommand(int argc, char *argv[]);
+
+#endif //FUZZY_H
@@ -0,0 +1,48 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdio.h>
+
+#include "tree.h"
+
+const size_t HISTORY_MIN_CAPACITY = 8;
+
+struct Version
+{
+    Node  *root;
+    size_t size;
+};
+
+// Every kept version holds one reference to its root, so the root of the live tree is
+// always shared and TreeUnsharePath copies the whole learned path instead of editing it.
+struct History
+{
+    size_t max_versions;  // older versions are released once there are more
+    size_t first;         // number of versions[0]
+
+    size_t count;
+    size_t current;       // index of the version the tree shows
+    size_t capacity;
+
+    Version *versions;
+};
+
+History *HistoryCtor(Tree *tree, size_t max_versions);
+
+void HistoryDtor(History *history);
+
+int HistoryCommit(Tree *tree);
+
+int HistoryUndo(Tree *tree);
+
+int HistoryRedo(Tree *tree);
+
+size_t HistoryCurrent(const Tree *const tree);
+
+Tree HistoryOpen(Tree *const tree, size_t version);
+
+void HistoryClose(Tree *view);
+
+void HistoryList(const Tree *const tree, FILE *out_file);
+
+#endif //HISTORY_H
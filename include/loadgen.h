@@ -0,0 +1,44 @@
+#ifndef LOADGEN_H
+#define LOADGEN_H
+
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "tree.h"
+
+const size_t LOADGEN_PLAYERS = 16;
+const size_t LOADGEN_GAMES   = 1000;
+const int    LOADGEN_TEACH   = 10;
+
+struct LoadReport
+{
+    size_t players;
+    size_t games;
+    size_t guessed;
+    size_t learned;
+    size_t errors;
+    size_t mismatches;
+
+    double elapsed_ns;
+
+    size_t  n_latencies;
+    double *latencies;
+
+    long rss_start_kb;
+    long rss_end_kb;
+    long hwm_kb;
+};
+
+pid_t SpawnServer(const char *const data_base, const char *const socket_path, const char *const record_path = NULL);
+
+int StopServer(pid_t server);
+
+long ProcessMemoryKb(pid_t pid, const char *const field);
+
+int WriteLoadReport(LoadReport *report, FILE *file);
+
+int LoadgenCommand(int argc, char *argv[]);
+
+int ReplayCommand(int argc, char *argv[]);
+
+#endif //LOADGEN_H
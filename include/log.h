@@ -4,14 +4,16 @@
 #include <stdio.h>
 #include <stdbool.h>
 
+#include "metrics.h"
+
 #define PROTECT
 
 #ifndef LOG_CPP
 extern FILE *LOG_FILE;
 #endif
 
-#define LOG(...) fprintf(LOG_FILE, __VA_ARGS__)
-#define LOGS(string) fputs(string, LOG_FILE)
+#define LOG(...) METRICS_LOG(fprintf(LOG_FILE, __VA_ARGS__))
+#define LOGS(string) METRICS_LOG(fputs(string, LOG_FILE))
 
 #ifdef PROTECT
 #define ASSERT(condition, action) if(!(condition))\
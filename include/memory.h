@@ -0,0 +1,25 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <stddef.h>
+
+#include "metrics.h"
+
+const size_t MEMORY_REPORT_PATHS = 100;
+
+// Sizes are taken from malloc_usable_size, so a free needs only the pointer and the tag
+// it was allocated under.
+void *MemCalloc(MemTag tag, const size_t count, const size_t size);
+
+void *MemRealloc(MemTag tag, void *ptr, const size_t size);
+
+char *MemStrndup(MemTag tag, const char *const str, const size_t max_len);
+
+void MemFree(MemTag tag, void *ptr);
+
+// For blocks the C library allocates on our behalf, such as open_memstream buffers.
+void MemAdopt(MemTag tag, void *ptr);
+
+int MemoryReportCommand(int argc, char *argv[]);
+
+#endif //MEMORY_H
@@ -0,0 +1,28 @@
+#ifndef MERGE_H
+#define MERGE_H
+
+#include <stdio.h>
+
+#include "tree.h"
+
+const size_t MERGE_MAX_THREADS = 64;
+
+struct MergeStats
+{
+    size_t snapshots;
+    size_t failed;       // snapshots that could not be read or parsed
+    size_t changes;      // changed base leaves summed over all snapshots
+    size_t leaves;       // distinct base leaves that changed
+    size_t conflicts;    // positions where snapshots disagreed
+    size_t unsupported;  // changes other than leaf splits, ignored
+
+    double extract_s;
+    double merge_s;
+};
+
+int TreeMerge(Tree *base, char *const *snapshots, size_t n_snapshots, size_t n_threads,
+              FILE *conflicts_file, MergeStats *stats = NULL);
+
+int MergeCommand(int argc, char *argv[]);
+
+#endif //MERGE_H
@@ -0,0 +1,20 @@
+#ifndef MERKLE_H
+#define MERKLE_H
+
+#include <stdio.h>
+
+#include "tree.h"
+
+struct DiffStats
+{
+    size_t compared;  // node pairs whose hashes had to be compared
+    size_t changes;
+};
+
+int TreeDiff(Tree *const old_tree, Tree *const new_tree, FILE *out_file, DiffStats *stats = NULL);
+
+int DiffCommand(int argc, char *argv[]);
+
+int VerifyCommand(int argc, char *argv[]);
+
+#endif //MERKLE_H
@@ -0,0 +1,179 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifndef NO_METRICS
+#define METRICS
+#endif
+
+const int METRICS_SUB_BUCKETS_LOG = 3;
+const int METRICS_SUB_BUCKETS     = 1 << METRICS_SUB_BUCKETS_LOG;
+const int METRICS_BUCKETS         = 64 * METRICS_SUB_BUCKETS;
+
+const char *const METRICS_ENV = "AKINATOR_METRICS";
+
+enum MetricOp
+{
+    OP_READ_TREE,
+    OP_GET_ANSWER,
+    OP_TREE_PATH,
+    OP_ADD_ANSWER,
+    OP_TEXT_DUMP,
+    OP_TREE_DOT,
+    OP_SAVE,
+    OP_CHECKPOINT_PAUSE,
+    OP_CHECKPOINT_WRITE,
+    OP_REPLICATION_LAG,
+    OP_FUZZY_LOOKUP,
+
+    OP_COUNT
+};
+
+enum MetricCounter
+{
+    COUNTER_LOG_WRITES,
+    COUNTER_LOG_BYTES,
+    COUNTER_NODES,
+    COUNTER_LABEL_BYTES,
+    COUNTER_ARENA_BYTES,
+    COUNTER_CACHE_HITS,
+    COUNTER_CACHE_MISSES,
+
+    COUNTER_COUNT
+};
+
+enum MemTag
+{
+    MEM_NODES,
+    MEM_LABELS,
+    MEM_STACKS,
+    MEM_PARSER,
+    MEM_DUMP,
+    MEM_INDEX,
+
+    MEM_TAG_COUNT
+};
+
+struct MetricsBlock
+{
+    int64_t counters[COUNTER_COUNT];
+
+    uint64_t ops   [OP_COUNT];
+    uint64_t sum_ns[OP_COUNT];
+    uint64_t hist  [OP_COUNT][METRICS_BUCKETS];
+
+    int64_t mem_live  [MEM_TAG_COUNT];
+    int64_t mem_peak  [MEM_TAG_COUNT];
+    int64_t mem_allocs[MEM_TAG_COUNT];
+    int64_t mem_frees [MEM_TAG_COUNT];
+
+    MetricsBlock *next;
+};
+
+int MetricsInit(void);
+
+int MetricsWrite(FILE *file);
+
+int MetricsExport(const char *const target);
+
+int MetricsMemoryWrite(FILE *file);
+
+// Monotonic nanoseconds; also the clock of every benchmark and timed pass.
+inline uint64_t MetricsNow(void)
+{
+    timespec now = {};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+#ifdef METRICS
+extern thread_local MetricsBlock *METRICS_BLOCK;
+
+MetricsBlock *MetricsThreadBlock(void);
+
+// Every thread writes only its own block, so plain relaxed stores are enough;
+// MetricsWrite reads the blocks with relaxed loads while they are being updated.
+inline void MetricsAdd(MetricCounter counter, int64_t value)
+{
+    MetricsBlock *block = METRICS_BLOCK ? METRICS_BLOCK : MetricsThreadBlock();
+    if(!block) return;
+
+    __atomic_store_n(&block->counters[counter], block->counters[counter] + value, __ATOMIC_RELAXED);
+}
+
+// The peak is per thread, so the reported sum is exact for a single thread and an upper
+// bound when several threads hold memory of the same tag at once.
+inline void MetricsMemory(MemTag tag, int64_t bytes)
+{
+    MetricsBlock *block = METRICS_BLOCK ? METRICS_BLOCK : MetricsThreadBlock();
+    if(!block) return;
+
+    int64_t live = block->mem_live[tag] + bytes;
+
+    __atomic_store_n(&block->mem_live[tag], live, __ATOMIC_RELAXED);
+
+    if(bytes >= 0)
+    {
+        __atomic_store_n(&block->mem_allocs[tag], block->mem_allocs[tag] + 1, __ATOMIC_RELAXED);
+
+        if(live > block->mem_peak[tag]) __atomic_store_n(&block->mem_peak[tag], live, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        __atomic_store_n(&block->mem_frees[tag], block->mem_frees[tag] + 1, __ATOMIC_RELAXED);
+    }
+}
+
+inline int MetricsBucket(uint64_t ns)
+{
+    if(ns < (uint64_t)METRICS_SUB_BUCKETS) return (int)ns;
+
+    int exponent = 63 - __builtin_clzll(ns);
+    int sub      = (int)(ns >> (exponent - METRICS_SUB_BUCKETS_LOG)) & (METRICS_SUB_BUCKETS - 1);
+
+    return (exponent - METRICS_SUB_BUCKETS_LOG + 1) * METRICS_SUB_BUCKETS + sub;
+}
+
+inline void MetricsRecord(MetricOp op, uint64_t ns)
+{
+    MetricsBlock *block = METRICS_BLOCK ? METRICS_BLOCK : MetricsThreadBlock();
+    if(!block) return;
+
+    uint64_t *bucket = &block->hist[op][MetricsBucket(ns)];
+
+    __atomic_store_n(&block->ops[op]   , block->ops[op]    + 1 , __ATOMIC_RELAXED);
+    __atomic_store_n(&block->sum_ns[op], block->sum_ns[op] + ns, __ATOMIC_RELAXED);
+    __atomic_store_n(bucket            , *bucket           + 1 , __ATOMIC_RELAXED);
+}
+
+struct MetricsTimer
+{
+    MetricOp op;
+    uint64_t start;
+
+    explicit MetricsTimer(MetricOp timer_op) : op(timer_op), start(MetricsNow()) {}
+    ~MetricsTimer() { MetricsRecord(op, MetricsNow() - start); }
+
+    MetricsTimer(const MetricsTimer &) = delete;
+    MetricsTimer &operator=(const MetricsTimer &) = delete;
+};
+
+#define METRICS_CONCAT_(a, b) a##b
+#define METRICS_CONCAT(a, b) METRICS_CONCAT_(a, b)
+
+#define METRICS_TIME(op) MetricsTimer METRICS_CONCAT(metrics_timer_, __LINE__)(op)
+#define METRICS_ADD(counter, value) MetricsAdd(counter, value)
+#define METRICS_LOG(bytes) (MetricsAdd(COUNTER_LOG_WRITES, 1), MetricsAdd(COUNTER_LOG_BYTES, (int64_t)(bytes)))
+#define METRICS_MEMORY(tag, bytes) MetricsMemory(tag, bytes)
+#else
+#define METRICS_TIME(op) ((void)0)
+#define METRICS_ADD(counter, value) ((void)0)
+#define METRICS_LOG(bytes) ((void)(bytes))
+#define METRICS_MEMORY(tag, bytes) ((void)(tag), (void)(bytes))
+#endif
+
+#endif //METRICS_H
@@ -0,0 +1,51 @@
+#ifndef ORDERED_H
+#define ORDERED_H
+
+#include "tree.h"
+
+const size_t TREE_ITER_DEPTH     = 96;  // an AVL tree of 2^64 nodes is less than 93 levels deep
+const size_t BENCH_ORDERED_NODES = 10000;
+
+const size_t BULK_PARALLEL_SORT     = 1 << 16;  // fewer labels are sorted by the caller alone
+const size_t BENCH_BULK_LABELS      = 1000000;
+const size_t BENCH_BULK_INCREMENTAL = 10000;
+
+// Walks the labels of a balanced tree in strcmp order, both bounds included.
+struct TreeIter
+{
+    Node  *stack[TREE_ITER_DEPTH];
+    size_t depth;
+
+    const char *to;  // NULL for no upper bound
+};
+
+struct BulkReport
+{
+    size_t labels;
+    size_t unique;
+
+    uint64_t sort_ns;
+    uint64_t build_ns;  // duplicates removed, labels copied and nodes linked
+};
+
+Node *OrderedSearch(Node *const root, const char *const val);
+
+int TreeIterCtor(TreeIter *iter, Tree *const tree, const char *const from = NULL, const char *const to = NULL);
+
+Node *TreeIterNext(TreeIter *iter);
+
+int TreeBalance(Tree *tree);
+
+Tree TreeBulkLoad(const char **labels, const size_t count, BulkReport *report = NULL);
+
+Tree TreeBulkLoadFile(const char *const file_name, BulkReport *report = NULL);
+
+int RangeCommand(int argc, char *argv[]);
+
+int BenchOrderedCommand(int argc, char *argv[]);
+
+int BulkLoadCommand(int argc, char *argv[]);
+
+int BenchBulkCommand(int argc, char *argv[]);
+
+#endif //ORDERED_H
@@ -0,0 +1,60 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "tree.h"
+
+const size_t PARALLEL_MAX_THREADS = 64;
+const size_t PARALLEL_CUTOFF      = 1 << 14;  // nodes the caller visits alone before helpers start
+const size_t PARALLEL_GRAIN       = 1 << 10;  // nodes a worker visits between two hand-offs
+const size_t PARALLEL_DEPTH_BINS  = 64;
+
+// Called once per node. Returning false skips the children. The children are read before
+// the call, so a visitor may free the node it is given.
+typedef bool (*ParallelVisit)(Node *node, size_t depth, void *acc, void *ctx);
+
+// Folds one worker's accumulator into the result, which the caller initialized.
+typedef void (*ParallelMerge)(void *result, const void *acc, void *ctx);
+
+struct ParallelFold
+{
+    ParallelVisit visit;
+    ParallelMerge merge;     // NULL for a plain visitor
+
+    size_t acc_size;         // every worker starts from a zeroed accumulator of this size
+    void  *ctx;
+};
+
+struct TreeStats
+{
+    size_t nodes;
+    size_t leaves;
+    size_t unary;            // nodes with exactly one child
+    size_t max_depth;
+    size_t leaf_depth_sum;
+
+    size_t depth_bins[PARALLEL_DEPTH_BINS];  // bin b holds depths in [2^(b-1), 2^b), bin 0 the root
+};
+
+void ParallelSetThreads(size_t n_threads);
+
+size_t ParallelThreads(void);
+
+// Takes a leading "--threads N" off the command line.
+int ParseThreads(int *argc, char **argv[]);
+
+int SubTreeFold(Node *sub_tree, const ParallelFold *fold, void *result);
+
+// For folds into a size_t: counts the nodes, and adds up what the workers counted.
+bool CountVisit(Node *node, size_t depth, void *acc, void *ctx);
+
+void SumMerge(void *result, const void *acc, void *ctx);
+
+int SubTreeStats(Node *sub_tree, TreeStats *stats);
+
+void TreeStatsWrite(FILE *file, const TreeStats *stats);
+
+int TreeStatsCommand(int argc, char *argv[]);
+
+int BenchParallelCommand(int argc, char *argv[]);
+
+#endif //PARALLEL_H
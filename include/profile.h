@@ -0,0 +1,18 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "tree.h"
+
+const char *const PROFILE_SUFFIX = ".profile";
+
+const size_t RELAYOUT_ALIGN = 64;  // a cache line
+
+int ProfileLoad(Tree *tree, const char *const data_base);
+
+int ProfileSave(Tree *const tree, const char *const data_base);
+
+int TreeRelayout(Tree *tree);
+
+int BenchLayoutCommand(int argc, char *argv[]);
+
+#endif //PROFILE_H
@@ -0,0 +1,75 @@
+#ifndef REPLICA_H
+#define REPLICA_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "tree.h"
+
+// One line per change: "<kind>\t<seq>\t<root hash after>\t<time ns>[\t<path>\t<answer>\t<property>]".
+// The path is a string of 0 (left) and 1 (right) from the root to the split leaf.
+enum FeedKind
+{
+    FEED_BASE  = 'B',  // the primary (re)started from this root
+    FEED_SPLIT = 'S',  // a leaf split into a question, the old leaf on the left and the answer on the right
+    FEED_UNDO  = 'U',
+    FEED_REDO  = 'R'
+};
+
+const char *const REPLICATION_BENCH_FEED = "/tmp/akinator-bench.feed";
+
+struct Feed
+{
+    int      fd;
+    uint64_t seq;
+};
+
+struct FollowerStats
+{
+    size_t applied;
+    size_t skipped;  // records before the snapshot the follower started from
+
+    uint64_t max_lag_ns;
+    uint64_t sum_lag_ns;
+};
+
+// A follower never learns on its own: it replays the primary's changes and checks the
+// root hash after each one. Once that differs it stops following.
+struct Follower
+{
+    Tree *tree;
+
+    const char *feed_name;
+
+    int fd;
+    int watch_fd;  // inotify, ready whenever the feed grows
+
+    char  *line;   // a record not yet complete
+    size_t line_len;
+    size_t line_capacity;
+
+    bool     synced;  // found the snapshot in the feed
+    bool     diverged;
+    uint64_t seq;
+
+    FollowerStats stats;
+};
+
+Feed *FeedOpen(Tree *tree, const char *const file_name);
+
+void FeedClose(Feed *feed);
+
+int FeedAppend(Feed *feed, FeedKind kind, uint64_t hash, const Stack *path = NULL,
+               const char *const answer = NULL, const char *const property = NULL);
+
+Follower *FollowerCtor(Tree *tree, const char *const feed_name);
+
+void FollowerDtor(Follower *follower);
+
+int FollowerPoll(Follower *follower);
+
+void FollowerReport(const Follower *follower, FILE *out_file);
+
+int BenchReplicationCommand(int argc, char *argv[]);
+
+#endif //REPLICA_H
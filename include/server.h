@@ -0,0 +1,19 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "tree.h"
+#include "session.h"
+
+struct Checkpointer;
+struct Follower;
+
+int Serve(Tree *tree, const char *const socket_path, FILE *record = NULL, Checkpointer *checkpointer = NULL,
+          size_t beam_width = BEAM_DEFAULT_WIDTH, Follower *follower = NULL, bool save = true);
+
+int ServeCommand(int argc, char *argv[]);
+
+int BenchSessionsCommand(int argc, char *argv[]);
+
+int BenchBeamCommand(int argc, char *argv[]);
+
+#endif //SERVER_H
@@ -0,0 +1,119 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <coroutine>
+
+#include "tree.h"
+
+const int LIKELIHOOD_YES      = 100;  // percent chance of "yes" behind an answer to a question
+const int LIKELIHOOD_PROBABLY = 75;
+
+const size_t BEAM_DEFAULT_WIDTH = 8;
+const size_t BEAM_MAX_GUESSES   = 3;  // ranked leaves offered before learning
+
+enum PromptKind
+{
+    PROMPT_QUESTION,
+    PROMPT_GUESS,
+    PROMPT_CORRECT_ANSWER,
+    PROMPT_PROPERTY
+};
+
+enum GameResult
+{
+    GAME_RUNNING,
+    GAME_GUESSED,
+    GAME_LEARNED,
+    GAME_LOST      // wrong guess on a read-only version
+};
+
+struct Prompt
+{
+    PromptKind kind;
+
+    const char *subject;
+    const char *object;
+};
+
+struct BeamEntry
+{
+    Node  *node;
+    double weight;
+};
+
+// Candidates sorted by weight. Sized once per session, so answering never allocates.
+struct Beam
+{
+    size_t width;
+    size_t size;
+
+    BeamEntry *entries;  // 3 * width: the beam, then room for every entry to split in two
+};
+
+struct GameSession
+{
+    struct promise_type;
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+struct GameSession::promise_type
+{
+    Prompt      prompt = {};
+    const char *answer = NULL;
+    GameResult  result = GAME_RUNNING;
+
+    char *learned = NULL;
+    Stack path    = StackCtor();
+
+    Node *pinned = NULL;  // version root kept alive while the session walks it
+
+    Beam beam = {};
+
+    struct Resume
+    {
+        promise_type *promise;
+
+        bool await_ready(void) const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<>) const noexcept {}
+        const char *await_resume(void) const noexcept { return promise->answer; }
+    };
+
+    static void *operator new(size_t size);
+    static void  operator delete(void *frame, size_t size);
+
+    ~promise_type();
+
+    GameSession get_return_object(void) { return {std::coroutine_handle<promise_type>::from_promise(*this)}; }
+
+    std::suspend_never  initial_suspend(void) noexcept { return {}; }
+    std::suspend_always final_suspend  (void) noexcept { return {}; }
+
+    Resume yield_value(Prompt next) { prompt = next; return {this}; }
+
+    void return_value(GameResult game_result) { result = game_result; }
+
+    [[noreturn]] void unhandled_exception(void);
+};
+
+GameSession GameSessionCtor(Tree *tree, size_t beam_width = BEAM_DEFAULT_WIDTH);
+
+void GameSessionDtor(GameSession *session);
+
+bool IsGameOver(const GameSession *session);
+
+Prompt GamePrompt(const GameSession *session);
+
+GameResult GameSessionResult(const GameSession *session);
+
+bool GameAnswer(GameSession *session, const char *const answer);
+
+int ParseYesNo(const char *const answer);
+
+int ParseLikelihood(const char *const answer);
+
+void AddAnswer(Tree *tree, const Stack *path, Node *prev_answer, const char *const answer, const char *const property);
+
+size_t GameSessionsBytes(void);
+
+#endif //SESSION_H
@@ -0,0 +1,33 @@
+#ifndef SHARED_H
+#define SHARED_H
+
+#include <stdint.h>
+
+#include "tree.h"
+
+const char *const SHARED_DATA_BASE_PREFIX = "shm:";
+
+const uint64_t  SHARED_MAGIC     = 0x3142534E494B41ull;  // "AKINSB1"
+const uintptr_t SHARED_BASE_HINT = 0x7e0000000000;       // far from the heap, the stacks and the sanitizer shadow
+const size_t    SHARED_ALIGN     = 64;
+
+// The nodes are written for the address the publisher mapped the segment at. Every
+// process maps it there when that range is free, and otherwise relocates a private copy.
+struct SharedHeader
+{
+    uint64_t magic;
+    uint64_t base;
+    uint64_t size;
+
+    uint64_t nodes;         // root first, in preorder
+    uint64_t nodes_offset;
+    uint64_t labels_offset;
+};
+
+int SharedPublish(Tree *const tree, const char *const file_name);
+
+Tree SharedTree(const char *const file_name);
+
+int PublishCommand(int argc, char *argv[]);
+
+#endif //SHARED_H
@@ -0,0 +1,83 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+const size_t TRACE_CHUNK_EVENTS = 4096;
+const size_t TRACE_ARG_LEN      = 64;
+const size_t TRACE_READ_DEPTH   = 3;
+
+const uint64_t TRACE_OPEN = UINT64_MAX;
+
+const char *const TRACE_ENV = "AKINATOR_TRACE";
+
+struct TraceEvent
+{
+    const char *name;
+
+    uint64_t start_ns;
+    uint64_t dur_ns;
+
+    const char *int_key;
+    long long   int_value;
+
+    const char *str_key;
+    char        str_value[TRACE_ARG_LEN];
+};
+
+struct TraceChunk
+{
+    TraceChunk *next;
+
+    size_t     size;
+    TraceEvent events[TRACE_CHUNK_EVENTS];
+};
+
+struct TraceBuffer
+{
+    pid_t tid;
+
+    TraceChunk *head;
+    TraceChunk *tail;
+
+    TraceBuffer *next;
+};
+
+extern bool TRACE_ENABLED;
+
+int TraceInit(void);
+
+int TraceWrite(const char *const file_name);
+
+TraceEvent *TraceBegin(const char *name);
+
+void TraceEnd(TraceEvent *event);
+
+int TracedSystem(const char *const command);
+
+// Tracing off costs one load and a branch: the event slot is reserved only when enabled.
+struct TraceSpan
+{
+    TraceEvent *event;
+
+    explicit TraceSpan(const char *name) : event((TRACE_ENABLED && name) ? TraceBegin(name) : NULL) {}
+    ~TraceSpan() { if(event) TraceEnd(event); }
+
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+};
+
+inline void TraceSpanInt(TraceSpan *span, const char *key, long long value)
+{
+    if(!span->event) return;
+
+    span->event->int_key   = key;
+    span->event->int_value = value;
+}
+
+void TraceSpanStr(TraceSpan *span, const char *key, const char *value);
+
+#define TRACE_SPAN(var, name) TraceSpan var(name)
+
+#endif //TRACE_H
@@ -2,10 +2,20 @@
 #define TREE_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "log.h"
 #include "stack.h"
 #include "constants.h"
+#include "arena.h"
+
+enum NodeFlags
+{
+    NODE_SHARED_DATA = 1 << 0,
+    NODE_STATIC      = 1 << 1,  // compiled into the binary: read-only, shared by every tree, never freed
+    NODE_ARENA       = 1 << 2,  // placed in the tree arena by a relayout, freed with the arena
+    NODE_HOT_RIGHT   = 1 << 3   // the right child is the likely next step, set by a relayout
+};
 
 struct Node
 {
@@ -13,13 +23,58 @@ struct Node
 
     Node *left;
     Node *right;
+
+    size_t   refs;  // parents sharing the node besides the first one
+    unsigned flags;
+    unsigned height;  // of the subtree, kept up to date only in balanced trees
+
+    uint64_t hash;  // Merkle hash of the label and both child hashes
+    uint64_t gen;   // fresh whenever the label or a child link changes, kept by copies
+
+    uint64_t visits;  // games and paths that went through the node
 };
 
+struct History;
+struct Feed;
+
 struct Tree
 {
     Node *root;
 
     size_t size;
+
+    Arena *arena;
+
+    History *history;  // kept versions, NULL unless the tree is persistent
+    bool     read_only;
+    bool     balanced;  // AUTO inserts keep it an AVL tree in strcmp order, see TreeBalance
+
+    Feed *feed;  // where structural changes are published for followers, NULL for none
+};
+
+struct ReadReport
+{
+    size_t nodes;
+    size_t hashed;      // nodes that carried a stored hash
+    size_t mismatched;  // stored hash differs from the recomputed one
+    size_t corrupted;   // mismatched nodes whose children both matched
+
+    FILE *corruption_file;  // where corrupted nodes are listed, the log if NULL
+};
+
+// For walks that must not recurse, since sorted AUTO inserts build trees as deep as they are large.
+struct NodeFrame
+{
+    Node *node;
+    int   state;  // what the walk has done at the node so far
+};
+
+struct NodeStack
+{
+    NodeFrame *frames;
+
+    size_t size;
+    size_t capacity;
 };
 
 enum PlacePref
@@ -54,19 +109,61 @@ Node *TreeSearchVal(Tree *const tree, const char *const val);
 
 Stack TreePath(Tree *const tree, const char *const val);
 
+// Pushes the directions from sub_tree down to target, root end first.
+bool SubTreePathTo(Node *const sub_tree, const Node *const target, Stack *path);
+
 Node *TreeSearchParent(Tree *const tree, Node *const search_node);
 
+Node *TreeFollowPath(Tree *const tree, const data_t *const path, const size_t depth);
+
+Node *TreeUnsharePath(Tree *tree, const data_t *const path, const size_t depth);
+
+size_t SubTreeSize(Node *const tree_node);
+
+size_t SubTreeLabelBytes(Node *const tree_node);  // terminators included
+
+void NodeHold(Node *node);
+
+void NodeVisit(Node *node);
+
+Node *NodeLikelyChild(const Node *const node);
+
+void NodePrefetch(const Node *const node);
+
+int SubTreeRelease(Node *sub_tree);
+
+uint64_t NodeGeneration(void);
+
+// Changes whenever a node is added with the label or relabelled to it.
+uint64_t LabelGeneration(const char *const label);
+
 Node *NodeCtor(const char *const val, Node *const left = NULL, Node *const right = NULL);
 
 int NodeDtor(Node *node);
 
-void TreeTextDump(Tree *const tree, FILE *dump_file = LOG_FILE);
+Node *NodeCopy(Node *const node);
+
+int NodeRelabel(Node *node, const char *const val);
+
+void NodeRehash(Node *node);
+
+int NodeStackPush(NodeStack *stack, Node *const node, const int state = 0);
+
+void NodeStackDtor(NodeStack *stack);
+
+void NodeRelink(Node *node);
+
+int TreeRehashPath(Tree *tree, const data_t *const path, const size_t depth);
+
+void TreeRehash(Tree *tree);
+
+int TreeTextDump(Tree *const tree, FILE *dump_file = LOG_FILE);
 
 void TreeDot(Tree *const tree, const char *png_file_name);
 
 void TreeDump(Tree *tree, const char *func, const int line);
 
-Tree ReadTree(const char *const file_name);
+Tree ReadTree(const char *const file_name, ReadReport *report = NULL);
 
 #ifdef PROTECT
 bool IsTreeValid(Tree *const tree);
@@ -0,0 +1,40 @@
+#ifndef VALIDATE_H
+#define VALIDATE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+const size_t VALIDATE_BLOCK      = 1 << 20;   // bytes read at a time by every thread
+const size_t VALIDATE_MIN_CHUNK  = 64 << 20;  // smaller files are checked by one thread
+const size_t VALIDATE_MAX_ERRORS = 100;       // listed, the rest are only counted
+const size_t VALIDATE_MAX_PLACES = 5;         // lines listed for a duplicate label
+const size_t VALIDATE_HASH_LEN   = 16;        // hex digits of a stored node hash
+
+struct ValidateOptions
+{
+    size_t threads;     // 0 for ParallelThreads()
+    size_t chunk;       // bytes per chunk, 0 to split the file evenly between the threads
+    bool   duplicates;  // costs 24 bytes per leaf, everything else is bounded by the depth
+};
+
+struct ValidateReport
+{
+    uint64_t bytes;
+    size_t   lines;
+    size_t   chunks;
+
+    size_t nodes;
+    size_t leaves;
+    size_t max_depth;   // the root is at depth 0
+
+    size_t errors;      // all of them, not only the listed ones
+    size_t duplicates;  // leaf labels met more than once
+};
+
+// Checks a data base without loading it. Errors go to out as "file:line:column: message",
+// columns counted in codepoints. Returns EXIT_FAILURE on errors or if the file can`t be read.
+int ValidateFile(const char *const file_name, const ValidateOptions *options, FILE *out, ValidateReport *report);
+
+int ValidateCommand(int argc, char *argv[]);
+
+#endif //VALIDATE_H
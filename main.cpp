@@ -1,12 +1,79 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include "include/akinator.h"
+#include "include/server.h"
+#include "include/dag.h"
+#include "include/export.h"
+#include "include/classifier.h"
+#include "include/trace.h"
+#include "include/loadgen.h"
+#include "include/merkle.h"
+#include "include/merge.h"
+#include "include/profile.h"
+#include "include/shared.h"
+#include "include/memory.h"
+#include "include/parallel.h"
+#include "include/replica.h"
+#include "include/ordered.h"
+#include "include/fuzzy.h"
+#include "include/validate.h"
+
+struct Command
+{
+    const char *name;
+
+    int (*run)(int argc, char *argv[]);
+};
+
+static const Command COMMANDS[] =
+{
+    {"serve"          , ServeCommand         },
+    {"bench-sessions" , BenchSessionsCommand },
+    {"bench-beam"     , BenchBeamCommand     },
+    {"compress-report", CompressReportCommand},
+    {"export"         , ExportCommand        },
+    {"classify"       , ClassifyCommand      },
+    {"loadgen"        , LoadgenCommand       },
+    {"replay"         , ReplayCommand        },
+    {"diff"           , DiffCommand          },
+    {"verify"         , VerifyCommand        },
+    {"merge"          , MergeCommand         },
+    {"bench-layout"   , BenchLayoutCommand   },
+    {"publish"        , PublishCommand       },
+    {"memory-report"  , MemoryReportCommand  },
+    {"tree-stats"     , TreeStatsCommand     },
+    {"bench-parallel" , BenchParallelCommand },
+    {"bench-replication", BenchReplicationCommand},
+    {"range"          , RangeCommand         },
+    {"bench-ordered"  , BenchOrderedCommand  },
+    {"bulk-load"      , BulkLoadCommand      },
+    {"bench-bulk"     , BenchBulkCommand     },
+    {"fuzzy"          , FuzzyCommand         },
+    {"bench-fuzzy"    , BenchFuzzyCommand    },
+    {"validate"       , ValidateCommand      },
+};
 
 int main(int argc, char *argv[])
 {
-    if(argc != 2) return EXIT_FAILURE;
+    if(argc < 2) return EXIT_FAILURE;
+
+    MetricsInit();
+    TraceInit();
+
+    for(size_t i = 0; i < sizeof(COMMANDS) / sizeof(COMMANDS[0]); i++)
+    {
+        if(strcmp(argv[1], COMMANDS[i].name) == 0) return COMMANDS[i].run(argc - 2, argv + 2);
+    }
+
+    AkinatorOptions options = {};
+
+    argc--;
+    argv++;
+
+    if(ParseAkinatorOptions(&argc, &argv, &options) != EXIT_SUCCESS || argc != 1) return EXIT_FAILURE;
 
-    Akinator(argv[1]);
+    Akinator(argv[0], &options);
 
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
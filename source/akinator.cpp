@@ -6,6 +6,18 @@
 
 #include "../include/akinator.h"
 #include "../include/tree.h"
+#include "../include/session.h"
+#include "../include/dag.h"
+#include "../include/trace.h"
+#include "../include/history.h"
+#include "../include/cache.h"
+#include "../include/checkpoint.h"
+#include "../include/builtin.h"
+#include "../include/profile.h"
+#include "../include/shared.h"
+#include "../include/memory.h"
+#include "../include/replica.h"
+#include "../include/fuzzy.h"
 
 static void ClearStdin(void)
 {
@@ -60,148 +72,189 @@ static bool ProcessingYesNoAnswer(const char *message)
 }
 
 
-static void Quit(Tree *tree)
+void SaveProgress(Tree *tree)
 {
-    if(ProcessingYesNoAnswer("Do you want to save your progress?[Y/n]: "))
-    {
-        char file_name[MAX_STR_LEN] = {};
+    METRICS_TIME(OP_SAVE);
+
+    TRACE_SPAN(span, "SaveProgress");
+
+    char file_name[MAX_STR_LEN] = {};
+
+    time_t cur_time = time(NULL);
+    sprintf(file_name, "data/saved/data_%s.txt", ctime(&cur_time));
+
+    TraceSpanStr(&span, "file", file_name);
+    TraceSpanInt(&span, "nodes", (long long)tree->size);
 
-        time_t cur_time = time(NULL);
-        sprintf(file_name, "data/saved/data_%s.txt", ctime(&cur_time));
+    FILE *db_file = fopen(file_name, "wb");
 
-        FILE *db_file = fopen(file_name, "wb");
+    ASSERT(db_file, return);
 
-        ASSERT(db_file, return);
+    int status = TreeTextDump(tree, db_file);
+    fclose(db_file);
 
-        TreeTextDump(tree, db_file);
-        fclose(db_file);
+    ASSERT(status == EXIT_SUCCESS, remove(file_name));
+}
+
+static void Quit(Tree *tree)
+{
+    TRACE_SPAN(span, "menu:quit");
+
+    if(ProcessingYesNoAnswer("Do you want to save your progress?[Y/n]: "))
+    {
+        SaveProgress(tree);
     }
 }
 
 
 static void ShowTree(Tree *tree)
 {
+    TRACE_SPAN(span, "menu:tree");
+
     TreeDot(tree, "data/tree.png");
 
-    system("xdg-open data/tree.png");
-    system("clear");
+    TracedSystem("xdg-open data/tree.png");
+    TracedSystem("clear");
 }
 
 
-static Node *GetAnswer(Tree *const tree)
+static void ProcessingLikelihoodAnswer(const char *message, char *ans)
 {
-    char message[MAX_STR_LEN] = {};
+    while(true)
+    {
+        printf("%s", message);
 
-    Node *cur_pos = tree->root;
+        scanf("%" STRINGIFY(SHORT_ANS_WIDTH) "s", ans);
 
-    while(cur_pos->right != NULL)
-    {
-        sprintf(message, "%s?[Y/n]: ", cur_pos->data);
+        if(ParseLikelihood(ans) >= 0) return;
 
-        if(ProcessingYesNoAnswer(message))
-        {
-            cur_pos = cur_pos->right;
-        }
-        else
-        {
-            cur_pos = cur_pos->left;
-        }
+        printf("Try again.\n");
+        ClearStdin();
     }
-
-    return cur_pos;
 }
 
-static void AddAnswer(Tree *tree, Node *prev_answer)
+static void Game(Tree *tree, size_t beam_width)
 {
-    char ans[MAX_DATA_LEN] = {};
+    TRACE_SPAN(span, "menu:guess");
+
+    char message[MAX_STR_LEN] = {};
+    char ans[MAX_DATA_LEN]    = {};
 
     char fmt[FMT_STR_LEN] = {};
     sprintf(fmt, " %%%d[^\n]", MAX_DATA_LEN - 1);
 
-    printf("What is correct answer then?\n");
-    scanf(fmt, ans);
-    ClearStdin();
+    GameSession session = GameSessionCtor(tree, beam_width);
+    ASSERT(session.handle, return);
 
-    AddNode(tree, prev_answer, prev_answer->data, LEFT );
-    AddNode(tree, prev_answer, ans              , RIGHT);
+    printf("Not sure? [P] - probably, [U] - probably not, [D] - don't know.\n");
 
-    printf("what property distinguishes \'%s\' from \'%s\'?\n", ans, prev_answer->data);
-    scanf(fmt, ans);
-    ClearStdin();
+    while(!IsGameOver(&session))
+    {
+        Prompt prompt = GamePrompt(&session);
 
-    free(prev_answer->data);
-    prev_answer->data = strdup(ans);
-}
+        switch(prompt.kind)
+        {
+            case PROMPT_QUESTION:
+            {
+                sprintf(message, "%s?[Y/n/p/u/d]: ", prompt.subject);
 
-static void Game(Tree *tree)
-{
-    char message[MAX_STR_LEN] = {};
+                char likelihood[MAX_SHORT_ANS_LEN] = {};
+                ProcessingLikelihoodAnswer(message, likelihood);
+
+                GameAnswer(&session, likelihood);
+                break;
+            }
+            case PROMPT_GUESS:
+            {
+                sprintf(message, "Is \'%s\' the correct answer?[Y/n]: ", prompt.subject);
+
+                GameAnswer(&session, ProcessingYesNoAnswer(message) ? "y" : "n");
+                break;
+            }
+            case PROMPT_CORRECT_ANSWER:
+            {
+                printf("What is correct answer then?\n");
+                scanf(fmt, ans);
+                ClearStdin();
 
-    Node *answer = GetAnswer(tree);
+                GameAnswer(&session, ans);
+                break;
+            }
+            case PROMPT_PROPERTY:
+            {
+                printf("what property distinguishes \'%s\' from \'%s\'?\n", prompt.subject, prompt.object);
+                scanf(fmt, ans);
+                ClearStdin();
+
+                GameAnswer(&session, ans);
+                break;
+            }
+            default:
+            {
+                GameSessionDtor(&session);
+                return;
+            }
+        }
+    }
 
-    sprintf(message, "Is \'%s\' the correct answer?[Y/n]: ", answer->data);
+    GameResult result = GameSessionResult(&session);
 
-    if(ProcessingYesNoAnswer(message))
+    if(result == GAME_GUESSED)
     {
         printf("GG.\n");
     }
-    else
+    else if(result == GAME_LOST)
     {
-        AddAnswer(tree, answer);
+        printf("This version is read-only, nothing was learned.\n");
     }
+
+    TraceSpanStr(&span, "result", (result == GAME_GUESSED) ? "guessed" : (result == GAME_LOST) ? "lost" : "learned");
+
+    GameSessionDtor(&session);
 }
 
 
-static void PropertiesDump(Node *tree_pos, Stack *path)
+static void PropertiesDump(FILE *out_file, Node *tree_pos, const Stack *path, size_t depth)
 {
-    data_t direction = 0;
-
-    while(path->size)
+    // TreePath pushes the leaf end first, so the root direction is on top.
+    for(size_t i = path->size - depth; i-- > 0; )
     {
-        PopStack(path, &direction);
-
-        if(direction == 1)
+        if(path->data[i] == 1)
         {
-            printf(color_green("\t%s\n"), tree_pos->data);
+            fprintf(out_file, color_green("\t%s\n"), tree_pos->data);
 
             tree_pos = tree_pos->right;
         }
         else
         {
-            printf(color_red("\t%s\n"), tree_pos->data);
+            fprintf(out_file, color_red("\t%s\n"), tree_pos->data);
 
             tree_pos = tree_pos->left;
         }
     }
 }
 
-static Node *SimilarPropertiesDump(Node *tree_pos, Stack *path1, Stack *path2)
+static Node *SimilarPropertiesDump(FILE *out_file, Node *tree_pos, const Stack *path1, const Stack *path2, size_t *depth)
 {
-    data_t direction1 = 0;
-    data_t direction2 = 0;
-
-    while(path1->size && path2->size)
+    for(; *depth < path1->size && *depth < path2->size; (*depth)++)
     {
-        PopStack(path1, &direction1);
-        PopStack(path2, &direction2);
+        data_t direction1 = path1->data[path1->size - 1 - *depth];
+        data_t direction2 = path2->data[path2->size - 1 - *depth];
 
         if(direction1 == 1 && direction2 == 1)
         {
-            printf(color_green("%s, "), tree_pos->data);
+            fprintf(out_file, color_green("%s, "), tree_pos->data);
 
             tree_pos = tree_pos->right;
         }
         else if(direction1 == 0 && direction2 == 0)
         {
-            printf(color_red("%s, "), tree_pos->data);
+            fprintf(out_file, color_red("%s, "), tree_pos->data);
 
             tree_pos = tree_pos->left;
         }
         else
         {
-            PushStack(path1, direction1);
-            PushStack(path2, direction2);
-
             break;
         }
     }
@@ -209,8 +262,51 @@ static Node *SimilarPropertiesDump(Node *tree_pos, Stack *path1, Stack *path2)
     return tree_pos;
 }
 
-static void Definition(Tree *tree)
+// Offers the leaf labels closest to a name that is not in the tree, and puts the one the
+// user picks in place of it.
+static bool DidYouMean(Tree *tree, LabelIndex *labels, char *str)
+{
+    printf("There is no %s in data base.\n", str);
+
+    if(!IsFuzzyQuery(str))
+    {
+        printf("The name is too long to look for close ones.\n");
+        return false;
+    }
+
+    FuzzyMatch matches[FUZZY_MAX_MATCHES] = {};
+    size_t     n_matches = 0;
+
+    if(LabelIndexSync(labels, tree) == EXIT_SUCCESS)
+    {
+        n_matches = FuzzyLookup(labels, str, FUZZY_DISTANCE, matches, FUZZY_MAX_MATCHES);
+    }
+
+    if(!n_matches) return false;
+
+    printf("Did you mean:\n");
+
+    for(size_t i = 0; i < n_matches; i++) printf("  [%zu] %s\n", i + 1, matches[i].label);
+
+    printf("Number, or Enter to skip: ");
+
+    char line[FMT_STR_LEN] = {};
+    if(!fgets(line, sizeof(line), stdin)) return false;
+
+    if(!strchr(line, '\n')) ClearStdin();
+
+    size_t choice = strtoul(line, NULL, 10);
+    if(!choice || choice > n_matches) return false;
+
+    snprintf(str, MAX_DATA_LEN, "%s", matches[choice - 1].label);
+
+    return true;
+}
+
+static void Definition(Tree *tree, QueryCache *cache, LabelIndex *labels)
 {
+    TRACE_SPAN(span, "menu:definition");
+
     printf("Definition of: ");
 
     char str[MAX_DATA_LEN] = {};
@@ -220,23 +316,56 @@ static void Definition(Tree *tree)
 
     scanf(fmt, str);
     ClearStdin();
+    NormalizeQuery(str);
+
+    TraceSpanStr(&span, "label", str);
+
+    char key[MAX_DATA_LEN + 2] = {};
+    snprintf(key, sizeof(key), "D\x1f%s", str);
+
+    if(QueryCacheLookup(cache, tree, key, stdout))
+    {
+        TraceSpanStr(&span, "cache", "hit");
+        return;
+    }
 
     Stack path = TreePath(tree, str);
     if(!path.data)
     {
-        printf("There is no %s in data base.\n", str);
+        if(!DidYouMean(tree, labels, str)) return;
 
-        return;
+        path = TreePath(tree, str);
+        ASSERT(path.data, return);
+
+        snprintf(key, sizeof(key), "D\x1f%s", str);
     }
 
-    PropertiesDump(tree->root, &path);
-    printf(" - this is \'%s\'.\n", str);
+    char  *text = NULL;
+    size_t size = 0;
+
+    FILE *text_file = open_memstream(&text, &size);
+    ASSERT(text_file, StackDtor(&path); return);
+
+    PropertiesDump(text_file, tree->root, &path, 0);
+    fprintf(text_file, " - this is \'%s\'.\n", str);
 
+    bool written = (fclose(text_file) == 0);
+    MemAdopt(MEM_DUMP, text);
+
+    if(written)
+    {
+        fputs(text, stdout);
+        QueryCachePut(cache, tree, key, &path, 1, text);
+    }
+
+    MemFree(MEM_DUMP, text);
     StackDtor(&path);
 }
 
-static void Compare(Tree *tree)
+static void Compare(Tree *tree, QueryCache *cache, LabelIndex *labels)
 {
+    TRACE_SPAN(span, "menu:compare");
+
     char str1[MAX_DATA_LEN] = {};
     char str2[MAX_DATA_LEN] = {};
 
@@ -246,54 +375,279 @@ static void Compare(Tree *tree)
     printf(" First to compare: ");
     scanf(fmt, str1);
     ClearStdin();
-
-    Stack path1 = TreePath(tree, str1);
-    if(!path1.data)
-    {
-        printf("There is no %s in data base.\n", str1);
-        return;
-    }
+    NormalizeQuery(str1);
 
     printf("Second to compare: ");
     scanf(fmt, str2);
     ClearStdin();
+    NormalizeQuery(str2);
 
-    Stack path2 = TreePath(tree, str2);
-    if(!path2.data)
+    char key[2 * MAX_DATA_LEN + 2] = {};
+    snprintf(key, sizeof(key), "C\x1f%s\x1f%s", str1, str2);
+
+    if(QueryCacheLookup(cache, tree, key, stdout))
     {
-        printf("There is no %s in data base.\n", str2);
+        TraceSpanStr(&span, "cache", "hit");
+        return;
+    }
+
+    Stack paths[2] = {TreePath(tree, str1), TreePath(tree, str2)};
+
+    if(!paths[0].data && DidYouMean(tree, labels, str1)) paths[0] = TreePath(tree, str1);
+    if(!paths[1].data && DidYouMean(tree, labels, str2)) paths[1] = TreePath(tree, str2);
 
-        StackDtor(&path1);
+    if(!paths[0].data || !paths[1].data)
+    {
+        if(paths[0].data) StackDtor(&paths[0]);
+        if(paths[1].data) StackDtor(&paths[1]);
         return;
     }
 
-    Node *tree_pos = SimilarPropertiesDump(tree->root, &path1, &path2);
+    snprintf(key, sizeof(key), "C\x1f%s\x1f%s", str1, str2);
+
+    char  *text = NULL;
+    size_t size = 0;
+
+    FILE *text_file = open_memstream(&text, &size);
+    ASSERT(text_file, StackDtor(&paths[0]); StackDtor(&paths[1]); return);
+
+    size_t depth    = 0;
+    Node  *tree_pos = SimilarPropertiesDump(text_file, tree->root, &paths[0], &paths[1], &depth);
     if(tree_pos != tree->root)
     {
-        printf(" - similarities of \'%s\' и \'%s\'.\n", str1, str2);
+        fprintf(text_file, " - similarities of \'%s\' и \'%s\'.\n", str1, str2);
+    }
+
+    fprintf(text_file, "\n'%s':\n", str1);
+    PropertiesDump(text_file, tree_pos, &paths[0], depth);
+
+    fprintf(text_file, "\n'%s':\n", str2);
+    PropertiesDump(text_file, tree_pos, &paths[1], depth);
+
+    bool written = (fclose(text_file) == 0);
+    MemAdopt(MEM_DUMP, text);
+
+    if(written)
+    {
+        fputs(text, stdout);
+        QueryCachePut(cache, tree, key, paths, 2, text);
+    }
+
+    MemFree(MEM_DUMP, text);
+    StackDtor(&paths[0]);
+    StackDtor(&paths[1]);
+}
+
+static void Undo(Tree *tree, bool redo)
+{
+    TRACE_SPAN(span, redo ? "menu:redo" : "menu:undo");
+
+    if(!tree->history)
+    {
+        printf("Versions are off, start with --versions <count>.\n");
+        return;
+    }
+
+    if((redo ? HistoryRedo(tree) : HistoryUndo(tree)) != EXIT_SUCCESS)
+    {
+        printf("Nothing to %s.\n", redo ? "redo" : "undo");
+        return;
+    }
+
+    TraceSpanInt(&span, "version", (long long)HistoryCurrent(tree));
+
+    printf("Now at version %zu.\n", HistoryCurrent(tree));
+}
+
+static void OpenVersion(Tree *tree, size_t beam_width)
+{
+    TRACE_SPAN(span, "menu:version");
+
+    if(!tree->history)
+    {
+        printf("Versions are off, start with --versions <count>.\n");
+        return;
+    }
+
+    HistoryList(tree, stdout);
+
+    printf("Open version: ");
+
+    size_t version = 0;
+    int    scanned = scanf("%zu", &version);
+    ClearStdin();
+
+    Tree view = (scanned == 1) ? HistoryOpen(tree, version) : Tree{};
+    if(!view.root)
+    {
+        printf("There is no such version.\n");
+        return;
     }
 
-    printf("\n'%s':\n", str1);
-    PropertiesDump(tree_pos, &path1);
+    TraceSpanInt(&span, "version", (long long)version);
 
-    printf("\n'%s':\n", str2);
-    PropertiesDump(tree_pos, &path2);
+    Game(&view, beam_width);
 
-    StackDtor(&path1);
-    StackDtor(&path2);
+    HistoryClose(&view);
 }
 
 
-void Akinator(const char *const data_base)
+int ParseAkinatorOptions(int *argc, char **argv[], AkinatorOptions *options)
+{
+    ASSERT(argc && argv && options, return EXIT_FAILURE);
+
+    while(*argc > 0 && strncmp((*argv)[0], "--", 2) == 0)
+    {
+        if(strcmp((*argv)[0], "--dag") == 0)
+        {
+            options->compress = true;
+        }
+        else if(strcmp((*argv)[0], "--profile") == 0)
+        {
+            options->profile = true;
+        }
+        else if(strcmp((*argv)[0], "--relayout") == 0)
+        {
+            options->profile  = true;
+            options->relayout = true;
+        }
+        else if(strcmp((*argv)[0], "--beam") == 0 && *argc > 1)
+        {
+            options->beam_width = strtoul((*argv)[1], NULL, 10);
+
+            (*argc)--;
+            (*argv)++;
+        }
+        else if(strcmp((*argv)[0], "--versions") == 0 && *argc > 1)
+        {
+            options->versions = strtoul((*argv)[1], NULL, 10);
+
+            (*argc)--;
+            (*argv)++;
+        }
+        else if(strcmp((*argv)[0], "--checkpoint") == 0 && *argc > 1)
+        {
+            options->checkpoint = (*argv)[1];
+
+            (*argc)--;
+            (*argv)++;
+        }
+        else if(strcmp((*argv)[0], "--checkpoint-interval") == 0 && *argc > 1)
+        {
+            options->checkpoint_interval = strtod((*argv)[1], NULL);
+
+            (*argc)--;
+            (*argv)++;
+        }
+        else if(strcmp((*argv)[0], "--checkpoint-budget") == 0 && *argc > 1)
+        {
+            options->checkpoint_budget = strtoul((*argv)[1], NULL, 10);
+
+            (*argc)--;
+            (*argv)++;
+        }
+        else if(strcmp((*argv)[0], "--feed") == 0 && *argc > 1)
+        {
+            options->feed = (*argv)[1];
+
+            (*argc)--;
+            (*argv)++;
+        }
+        else if(strcmp((*argv)[0], "--follow") == 0 && *argc > 1)
+        {
+            options->follow = (*argv)[1];
+
+            (*argc)--;
+            (*argv)++;
+        }
+        else if(strcmp((*argv)[0], "--no-save") == 0)
+        {
+            options->no_save = true;
+        }
+        else
+        {
+            fprintf(stderr, "Unknown option: %s\n", (*argv)[0]);
+            return EXIT_FAILURE;
+        }
+
+        (*argc)--;
+        (*argv)++;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+bool IsReadOnlyDataBase(const char *const data_base)
+{
+    ASSERT(data_base, return false);
+
+    return strcmp(data_base, BUILTIN_DATA_BASE) == 0 ||
+           strncmp(data_base, SHARED_DATA_BASE_PREFIX, strlen(SHARED_DATA_BASE_PREFIX)) == 0;
+}
+
+Tree LoadKnowledgeBase(const char *const data_base, const AkinatorOptions *options)
+{
+    ASSERT(data_base, return {});
+
+    TRACE_SPAN(span, "LoadKnowledgeBase");
+
+    bool is_read_only = IsReadOnlyDataBase(data_base);
+
+    Tree tree = {};
+
+    if(strcmp(data_base, BUILTIN_DATA_BASE) == 0) tree = BuiltinTree();
+    else if(is_read_only)                         tree = SharedTree(data_base + strlen(SHARED_DATA_BASE_PREFIX));
+    else                                          tree = ReadTree(data_base);
+
+    ASSERT(tree.root, return {});
+
+    // Compiled-in and published nodes can hold no counters and are laid out in preorder already.
+    if(options && options->profile && !is_read_only)
+    {
+        ProfileLoad(&tree, data_base);
+
+        if(options->relayout) TreeRelayout(&tree);
+    }
+
+    // Interning relinks nodes in place, and read-only bases can't be relinked.
+    if(options && options->compress && !is_read_only)
+    {
+        TreeCompress(&tree);
+    }
+
+    if(options && options->versions)
+    {
+        HistoryCtor(&tree, options->versions);
+    }
+
+    return tree;
+}
+
+void Akinator(const char *const data_base, const AkinatorOptions *options)
 {
     ASSERT(data_base, return);
 
-    Tree tree = ReadTree(data_base);
+    Tree tree = LoadKnowledgeBase(data_base, options);
     ASSERT(tree.root, return);
 
-    system("mkdir data");
-    system("mkdir data/saved");
-    system("clear");
+    QueryCache *cache = QueryCacheCtor();
+    ASSERT(cache, TreeDtor(&tree, tree.root); return);
+
+    LabelIndex *labels = LabelIndexCtor();
+    ASSERT(labels, QueryCacheDtor(cache); TreeDtor(&tree, tree.root); return);
+
+    Checkpointer *checkpointer = (options && options->checkpoint) ? CheckpointerCtor(&tree, options) : NULL;
+
+    Feed     *feed     = (options && options->feed  ) ? FeedOpen    (&tree, options->feed  ) : NULL;
+    Follower *follower = (options && options->follow) ? FollowerCtor(&tree, options->follow) : NULL;
+
+    if(follower) tree.read_only = true;
+
+    size_t beam_width = (options && options->beam_width) ? options->beam_width : BEAM_DEFAULT_WIDTH;
+
+    TracedSystem("mkdir data");
+    TracedSystem("mkdir data/saved");
+    TracedSystem("clear");
 
     char ans[MAX_SHORT_ANS_LEN] = {};
 
@@ -302,7 +656,11 @@ void Akinator(const char *const data_base)
 
     while(true)
     {
-        printf("[G] - Guess, [T] - Tree, [D] - Definition, [C] - compare, [Q] - Quit\n");
+        if(checkpointer) CheckpointTick(checkpointer);
+        if(follower    ) FollowerPoll  (follower);
+
+        printf("[G] - Guess, [T] - Tree, [D] - Definition, [C] - compare, %s[M] - Memory, [Q] - Quit\n",
+               tree.history ? "[U] - Undo, [R] - Redo, [V] - Version, " : "");
 
         scanf(fmt, ans);
 
@@ -317,16 +675,28 @@ void Akinator(const char *const data_base)
         switch(tolower(ans[0]))
         {
             case 'g':
-                Game(&tree);
+                Game(&tree, beam_width);
                 continue;
             case 't':
                 ShowTree(&tree);
                 continue;
             case 'd':
-                Definition(&tree);
+                Definition(&tree, cache, labels);
                 continue;
             case 'c':
-                Compare(&tree);
+                Compare(&tree, cache, labels);
+                continue;
+            case 'u':
+                Undo(&tree, false);
+                continue;
+            case 'r':
+                Undo(&tree, true);
+                continue;
+            case 'v':
+                OpenVersion(&tree, beam_width);
+                continue;
+            case 'm':
+                MetricsMemoryWrite(stdout);
                 continue;
             case 'q':
                 Quit(&tree);
@@ -339,5 +709,17 @@ void Akinator(const char *const data_base)
         break;
     }
 
+    if(options && options->profile && !IsReadOnlyDataBase(data_base)) ProfileSave(&tree, data_base);
+
+    CheckpointerDtor(checkpointer);
+    QueryCacheDtor(cache);
+    LabelIndexDtor(labels);
+
+    FollowerDtor(follower);
+    tree.read_only = false;
+
+    tree.feed = NULL;
+    FeedClose(feed);
+
     TreeDtor(&tree, tree.root);
 }
\ No newline at end of file
@@ -0,0 +1,93 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/arena.h"
+#include "../include/log.h"
+
+Arena *ArenaCtor(void)
+{
+    Arena *arena = (Arena *)calloc(1, sizeof(Arena));
+    ASSERT(arena, return NULL);
+
+    return arena;
+}
+
+void ArenaDtor(Arena *arena)
+{
+    if(!arena) return;
+
+    METRICS_ADD(COUNTER_ARENA_BYTES, -(int64_t)arena->allocated);
+
+    ArenaChunk *chunk = arena->chunks;
+    while(chunk)
+    {
+        ArenaChunk *next = chunk->next;
+        free(chunk);
+
+        chunk = next;
+    }
+
+    free(arena);
+}
+
+// Aligned by address rather than by offset, so alignments above malloc's hold too.
+static size_t AlignedStart(const ArenaChunk *chunk, const size_t header, const size_t align)
+{
+    uintptr_t base = (uintptr_t)chunk + header;
+
+    return (base + chunk->used + align - 1) / align * align - base;
+}
+
+void *ArenaAllocAligned(Arena *arena, const size_t size, const size_t align)
+{
+    ASSERT(arena, return NULL);
+    ASSERT(align && (align & (align - 1)) == 0, return NULL);
+
+    const size_t header = (sizeof(ArenaChunk) + alignof(max_align_t) - 1) / alignof(max_align_t) * alignof(max_align_t);
+
+    ArenaChunk *chunk = arena->chunks;
+    size_t      start = chunk ? AlignedStart(chunk, header, align) : 0;
+
+    if(!chunk || start > chunk->capacity || chunk->capacity - start < size)
+    {
+        size_t slack    = (align > alignof(max_align_t)) ? align - 1 : 0;
+        size_t capacity = (size + slack > ARENA_CHUNK_SIZE - header) ? size + slack : ARENA_CHUNK_SIZE - header;
+
+        chunk = (ArenaChunk *)malloc(header + capacity);
+        ASSERT(chunk, return NULL);
+
+        chunk->next     = arena->chunks;
+        chunk->used     = 0;
+        chunk->capacity = capacity;
+
+        arena->chunks = chunk;
+        start         = AlignedStart(chunk, header, align);
+    }
+
+    chunk->used       = start + size;
+    arena->allocated += size;
+
+    METRICS_ADD(COUNTER_ARENA_BYTES, (int64_t)size);
+
+    return (char *)chunk + header + start;
+}
+
+void *ArenaAlloc(Arena *arena, const size_t size)
+{
+    return ArenaAllocAligned(arena, size, alignof(max_align_t));
+}
+
+char *ArenaStrdup(Arena *arena, const char *const str)
+{
+    ASSERT(str, return NULL);
+
+    size_t len = strlen(str);
+
+    char *copy = (char *)ArenaAllocAligned(arena, len + 1, 1);
+    ASSERT(copy, return NULL);
+
+    memcpy(copy, str, len + 1);
+
+    return copy;
+}
@@ -0,0 +1,10 @@
+#include "../include/builtin.h"
+
+// The nodes are const, so the root is handed out without a copy: NODE_STATIC makes
+// every tree operation copy them before a change and never touch their refs.
+Tree BuiltinTree(void)
+{
+    Tree tree = {const_cast<Node *>(&BUILTIN_NODES[0]), BUILTIN_NODES_COUNT};
+
+    return tree;
+}
@@ -0,0 +1,215 @@
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/cache.h"
+
+static uint64_t HashKey(const char *key)
+{
+    uint64_t hash = 14695981039346656037ull;
+
+    for(; *key; key++)
+    {
+        hash ^= (unsigned char)*key;
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+QueryCache *QueryCacheCtor(size_t capacity)
+{
+    QueryCache *cache = (QueryCache *)calloc(1, sizeof(QueryCache));
+    ASSERT(cache, return NULL);
+
+    cache->n_sets  = (capacity + QUERY_CACHE_WAYS - 1) / QUERY_CACHE_WAYS;
+    if(cache->n_sets == 0) cache->n_sets = 1;
+
+    cache->entries = (CacheEntry *)calloc(cache->n_sets * QUERY_CACHE_WAYS, sizeof(CacheEntry));
+    ASSERT(cache->entries, free(cache); return NULL);
+
+    pthread_rwlock_init(&cache->lock, NULL);
+
+    return cache;
+}
+
+static void EntryClear(CacheEntry *entry)
+{
+    for(size_t i = 0; i < entry->n_paths; i++)
+    {
+        free(entry->paths[i].directions);
+        free(entry->paths[i].gens);
+    }
+
+    free(entry->key);
+    free(entry->text);
+
+    *entry = {};
+}
+
+void QueryCacheDtor(QueryCache *cache)
+{
+    if(!cache) return;
+
+    for(size_t i = 0; i < cache->n_sets * QUERY_CACHE_WAYS; i++) EntryClear(&cache->entries[i]);
+
+    pthread_rwlock_destroy(&cache->lock);
+
+    free(cache->entries);
+    free(cache);
+}
+
+void NormalizeQuery(char *query)
+{
+    ASSERT(query, return);
+
+    char *out = query;
+
+    for(const char *in = query; *in; in++)
+    {
+        if(!isspace((unsigned char)*in))
+        {
+            *out++ = *in;
+            continue;
+        }
+
+        if(out != query && out[-1] != ' ') *out++ = ' ';
+    }
+
+    if(out != query && out[-1] == ' ') out--;
+
+    *out = '\0';
+}
+
+
+static CacheEntry *CacheSet(QueryCache *cache, uint64_t key_hash)
+{
+    return cache->entries + (key_hash % cache->n_sets) * QUERY_CACHE_WAYS;
+}
+
+// Copies keep the generation and every change takes a fresh one, so equal generations
+// along the path mean the same labels in the same places, in whatever version is live.
+// The path was found by a search for the leaf label, which a node added off the path with
+// the same label can answer first, so the label generation has to match too.
+static bool IsPathFresh(Tree *const tree, const CachedPath *path)
+{
+    Node *tree_node = tree->root;
+
+    for(size_t i = 0; i <= path->depth; i++)
+    {
+        if(!tree_node || tree_node->gen != path->gens[i]) return false;
+
+        if(i < path->depth) tree_node = path->directions[i] ? tree_node->right : tree_node->left;
+    }
+
+    return LabelGeneration(tree_node->data) == path->label_gen;
+}
+
+bool QueryCacheLookup(QueryCache *cache, Tree *const tree, const char *const key, FILE *out_file)
+{
+    ASSERT(cache && tree && key && out_file, return false);
+
+    uint64_t key_hash = HashKey(key);
+    bool     hit      = false;
+
+    pthread_rwlock_rdlock(&cache->lock);
+
+    CacheEntry *set = CacheSet(cache, key_hash);
+
+    for(size_t way = 0; way < QUERY_CACHE_WAYS && !hit; way++)
+    {
+        CacheEntry *entry = &set[way];
+
+        if(!entry->key || entry->key_hash != key_hash || strcmp(entry->key, key) != 0) continue;
+
+        hit = true;
+        for(size_t i = 0; i < entry->n_paths && hit; i++) hit = IsPathFresh(tree, &entry->paths[i]);
+
+        if(!hit) break;
+
+        __atomic_store_n(&entry->used, __atomic_add_fetch(&cache->tick, 1, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+
+        fputs(entry->text, out_file);
+    }
+
+    pthread_rwlock_unlock(&cache->lock);
+
+    METRICS_ADD(hit ? COUNTER_CACHE_HITS : COUNTER_CACHE_MISSES, 1);
+
+    return hit;
+}
+
+
+static int CachePath(Tree *const tree, const Stack *const stack, CachedPath *path)
+{
+    path->depth      = stack->size;
+    path->directions = (data_t   *)calloc(stack->size + 1, sizeof(data_t));
+    path->gens       = (uint64_t *)calloc(stack->size + 1, sizeof(uint64_t));
+    ASSERT(path->directions && path->gens, return EXIT_FAILURE);
+
+    Node *tree_node = tree->root;
+
+    // TreePath pushes the leaf end first.
+    for(size_t i = 0; i <= path->depth; i++)
+    {
+        if(!tree_node) return EXIT_FAILURE;
+
+        path->gens[i] = tree_node->gen;
+
+        if(i == path->depth) break;
+
+        path->directions[i] = stack->data[stack->size - 1 - i];
+        tree_node = path->directions[i] ? tree_node->right : tree_node->left;
+    }
+
+    path->label_gen = LabelGeneration(tree_node->data);
+
+    return EXIT_SUCCESS;
+}
+
+static CacheEntry *CacheVictim(CacheEntry *set, const char *const key)
+{
+    CacheEntry *victim = &set[0];
+
+    for(size_t way = 0; way < QUERY_CACHE_WAYS; way++)
+    {
+        if(!set[way].key || strcmp(set[way].key, key) == 0) return &set[way];
+
+        if(set[way].used < victim->used) victim = &set[way];
+    }
+
+    return victim;
+}
+
+int QueryCachePut(QueryCache *cache, Tree *const tree, const char *const key,
+                  const Stack *const paths, size_t n_paths, const char *const text)
+{
+    ASSERT(cache && tree && key && text, return EXIT_FAILURE);
+    ASSERT(paths && n_paths <= QUERY_CACHE_PATHS, return EXIT_FAILURE);
+
+    uint64_t key_hash = HashKey(key);
+
+    pthread_rwlock_wrlock(&cache->lock);
+
+    CacheEntry *entry = CacheVictim(CacheSet(cache, key_hash), key);
+    EntryClear(entry);
+
+    entry->key      = strdup(key);
+    entry->key_hash = key_hash;
+    entry->text     = strdup(text);
+    entry->used     = __atomic_add_fetch(&cache->tick, 1, __ATOMIC_RELAXED);
+
+    int status = (entry->key && entry->text) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    for(size_t i = 0; i < n_paths && status == EXIT_SUCCESS; i++)
+    {
+        entry->n_paths++;
+        status = CachePath(tree, &paths[i], &entry->paths[i]);
+    }
+
+    if(status != EXIT_SUCCESS) EntryClear(entry);
+
+    pthread_rwlock_unlock(&cache->lock);
+
+    return status;
+}
@@ -0,0 +1,219 @@
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../include/checkpoint.h"
+#include "../include/trace.h"
+
+static void RecordPause(Checkpointer *checkpointer, uint64_t start)
+{
+    uint64_t pause = MetricsNow() - start;
+
+    checkpointer->stats.pauses++;
+    checkpointer->stats.sum_pause_ns += pause;
+    if(pause > checkpointer->stats.max_pause_ns) checkpointer->stats.max_pause_ns = pause;
+
+#ifdef METRICS
+    MetricsRecord(OP_CHECKPOINT_PAUSE, pause);
+#endif
+}
+
+Checkpointer *CheckpointerCtor(Tree *tree, const AkinatorOptions *options)
+{
+    ASSERT(tree && tree->root, return NULL);
+    ASSERT(options && options->checkpoint, return NULL);
+
+    Checkpointer *checkpointer = (Checkpointer *)calloc(1, sizeof(Checkpointer));
+    ASSERT(checkpointer, return NULL);
+
+    double interval = (options->checkpoint_interval > 0) ? options->checkpoint_interval : CHECKPOINT_DEFAULT_INTERVAL;
+
+    checkpointer->tree        = tree;
+    checkpointer->file_name   = options->checkpoint;
+    checkpointer->interval_ns = (uint64_t)(interval * 1e9);
+    checkpointer->budget      = options->checkpoint_budget;
+
+    checkpointer->last_ns   = MetricsNow();
+    checkpointer->last_gen  = NodeGeneration();
+    checkpointer->last_hash = tree->root->hash;
+
+    return checkpointer;
+}
+
+
+static int WriteSnapshot(Tree *snapshot, const char *const file_name)
+{
+    char tmp_name[MAX_STR_LEN] = {};
+    snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", file_name);
+
+    FILE *file = fopen(tmp_name, "wb");
+    if(!file) return EXIT_FAILURE;
+
+    bool written = (TreeTextDump(snapshot, file) == EXIT_SUCCESS &&
+                    fflush(file) == 0 && fsync(fileno(file)) == 0);
+
+    if(fclose(file) != 0 || !written || rename(tmp_name, file_name) != 0)
+    {
+        unlink(tmp_name);
+
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static void *CheckpointWriter(void *arg)
+{
+    Checkpointer *checkpointer = (Checkpointer *)arg;
+
+    TRACE_SPAN(span, "checkpoint:write");
+    TraceSpanInt(&span, "nodes", (long long)checkpointer->snapshot.size);
+
+    uint64_t start = MetricsNow();
+
+    checkpointer->status   = WriteSnapshot(&checkpointer->snapshot, checkpointer->file_name);
+    checkpointer->write_ns = MetricsNow() - start;
+
+#ifdef METRICS
+    MetricsRecord(OP_CHECKPOINT_WRITE, checkpointer->write_ns);
+#endif
+
+    __atomic_store_n(&checkpointer->done, 1, __ATOMIC_RELEASE);
+
+    return NULL;
+}
+
+// The writer has finished by now unless the checkpointer is being destroyed,
+// and waiting for it then is not a pause of the game loop.
+static void ReapWriter(Checkpointer *checkpointer)
+{
+    pthread_join(checkpointer->thread, NULL);
+
+    uint64_t start = MetricsNow();
+
+    SubTreeRelease(checkpointer->snapshot.root);
+    checkpointer->snapshot = {};
+    checkpointer->running  = false;
+
+    RecordPause(checkpointer, start);
+
+    if(checkpointer->write_ns > checkpointer->stats.max_write_ns) checkpointer->stats.max_write_ns = checkpointer->write_ns;
+
+    if(checkpointer->status == EXIT_SUCCESS)
+    {
+        checkpointer->stats.written++;
+    }
+    else
+    {
+        checkpointer->stats.failed++;
+        checkpointer->last_hash = 0;  // retry when the next checkpoint is due
+
+        LOG("Can`t write checkpoint \"%s\".\n", checkpointer->file_name);
+    }
+}
+
+static bool IsCheckpointDue(const Checkpointer *checkpointer, uint64_t now)
+{
+    if(now - checkpointer->last_ns >= checkpointer->interval_ns) return true;
+
+    return checkpointer->budget && NodeGeneration() - checkpointer->last_gen >= checkpointer->budget;
+}
+
+static int StartWriter(Checkpointer *checkpointer, uint64_t now)
+{
+    Tree *tree = checkpointer->tree;
+
+    checkpointer->last_ns  = now;
+    checkpointer->last_gen = NodeGeneration();
+
+    if(tree->root->hash == checkpointer->last_hash)
+    {
+        checkpointer->stats.skipped++;
+
+        return EXIT_SUCCESS;
+    }
+
+    TRACE_SPAN(span, "checkpoint:start");
+
+    checkpointer->last_hash = tree->root->hash;
+
+    checkpointer->snapshot = {tree->root, tree->size};
+    NodeHold(checkpointer->snapshot.root);
+
+    checkpointer->done    = 0;
+    checkpointer->running = true;
+
+    if(pthread_create(&checkpointer->thread, NULL, CheckpointWriter, checkpointer) != 0)
+    {
+        SubTreeRelease(checkpointer->snapshot.root);
+        checkpointer->snapshot = {};
+        checkpointer->running  = false;
+        checkpointer->stats.failed++;
+
+        LOG("Can`t start checkpoint writer.\n");
+
+        return EXIT_FAILURE;
+    }
+
+    RecordPause(checkpointer, now);
+
+    return EXIT_SUCCESS;
+}
+
+int CheckpointTick(Checkpointer *checkpointer)
+{
+    ASSERT(checkpointer, return EXIT_FAILURE);
+
+    if(checkpointer->running)
+    {
+        if(!__atomic_load_n(&checkpointer->done, __ATOMIC_ACQUIRE)) return EXIT_SUCCESS;
+
+        ReapWriter(checkpointer);
+    }
+
+    uint64_t now = MetricsNow();
+
+    if(!IsCheckpointDue(checkpointer, now)) return EXIT_SUCCESS;
+
+    return StartWriter(checkpointer, now);
+}
+
+int CheckpointTimeoutMs(const Checkpointer *checkpointer)
+{
+    ASSERT(checkpointer, return -1);
+
+    if(checkpointer->running) return CHECKPOINT_POLL_MS;
+
+    uint64_t elapsed = MetricsNow() - checkpointer->last_ns;
+    if(elapsed >= checkpointer->interval_ns) return 0;
+
+    uint64_t left_ms = (checkpointer->interval_ns - elapsed + 999999) / 1000000;
+
+    return (left_ms > INT_MAX) ? INT_MAX : (int)left_ms;
+}
+
+void CheckpointReport(const Checkpointer *checkpointer, FILE *out_file)
+{
+    ASSERT(checkpointer && out_file, return);
+
+    const CheckpointStats *stats = &checkpointer->stats;
+
+    fprintf(out_file, "checkpoints \"%s\": %zu written, %zu skipped, %zu failed, "
+                      "pause max %.1f us, mean %.1f us, write max %.1f ms\n",
+                      checkpointer->file_name, stats->written, stats->skipped, stats->failed,
+                      (double)stats->max_pause_ns * 1e-3,
+                      stats->pauses ? (double)stats->sum_pause_ns / (double)stats->pauses * 1e-3 : 0.0,
+                      (double)stats->max_write_ns * 1e-6);
+}
+
+void CheckpointerDtor(Checkpointer *checkpointer)
+{
+    if(!checkpointer) return;
+
+    if(checkpointer->running) ReapWriter(checkpointer);
+
+    CheckpointReport(checkpointer, LOG_FILE);
+
+    free(checkpointer);
+}
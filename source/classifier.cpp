@@ -0,0 +1,361 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "../include/classifier.h"
+
+struct Compiler
+{
+    DecisionProgram *program;
+
+    int32_t *table;
+    size_t   table_capacity;
+};
+
+static uint64_t HashLabel(const char *label)
+{
+    uint64_t hash = 14695981039346656037ull;
+
+    for(; *label; label++)
+    {
+        hash ^= (unsigned char)*label;
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+static size_t TableCapacity(size_t size)
+{
+    size_t capacity = 16;
+    while(capacity < 2 * size) capacity *= 2;
+
+    return capacity;
+}
+
+// Returns the slot of the attribute with this label, or the empty slot where it belongs.
+static int32_t *AttributeSlot(const DecisionProgram *program, int32_t *table, size_t capacity, const char *label)
+{
+    size_t mask = capacity - 1;
+    size_t i    = HashLabel(label) & mask;
+
+    while(table[i] >= 0 && strcmp(program->attributes[table[i]], label) != 0) i = (i + 1) & mask;
+
+    return &table[i];
+}
+
+static int32_t InternAttribute(Compiler *compiler, const char *label)
+{
+    DecisionProgram *program = compiler->program;
+
+    int32_t *slot = AttributeSlot(program, compiler->table, compiler->table_capacity, label);
+
+    if(*slot < 0)
+    {
+        program->attributes[program->n_attributes] = strndup(label, MAX_DATA_LEN - 1);
+        ASSERT(program->attributes[program->n_attributes], return -1);
+
+        *slot = (int32_t)program->n_attributes++;
+    }
+
+    return *slot;
+}
+
+// Steps are numbered in preorder. A leaf loops back onto itself through the constant
+// column, so every record can be advanced the same number of levels without branching.
+static int32_t CompileSubTree(Compiler *compiler, Node *const tree_node, size_t depth)
+{
+    DecisionProgram *program = compiler->program;
+
+    int32_t step = (int32_t)program->n_steps++;
+
+    if(depth > program->max_depth) program->max_depth = depth;
+
+    if(tree_node->right == NULL)
+    {
+        program->answers[program->n_answers] = strndup(tree_node->data, MAX_DATA_LEN - 1);
+        ASSERT(program->answers[program->n_answers], return -1);
+
+        program->answer[step] = (int32_t)program->n_answers++;
+
+        program->attribute[step] = -1;
+        for(int value = 0; value < 3; value++) program->next[3 * step + value] = step;
+
+        return step;
+    }
+
+    program->answer   [step] = -1;
+    program->attribute[step] = InternAttribute(compiler, tree_node->data);
+
+    program->next[3 * step + VALUE_MISSING] = step;
+    program->next[3 * step + VALUE_NO ] = tree_node->left ? CompileSubTree(compiler, tree_node->left, depth + 1) : step;
+    program->next[3 * step + VALUE_YES] = CompileSubTree(compiler, tree_node->right, depth + 1);
+
+    return step;
+}
+
+DecisionProgram CompileTree(Tree *const tree)
+{
+    TREE_VERIFICATION(tree, {});
+
+    DecisionProgram program = {};
+    Compiler compiler       = {&program, NULL, TableCapacity(tree->size)};
+
+    program.attribute  = (int32_t *)calloc(tree->size    , sizeof(int32_t));
+    program.next       = (int32_t *)calloc(3 * tree->size, sizeof(int32_t));
+    program.answer     = (int32_t *)calloc(tree->size    , sizeof(int32_t));
+    program.attributes = (char   **)calloc(tree->size    , sizeof(char *));
+    program.answers    = (char   **)calloc(tree->size    , sizeof(char *));
+    compiler.table     = (int32_t *)malloc(compiler.table_capacity * sizeof(int32_t));
+
+    ASSERT(program.attribute && program.next && program.answer && program.attributes && program.answers && compiler.table,
+           free(compiler.table); DecisionProgramDtor(&program); return {});
+
+    memset(compiler.table, -1, compiler.table_capacity * sizeof(int32_t));
+
+    CompileSubTree(&compiler, tree->root, 0);
+
+    // Leaves read the constant column that follows the real attributes.
+    for(size_t step = 0; step < program.n_steps; step++)
+    {
+        if(program.attribute[step] < 0) program.attribute[step] = (int32_t)program.n_attributes;
+    }
+
+    free(compiler.table);
+
+    return program;
+}
+
+void DecisionProgramDtor(DecisionProgram *program)
+{
+    ASSERT(program, return);
+
+    for(size_t i = 0; i < program->n_attributes; i++) free(program->attributes[i]);
+    for(size_t i = 0; i < program->n_answers   ; i++) free(program->answers[i]);
+
+    free(program->attribute);
+    free(program->next);
+    free(program->answer);
+    free(program->attributes);
+    free(program->answers);
+
+    *program = {};
+}
+
+
+static uint8_t ParseValue(char ch)
+{
+    switch(ch)
+    {
+        case 'y': case 'Y': case '1': return VALUE_YES;
+        case 'n': case 'N': case '0': return VALUE_NO;
+        default : return VALUE_MISSING;
+    }
+}
+
+static char *ReadFile(const char *const file_name, size_t *size)
+{
+    FILE *file = fopen(file_name, "rb");
+    if(!file)
+    {
+        LOG("No such file: \"%s\"", file_name);
+        return NULL;
+    }
+
+    struct stat file_info = {};
+    stat(file_name, &file_info);
+    *size = (size_t)file_info.st_size;
+
+    char *buffer = (char *)calloc(*size + 1, sizeof(char));
+    ASSERT(buffer, fclose(file); return NULL);
+
+    fread(buffer, *size, sizeof(char), file);
+    fclose(file);
+
+    return buffer;
+}
+
+// Every line of a columns file is one attribute: "<question>\t<one y/n/? per record>".
+int ReadColumns(const DecisionProgram *program, const char *const file_name, Columns *columns)
+{
+    ASSERT(program && file_name && columns, return EXIT_FAILURE);
+
+    size_t size = 0;
+
+    *columns = {};
+    columns->buffer = ReadFile(file_name, &size);
+    if(!columns->buffer) return EXIT_FAILURE;
+
+    columns->values = (uint8_t **)calloc(program->n_attributes + 1, sizeof(uint8_t *));
+    ASSERT(columns->values, ColumnsDtor(columns); return EXIT_FAILURE);
+
+    size_t capacity = TableCapacity(program->n_attributes);
+
+    int32_t *table = (int32_t *)malloc(capacity * sizeof(int32_t));
+    ASSERT(table, ColumnsDtor(columns); return EXIT_FAILURE);
+
+    memset(table, -1, capacity * sizeof(int32_t));
+
+    for(size_t attr = 0; attr < program->n_attributes; attr++)
+    {
+        *AttributeSlot(program, table, capacity, program->attributes[attr]) = (int32_t)attr;
+    }
+
+    bool   has_records = false;
+    char  *line        = columns->buffer;
+
+    while(line < columns->buffer + size)
+    {
+        char *end = strchr(line, '\n');
+        if(!end) end = columns->buffer + size;
+        *end = '\0';
+
+        char *values = strchr(line, '\t');
+
+        if(values)
+        {
+            *values++ = '\0';
+
+            size_t n_records = (size_t)(end - values);
+            if(n_records && values[n_records - 1] == '\r') n_records--;
+
+            if(has_records && n_records != columns->n_records)
+            {
+                LOG("Column \"%s\" has %zu records instead of %zu.\n", line, n_records, columns->n_records);
+
+                free(table);
+                ColumnsDtor(columns);
+                return EXIT_FAILURE;
+            }
+
+            columns->n_records = n_records;
+            has_records        = true;
+
+            int32_t attr = *AttributeSlot(program, table, capacity, line);
+
+            if(attr >= 0)
+            {
+                for(size_t rec = 0; rec < n_records; rec++) values[rec] = (char)ParseValue(values[rec]);
+
+                columns->values[attr] = (uint8_t *)values;
+            }
+        }
+
+        line = end + 1;
+    }
+
+    free(table);
+
+    columns->constant = (uint8_t *)calloc(columns->n_records + 1, sizeof(uint8_t));
+    columns->missing  = (uint8_t *)calloc(columns->n_records + 1, sizeof(uint8_t));
+    ASSERT(columns->constant && columns->missing, ColumnsDtor(columns); return EXIT_FAILURE);
+
+    memset(columns->missing, VALUE_MISSING, columns->n_records);
+
+    columns->values[program->n_attributes] = columns->constant;
+
+    for(size_t attr = 0; attr < program->n_attributes; attr++)
+    {
+        if(!columns->values[attr]) columns->values[attr] = columns->missing;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+void ColumnsDtor(Columns *columns)
+{
+    ASSERT(columns, return);
+
+    free(columns->values);
+    free(columns->buffer);
+    free(columns->constant);
+    free(columns->missing);
+
+    *columns = {};
+}
+
+
+// Records advance one level together, so the loads of a whole batch are in flight at once.
+int ClassifyRecords(const DecisionProgram *program, const Columns *columns, int32_t *result)
+{
+    ASSERT(program && columns && result, return EXIT_FAILURE);
+
+    const int32_t *attribute = program->attribute;
+    const int32_t *next      = program->next;
+    uint8_t *const *values   = columns->values;
+
+    for(size_t base = 0; base < columns->n_records; base += CLASSIFY_BATCH)
+    {
+        size_t   count = (columns->n_records - base < CLASSIFY_BATCH) ? columns->n_records - base : CLASSIFY_BATCH;
+        int32_t *cur   = result + base;
+
+        memset(cur, 0, count * sizeof(int32_t));
+
+        for(size_t level = 0; level < program->max_depth; level++)
+        {
+            for(size_t i = 0; i < count; i++)
+            {
+                int32_t step = cur[i];
+
+                cur[i] = next[3 * step + values[attribute[step]][base + i]];
+
+                __builtin_prefetch(&next[3 * cur[i]]);
+            }
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+
+int ClassifyCommand(int argc, char *argv[])
+{
+    if(argc != 2)
+    {
+        fprintf(stderr, "Usage: classify <data_base> <columns_file>\n");
+        return EXIT_FAILURE;
+    }
+
+    Tree tree = ReadTree(argv[0]);
+    ASSERT(tree.root, return EXIT_FAILURE);
+
+    DecisionProgram program = CompileTree(&tree);
+    TreeDtor(&tree, tree.root);
+    ASSERT(program.n_steps, return EXIT_FAILURE);
+
+    Columns columns = {};
+    if(ReadColumns(&program, argv[1], &columns) != EXIT_SUCCESS)
+    {
+        DecisionProgramDtor(&program);
+        return EXIT_FAILURE;
+    }
+
+    int32_t *result = (int32_t *)calloc(columns.n_records + 1, sizeof(int32_t));
+    ASSERT(result, ColumnsDtor(&columns); DecisionProgramDtor(&program); return EXIT_FAILURE);
+
+    timespec start = {}, end = {};
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ClassifyRecords(&program, &columns, result);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    for(size_t rec = 0; rec < columns.n_records; rec++)
+    {
+        int32_t step = result[rec];
+
+        if(program.answer[step] >= 0) printf("%zu\t%s\n"           , rec, program.answers[program.answer[step]]);
+        else                          printf("%zu\t?\tmissing: %s\n", rec, program.attributes[program.attribute[step]]);
+    }
+
+    double elapsed = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) * 1e-9;
+
+    fprintf(stderr, "classified %zu records in %.6f s (%.0f records/s)\n",
+                    columns.n_records, elapsed, (elapsed > 0) ? (double)columns.n_records / elapsed : 0.0);
+
+    free(result);
+    ColumnsDtor(&columns);
+    DecisionProgramDtor(&program);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,316 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/dag.h"
+#include "../include/memory.h"
+
+const size_t SYNTHETIC_LABELS = 64;
+
+struct InternTable
+{
+    size_t capacity;
+
+    char **labels;
+    Node **nodes;
+
+    size_t unique_labels;
+    size_t unique_nodes;
+
+    size_t label_bytes;
+};
+
+static size_t TableCapacity(size_t size)
+{
+    size_t capacity = 16;
+    while(capacity < 2 * size) capacity *= 2;
+
+    return capacity;
+}
+
+static uint64_t HashLabel(const char *label)
+{
+    uint64_t hash = 14695981039346656037ull;
+
+    for(; *label; label++)
+    {
+        hash ^= (unsigned char)*label;
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+static uint64_t HashShape(const Node *const node)
+{
+    uint64_t hash = (uintptr_t)node->data;
+
+    hash = (hash ^ (uintptr_t)node->left ) * 0x9E3779B97F4A7C15ull;
+    hash = (hash ^ (uintptr_t)node->right) * 0x9E3779B97F4A7C15ull;
+
+    return hash ^ (hash >> 29);
+}
+
+
+static char *InternLabel(Tree *tree, InternTable *table, Node *node)
+{
+    size_t mask = table->capacity - 1;
+
+    for(size_t i = HashLabel(node->data) & mask; ; i = (i + 1) & mask)
+    {
+        if(!table->labels[i])
+        {
+            table->labels[i] = ArenaStrdup(tree->arena, node->data);
+            ASSERT(table->labels[i], return NULL);
+
+            table->unique_labels++;
+            table->label_bytes += strlen(node->data) + 1;
+
+            return table->labels[i];
+        }
+
+        if(strcmp(table->labels[i], node->data) == 0) return table->labels[i];
+    }
+}
+
+// Children are interned before their parent, so two subtrees are equal exactly when
+// their roots have the same interned label and the same canonical children.
+static Node *InternNode(Tree *tree, InternTable *table, Node *tree_node)
+{
+    char *label = InternLabel(tree, table, tree_node);
+    ASSERT(label, return tree_node);
+
+    if(label != tree_node->data)
+    {
+        if(!(tree_node->flags & NODE_SHARED_DATA))
+        {
+            METRICS_ADD(COUNTER_LABEL_BYTES, -(int64_t)(strlen(tree_node->data) + 1));
+
+            MemFree(MEM_LABELS, tree_node->data);
+        }
+
+        tree_node->data   = label;
+        tree_node->flags |= NODE_SHARED_DATA;
+    }
+
+    size_t mask = table->capacity - 1;
+
+    for(size_t i = HashShape(tree_node) & mask; ; i = (i + 1) & mask)
+    {
+        Node *canon = table->nodes[i];
+
+        if(!canon)
+        {
+            table->nodes[i] = tree_node;
+            table->unique_nodes++;
+
+            return tree_node;
+        }
+
+        if(canon == tree_node) return tree_node;
+
+        if(canon->data  == tree_node->data &&
+           canon->left  == tree_node->left &&
+           canon->right == tree_node->right)
+        {
+            if(tree_node->refs)
+            {
+                tree_node->refs--;
+            }
+            else
+            {
+                if(tree_node->left ) tree_node->left ->refs--;
+                if(tree_node->right) tree_node->right->refs--;
+
+                NodeDtor(tree_node);
+            }
+
+            canon->refs++;
+
+            return canon;
+        }
+    }
+}
+
+// A node`s state is 1 while its left subtree is interned and 2 for the right one.
+static Node *InternSubTree(Tree *tree, InternTable *table, Node *tree_node)
+{
+    NodeStack stack = {};
+
+    if(!tree_node || NodeStackPush(&stack, tree_node) != EXIT_SUCCESS) return tree_node;
+
+    Node *interned = tree_node;
+
+    while(stack.size)
+    {
+        NodeFrame *frame = &stack.frames[stack.size - 1];
+        Node      *node  = frame->node;
+
+        if(frame->state < 2)
+        {
+            Node *next = (frame->state++ == 0) ? node->left : node->right;
+
+            if(next && NodeStackPush(&stack, next) != EXIT_SUCCESS) break;
+
+            continue;
+        }
+
+        stack.size--;
+
+        Node *canon = InternNode(tree, table, node);
+
+        if(!stack.size)
+        {
+            interned = canon;
+            continue;
+        }
+
+        NodeFrame *parent = &stack.frames[stack.size - 1];
+
+        if(parent->state == 1) parent->node->left  = canon;
+        else                   parent->node->right = canon;
+    }
+
+    NodeStackDtor(&stack);
+
+    return interned;
+}
+
+int TreeCompress(Tree *tree, DagReport *report)
+{
+    TREE_VERIFICATION(tree, EXIT_FAILURE);
+
+    if(!tree->arena) tree->arena = ArenaCtor();
+    ASSERT(tree->arena, return EXIT_FAILURE);
+
+    InternTable table = {TableCapacity(tree->size), NULL, NULL, 0, 0, 0};
+
+    table.labels = (char **)calloc(table.capacity, sizeof(char *));
+    table.nodes  = (Node **)calloc(table.capacity, sizeof(Node *));
+    ASSERT(table.labels && table.nodes, free(table.labels); free(table.nodes); return EXIT_FAILURE);
+
+    size_t label_bytes = SubTreeLabelBytes(tree->root);
+
+    tree->root = InternSubTree(tree, &table, tree->root);
+
+    if(report)
+    {
+        report->nodes         = tree->size;
+        report->unique_nodes  = table.unique_nodes;
+        report->labels        = tree->size;
+        report->unique_labels = table.unique_labels;
+        report->bytes_before  = tree->size * sizeof(Node) + label_bytes;
+        report->bytes_after   = table.unique_nodes * sizeof(Node) + table.label_bytes;
+    }
+
+    free(table.labels);
+    free(table.nodes);
+
+    TREE_VERIFICATION(tree, EXIT_FAILURE);
+
+    return EXIT_SUCCESS;
+}
+
+
+static Node *SubTreeCopy(Node *const tree_node)
+{
+    if(!tree_node) return NULL;
+
+    return NodeCtor(tree_node->data, SubTreeCopy(tree_node->left), SubTreeCopy(tree_node->right));
+}
+
+static Node *RandomDescent(Node *tree_node, int stop_chance = 0)
+{
+    while(tree_node->right && !(stop_chance && rand() % stop_chance == 0))
+    {
+        tree_node = (rand() % 2) ? tree_node->right : tree_node->left;
+    }
+
+    return tree_node;
+}
+
+// Mimics merged session databases: learned questions come from a small vocabulary
+// and half of the answers are copies of subtrees that already exist elsewhere in the base.
+static void GrowSynthetic(Tree *tree, size_t target_size)
+{
+    char label[FMT_STR_LEN] = {};
+
+    while(tree->size < target_size)
+    {
+        Node *leaf  = RandomDescent(tree->root);
+        Node *donor = RandomDescent(tree->root, 3);
+
+        Node *copy = NULL;
+        Node *old  = NodeCtor(leaf->data);
+
+        if(rand() % 2)
+        {
+            sprintf(label, "синтетический ответ %zu", tree->size);
+            copy = NodeCtor(label);
+        }
+        else
+        {
+            copy = SubTreeCopy(donor);
+        }
+        ASSERT(copy && old, return);
+
+        sprintf(label, "синтетический признак %d", rand() % (int)SYNTHETIC_LABELS);
+        NodeRelabel(leaf, label);
+
+        leaf->left  = old;
+        leaf->right = copy;
+
+        tree->size += 1 + SubTreeSize(copy);
+    }
+
+    TreeRehash(tree);
+}
+
+static void PrintReport(const char *name, const DagReport *report)
+{
+    printf("%s:\n"
+           "\tnodes:  %zu -> %zu unique\n"
+           "\tlabels: %zu -> %zu unique\n"
+           "\tbytes:  %zu -> %zu (%.1f%% saved)\n",
+           name,
+           report->nodes , report->unique_nodes,
+           report->labels, report->unique_labels,
+           report->bytes_before, report->bytes_after,
+           100.0 * (1.0 - (double)report->bytes_after / (double)report->bytes_before));
+}
+
+int CompressReportCommand(int argc, char *argv[])
+{
+    if(argc < 1 || argc > 2)
+    {
+        fprintf(stderr, "Usage: compress-report <data_base> [synthetic_size]\n");
+        return EXIT_FAILURE;
+    }
+
+    DagReport report = {};
+
+    Tree tree = ReadTree(argv[0]);
+    ASSERT(tree.root, return EXIT_FAILURE);
+
+    TreeCompress(&tree, &report);
+    PrintReport(argv[0], &report);
+
+    TreeDtor(&tree, tree.root);
+
+    if(argc == 1) return EXIT_SUCCESS;
+
+    size_t target_size = strtoul(argv[1], NULL, 10);
+
+    tree = ReadTree(argv[0]);
+    ASSERT(tree.root, return EXIT_FAILURE);
+
+    srand(0);
+    GrowSynthetic(&tree, target_size);
+
+    TreeCompress(&tree, &report);
+    PrintReport("synthetic", &report);
+
+    TreeDtor(&tree, tree.root);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,268 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/export.h"
+
+struct ExportFrame
+{
+    Node *node;
+
+    int state;
+};
+
+enum ExportState
+{
+    FRAME_NEW = 0,
+    FRAME_NO  = 1,
+    FRAME_YES = 2
+};
+
+struct ExportWriter
+{
+    FILE *out_file;
+
+    size_t size;
+    char   buffer[EXPORT_CHUNK_SIZE];
+};
+
+static void FlushWriter(ExportWriter *writer)
+{
+    fwrite(writer->buffer, sizeof(char), writer->size, writer->out_file);
+    fflush(writer->out_file);
+
+    writer->size = 0;
+}
+
+static void WriteChar(ExportWriter *writer, char ch)
+{
+    if(writer->size == EXPORT_CHUNK_SIZE) FlushWriter(writer);
+
+    writer->buffer[writer->size++] = ch;
+}
+
+static void WriteStr(ExportWriter *writer, const char *str)
+{
+    for(; *str; str++) WriteChar(writer, *str);
+}
+
+// Control characters JSON has no short escape for, such as ones pasted into a learned label.
+static void WriteJsonChar(ExportWriter *writer, char ch)
+{
+    if((unsigned char)ch >= 0x20)
+    {
+        WriteChar(writer, ch);
+        return;
+    }
+
+    char escape[8] = {};
+    snprintf(escape, sizeof(escape), "\\u%04x", (unsigned)(unsigned char)ch);
+
+    WriteStr(writer, escape);
+}
+
+static void WriteField(ExportWriter *writer, const char *str, ExportFormat format)
+{
+    switch(format)
+    {
+        case EXPORT_CSV:
+        {
+            WriteChar(writer, '"');
+
+            for(; *str; str++)
+            {
+                if(*str == '"') WriteChar(writer, '"');
+                WriteChar(writer, *str);
+            }
+
+            WriteChar(writer, '"');
+            break;
+        }
+        case EXPORT_JSONL:
+        {
+            WriteChar(writer, '"');
+
+            for(; *str; str++)
+            {
+                switch(*str)
+                {
+                    case '"' : WriteStr(writer, "\\\""); break;
+                    case '\\': WriteStr(writer, "\\\\"); break;
+                    case '\n': WriteStr(writer, "\\n" ); break;
+                    case '\t': WriteStr(writer, "\\t" ); break;
+                    case '\r': WriteStr(writer, "\\r" ); break;
+                    default  : WriteJsonChar(writer, *str); break;
+                }
+            }
+
+            WriteChar(writer, '"');
+            break;
+        }
+        case EXPORT_TSV:
+        {
+            for(; *str; str++)
+            {
+                switch(*str)
+                {
+                    case '\n': WriteStr(writer, "\\n"); break;
+                    case '\t': WriteStr(writer, "\\t"); break;
+                    case '\r': WriteStr(writer, "\\r"); break;
+                    case '\\': WriteStr(writer, "\\\\"); break;
+                    default  : WriteChar(writer, *str); break;
+                }
+            }
+
+            break;
+        }
+        default: break;
+    }
+}
+
+// Writes the leaf on top of the stack and the yes/no chain of its ancestors in PropertiesDump order.
+static void WriteLeaf(ExportWriter *writer, ExportFrame *frames, size_t depth, ExportFormat format)
+{
+    Node *leaf = frames[depth - 1].node;
+
+    if(format == EXPORT_JSONL)
+    {
+        WriteStr  (writer, "{\"answer\":");
+        WriteField(writer, leaf->data, format);
+        WriteStr  (writer, ",\"properties\":[");
+
+        for(size_t i = 0; i + 1 < depth; i++)
+        {
+            if(i) WriteChar(writer, ',');
+
+            WriteStr  (writer, "{\"property\":");
+            WriteField(writer, frames[i].node->data, format);
+            WriteStr  (writer, (frames[i].state == FRAME_YES) ? ",\"value\":true}" : ",\"value\":false}");
+        }
+
+        WriteStr(writer, "]}\n");
+
+        return;
+    }
+
+    char separator = (format == EXPORT_CSV) ? ',' : '\t';
+
+    WriteField(writer, leaf->data, format);
+
+    for(size_t i = 0; i + 1 < depth; i++)
+    {
+        WriteChar (writer, separator);
+        WriteField(writer, frames[i].node->data, format);
+        WriteChar (writer, separator);
+        WriteStr  (writer, (frames[i].state == FRAME_YES) ? "yes" : "no");
+    }
+
+    WriteChar(writer, '\n');
+}
+
+static int PushFrame(ExportFrame **frames, size_t *depth, size_t *capacity, Node *node)
+{
+    if(*depth == *capacity)
+    {
+        ExportFrame *frames_r = (ExportFrame *)realloc(*frames, 2 * (*capacity) * sizeof(ExportFrame));
+        ASSERT(frames_r, return EXIT_FAILURE);
+
+        *frames    = frames_r;
+        *capacity *= 2;
+    }
+
+    (*frames)[(*depth)++] = {node, FRAME_NEW};
+
+    return EXIT_SUCCESS;
+}
+
+int TreeExportLeaves(Tree *const tree, FILE *out_file, ExportFormat format)
+{
+    TREE_VERIFICATION(tree, EXIT_FAILURE);
+
+    ASSERT(out_file, return EXIT_FAILURE);
+
+    ExportWriter *writer = (ExportWriter *)calloc(1, sizeof(ExportWriter));
+    ASSERT(writer, return EXIT_FAILURE);
+
+    writer->out_file = out_file;
+
+    size_t depth    = 0;
+    size_t capacity = BASE_CAPACITY;
+
+    ExportFrame *frames = (ExportFrame *)calloc(capacity, sizeof(ExportFrame));
+    ASSERT(frames, free(writer); return EXIT_FAILURE);
+
+    int status = PushFrame(&frames, &depth, &capacity, tree->root);
+
+    while(depth && status == EXIT_SUCCESS)
+    {
+        ExportFrame *top = &frames[depth - 1];
+        Node *next       = NULL;
+
+        switch(top->state)
+        {
+            case FRAME_NEW:
+            {
+                if(!top->node->left && !top->node->right)
+                {
+                    WriteLeaf(writer, frames, depth, format);
+                    depth--;
+
+                    continue;
+                }
+
+                top->state = FRAME_NO;
+                next       = top->node->left;
+                break;
+            }
+            case FRAME_NO:
+            {
+                top->state = FRAME_YES;
+                next       = top->node->right;
+                break;
+            }
+            default:
+            {
+                depth--;
+                continue;
+            }
+        }
+
+        if(next) status = PushFrame(&frames, &depth, &capacity, next);
+    }
+
+    FlushWriter(writer);
+
+    free(frames);
+    free(writer);
+
+    return status;
+}
+
+
+int ExportCommand(int argc, char *argv[])
+{
+    static const char *const FORMATS[] = {"csv", "jsonl", "tsv"};
+
+    if(argc != 2)
+    {
+        fprintf(stderr, "Usage: export <csv|jsonl|tsv> <data_base>\n");
+        return EXIT_FAILURE;
+    }
+
+    int format = 0;
+    while(format < 3 && strcmp(argv[0], FORMATS[format]) != 0) format++;
+
+    if(format == 3)
+    {
+        fprintf(stderr, "Unknown export format: %s\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    Tree tree = ReadTree(argv[1]);
+    ASSERT(tree.root, return EXIT_FAILURE);
+
+    int status = TreeExportLeaves(&tree, stdout, (ExportFormat)format);
+
+    TreeDtor(&tree, tree.root);
+
+    return status;
+}
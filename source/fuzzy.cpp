@@ -0,0 +1,604 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/fuzzy.h"
+#include "../include/memory.h"
+#include "../include/trace.h"
+
+const uint32_t FUZZY_RAW_BYTE = 0x110000;  // past Unicode: a byte that starts no valid sequence
+
+// A malformed byte stands for itself, so it still matches only the same byte.
+static uint32_t NextCodepoint(const unsigned char **cursor)
+{
+    const unsigned char *str = *cursor;
+
+    uint32_t codepoint = str[0];
+    size_t   len       = (codepoint < 0x80)           ? 1 :
+                         ((codepoint & 0xE0) == 0xC0) ? 2 :
+                         ((codepoint & 0xF0) == 0xE0) ? 3 :
+                         ((codepoint & 0xF8) == 0xF0) ? 4 : 0;
+
+    if(len > 1) codepoint &= 0x7Fu >> len;
+
+    for(size_t i = 1; i < len; i++)
+    {
+        if((str[i] & 0xC0) != 0x80)
+        {
+            len = 0;
+            break;
+        }
+
+        codepoint = (codepoint << 6) | (str[i] & 0x3Fu);
+    }
+
+    if(!len)
+    {
+        *cursor = str + 1;
+        return FUZZY_RAW_BYTE + str[0];
+    }
+
+    *cursor = str + len;
+
+    return codepoint;
+}
+
+// Case is dropped for Latin and Cyrillic, and Ё is read as Е, as Russian writing often does.
+static uint32_t FoldCodepoint(uint32_t codepoint)
+{
+    if(codepoint >= 'A'   && codepoint <= 'Z'                      ) return codepoint + 0x20;
+    if(codepoint >= 0xC0  && codepoint <= 0xDE && codepoint != 0xD7) return codepoint + 0x20;
+    if(codepoint >= 0x410 && codepoint <= 0x42F                    ) return codepoint + 0x20;
+    if(codepoint >= 0x400 && codepoint <= 0x40F                    ) codepoint += 0x50;
+
+    return (codepoint == 0x451) ? 0x435 : codepoint;
+}
+
+// Counts the codepoints, and writes them when there is somewhere to.
+static size_t FoldLabel(const char *const label, uint32_t *symbols)
+{
+    size_t len = 0;
+
+    for(const unsigned char *cursor = (const unsigned char *)label; *cursor; len++)
+    {
+        uint32_t codepoint = FoldCodepoint(NextCodepoint(&cursor));
+
+        if(symbols) symbols[len] = codepoint;
+    }
+
+    return len;
+}
+
+static uint64_t SymbolBit(uint32_t codepoint)
+{
+    return 1ull << ((codepoint * 0x9E3779B97F4A7C15ull) >> 58);
+}
+
+static size_t Bucket(size_t len)
+{
+    return (len < FUZZY_BUCKETS - 1) ? len : FUZZY_BUCKETS - 1;
+}
+
+
+LabelIndex *LabelIndexCtor(void)
+{
+    LabelIndex *index = (LabelIndex *)MemCalloc(MEM_INDEX, 1, sizeof(LabelIndex));
+    ASSERT(index, return NULL);
+
+    return index;
+}
+
+static void LabelIndexClear(LabelIndex *index)
+{
+    MemFree(MEM_INDEX, index->text);
+    MemFree(MEM_INDEX, index->text_at);
+    MemFree(MEM_INDEX, index->symbols);
+    MemFree(MEM_INDEX, index->symbols_at);
+    MemFree(MEM_INDEX, index->masks);
+
+    index->root_hash = 0;
+    index->n_labels  = 0;
+
+    index->text       = NULL;
+    index->text_at    = NULL;
+    index->symbols    = NULL;
+    index->symbols_at = NULL;
+    index->masks      = NULL;
+
+    memset(index->buckets, 0, sizeof(index->buckets));
+}
+
+void LabelIndexDtor(LabelIndex *index)
+{
+    if(!index) return;
+
+    LabelIndexClear(index);
+    MemFree(MEM_INDEX, index);
+}
+
+// A counting sort by length: one pass measures, the other writes each label into its place.
+int LabelIndexBuild(LabelIndex *index, const char *const *labels, const size_t count)
+{
+    ASSERT(index, return EXIT_FAILURE);
+    ASSERT(labels || !count, return EXIT_FAILURE);
+
+    TRACE_SPAN(span, "LabelIndexBuild");
+
+    LabelIndexClear(index);
+
+    size_t *places = (size_t *)MemCalloc(MEM_INDEX, count + 1, sizeof(size_t));
+    ASSERT(places, return EXIT_FAILURE);
+
+    size_t n_symbols  = 0;
+    size_t text_bytes = 0;
+
+    for(size_t i = 0; i < count; i++)
+    {
+        places[i] = FoldLabel(labels[i], NULL);
+
+        n_symbols  += places[i];
+        text_bytes += strlen(labels[i]) + 1;
+
+        index->buckets[Bucket(places[i]) + 1]++;
+    }
+
+    for(size_t bucket = 0; bucket < FUZZY_BUCKETS; bucket++) index->buckets[bucket + 1] += index->buckets[bucket];
+
+    index->text       = (char     *)MemCalloc(MEM_INDEX, text_bytes + 1, sizeof(char    ));
+    index->text_at    = (size_t   *)MemCalloc(MEM_INDEX, count      + 1, sizeof(size_t  ));
+    index->symbols    = (uint32_t *)MemCalloc(MEM_INDEX, n_symbols  + 1, sizeof(uint32_t));
+    index->symbols_at = (size_t   *)MemCalloc(MEM_INDEX, count      + 1, sizeof(size_t  ));
+    index->masks      = (uint64_t *)MemCalloc(MEM_INDEX, count      + 1, sizeof(uint64_t));
+
+    ASSERT(index->text && index->text_at && index->symbols && index->symbols_at && index->masks,
+           LabelIndexClear(index); MemFree(MEM_INDEX, places); return EXIT_FAILURE);
+
+    size_t next[FUZZY_BUCKETS] = {};
+    memcpy(next, index->buckets, sizeof(next));
+
+    for(size_t i = 0; i < count; i++)
+    {
+        size_t place = next[Bucket(places[i])]++;
+
+        index->symbols_at[place + 1] = places[i];
+        places[i] = place;
+    }
+
+    for(size_t place = 0; place < count; place++) index->symbols_at[place + 1] += index->symbols_at[place];
+
+    size_t text_used = 0;
+
+    for(size_t i = 0; i < count; i++)
+    {
+        size_t    place   = places[i];
+        uint32_t *symbols = index->symbols + index->symbols_at[place];
+        size_t    len     = FoldLabel(labels[i], symbols);
+
+        for(size_t j = 0; j < len; j++) index->masks[place] |= SymbolBit(symbols[j]);
+
+        size_t bytes = strlen(labels[i]) + 1;
+
+        index->text_at[place] = text_used;
+        memcpy(index->text + text_used, labels[i], bytes);
+
+        text_used += bytes;
+    }
+
+    index->n_labels = count;
+
+    MemFree(MEM_INDEX, places);
+
+    TraceSpanInt(&span, "labels", (long long)count);
+
+    return EXIT_SUCCESS;
+}
+
+// Rebuilt from the leaves whenever the tree has changed since the last build.
+int LabelIndexSync(LabelIndex *index, Tree *const tree)
+{
+    ASSERT(index && tree && tree->root, return EXIT_FAILURE);
+
+    if(index->root_hash == tree->root->hash && index->text) return EXIT_SUCCESS;
+
+    size_t       capacity = tree->size + 1;
+    Node       **stack    = (Node       **)MemCalloc(MEM_INDEX, capacity, sizeof(Node *));
+    const char **labels   = (const char **)MemCalloc(MEM_INDEX, capacity, sizeof(const char *));
+    ASSERT(stack && labels, MemFree(MEM_INDEX, stack); MemFree(MEM_INDEX, labels); return EXIT_FAILURE);
+
+    size_t depth = 0;
+    size_t count = 0;
+
+    stack[depth++] = tree->root;
+
+    while(depth)
+    {
+        Node *tree_node = stack[--depth];
+
+        // Shared subtrees are met once per parent, so the size is only a first guess.
+        if(depth + 2 > capacity || count + 1 > capacity)
+        {
+            capacity *= 2;
+
+            Node       **stack_r  = (Node **)MemRealloc(MEM_INDEX, stack, capacity * sizeof(Node *));
+            const char **labels_r = stack_r ? (const char **)MemRealloc(MEM_INDEX, labels, capacity * sizeof(const char *)) : NULL;
+
+            if(stack_r) stack = stack_r;
+            ASSERT(labels_r, MemFree(MEM_INDEX, stack); MemFree(MEM_INDEX, labels); return EXIT_FAILURE);
+
+            labels = labels_r;
+        }
+
+        if(!tree_node->left && !tree_node->right) labels[count++] = tree_node->data;
+
+        if(tree_node->right) stack[depth++] = tree_node->right;
+        if(tree_node->left ) stack[depth++] = tree_node->left;
+    }
+
+    int status = LabelIndexBuild(index, labels, count);
+    if(status == EXIT_SUCCESS) index->root_hash = tree->root->hash;
+
+    MemFree(MEM_INDEX, stack);
+    MemFree(MEM_INDEX, labels);
+
+    return status;
+}
+
+
+struct FarSymbol
+{
+    uint32_t codepoint;
+    uint64_t mask;
+};
+
+// Match vectors of the query: codepoints below FUZZY_DIRECT are looked up in the index
+// table, the rest are few and scanned.
+struct Pattern
+{
+    const uint64_t *direct;
+
+    FarSymbol far[FUZZY_MAX_LEN];
+    size_t    n_far;
+
+    size_t   len;
+    uint64_t mask;
+};
+
+static uint64_t MatchVector(const Pattern *pattern, uint32_t codepoint)
+{
+    if(codepoint < FUZZY_DIRECT) return pattern->direct[codepoint];
+
+    for(size_t i = 0; i < pattern->n_far; i++)
+    {
+        if(pattern->far[i].codepoint == codepoint) return pattern->far[i].mask;
+    }
+
+    return 0;
+}
+
+// Myers' bit-parallel edit distance between the whole query and the whole label: one
+// column of the dynamic programming matrix per codepoint of the label, as two bit vectors.
+static size_t MyersDistance(const Pattern *pattern, const uint32_t *text, const size_t text_len)
+{
+    uint64_t high  = 1ull << (pattern->len - 1);
+    uint64_t pv    = ~0ull;
+    uint64_t mv    = 0;
+    size_t   score = pattern->len;
+
+    for(size_t j = 0; j < text_len; j++)
+    {
+        uint64_t eq = MatchVector(pattern, text[j]);
+        uint64_t xv = eq | mv;
+        uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+        uint64_t ph = mv | ~(xh | pv);
+        uint64_t mh = pv & xh;
+
+        if     (ph & high) score++;
+        else if(mh & high) score--;
+
+        ph = (ph << 1) | 1;
+        mh =  mh << 1;
+
+        pv = mh | ~(xv | ph);
+        mv = ph & xv;
+    }
+
+    return score;
+}
+
+static bool IsBetterMatch(const FuzzyMatch *lhs, const FuzzyMatch *rhs, size_t query_len)
+{
+    if(lhs->distance != rhs->distance) return lhs->distance < rhs->distance;
+
+    size_t lhs_skew = (lhs->length > query_len) ? lhs->length - query_len : query_len - lhs->length;
+    size_t rhs_skew = (rhs->length > query_len) ? rhs->length - query_len : query_len - rhs->length;
+
+    if(lhs_skew != rhs_skew) return lhs_skew < rhs_skew;
+
+    return strcmp(lhs->label, rhs->label) < 0;
+}
+
+// Keeps the best max_matches in order, each label once.
+static void AddMatch(FuzzyMatch *matches, size_t *n_matches, const size_t max_matches, const FuzzyMatch *match,
+                     size_t query_len)
+{
+    for(size_t i = 0; i < *n_matches; i++)
+    {
+        if(strcmp(matches[i].label, match->label) == 0) return;
+    }
+
+    size_t place = *n_matches;
+
+    while(place && IsBetterMatch(match, &matches[place - 1], query_len)) place--;
+
+    if(place >= max_matches) return;
+
+    size_t last = (*n_matches < max_matches) ? (*n_matches)++ : max_matches - 1;
+
+    memmove(&matches[place + 1], &matches[place], (last - place) * sizeof(FuzzyMatch));
+    matches[place] = *match;
+}
+
+bool IsFuzzyQuery(const char *const query)
+{
+    ASSERT(query, return false);
+
+    size_t len = FoldLabel(query, NULL);
+
+    return len && len <= FUZZY_MAX_LEN;
+}
+
+// Labels of the wrong length are never looked at, and a label missing more distinct
+// codepoints of the query than the distance allows, or having more the query lacks, is
+// passed over without running the distance. Longer queries than IsFuzzyQuery takes find nothing.
+size_t FuzzyLookup(LabelIndex *index, const char *const query, size_t max_distance,
+                   FuzzyMatch *matches, const size_t max_matches)
+{
+    METRICS_TIME(OP_FUZZY_LOOKUP);
+
+    ASSERT(index && query, return 0);
+    ASSERT(matches || !max_matches, return 0);
+
+    size_t len = FoldLabel(query, NULL);
+    if(!len || !max_matches) return 0;
+
+    if(len > FUZZY_MAX_LEN)
+    {
+        LOG("Query of %zu codepoints is not looked up, at most %zu are.\n", len, FUZZY_MAX_LEN);
+        return 0;
+    }
+
+    if(max_distance > FUZZY_MAX_DISTANCE) max_distance = FUZZY_MAX_DISTANCE;
+
+    uint32_t symbols[FUZZY_MAX_LEN] = {};
+    FoldLabel(query, symbols);
+
+    Pattern pattern = {index->peq, {}, 0, len, 0};
+
+    for(size_t i = 0; i < len; i++)
+    {
+        uint32_t codepoint = symbols[i];
+
+        pattern.mask |= SymbolBit(codepoint);
+
+        if(codepoint < FUZZY_DIRECT)
+        {
+            index->peq[codepoint] |= 1ull << i;
+            continue;
+        }
+
+        size_t far = 0;
+        while(far < pattern.n_far && pattern.far[far].codepoint != codepoint) far++;
+
+        if(far == pattern.n_far) pattern.far[pattern.n_far++] = {codepoint, 0};
+
+        pattern.far[far].mask |= 1ull << i;
+    }
+
+    size_t n_matches = 0;
+    size_t shortest  = (len > max_distance) ? len - max_distance : 0;
+
+    for(size_t text_len = shortest; text_len <= len + max_distance; text_len++)
+    {
+        for(size_t place = index->buckets[text_len]; place < index->buckets[text_len + 1]; place++)
+        {
+            uint64_t mask = index->masks[place];
+
+            if((size_t)__builtin_popcountll(pattern.mask & ~mask) > max_distance ||
+               (size_t)__builtin_popcountll(mask & ~pattern.mask) > max_distance) continue;
+
+            size_t distance = MyersDistance(&pattern, index->symbols + index->symbols_at[place], text_len);
+            if(distance > max_distance) continue;
+
+            FuzzyMatch match = {index->text + index->text_at[place], distance, text_len};
+            AddMatch(matches, &n_matches, max_matches, &match, len);
+        }
+    }
+
+    for(size_t i = 0; i < len; i++)
+    {
+        if(symbols[i] < FUZZY_DIRECT) index->peq[symbols[i]] = 0;
+    }
+
+    return n_matches;
+}
+
+
+int FuzzyCommand(int argc, char *argv[])
+{
+    if(argc != 2 && argc != 3)
+    {
+        fprintf(stderr, "Usage: fuzzy <data_base> <name> [distance]\n");
+        return EXIT_FAILURE;
+    }
+
+    size_t max_distance = (argc == 3) ? strtoul(argv[2], NULL, 10) : FUZZY_DISTANCE;
+
+    if(!IsFuzzyQuery(argv[1]))
+    {
+        fprintf(stderr, "A name is looked up by at most %zu characters.\n", FUZZY_MAX_LEN);
+        return EXIT_FAILURE;
+    }
+
+    Tree tree = ReadTree(argv[0]);
+    ASSERT(tree.root, return EXIT_FAILURE);
+
+    LabelIndex *index = LabelIndexCtor();
+
+    int status = index ? LabelIndexSync(index, &tree) : EXIT_FAILURE;
+
+    if(status == EXIT_SUCCESS)
+    {
+        FuzzyMatch matches[FUZZY_MAX_MATCHES] = {};
+        size_t     n_matches = FuzzyLookup(index, argv[1], max_distance, matches, FUZZY_MAX_MATCHES);
+
+        for(size_t i = 0; i < n_matches; i++) printf("%zu\t%s\n", matches[i].distance, matches[i].label);
+    }
+
+    LabelIndexDtor(index);
+    TreeDtor(&tree, tree.root);
+
+    return status;
+}
+
+
+const size_t BENCH_FUZZY_MAX_WORD = 20;
+
+// Capitalized Cyrillic words of 5 to 20 letters, rebuilt from their number when needed.
+static size_t BenchWord(size_t number, uint32_t *letters)
+{
+    unsigned seed = (unsigned)(number * 2654435761u + 1);
+    size_t   len  = 5 + (size_t)rand_r(&seed) % (BENCH_FUZZY_MAX_WORD - 4);
+
+    for(size_t i = 0; i < len; i++)
+    {
+        int letter = rand_r(&seed) % 33;
+
+        letters[i] = (letter == 32) ? 0x451 : 0x430 + (uint32_t)letter;
+    }
+
+    letters[0] = (letters[0] == 0x451) ? 0x401 : letters[0] - 0x20;
+
+    return len;
+}
+
+// Two bytes a letter.
+static void BenchEncode(const uint32_t *letters, size_t len, char *out)
+{
+    for(size_t i = 0; i < len; i++)
+    {
+        *out++ = (char)(0xC0 | (letters[i] >> 6  ));
+        *out++ = (char)(0x80 | (letters[i] & 0x3F));
+    }
+
+    *out = '\0';
+}
+
+// One or two random substitutions, insertions or deletions, in lower case.
+static size_t BenchTypo(uint32_t *letters, size_t len, unsigned *seed)
+{
+    letters[0] = FoldCodepoint(letters[0]);
+
+    size_t n_edits = 1 + (size_t)rand_r(seed) % 2;
+
+    for(size_t edit = 0; edit < n_edits; edit++)
+    {
+        size_t   at     = (size_t)rand_r(seed) % len;
+        uint32_t letter = 0x430 + (uint32_t)(rand_r(seed) % 32);
+
+        switch(rand_r(seed) % 3)
+        {
+            case 0:
+                letters[at] = letter;
+                break;
+            case 1:
+                memmove(&letters[at + 1], &letters[at], (len - at) * sizeof(uint32_t));
+                letters[at] = letter;
+                len++;
+                break;
+            default:
+                if(len < 2) break;
+                memmove(&letters[at], &letters[at + 1], (len - at - 1) * sizeof(uint32_t));
+                len--;
+                break;
+        }
+    }
+
+    return len;
+}
+
+int BenchFuzzyCommand(int argc, char *argv[])
+{
+    if(argc > 2)
+    {
+        fprintf(stderr, "Usage: bench-fuzzy [labels] [queries]\n");
+        return EXIT_FAILURE;
+    }
+
+    size_t n_labels  = (argc > 0) ? strtoul(argv[0], NULL, 10) : BENCH_FUZZY_LABELS;
+    size_t n_queries = (argc > 1) ? strtoul(argv[1], NULL, 10) : BENCH_FUZZY_QUERIES;
+    ASSERT(n_labels && n_queries, return EXIT_FAILURE);
+
+    const size_t word_bytes = 2 * BENCH_FUZZY_MAX_WORD + 1;
+
+    char        *text   = (char        *)calloc(n_labels, word_bytes);
+    const char **labels = (const char **)calloc(n_labels, sizeof(const char *));
+    LabelIndex  *index  = LabelIndexCtor();
+    ASSERT(text && labels && index, free(text); free(labels); LabelIndexDtor(index); return EXIT_FAILURE);
+
+    uint32_t letters[BENCH_FUZZY_MAX_WORD + 2] = {};
+
+    for(size_t i = 0; i < n_labels; i++)
+    {
+        labels[i] = text + i * word_bytes;
+        BenchEncode(letters, BenchWord(i, letters), text + i * word_bytes);
+    }
+
+    uint64_t start  = MetricsNow();
+    int      status = LabelIndexBuild(index, labels, n_labels);
+    double   build  = (double)(MetricsNow() - start) * 1e-9;
+
+    size_t   found    = 0;
+    uint64_t total_ns = 0;
+    uint64_t max_ns   = 0;
+    unsigned seed     = 1;
+
+    char query[2 * (BENCH_FUZZY_MAX_WORD + 2) + 1] = {};
+
+    for(size_t i = 0; i < n_queries && status == EXIT_SUCCESS; i++)
+    {
+        size_t number = (size_t)rand_r(&seed) % n_labels;
+
+        BenchEncode(letters, BenchTypo(letters, BenchWord(number, letters), &seed), query);
+
+        FuzzyMatch matches[FUZZY_MAX_MATCHES] = {};
+
+        uint64_t query_start = MetricsNow();
+        size_t   n_matches   = FuzzyLookup(index, query, FUZZY_DISTANCE, matches, FUZZY_MAX_MATCHES);
+        uint64_t query_ns    = MetricsNow() - query_start;
+
+        total_ns += query_ns;
+        if(query_ns > max_ns) max_ns = query_ns;
+
+        for(size_t j = 0; j < n_matches; j++)
+        {
+            if(strcmp(matches[j].label, labels[number]) == 0)
+            {
+                found++;
+                break;
+            }
+        }
+    }
+
+    if(status == EXIT_SUCCESS)
+    {
+        printf("%zu labels indexed in %.3f s\n"
+               "%zu queries with one or two typos: mean %.3f ms, max %.3f ms, original among the top %zu in %zu\n",
+               n_labels, build, n_queries, (double)total_ns * 1e-6 / (double)n_queries, (double)max_ns * 1e-6,
+               FUZZY_MAX_MATCHES, found);
+    }
+
+    LabelIndexDtor(index);
+    free(text);
+    free(labels);
+
+    return status;
+}
@@ -0,0 +1,183 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/history.h"
+#include "../include/replica.h"
+
+static Node *Acquire(Node *root)
+{
+    NodeHold(root);
+
+    return root;
+}
+
+static int GrowVersions(History *history)
+{
+    if(history->count < history->capacity) return EXIT_SUCCESS;
+
+    size_t capacity = history->capacity ? 2 * history->capacity : HISTORY_MIN_CAPACITY;
+
+    Version *versions_r = (Version *)realloc(history->versions, capacity * sizeof(Version));
+    ASSERT(versions_r, return EXIT_FAILURE);
+
+    history->versions = versions_r;
+    history->capacity = capacity;
+
+    return EXIT_SUCCESS;
+}
+
+History *HistoryCtor(Tree *tree, size_t max_versions)
+{
+    ASSERT(tree && tree->root && !tree->history, return NULL);
+    ASSERT(max_versions > 0, return NULL);
+
+    History *history = (History *)calloc(1, sizeof(History));
+    ASSERT(history, return NULL);
+
+    history->max_versions = max_versions;
+
+    if(GrowVersions(history) != EXIT_SUCCESS)
+    {
+        free(history);
+        return NULL;
+    }
+
+    history->versions[0] = {Acquire(tree->root), tree->size};
+    history->count       = 1;
+
+    tree->history = history;
+
+    return history;
+}
+
+// Nodes shared with the remaining versions only lose a reference, so this frees
+// exactly the nodes no other version, view or running session still reaches.
+static void ReleaseVersions(History *history, size_t from, size_t to)
+{
+    for(size_t i = from; i < to; i++) SubTreeRelease(history->versions[i].root);
+}
+
+void HistoryDtor(History *history)
+{
+    if(!history) return;
+
+    ReleaseVersions(history, 0, history->count);
+
+    free(history->versions);
+    free(history);
+}
+
+int HistoryCommit(Tree *tree)
+{
+    ASSERT(tree && tree->root && tree->history, return EXIT_FAILURE);
+
+    History *history = tree->history;
+
+    if(history->versions[history->current].root == tree->root) return EXIT_SUCCESS;
+
+    ReleaseVersions(history, history->current + 1, history->count);
+    history->count = history->current + 1;
+
+    if(GrowVersions(history) != EXIT_SUCCESS) return EXIT_FAILURE;
+
+    history->versions[history->count] = {Acquire(tree->root), tree->size};
+    history->current = history->count++;
+
+    if(history->count > history->max_versions)
+    {
+        size_t dropped = history->count - history->max_versions;
+
+        ReleaseVersions(history, 0, dropped);
+        memmove(history->versions, history->versions + dropped, history->max_versions * sizeof(Version));
+
+        history->first   += dropped;
+        history->count   -= dropped;
+        history->current -= dropped;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static void SwitchVersion(Tree *tree, size_t index)
+{
+    Node *old_root = tree->root;
+
+    tree->root = Acquire(tree->history->versions[index].root);
+    tree->size = tree->history->versions[index].size;
+
+    SubTreeRelease(old_root);
+
+    tree->history->current = index;
+}
+
+int HistoryUndo(Tree *tree)
+{
+    ASSERT(tree && tree->root && tree->history, return EXIT_FAILURE);
+
+    if(tree->history->current == 0) return EXIT_FAILURE;
+
+    SwitchVersion(tree, tree->history->current - 1);
+
+    if(tree->feed) FeedAppend(tree->feed, FEED_UNDO, tree->root->hash);
+
+    return EXIT_SUCCESS;
+}
+
+int HistoryRedo(Tree *tree)
+{
+    ASSERT(tree && tree->root && tree->history, return EXIT_FAILURE);
+
+    if(tree->history->current + 1 >= tree->history->count) return EXIT_FAILURE;
+
+    SwitchVersion(tree, tree->history->current + 1);
+
+    if(tree->feed) FeedAppend(tree->feed, FEED_REDO, tree->root->hash);
+
+    return EXIT_SUCCESS;
+}
+
+size_t HistoryCurrent(const Tree *const tree)
+{
+    ASSERT(tree && tree->history, return 0);
+
+    return tree->history->first + tree->history->current;
+}
+
+// The view keeps its version alive on its own, even after the history releases it,
+// but its labels may live in the tree arena: close it before destroying the tree.
+Tree HistoryOpen(Tree *const tree, size_t version)
+{
+    ASSERT(tree && tree->history, return {});
+
+    History *history = tree->history;
+
+    if(version < history->first || version - history->first >= history->count) return {};
+
+    Version *opened = &history->versions[version - history->first];
+
+    Tree view = {Acquire(opened->root), opened->size, NULL, NULL, true};
+
+    return view;
+}
+
+void HistoryClose(Tree *view)
+{
+    ASSERT(view && view->read_only, return);
+
+    SubTreeRelease(view->root);
+
+    *view = {};
+}
+
+void HistoryList(const Tree *const tree, FILE *out_file)
+{
+    ASSERT(tree && tree->history && out_file, return);
+
+    const History *history = tree->history;
+
+    for(size_t i = 0; i < history->count; i++)
+    {
+        fprintf(out_file, "%c %zu\t%zu nodes\n", (i == history->current) ? '*' : ' ',
+                          history->first + i, history->versions[i].size);
+    }
+}
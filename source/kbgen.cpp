@@ -0,0 +1,123 @@
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/tree.h"
+
+const size_t NO_CHILD = SIZE_MAX;
+
+struct KbNode
+{
+    Node *node;
+
+    size_t left;
+    size_t right;
+};
+
+// Preorder, so a parent is written before its children and the root is node 0.
+static size_t CollectNodes(Node *tree_node, KbNode *nodes, size_t *count)
+{
+    size_t index = (*count)++;
+
+    nodes[index].node  = tree_node;
+    nodes[index].left  = tree_node->left  ? CollectNodes(tree_node->left , nodes, count) : NO_CHILD;
+    nodes[index].right = tree_node->right ? CollectNodes(tree_node->right, nodes, count) : NO_CHILD;
+
+    return index;
+}
+
+// Octal escapes are always three digits, so they never swallow the next character.
+static void WriteLiteral(FILE *file, const char *str)
+{
+    fputc('"', file);
+
+    for(; *str; str++)
+    {
+        unsigned char ch = (unsigned char)*str;
+
+        if(ch == '"' || ch == '\\' || ch < 0x20) fprintf(file, "\\%03o", ch);
+        else                                     fputc(ch, file);
+    }
+
+    fputs("\\000\"", file);
+}
+
+static void WriteChild(FILE *file, size_t child)
+{
+    if(child == NO_CHILD) fputs("NULL", file);
+    else                  fprintf(file, "const_cast<Node *>(BUILTIN_NODES + %zu)", child);
+}
+
+static void WriteKnowledgeBase(FILE *file, const char *const data_base, const KbNode *nodes, size_t count)
+{
+    fprintf(file, "// Generated by kbgen.out from %s, do not edit.\n\n"
+                  "#include \"../include/builtin.h\"\n\n"
+                  "const char BUILTIN_STRINGS[] =\n", data_base);
+
+    for(size_t i = 0; i < count; i++)
+    {
+        fputs("    ", file);
+        WriteLiteral(file, nodes[i].node->data);
+        fputs((i + 1 == count) ? ";\n\n" : "\n", file);
+    }
+
+    fputs("const Node BUILTIN_NODES[] =\n{\n", file);
+
+    size_t offset = 0;
+
+    for(size_t i = 0; i < count; i++)
+    {
+        fprintf(file, "    {const_cast<char *>(BUILTIN_STRINGS + %zu), ", offset);
+        WriteChild(file, nodes[i].left);
+        fputs(", ", file);
+        WriteChild(file, nodes[i].right);
+        fprintf(file, ", 0, NODE_STATIC | NODE_SHARED_DATA, 0, 0x%016" PRIx64 "ull, 0, 0},\n", nodes[i].node->hash);
+
+        offset += strlen(nodes[i].node->data) + 1;
+    }
+
+    fputs("};\n\n"
+          "const size_t BUILTIN_NODES_COUNT = sizeof(BUILTIN_NODES) / sizeof(BUILTIN_NODES[0]);\n", file);
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc != 3)
+    {
+        fprintf(stderr, "Usage: kbgen.out <data_base> <output.cpp>\n");
+        return EXIT_FAILURE;
+    }
+
+    Tree tree = ReadTree(argv[1]);
+    if(!tree.root)
+    {
+        fprintf(stderr, "Can`t read \"%s\".\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    KbNode *nodes = (KbNode *)calloc(SubTreeSize(tree.root), sizeof(KbNode));
+    ASSERT(nodes, TreeDtor(&tree, tree.root); return EXIT_FAILURE);
+
+    size_t count = 0;
+    CollectNodes(tree.root, nodes, &count);
+
+    char tmp_name[MAX_STR_LEN] = {};
+    snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", argv[2]);
+
+    int status = EXIT_FAILURE;
+
+    FILE *file = fopen(tmp_name, "wb");
+    if(file)
+    {
+        WriteKnowledgeBase(file, argv[1], nodes, count);
+
+        if(fclose(file) == 0 && rename(tmp_name, argv[2]) == 0) status = EXIT_SUCCESS;
+    }
+
+    if(status != EXIT_SUCCESS) fprintf(stderr, "Can`t write \"%s\".\n", argv[2]);
+
+    free(nodes);
+    TreeDtor(&tree, tree.root);
+
+    return status;
+}
@@ -0,0 +1,752 @@
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "../include/loadgen.h"
+
+const int CONNECT_RETRIES = 500;
+const int CONNECT_WAIT_US = 10000;
+
+const size_t SHOWN_MISMATCHES = 5;
+
+const int REPLAY_WAIT_MS = 5000;  // for a recorded reply the server may never send
+
+struct Leaf
+{
+    Node *node;
+
+    size_t depth;
+    char  *path;
+};
+
+struct Player
+{
+    int fd;
+
+    const Leaf *target;
+    Node       *cursor;
+    size_t      step;
+    size_t      game;
+    bool        teach;
+
+    bool     waiting;
+    uint64_t sent_at;
+
+    size_t in_len;
+    char   in[MAX_STR_LEN];
+};
+
+struct LoadGen
+{
+    Tree tree;
+
+    size_t n_leaves;
+    Leaf  *leaves;
+
+    int teach_percent;
+
+    size_t started;
+    size_t capacity;
+
+    LoadReport report;
+};
+
+
+static int CompareDoubles(const void *lhs, const void *rhs)
+{
+    double a = *(const double *)lhs;
+    double b = *(const double *)rhs;
+
+    return (a > b) - (a < b);
+}
+
+static int AddLatency(LoadReport *report, size_t *capacity, double ns)
+{
+    if(report->n_latencies == *capacity)
+    {
+        size_t new_capacity = *capacity ? 2 * *capacity : 1024;
+
+        double *latencies = (double *)realloc(report->latencies, new_capacity * sizeof(double));
+        ASSERT(latencies, return EXIT_FAILURE);
+
+        report->latencies = latencies;
+        *capacity         = new_capacity;
+    }
+
+    report->latencies[report->n_latencies++] = ns;
+
+    return EXIT_SUCCESS;
+}
+
+
+pid_t SpawnServer(const char *const data_base, const char *const socket_path, const char *const record_path)
+{
+    ASSERT(data_base && socket_path, return -1);
+
+    pid_t pid = fork();
+
+    if(pid == 0)
+    {
+        if(record_path) execl("/proc/self/exe", "akinator.out", "serve", "--record", record_path, "--no-save",
+                                                                  data_base, socket_path, (char *)NULL);
+        else            execl("/proc/self/exe", "akinator.out", "serve", "--no-save", data_base, socket_path, (char *)NULL);
+
+        _exit(EXIT_FAILURE);
+    }
+
+    return pid;
+}
+
+int StopServer(pid_t server)
+{
+    if(server <= 0) return EXIT_FAILURE;
+
+    kill(server, SIGTERM);
+
+    int status = 0;
+    waitpid(server, &status, 0);
+
+    return (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// The server needs a moment to load the base before it listens, so connecting is retried.
+static int ConnectServer(const char *const socket_path)
+{
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+
+    ASSERT(strlen(socket_path) < sizeof(addr.sun_path), return -1);
+    strcpy(addr.sun_path, socket_path);
+
+    for(int i = 0; i < CONNECT_RETRIES; i++)
+    {
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        ASSERT(fd >= 0, return -1);
+
+        if(connect(fd, (sockaddr *)&addr, sizeof(addr)) == 0) return fd;
+
+        close(fd);
+        usleep(CONNECT_WAIT_US);
+    }
+
+    LOG("Can`t connect to \"%s\".\n", socket_path);
+
+    return -1;
+}
+
+long ProcessMemoryKb(pid_t pid, const char *const field)
+{
+    ASSERT(field, return -1);
+
+    char file_name[FMT_STR_LEN] = {};
+    sprintf(file_name, "/proc/%d/status", pid);
+
+    FILE *file = fopen(file_name, "rb");
+    if(!file) return -1;
+
+    char line[FMT_STR_LEN] = {};
+    long kb = -1;
+
+    size_t field_len = strlen(field);
+
+    while(fgets(line, sizeof(line), file))
+    {
+        if(strncmp(line, field, field_len) == 0 && line[field_len] == ':')
+        {
+            kb = strtol(line + field_len + 1, NULL, 10);
+            break;
+        }
+    }
+
+    fclose(file);
+
+    return kb;
+}
+
+static int SendAnswer(Player *player, const char *const answer)
+{
+    char line[MAX_DATA_LEN + 1] = {};
+    int  len = snprintf(line, sizeof(line), "%s\n", answer);
+
+    ASSERT(len > 0 && (size_t)len < sizeof(line), return EXIT_FAILURE);
+
+    player->sent_at = MetricsNow();
+    player->waiting = true;
+
+    return (send(player->fd, line, (size_t)len, MSG_NOSIGNAL) == len) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+int WriteLoadReport(LoadReport *report, FILE *file)
+{
+    ASSERT(report && file, return EXIT_FAILURE);
+
+    double p50 = 0, p90 = 0, p99 = 0, max = 0;
+
+    if(report->n_latencies)
+    {
+        qsort(report->latencies, report->n_latencies, sizeof(double), CompareDoubles);
+
+        p50 = report->latencies[report->n_latencies / 2];
+        p90 = report->latencies[report->n_latencies * 90 / 100];
+        p99 = report->latencies[report->n_latencies * 99 / 100];
+        max = report->latencies[report->n_latencies - 1];
+    }
+
+    fprintf(file, "players:              %zu\n"
+                  "games:                %zu\n"
+                  "guessed:              %zu\n"
+                  "learned:              %zu\n"
+                  "errors:               %zu\n"
+                  "mismatches:           %zu\n"
+                  "prompts:              %zu\n"
+                  "elapsed, s:           %.3f\n"
+                  "games per second:     %.1f\n"
+                  "p50 prompt, us:       %.1f\n"
+                  "p90 prompt, us:       %.1f\n"
+                  "p99 prompt, us:       %.1f\n"
+                  "max prompt, us:       %.1f\n"
+                  "server rss start, kB: %ld\n"
+                  "server rss end, kB:   %ld\n"
+                  "server rss peak, kB:  %ld\n"
+                  "rss growth, kB:       %ld\n",
+                  report->players, report->games, report->guessed, report->learned,
+                  report->errors, report->mismatches, report->n_latencies,
+                  report->elapsed_ns * 1e-9,
+                  (double)report->games / report->elapsed_ns * 1e9,
+                  p50 * 1e-3, p90 * 1e-3, p99 * 1e-3, max * 1e-3,
+                  report->rss_start_kb, report->rss_end_kb, report->hwm_kb,
+                  report->rss_end_kb - report->rss_start_kb);
+
+    return EXIT_SUCCESS;
+}
+
+
+static void CollectLeaves(LoadGen *gen, Node *tree_node, char *path, size_t depth)
+{
+    if(!tree_node->right)
+    {
+        Leaf *leaf = &gen->leaves[gen->n_leaves++];
+
+        leaf->node  = tree_node;
+        leaf->depth = depth;
+        leaf->path  = (char *)malloc(depth + 1);
+
+        if(leaf->path) memcpy(leaf->path, path, depth);
+        else           gen->n_leaves--;
+
+        return;
+    }
+
+    path[depth] = 0;
+    CollectLeaves(gen, tree_node->left , path, depth + 1);
+
+    path[depth] = 1;
+    CollectLeaves(gen, tree_node->right, path, depth + 1);
+}
+
+static void LoadGenDtor(LoadGen *gen)
+{
+    for(size_t i = 0; i < gen->n_leaves; i++) free(gen->leaves[i].path);
+
+    free(gen->leaves);
+    free(gen->report.latencies);
+
+    if(gen->tree.root) TreeDtor(&gen->tree, gen->tree.root);
+}
+
+static bool StartGame(LoadGen *gen, Player *player)
+{
+    if(gen->started == gen->report.games) return false;
+
+    player->game   = gen->started++;
+    player->target = &gen->leaves[(size_t)rand() % gen->n_leaves];
+    player->teach  = (rand() % 100 < gen->teach_percent);
+    player->cursor = gen->tree.root;
+    player->step   = 0;
+
+    return true;
+}
+
+// Questions learned by other players sit where a leaf used to be and have the old
+// leaf on their "no" side, so any question off the known path is answered "n".
+static const char *PlayerAnswer(LoadGen *gen, Player *player, const char *line, char *buf)
+{
+    if(strncmp(line, "QUESTION ", 9) == 0)
+    {
+        Node *cursor = player->cursor;
+
+        if(!cursor || player->step >= player->target->depth || strcmp(line + 9, cursor->data) != 0) return "n";
+
+        bool yes = player->target->path[player->step++];
+        player->cursor = yes ? cursor->right : cursor->left;
+
+        return yes ? "y" : "n";
+    }
+
+    if(strncmp(line, "GUESS ", 6) == 0)
+    {
+        return (!player->teach && strcmp(line + 6, player->target->node->data) == 0) ? "y" : "n";
+    }
+
+    if(strncmp(line, "ANSWER ", 7) == 0)
+    {
+        if(!player->teach) return player->target->node->data;
+
+        sprintf(buf, "loadgen answer %zu", player->game);
+        return buf;
+    }
+
+    if(strncmp(line, "PROPERTY ", 9) == 0)
+    {
+        sprintf(buf, "loadgen property %zu", player->game);
+        return buf;
+    }
+
+    gen->report.errors++;
+
+    return NULL;
+}
+
+static int HandlePlayerLine(LoadGen *gen, Player *player, const char *line)
+{
+    if(player->waiting)
+    {
+        player->waiting = false;
+
+        if(AddLatency(&gen->report, &gen->capacity, (double)(MetricsNow() - player->sent_at)) != EXIT_SUCCESS) return EXIT_FAILURE;
+    }
+
+    if(strncmp(line, "RESULT ", 7) == 0)
+    {
+        if(strcmp(line + 7, "GG") == 0) gen->report.guessed++;
+        else                            gen->report.learned++;
+
+        return StartGame(gen, player) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if(strncmp(line, "ERROR ", 6) == 0)
+    {
+        gen->report.errors++;
+
+        return EXIT_SUCCESS;
+    }
+
+    char buf[FMT_STR_LEN] = {};
+
+    const char *answer = PlayerAnswer(gen, player, line, buf);
+    if(!answer) return EXIT_FAILURE;
+
+    return SendAnswer(player, answer);
+}
+
+static int ReadPlayer(LoadGen *gen, Player *player)
+{
+    ssize_t got = recv(player->fd, player->in + player->in_len, sizeof(player->in) - player->in_len - 1, 0);
+    if(got <= 0) return EXIT_FAILURE;
+
+    player->in_len += (size_t)got;
+    player->in[player->in_len] = '\0';
+
+    char *line = player->in;
+    char *end  = NULL;
+
+    while((end = strchr(line, '\n')) != NULL)
+    {
+        *end = '\0';
+
+        if(HandlePlayerLine(gen, player, line) != EXIT_SUCCESS) return EXIT_FAILURE;
+
+        line = end + 1;
+    }
+
+    player->in_len -= (size_t)(line - player->in);
+    memmove(player->in, line, player->in_len);
+
+    return (player->in_len == sizeof(player->in) - 1) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int RunPlayers(LoadGen *gen, const char *const socket_path, pid_t server)
+{
+    size_t n_players = gen->report.players;
+
+    Player *players = (Player *)calloc(n_players, sizeof(Player));
+    pollfd *fds     = (pollfd *)calloc(n_players, sizeof(pollfd));
+    ASSERT(players && fds, free(players); free(fds); return EXIT_FAILURE);
+
+    size_t active = 0;
+
+    for(size_t i = 0; i < n_players; i++)
+    {
+        players[i].fd = -1;
+
+        if(!StartGame(gen, &players[i])) continue;
+
+        players[i].fd = ConnectServer(socket_path);
+        if(players[i].fd >= 0) active++;
+    }
+
+    gen->report.rss_start_kb = ProcessMemoryKb(server, "VmRSS");
+
+    while(active)
+    {
+        for(size_t i = 0; i < n_players; i++)
+        {
+            fds[i].fd     = players[i].fd;
+            fds[i].events = POLLIN;
+        }
+
+        if(poll(fds, n_players, -1) < 0) break;
+
+        for(size_t i = 0; i < n_players; i++)
+        {
+            if(!fds[i].revents) continue;
+
+            if(ReadPlayer(gen, &players[i]) != EXIT_SUCCESS)
+            {
+                close(players[i].fd);
+                players[i].fd = -1;
+
+                active--;
+            }
+        }
+    }
+
+    free(players);
+    free(fds);
+
+    return EXIT_SUCCESS;
+}
+
+static void SocketPath(char *socket_path)
+{
+    sprintf(socket_path, "/tmp/akinator-loadgen-%d.sock", getpid());
+}
+
+static FILE *OpenReport(const char *const report_path)
+{
+    if(!report_path) return stdout;
+
+    FILE *file = fopen(report_path, "wb");
+    ASSERT(file, return stdout);
+
+    return file;
+}
+
+int LoadgenCommand(int argc, char *argv[])
+{
+    LoadGen gen = {};
+
+    gen.report.players = LOADGEN_PLAYERS;
+    gen.report.games   = LOADGEN_GAMES;
+    gen.teach_percent  = LOADGEN_TEACH;
+
+    unsigned    seed        = 0;
+    const char *report_path = NULL;
+    const char *record_path = NULL;
+
+    for(; argc >= 2 && strncmp(argv[0], "--", 2) == 0; argc -= 2, argv += 2)
+    {
+        if     (strcmp(argv[0], "--players") == 0) gen.report.players = strtoul(argv[1], NULL, 10);
+        else if(strcmp(argv[0], "--games"  ) == 0) gen.report.games   = strtoul(argv[1], NULL, 10);
+        else if(strcmp(argv[0], "--teach"  ) == 0) gen.teach_percent  = atoi(argv[1]);
+        else if(strcmp(argv[0], "--seed"   ) == 0) seed               = (unsigned)strtoul(argv[1], NULL, 10);
+        else if(strcmp(argv[0], "--report" ) == 0) report_path        = argv[1];
+        else if(strcmp(argv[0], "--record" ) == 0) record_path        = argv[1];
+        else break;
+    }
+
+    if(argc != 1 || !gen.report.players)
+    {
+        fprintf(stderr, "Usage: loadgen [--players N] [--games N] [--teach percent] [--seed N] [--report file] [--record file] <data_base>\n");
+        return EXIT_FAILURE;
+    }
+
+    gen.tree = ReadTree(argv[0]);
+    ASSERT(gen.tree.root, return EXIT_FAILURE);
+
+    char *path  = (char *)calloc(gen.tree.size, sizeof(char));
+    gen.leaves  = (Leaf *)calloc(gen.tree.size, sizeof(Leaf));
+    ASSERT(path && gen.leaves, free(path); LoadGenDtor(&gen); return EXIT_FAILURE);
+
+    CollectLeaves(&gen, gen.tree.root, path, 0);
+    free(path);
+
+    char socket_path[FMT_STR_LEN] = {};
+    SocketPath(socket_path);
+
+    pid_t server = SpawnServer(argv[0], socket_path, record_path);
+    ASSERT(server > 0, LoadGenDtor(&gen); return EXIT_FAILURE);
+
+    srand(seed);
+
+    uint64_t start = MetricsNow();
+
+    RunPlayers(&gen, socket_path, server);
+
+    gen.report.elapsed_ns = (double)(MetricsNow() - start);
+    gen.report.games      = gen.report.guessed + gen.report.learned;
+    gen.report.rss_end_kb = ProcessMemoryKb(server, "VmRSS");
+    gen.report.hwm_kb     = ProcessMemoryKb(server, "VmHWM");
+
+    int status = StopServer(server);
+    if(status != EXIT_SUCCESS) fprintf(stderr, "Server did not exit cleanly\n");
+
+    FILE *report_file = OpenReport(report_path);
+
+    WriteLoadReport(&gen.report, report_file);
+
+    if(report_file != stdout) fclose(report_file);
+
+    LoadGenDtor(&gen);
+
+    return status;
+}
+
+
+struct ReplayConn
+{
+    int fd;
+
+    bool     waiting;
+    uint64_t sent_at;
+
+    size_t in_len;
+    char   in[MAX_STR_LEN];
+};
+
+struct Replay
+{
+    size_t      n_conns;
+    ReplayConn *conns;
+
+    LoadReport report;
+    size_t     capacity;
+};
+
+static ReplayConn *ReplayConnection(Replay *replay, size_t id)
+{
+    if(id >= replay->n_conns)
+    {
+        size_t n_conns = 2 * id + 1;
+
+        ReplayConn *conns = (ReplayConn *)realloc(replay->conns, n_conns * sizeof(ReplayConn));
+        ASSERT(conns, return NULL);
+
+        for(size_t i = replay->n_conns; i < n_conns; i++)
+        {
+            conns[i]    = {};
+            conns[i].fd = -1;
+        }
+
+        replay->conns   = conns;
+        replay->n_conns = n_conns;
+    }
+
+    return &replay->conns[id];
+}
+
+// A server that sends fewer lines than the recording has diverged from it, so a reply
+// that does not come in time stops the replay instead of waiting for it forever.
+static int ReplayOutput(Replay *replay, ReplayConn *conn, size_t id, const char *expected)
+{
+    ASSERT(conn->fd >= 0, return EXIT_FAILURE);
+
+    char *end = NULL;
+
+    while(!(end = (char *)memchr(conn->in, '\n', conn->in_len)))
+    {
+        pollfd fd = {conn->fd, POLLIN, 0};
+
+        ssize_t got = (conn->in_len < sizeof(conn->in) && poll(&fd, 1, REPLAY_WAIT_MS) > 0) ?
+                      recv(conn->fd, conn->in + conn->in_len, sizeof(conn->in) - conn->in_len, 0) : 0;
+
+        if(got <= 0)
+        {
+            fprintf(stderr, "client %zu: expected \"%s\", got no reply\n", id, expected);
+
+            replay->report.mismatches++;
+
+            return EXIT_FAILURE;
+        }
+
+        conn->in_len += (size_t)got;
+    }
+
+    *end = '\0';
+
+    const char *line = conn->in;
+
+    if(conn->waiting)
+    {
+        conn->waiting = false;
+
+        if(AddLatency(&replay->report, &replay->capacity, (double)(MetricsNow() - conn->sent_at)) != EXIT_SUCCESS) return EXIT_FAILURE;
+    }
+
+    if(strncmp(line, "RESULT GG", 9) == 0) replay->report.guessed++;
+    if(strncmp(line, "RESULT LEARNED", 14) == 0) replay->report.learned++;
+
+    if(strcmp(line, expected) != 0)
+    {
+        if(replay->report.mismatches < SHOWN_MISMATCHES)
+        {
+            fprintf(stderr, "client %zu: expected \"%s\", got \"%s\"\n", id, expected, line);
+        }
+
+        replay->report.mismatches++;
+    }
+
+    conn->in_len -= (size_t)(end + 1 - conn->in);
+    memmove(conn->in, end + 1, conn->in_len);
+
+    return EXIT_SUCCESS;
+}
+
+// Every recorded input is followed by the server's replies to it, so waiting for those
+// replies before the next input makes the server see the inputs in the recorded order.
+static int ReplayEvent(Replay *replay, const char *const socket_path, char *event)
+{
+    char   kind   = 0;
+    size_t id     = 0;
+    int    offset = 0;
+
+    if(sscanf(event, "%c %zu%n", &kind, &id, &offset) != 2) return EXIT_FAILURE;
+
+    char *text = event + offset;
+    if(*text == ' ') text++;
+
+    ReplayConn *conn = ReplayConnection(replay, id);
+    ASSERT(conn, return EXIT_FAILURE);
+
+    switch(kind)
+    {
+        case 'C':
+        {
+            conn->fd     = ConnectServer(socket_path);
+            conn->in_len = 0;
+            ASSERT(conn->fd >= 0, return EXIT_FAILURE);
+
+            replay->report.players++;
+
+            return EXIT_SUCCESS;
+        }
+        case 'I':
+        {
+            size_t len = strlen(text);
+            text[len] = '\n';
+
+            conn->sent_at = MetricsNow();
+            conn->waiting = true;
+
+            ssize_t sent = send(conn->fd, text, len + 1, MSG_NOSIGNAL);
+            text[len] = '\0';
+
+            return (sent == (ssize_t)(len + 1)) ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        case 'O':
+        {
+            return ReplayOutput(replay, conn, id, text);
+        }
+        case 'D':
+        {
+            if(conn->fd >= 0) close(conn->fd);
+
+            conn->fd = -1;
+
+            return EXIT_SUCCESS;
+        }
+        default:
+        {
+            return EXIT_FAILURE;
+        }
+    }
+}
+
+int ReplayCommand(int argc, char *argv[])
+{
+    const char *report_path = NULL;
+
+    if(argc >= 2 && strcmp(argv[0], "--report") == 0)
+    {
+        report_path = argv[1];
+
+        argc -= 2;
+        argv += 2;
+    }
+
+    if(argc != 2)
+    {
+        fprintf(stderr, "Usage: replay [--report file] <data_base> <record>\n");
+        return EXIT_FAILURE;
+    }
+
+    FILE *record = fopen(argv[1], "rb");
+    ASSERT(record, return EXIT_FAILURE);
+
+    char socket_path[FMT_STR_LEN] = {};
+    SocketPath(socket_path);
+
+    pid_t server = SpawnServer(argv[0], socket_path, NULL);
+    ASSERT(server > 0, fclose(record); return EXIT_FAILURE);
+
+    Replay replay = {};
+
+    char  *event     = NULL;
+    size_t event_cap = 0;
+    size_t events    = 0;
+    int    status    = EXIT_SUCCESS;
+
+    uint64_t start = MetricsNow();
+
+    for(ssize_t len = 0; (len = getline(&event, &event_cap, record)) > 0; events++)
+    {
+        if(event[len - 1] == '\n') event[len - 1] = '\0';
+
+        if(events == 1) replay.report.rss_start_kb = ProcessMemoryKb(server, "VmRSS");
+
+        status = ReplayEvent(&replay, socket_path, event);
+        if(status != EXIT_SUCCESS)
+        {
+            fprintf(stderr, "Replay stopped at event %zu: %s\n", events + 1, event);
+            break;
+        }
+    }
+
+    replay.report.elapsed_ns = (double)(MetricsNow() - start);
+    replay.report.games      = replay.report.guessed + replay.report.learned;
+    replay.report.rss_end_kb = ProcessMemoryKb(server, "VmRSS");
+    replay.report.hwm_kb     = ProcessMemoryKb(server, "VmHWM");
+
+    for(size_t i = 0; i < replay.n_conns; i++)
+    {
+        if(replay.conns[i].fd >= 0) close(replay.conns[i].fd);
+    }
+
+    if(StopServer(server) != EXIT_SUCCESS)
+    {
+        fprintf(stderr, "Server did not exit cleanly\n");
+        status = EXIT_FAILURE;
+    }
+
+    FILE *report_file = OpenReport(report_path);
+
+    WriteLoadReport(&replay.report, report_file);
+
+    if(report_file != stdout) fclose(report_file);
+
+    free(event);
+    free(replay.conns);
+    free(replay.report.latencies);
+
+    fclose(record);
+
+    if(status == EXIT_SUCCESS && replay.report.mismatches) status = EXIT_FAILURE;
+
+    return status;
+}
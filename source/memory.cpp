@@ -0,0 +1,108 @@
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/memory.h"
+#include "../include/tree.h"
+
+static int64_t BlockSize(void *ptr)
+{
+    return ptr ? (int64_t)malloc_usable_size(ptr) : 0;
+}
+
+void *MemCalloc(MemTag tag, const size_t count, const size_t size)
+{
+    void *ptr = calloc(count, size);
+
+    if(ptr) METRICS_MEMORY(tag, BlockSize(ptr));
+
+    return ptr;
+}
+
+// The old block is counted out first, so growing a buffer does not show up as both sizes at once.
+void *MemRealloc(MemTag tag, void *ptr, const size_t size)
+{
+    int64_t old_size = BlockSize(ptr);
+
+    void *ptr_r = realloc(ptr, size);
+    if(!ptr_r) return NULL;
+
+    if(ptr) METRICS_MEMORY(tag, -old_size);
+    METRICS_MEMORY(tag, BlockSize(ptr_r));
+
+    return ptr_r;
+}
+
+char *MemStrndup(MemTag tag, const char *const str, const size_t max_len)
+{
+    char *copy = strndup(str, max_len);
+
+    if(copy) METRICS_MEMORY(tag, BlockSize(copy));
+
+    return copy;
+}
+
+void MemFree(MemTag tag, void *ptr)
+{
+    if(!ptr) return;
+
+    METRICS_MEMORY(tag, -BlockSize(ptr));
+
+    free(ptr);
+}
+
+void MemAdopt(MemTag tag, void *ptr)
+{
+    if(ptr) METRICS_MEMORY(tag, BlockSize(ptr));
+}
+
+
+static void CollectLeafPaths(Tree *tree, Node *tree_node, size_t *paths, size_t max_paths)
+{
+    if(!tree_node || *paths >= max_paths) return;
+
+    if(!tree_node->left && !tree_node->right)
+    {
+        Stack path = TreePath(tree, tree_node->data);
+        if(path.data) (*paths)++;
+
+        StackDtor(&path);
+        return;
+    }
+
+    CollectLeafPaths(tree, tree_node->left , paths, max_paths);
+    CollectLeafPaths(tree, tree_node->right, paths, max_paths);
+}
+
+// Loads the base, looks up the path to the first leaves and dumps the tree once, then
+// reports what each subsystem held at its peak.
+int MemoryReportCommand(int argc, char *argv[])
+{
+    if(argc != 1 && argc != 2)
+    {
+        fprintf(stderr, "Usage: memory-report <data_base> [paths]\n");
+        return EXIT_FAILURE;
+    }
+
+    size_t max_paths = (argc == 2) ? strtoul(argv[1], NULL, 10) : MEMORY_REPORT_PATHS;
+
+    Tree tree = ReadTree(argv[0]);
+    ASSERT(tree.root, return EXIT_FAILURE);
+
+    size_t paths = 0;
+    CollectLeafPaths(&tree, tree.root, &paths, max_paths);
+
+    FILE *dump_file = fopen("/dev/null", "wb");
+    if(dump_file)
+    {
+        TreeTextDump(&tree, dump_file);
+        fclose(dump_file);
+    }
+
+    printf("%zu nodes, %zu leaf paths.\n", tree.size, paths);
+    MetricsMemoryWrite(stdout);
+
+    TreeDtor(&tree, tree.root);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,1173 @@
+#include <ctype.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../include/merge.h"
+
+struct Change
+{
+    size_t leaf;
+    size_t snapshot;
+
+    Node *subtree;
+};
+
+struct LeafRef
+{
+    Node  *node;
+    size_t index;
+};
+
+struct Group
+{
+    size_t leaf;
+
+    size_t begin;
+    size_t end;
+
+    Node *merged;
+
+    size_t conflicts;
+    char  *report;
+    size_t report_size;
+};
+
+struct MergeJob
+{
+    Tree *base;
+
+    char *const *snapshots;
+    size_t       n_snapshots;
+    size_t       next_snapshot;
+
+    size_t   n_leaves;
+    Node   **leaves;
+    LeafRef *leaf_refs;
+
+    size_t  n_groups;
+    size_t  next_group;
+    Group  *groups;
+    Change *changes;
+};
+
+struct Worker
+{
+    MergeJob *job;
+
+    pthread_t thread;
+
+    size_t  n_changes;
+    size_t  capacity;
+    Change *changes;
+
+    size_t buffer_size;
+    char  *buffer;
+
+    MergeStats stats;
+};
+
+struct SnapshotReader
+{
+    char *pos;
+
+    bool bad;
+};
+
+struct MergeContext
+{
+    Group *group;
+    FILE  *report;
+
+    size_t path_size;
+    char  *path;
+};
+
+
+// The walks below keep their own stacks, since a base or a snapshot can be as deep as it is large.
+static void FreeSubTree(Node *tree_node)
+{
+    NodeStack stack = {};
+
+    if(tree_node) ASSERT(NodeStackPush(&stack, tree_node) == EXIT_SUCCESS, return);
+
+    while(stack.size)
+    {
+        Node *node = stack.frames[--stack.size].node;
+
+        if(node->left ) ASSERT(NodeStackPush(&stack, node->left ) == EXIT_SUCCESS, break);
+        if(node->right) ASSERT(NodeStackPush(&stack, node->right) == EXIT_SUCCESS, break);
+
+        NodeDtor(node);
+    }
+
+    NodeStackDtor(&stack);
+}
+
+static bool IsQuestion(const Node *const node)
+{
+    return node->left && node->right;
+}
+
+// Leaves go in preorder, the order PrintConflicts finds them in.
+static int CollectLeaves(MergeJob *job, Node *tree_node)
+{
+    NodeStack stack  = {};
+    int       status = NodeStackPush(&stack, tree_node);
+
+    while(status == EXIT_SUCCESS && stack.size)
+    {
+        Node *node = stack.frames[--stack.size].node;
+
+        if(!node->right)
+        {
+            job->leaves[job->n_leaves++] = node;
+            continue;
+        }
+
+        status = NodeStackPush(&stack, node->right);
+        if(status == EXIT_SUCCESS) status = NodeStackPush(&stack, node->left);
+    }
+
+    NodeStackDtor(&stack);
+
+    return status;
+}
+
+static int CompareLeafRefs(const void *lhs, const void *rhs)
+{
+    const Node *a = ((const LeafRef *)lhs)->node;
+    const Node *b = ((const LeafRef *)rhs)->node;
+
+    return (a > b) - (a < b);
+}
+
+static size_t LeafIndex(const MergeJob *job, Node *const leaf)
+{
+    LeafRef key = {leaf, 0};
+
+    const LeafRef *ref = (const LeafRef *)bsearch(&key, job->leaf_refs, job->n_leaves, sizeof(LeafRef), CompareLeafRefs);
+
+    return ref ? ref->index : job->n_leaves;
+}
+
+
+static int AddChange(Worker *worker, size_t leaf, size_t snapshot, Node *subtree)
+{
+    if(worker->n_changes == worker->capacity)
+    {
+        size_t capacity = worker->capacity ? 2 * worker->capacity : 64;
+
+        Change *changes = (Change *)realloc(worker->changes, capacity * sizeof(Change));
+        ASSERT(changes, return EXIT_FAILURE);
+
+        worker->changes  = changes;
+        worker->capacity = capacity;
+    }
+
+    worker->changes[worker->n_changes++] = {leaf, snapshot, subtree};
+
+    return EXIT_SUCCESS;
+}
+
+static void SkipSpaces(SnapshotReader *reader)
+{
+    while(isspace((unsigned char)*reader->pos)) reader->pos++;
+}
+
+// Reads "<label>" with an optional "#hash" right after the opening bracket; the label is
+// terminated in place, the buffer belongs to the worker.
+static char *ReadHeader(SnapshotReader *reader, uint64_t *hash, bool *has_hash)
+{
+    SkipSpaces(reader);
+
+    if(*reader->pos != '<') { reader->bad = true; return NULL; }
+
+    char *label = reader->pos + 1;
+    char *end   = strchr(label, '>');
+
+    if(!end) { reader->bad = true; return NULL; }
+
+    *end        = '\0';
+    reader->pos = end + 1;
+
+    *has_hash = false;
+
+    if(*reader->pos == '#')
+    {
+        char *hash_end = NULL;
+        *hash = strtoull(reader->pos + 1, &hash_end, 16);
+
+        *has_hash   = (hash_end != reader->pos + 1);
+        reader->pos = hash_end;
+    }
+
+    return label;
+}
+
+static void SkipSubTree(SnapshotReader *reader)
+{
+    size_t depth = 1;
+
+    while((reader->pos = strpbrk(reader->pos, "<()")) != NULL)
+    {
+        switch(*reader->pos)
+        {
+            case '<':
+            {
+                reader->pos = strchr(reader->pos, '>');
+                if(!reader->pos) { reader->bad = true; return; }
+
+                break;
+            }
+            case '(':
+            {
+                depth++;
+                break;
+            }
+            case ')':
+            {
+                if(--depth == 0) { reader->pos++; return; }
+                break;
+            }
+            default:
+            {
+                break;
+            }
+        }
+
+        reader->pos++;
+    }
+
+    reader->bad = true;
+}
+
+static bool ReadClose(SnapshotReader *reader)
+{
+    SkipSpaces(reader);
+
+    if(*reader->pos != ')') { reader->bad = true; return false; }
+
+    reader->pos++;
+
+    return true;
+}
+
+// A node is linked to its parent as soon as its header is read, so a bad snapshot frees
+// everything parsed so far through the root. State counts the children read.
+static Node *ParseSubTree(SnapshotReader *reader)
+{
+    NodeStack stack = {};
+    Node     *root  = NULL;
+
+    do
+    {
+        SkipSpaces(reader);
+
+        Node *node = NULL;
+
+        if(*reader->pos == '(')
+        {
+            reader->pos++;
+
+            uint64_t hash     = 0;
+            bool     has_hash = false;
+
+            char *label = ReadHeader(reader, &hash, &has_hash);
+            if(!label) break;
+
+            node = NodeCtor(label);
+            if(!node) { reader->bad = true; break; }
+        }
+        else if(*reader->pos == '*')
+        {
+            reader->pos++;
+        }
+        else
+        {
+            reader->bad = true;
+            break;
+        }
+
+        if(stack.size)
+        {
+            NodeFrame *parent = &stack.frames[stack.size - 1];
+
+            if(parent->state++ == 0) parent->node->left  = node;
+            else                     parent->node->right = node;
+        }
+        else
+        {
+            root = node;
+        }
+
+        if(node && NodeStackPush(&stack, node) != EXIT_SUCCESS) { reader->bad = true; break; }
+
+        while(stack.size && stack.frames[stack.size - 1].state == 2 && ReadClose(reader))
+        {
+            NodeRehash(stack.frames[--stack.size].node);
+        }
+    }
+    while(stack.size && !reader->bad);
+
+    NodeStackDtor(&stack);
+
+    if(reader->bad)
+    {
+        FreeSubTree(root);
+        return NULL;
+    }
+
+    return root;
+}
+
+// Reads the snapshot subtree in place of base_node. Returns true for a question with the
+// base label, whose children the caller walks next before reading its closing bracket.
+static bool WalkNode(Worker *worker, SnapshotReader *reader, Node *const base_node, size_t snapshot)
+{
+    SkipSpaces(reader);
+
+    if(*reader->pos == '*')
+    {
+        reader->pos++;
+
+        if(base_node) worker->stats.unsupported++;
+        return false;
+    }
+
+    if(*reader->pos != '(') { reader->bad = true; return false; }
+
+    reader->pos++;
+
+    uint64_t hash     = 0;
+    bool     has_hash = false;
+
+    char *label = ReadHeader(reader, &hash, &has_hash);
+    if(!label) return false;
+
+    if(!base_node)
+    {
+        worker->stats.unsupported++;
+        SkipSubTree(reader);
+        return false;
+    }
+
+    if(has_hash && hash == base_node->hash)
+    {
+        SkipSubTree(reader);
+        return false;
+    }
+
+    if(!base_node->right)
+    {
+        Node *left  = ParseSubTree(reader);
+        Node *right = ParseSubTree(reader);
+
+        if(reader->bad || !ReadClose(reader) || (!left && !right && strcmp(label, base_node->data) == 0))
+        {
+            FreeSubTree(left );
+            FreeSubTree(right);
+            return false;
+        }
+
+        Node *subtree = NodeCtor(label, left, right);
+        if(!subtree)
+        {
+            FreeSubTree(left );
+            FreeSubTree(right);
+
+            reader->bad = true;
+        }
+        else if(AddChange(worker, LeafIndex(worker->job, base_node), snapshot, subtree) != EXIT_SUCCESS)
+        {
+            FreeSubTree(subtree);
+
+            reader->bad = true;
+        }
+
+        return false;
+    }
+
+    if(strcmp(label, base_node->data) != 0)
+    {
+        worker->stats.unsupported++;
+        SkipSubTree(reader);
+        return false;
+    }
+
+    return true;
+}
+
+// Walks a snapshot together with the base: subtrees with the base hash are skipped
+// unparsed, and only the base leaves that were split in the snapshot are built.
+static void WalkSnapshot(Worker *worker, SnapshotReader *reader, Node *const base_node, size_t snapshot)
+{
+    NodeStack stack = {};
+    Node     *next  = base_node;
+    bool      walk  = true;
+
+    while(walk && !reader->bad)
+    {
+        if(WalkNode(worker, reader, next, snapshot) && NodeStackPush(&stack, next) != EXIT_SUCCESS) reader->bad = true;
+
+        walk = false;
+
+        while(!walk && !reader->bad && stack.size)
+        {
+            NodeFrame *frame = &stack.frames[stack.size - 1];
+
+            if(frame->state == 2)
+            {
+                ReadClose(reader);
+                stack.size--;
+                continue;
+            }
+
+            next = (++frame->state == 1) ? frame->node->left : frame->node->right;
+            walk = true;
+        }
+    }
+
+    NodeStackDtor(&stack);
+}
+
+static bool ReadSnapshot(Worker *worker, const char *const file_name)
+{
+    struct stat file_info = {};
+    if(stat(file_name, &file_info) != 0) return false;
+
+    size_t size = (size_t)file_info.st_size;
+
+    if(size + 1 > worker->buffer_size)
+    {
+        char *buffer = (char *)realloc(worker->buffer, size + 1);
+        if(!buffer) return false;
+
+        worker->buffer      = buffer;
+        worker->buffer_size = size + 1;
+    }
+
+    FILE *file = fopen(file_name, "rb");
+    if(!file) return false;
+
+    size_t got = fread(worker->buffer, sizeof(char), size, file);
+    fclose(file);
+
+    worker->buffer[got] = '\0';
+
+    return got == size;
+}
+
+static void *ExtractChanges(void *arg)
+{
+    Worker   *worker = (Worker *)arg;
+    MergeJob *job    = worker->job;
+
+    while(true)
+    {
+        size_t snapshot = __atomic_fetch_add(&job->next_snapshot, 1, __ATOMIC_RELAXED);
+        if(snapshot >= job->n_snapshots) break;
+
+        size_t n_changes = worker->n_changes;
+
+        SnapshotReader reader = {NULL, false};
+
+        if(ReadSnapshot(worker, job->snapshots[snapshot]))
+        {
+            reader.pos = worker->buffer;
+            WalkSnapshot(worker, &reader, job->base->root, snapshot);
+        }
+        else
+        {
+            reader.bad = true;
+        }
+
+        if(reader.bad)
+        {
+            LOG("Can`t merge snapshot \"%s\".\n", job->snapshots[snapshot]);
+
+            for(size_t i = n_changes; i < worker->n_changes; i++) FreeSubTree(worker->changes[i].subtree);
+
+            worker->n_changes = n_changes;
+            worker->stats.failed++;
+        }
+
+        worker->stats.snapshots++;
+    }
+
+    return NULL;
+}
+
+
+static int CompareChanges(const void *lhs, const void *rhs)
+{
+    const Change *a = (const Change *)lhs;
+    const Change *b = (const Change *)rhs;
+
+    if(a->leaf != b->leaf) return (a->leaf > b->leaf) - (a->leaf < b->leaf);
+
+    return (a->snapshot > b->snapshot) - (a->snapshot < b->snapshot);
+}
+
+static int CompareLabels(const void *lhs, const void *rhs)
+{
+    return strcmp(*(const char *const *)lhs, *(const char *const *)rhs);
+}
+
+static int CompareNodeLabels(const void *lhs, const void *rhs)
+{
+    return strcmp((*(Node *const *)lhs)->data, (*(Node *const *)rhs)->data);
+}
+
+static const char *Origin(const Node *node)
+{
+    while(IsQuestion(node)) node = node->left;
+
+    return node->data;
+}
+
+static int PushPath(MergeContext *ctx, size_t depth, char direction)
+{
+    if(depth + 1 >= ctx->path_size)
+    {
+        size_t path_size = 2 * (depth + 1);
+
+        char *path = (char *)realloc(ctx->path, path_size);
+        ASSERT(path, return EXIT_FAILURE);
+
+        ctx->path      = path;
+        ctx->path_size = path_size;
+    }
+
+    ctx->path[depth] = direction;
+
+    return EXIT_SUCCESS;
+}
+
+static void ReportConflict(MergeContext *ctx, size_t depth, Node **candidates, size_t n_candidates,
+                           size_t winner, size_t winner_votes)
+{
+    if(!ctx->report) ctx->report = open_memstream(&ctx->group->report, &ctx->group->report_size);
+    if(!ctx->report) return;
+
+    ctx->group->conflicts++;
+
+    fprintf(ctx->report, "%.*s\t%s\t%zu", (int)depth, ctx->path, candidates[winner]->data, winner_votes);
+
+    for(size_t begin = 0, end = 0; begin < n_candidates; begin = end)
+    {
+        for(end = begin + 1; end < n_candidates && strcmp(candidates[begin]->data, candidates[end]->data) == 0; end++);
+
+        if(begin != winner) fprintf(ctx->report, "\t%s\t%zu", candidates[begin]->data, end - begin);
+    }
+
+    fputc('\n', ctx->report);
+}
+
+struct MergeScratch
+{
+    const char **origins;
+    Node       **live;
+    Node       **lefts;
+    Node       **rights;
+};
+
+// A depth of the merge: the winner of its candidates and the merged left children while
+// the right ones are merged.
+struct MergeFrame
+{
+    MergeScratch scratch;
+
+    const char *label;       // of the winner
+    size_t      n_children;  // of the winner candidates that are questions
+
+    Node *left;
+    int   state;  // 1 while the left children are merged, 2 for the right ones
+};
+
+struct MergeStack
+{
+    MergeFrame *frames;
+
+    size_t size;
+    size_t capacity;
+};
+
+static size_t LiveCandidates(MergeScratch *scratch, Node **candidates, size_t n_candidates)
+{
+    size_t n_origins = 0;
+
+    for(size_t i = 0; i < n_candidates; i++)
+    {
+        if(IsQuestion(candidates[i])) scratch->origins[n_origins++] = Origin(candidates[i]);
+    }
+
+    qsort(scratch->origins, n_origins, sizeof(char *), CompareLabels);
+
+    size_t n_live = 0;
+
+    for(size_t i = 0; i < n_candidates; i++)
+    {
+        if(!IsQuestion(candidates[i]) &&
+           bsearch(&candidates[i]->data, scratch->origins, n_origins, sizeof(char *), CompareLabels)) continue;
+
+        scratch->live[n_live++] = candidates[i];
+    }
+
+    qsort(scratch->live, n_live, sizeof(Node *), CompareNodeLabels);
+
+    return n_live;
+}
+
+static void MergeScratchDtor(MergeScratch *scratch)
+{
+    free(scratch->origins);
+    free(scratch->live);
+    free(scratch->lefts);
+    free(scratch->rights);
+
+    *scratch = {};
+}
+
+// A leaf that is the origin of another candidate's split is an older version of it, not a
+// competing answer; the remaining candidates vote by label, ties go to the smallest label.
+// Returns false if there is no winner.
+static bool MergeVote(MergeContext *ctx, MergeFrame *frame, Node **candidates, size_t n_candidates, size_t depth)
+{
+    MergeScratch *scratch = &frame->scratch;
+
+    *scratch = {(const char **)calloc(n_candidates, sizeof(char *)),
+                (Node       **)calloc(n_candidates, sizeof(Node *)),
+                (Node       **)calloc(n_candidates, sizeof(Node *)),
+                (Node       **)calloc(n_candidates, sizeof(Node *))};
+
+    if(!scratch->origins || !scratch->live || !scratch->lefts || !scratch->rights) return false;
+
+    size_t n_live = LiveCandidates(scratch, candidates, n_candidates);
+
+    size_t winner = 0;
+    size_t votes  = 0;
+    size_t runs   = 0;
+
+    for(size_t begin = 0, end = 0; begin < n_live; begin = end, runs++)
+    {
+        for(end = begin + 1; end < n_live && strcmp(scratch->live[begin]->data, scratch->live[end]->data) == 0; end++);
+
+        if(end - begin > votes)
+        {
+            winner = begin;
+            votes  = end - begin;
+        }
+    }
+
+    if(runs > 1) ReportConflict(ctx, depth, scratch->live, n_live, winner, votes);
+
+    if(!votes) return false;
+
+    frame->label = scratch->live[winner]->data;
+
+    for(size_t i = winner; i < winner + votes; i++)
+    {
+        Node *candidate = scratch->live[i];
+        if(!IsQuestion(candidate)) continue;
+
+        scratch->lefts [frame->n_children] = candidate->left;
+        scratch->rights[frame->n_children] = candidate->right;
+        frame->n_children++;
+    }
+
+    return true;
+}
+
+static int MergeStackPush(MergeStack *stack, const MergeFrame *frame)
+{
+    if(stack->size == stack->capacity)
+    {
+        size_t capacity = stack->capacity ? 2 * stack->capacity : 64;
+
+        MergeFrame *frames = (MergeFrame *)realloc(stack->frames, capacity * sizeof(MergeFrame));
+        ASSERT(frames, return EXIT_FAILURE);
+
+        stack->frames   = frames;
+        stack->capacity = capacity;
+    }
+
+    stack->frames[stack->size++] = *frame;
+
+    return EXIT_SUCCESS;
+}
+
+// The children of the winners are merged the same way a depth further down, left ones first;
+// a frame stays on the stack until both are merged. Each depth is its frame index.
+static Node *MergeCandidates(MergeContext *ctx, Node **candidates, size_t n_candidates)
+{
+    MergeStack stack  = {};
+    Node      *merged = NULL;
+    bool       open   = true;
+
+    while(true)
+    {
+        if(open)
+        {
+            MergeFrame frame = {};
+            size_t     depth = stack.size;
+
+            open   = false;
+            merged = NULL;
+
+            if(MergeVote(ctx, &frame, candidates, n_candidates, depth))
+            {
+                frame.state = 1;
+
+                if(frame.n_children && PushPath(ctx, depth, 'n') == EXIT_SUCCESS &&
+                   MergeStackPush(&stack, &frame) == EXIT_SUCCESS)
+                {
+                    candidates   = frame.scratch.lefts;
+                    n_candidates = frame.n_children;
+                    open         = true;
+                    continue;
+                }
+
+                if(!frame.n_children) merged = NodeCtor(frame.label);
+            }
+
+            MergeScratchDtor(&frame.scratch);
+        }
+
+        if(!stack.size) break;
+
+        MergeFrame *frame = &stack.frames[stack.size - 1];
+
+        if(frame->state == 1)
+        {
+            frame->left = merged;
+
+            if(PushPath(ctx, stack.size - 1, 'y') == EXIT_SUCCESS)
+            {
+                frame->state = 2;
+
+                candidates   = frame->scratch.rights;
+                n_candidates = frame->n_children;
+                open         = true;
+                continue;
+            }
+
+            FreeSubTree(frame->left);
+            merged = NULL;
+        }
+        else
+        {
+            Node *right = merged;
+
+            merged = NodeCtor(frame->label, frame->left, right);
+            if(!merged)
+            {
+                FreeSubTree(frame->left);
+                FreeSubTree(right);
+            }
+        }
+
+        MergeScratchDtor(&frame->scratch);
+        stack.size--;
+    }
+
+    free(stack.frames);
+
+    return merged;
+}
+
+static void *MergeGroups(void *arg)
+{
+    Worker   *worker = (Worker *)arg;
+    MergeJob *job    = worker->job;
+
+    Node **candidates = NULL;
+    size_t capacity   = 0;
+
+    MergeContext ctx = {};
+
+    while(true)
+    {
+        size_t index = __atomic_fetch_add(&job->next_group, 1, __ATOMIC_RELAXED);
+        if(index >= job->n_groups) break;
+
+        Group *group = &job->groups[index];
+        size_t n_candidates = group->end - group->begin;
+
+        if(n_candidates > capacity)
+        {
+            Node **candidates_r = (Node **)realloc(candidates, n_candidates * sizeof(Node *));
+            ASSERT(candidates_r, break);
+
+            candidates = candidates_r;
+            capacity   = n_candidates;
+        }
+
+        for(size_t i = 0; i < n_candidates; i++) candidates[i] = job->changes[group->begin + i].subtree;
+
+        ctx.group  = group;
+        ctx.report = NULL;
+
+        group->merged = MergeCandidates(&ctx, candidates, n_candidates);
+
+        if(ctx.report) fclose(ctx.report);
+
+        worker->stats.conflicts += group->conflicts;
+    }
+
+    free(candidates);
+    free(ctx.path);
+
+    return NULL;
+}
+
+
+static int RunWorkers(Worker *workers, size_t n_threads, void *(*run)(void *))
+{
+    size_t started = 0;
+
+    for(; started < n_threads; started++)
+    {
+        if(pthread_create(&workers[started].thread, NULL, run, &workers[started]) != 0) break;
+    }
+
+    for(size_t i = 0; i < started; i++) pthread_join(workers[i].thread, NULL);
+
+    // Whatever is left undone is picked up by this thread.
+    if(started == 0) run(&workers[0]);
+
+    return EXIT_SUCCESS;
+}
+
+static int GroupChanges(MergeJob *job, Worker *workers, size_t n_threads, MergeStats *stats)
+{
+    size_t n_changes = 0;
+    for(size_t i = 0; i < n_threads; i++) n_changes += workers[i].n_changes;
+
+    job->changes = (Change *)calloc(n_changes + 1, sizeof(Change));
+    job->groups  = (Group  *)calloc(n_changes + 1, sizeof(Group ));
+    ASSERT(job->changes && job->groups, return EXIT_FAILURE);
+
+    n_changes = 0;
+
+    for(size_t i = 0; i < n_threads; i++)
+    {
+        if(workers[i].n_changes) memcpy(job->changes + n_changes, workers[i].changes, workers[i].n_changes * sizeof(Change));
+        n_changes += workers[i].n_changes;
+    }
+
+    qsort(job->changes, n_changes, sizeof(Change), CompareChanges);
+
+    for(size_t begin = 0, end = 0; begin < n_changes; begin = end)
+    {
+        for(end = begin + 1; end < n_changes && job->changes[end].leaf == job->changes[begin].leaf; end++);
+
+        job->groups[job->n_groups++] = {job->changes[begin].leaf, begin, end, NULL, 0, NULL, 0};
+    }
+
+    stats->changes = n_changes;
+    stats->leaves  = job->n_groups;
+
+    return EXIT_SUCCESS;
+}
+
+// Goes through the base leaves in the order CollectLeaves numbered them, printing the
+// conflicts of each group with the path to its leaf in front. Each depth is its frame index.
+static void PrintConflicts(MergeJob *job, Node *tree_node, char *path, FILE *conflicts_file)
+{
+    NodeStack stack = {};
+
+    size_t leaf  = 0;
+    size_t group = 0;
+
+    ASSERT(NodeStackPush(&stack, tree_node) == EXIT_SUCCESS, return);
+
+    while(stack.size && group < job->n_groups)
+    {
+        NodeFrame *frame = &stack.frames[stack.size - 1];
+        Node      *node  = frame->node;
+        size_t     depth = stack.size - 1;
+
+        if(!node->right)
+        {
+            Group *cur = &job->groups[group];
+
+            if(cur->leaf == leaf++)
+            {
+                group++;
+
+                for(char *line = cur->report; line && *line; )
+                {
+                    char *end = strchr(line, '\n');
+                    if(!end) break;
+
+                    fprintf(conflicts_file, "%.*s%.*s\n", (int)depth, path, (int)(end - line), line);
+                    line = end + 1;
+                }
+            }
+
+            stack.size--;
+            continue;
+        }
+
+        if(frame->state == 2)
+        {
+            stack.size--;
+            continue;
+        }
+
+        path[depth] = (++frame->state == 1) ? 'n' : 'y';
+
+        ASSERT(NodeStackPush(&stack, frame->state == 1 ? node->left : node->right) == EXIT_SUCCESS, break);
+    }
+
+    NodeStackDtor(&stack);
+}
+
+static void ApplyGroups(MergeJob *job)
+{
+    for(size_t i = 0; i < job->n_groups; i++)
+    {
+        Group *group  = &job->groups[i];
+        Node  *merged = group->merged;
+
+        if(!merged || group->leaf >= job->n_leaves) continue;
+
+        Node *leaf = job->leaves[group->leaf];
+
+        NodeRelabel(leaf, merged->data);
+
+        leaf->left  = merged->left;
+        leaf->right = merged->right;
+
+        job->base->size += SubTreeSize(merged) - 1;
+
+        merged->left  = NULL;
+        merged->right = NULL;
+
+        NodeDtor(merged);
+        group->merged = NULL;
+    }
+
+    TreeRehash(job->base);
+}
+
+static void MergeJobDtor(MergeJob *job, Worker *workers, size_t n_threads)
+{
+    for(size_t i = 0; i < n_threads; i++)
+    {
+        free(workers[i].buffer);
+        free(workers[i].changes);
+    }
+
+    if(job->changes)
+    {
+        for(size_t i = 0; i < job->n_groups; i++)
+        {
+            for(size_t j = job->groups[i].begin; j < job->groups[i].end; j++) FreeSubTree(job->changes[j].subtree);
+
+            FreeSubTree(job->groups[i].merged);
+            free(job->groups[i].report);
+        }
+    }
+    else
+    {
+        for(size_t i = 0; i < n_threads; i++)
+        {
+            for(size_t j = 0; j < workers[i].n_changes; j++) FreeSubTree(workers[i].changes[j].subtree);
+        }
+    }
+
+    free(job->changes);
+    free(job->groups);
+    free(job->leaves);
+    free(job->leaf_refs);
+}
+
+int TreeMerge(Tree *base, char *const *snapshots, size_t n_snapshots, size_t n_threads,
+              FILE *conflicts_file, MergeStats *stats)
+{
+    TREE_VERIFICATION(base, EXIT_FAILURE);
+
+    ASSERT(snapshots || n_snapshots == 0, return EXIT_FAILURE);
+    ASSERT(conflicts_file, return EXIT_FAILURE);
+
+    if(n_threads == 0)                n_threads = 1;
+    if(n_threads > MERGE_MAX_THREADS) n_threads = MERGE_MAX_THREADS;
+
+    MergeJob job = {};
+
+    job.base        = base;
+    job.snapshots   = snapshots;
+    job.n_snapshots = n_snapshots;
+
+    job.leaves    = (Node   **)calloc(base->size, sizeof(Node *));
+    job.leaf_refs = (LeafRef *)calloc(base->size, sizeof(LeafRef));
+    ASSERT(job.leaves && job.leaf_refs, free(job.leaves); free(job.leaf_refs); return EXIT_FAILURE);
+
+    ASSERT(CollectLeaves(&job, base->root) == EXIT_SUCCESS, free(job.leaves); free(job.leaf_refs); return EXIT_FAILURE);
+
+    for(size_t i = 0; i < job.n_leaves; i++) job.leaf_refs[i] = {job.leaves[i], i};
+
+    qsort(job.leaf_refs, job.n_leaves, sizeof(LeafRef), CompareLeafRefs);
+
+    Worker *workers = (Worker *)calloc(n_threads, sizeof(Worker));
+    ASSERT(workers, free(job.leaves); free(job.leaf_refs); return EXIT_FAILURE);
+
+    for(size_t i = 0; i < n_threads; i++) workers[i].job = &job;
+
+    MergeStats total = {};
+
+    uint64_t start = MetricsNow();
+
+    RunWorkers(workers, n_threads, ExtractChanges);
+
+    total.extract_s = (double)(MetricsNow() - start) * 1e-9;
+
+    int status = GroupChanges(&job, workers, n_threads, &total);
+
+    if(status == EXIT_SUCCESS)
+    {
+        start = MetricsNow();
+
+        RunWorkers(workers, n_threads, MergeGroups);
+
+        total.merge_s = (double)(MetricsNow() - start) * 1e-9;
+
+        char *path = (char *)calloc(base->size + 1, sizeof(char));
+
+        if(path) PrintConflicts(&job, base->root, path, conflicts_file);
+        free(path);
+
+        ApplyGroups(&job);
+    }
+
+    for(size_t i = 0; i < n_threads; i++)
+    {
+        total.snapshots   += workers[i].stats.snapshots;
+        total.failed      += workers[i].stats.failed;
+        total.unsupported += workers[i].stats.unsupported;
+        total.conflicts   += workers[i].stats.conflicts;
+    }
+
+    if(stats) *stats = total;
+
+    MergeJobDtor(&job, workers, n_threads);
+    free(workers);
+
+    return status;
+}
+
+
+static int AddSnapshotName(char ***names, size_t *n_names, size_t *capacity, const char *name)
+{
+    if(*n_names == *capacity)
+    {
+        *capacity = *capacity ? 2 * *capacity : 64;
+
+        char **names_r = (char **)realloc(*names, *capacity * sizeof(char *));
+        ASSERT(names_r, return EXIT_FAILURE);
+
+        *names = names_r;
+    }
+
+    (*names)[*n_names] = strdup(name);
+    ASSERT((*names)[*n_names], return EXIT_FAILURE);
+
+    (*n_names)++;
+
+    return EXIT_SUCCESS;
+}
+
+// "@file" arguments name a list of snapshots, one per line, for more than fits on a command line.
+static int ReadSnapshotList(char ***names, size_t *n_names, size_t *capacity, const char *list_name)
+{
+    FILE *list = fopen(list_name, "rb");
+    ASSERT(list, return EXIT_FAILURE);
+
+    char  *line     = NULL;
+    size_t line_cap = 0;
+    int    status   = EXIT_SUCCESS;
+
+    for(ssize_t len = 0; status == EXIT_SUCCESS && (len = getline(&line, &line_cap, list)) > 0; )
+    {
+        if(line[len - 1] == '\n') line[--len] = '\0';
+
+        if(len) status = AddSnapshotName(names, n_names, capacity, line);
+    }
+
+    free(line);
+    fclose(list);
+
+    return status;
+}
+
+int MergeCommand(int argc, char *argv[])
+{
+    long n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if(argc >= 2 && strcmp(argv[0], "--threads") == 0)
+    {
+        n_threads = strtol(argv[1], NULL, 10);
+
+        argc -= 2;
+        argv += 2;
+    }
+
+    if(argc < 3 || n_threads <= 0)
+    {
+        fprintf(stderr, "Usage: merge [--threads N] <base> <output> <snapshot | @list>...\n");
+        return EXIT_FAILURE;
+    }
+
+    char **names    = NULL;
+    size_t n_names  = 0;
+    size_t capacity = 0;
+    int    status   = EXIT_SUCCESS;
+
+    for(int i = 2; i < argc && status == EXIT_SUCCESS; i++)
+    {
+        if(argv[i][0] == '@') status = ReadSnapshotList(&names, &n_names, &capacity, argv[i] + 1);
+        else                  status = AddSnapshotName (&names, &n_names, &capacity, argv[i]);
+    }
+
+    Tree base = (status == EXIT_SUCCESS) ? ReadTree(argv[0]) : Tree{};
+
+    if(base.root)
+    {
+        size_t base_size = base.size;
+
+        MergeStats stats = {};
+        status = TreeMerge(&base, names, n_names, (size_t)n_threads, stdout, &stats);
+
+        FILE *out_file = fopen(argv[1], "wb");
+
+        if(status == EXIT_SUCCESS && out_file) status = TreeTextDump(&base, out_file);
+        else                                   status = EXIT_FAILURE;
+
+        if(out_file) fclose(out_file);
+
+        fprintf(stderr, "snapshots:    %zu (%zu failed)\n"
+                        "changes:      %zu on %zu leaves\n"
+                        "conflicts:    %zu\n"
+                        "unsupported:  %zu\n"
+                        "nodes:        %zu -> %zu\n"
+                        "extract, s:   %.3f\n"
+                        "merge, s:     %.3f\n",
+                        stats.snapshots, stats.failed, stats.changes, stats.leaves, stats.conflicts,
+                        stats.unsupported, base_size, base.size, stats.extract_s, stats.merge_s);
+
+        TreeDtor(&base, base.root);
+    }
+    else
+    {
+        status = EXIT_FAILURE;
+    }
+
+    for(size_t i = 0; i < n_names; i++) free(names[i]);
+    free(names);
+
+    return status;
+}
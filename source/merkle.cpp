@@ -0,0 +1,127 @@
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/merkle.h"
+
+struct DiffState
+{
+    FILE *out_file;
+
+    char  *path;
+    size_t depth;
+
+    DiffStats stats;
+};
+
+static void PrintChange(DiffState *state, char kind, const Node *const old_node, const Node *const new_node)
+{
+    state->stats.changes++;
+
+    fprintf(state->out_file, "%c\t%.*s\t%s\t%s\n", kind, (int)state->depth, state->path,
+                             old_node ? old_node->data : "", new_node ? new_node->data : "");
+}
+
+// Subtrees with equal hashes are skipped, so only the paths leading to changes are walked.
+static void SubTreeDiff(DiffState *state, Node *const old_node, Node *const new_node)
+{
+    if(!old_node && !new_node) return;
+
+    state->stats.compared++;
+
+    if(!old_node) { PrintChange(state, '+', NULL, new_node); return; }
+    if(!new_node) { PrintChange(state, '-', old_node, NULL); return; }
+
+    if(old_node->hash == new_node->hash) return;
+
+    if(strcmp(old_node->data, new_node->data) != 0) PrintChange(state, '~', old_node, new_node);
+
+    state->path[state->depth++] = 'n';
+    SubTreeDiff(state, old_node->left, new_node->left);
+
+    state->path[state->depth - 1] = 'y';
+    SubTreeDiff(state, old_node->right, new_node->right);
+
+    state->depth--;
+}
+
+int TreeDiff(Tree *const old_tree, Tree *const new_tree, FILE *out_file, DiffStats *stats)
+{
+    ASSERT(old_tree && new_tree && out_file, return EXIT_FAILURE);
+
+    DiffState state = {out_file, NULL, 0, {}};
+
+    state.path = (char *)calloc(old_tree->size + new_tree->size + 1, sizeof(char));
+    ASSERT(state.path, return EXIT_FAILURE);
+
+    SubTreeDiff(&state, old_tree->root, new_tree->root);
+
+    free(state.path);
+
+    if(stats) *stats = state.stats;
+
+    return EXIT_SUCCESS;
+}
+
+int DiffCommand(int argc, char *argv[])
+{
+    if(argc != 2)
+    {
+        fprintf(stderr, "Usage: diff <old_data_base> <new_data_base>\n");
+        return EXIT_FAILURE;
+    }
+
+    Tree old_tree = ReadTree(argv[0]);
+    ASSERT(old_tree.root, return EXIT_FAILURE);
+
+    Tree new_tree = ReadTree(argv[1]);
+    ASSERT(new_tree.root, TreeDtor(&old_tree, old_tree.root); return EXIT_FAILURE);
+
+    DiffStats stats = {};
+    TreeDiff(&old_tree, &new_tree, stdout, &stats);
+
+    fprintf(stderr, "%zu changes, %zu of %zu + %zu nodes compared\n",
+                    stats.changes, stats.compared, old_tree.size, new_tree.size);
+
+    TreeDtor(&old_tree, old_tree.root);
+    TreeDtor(&new_tree, new_tree.root);
+
+    return stats.changes ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int VerifyCommand(int argc, char *argv[])
+{
+    if(argc < 1)
+    {
+        fprintf(stderr, "Usage: verify <data_base>...\n");
+        return EXIT_FAILURE;
+    }
+
+    int status = EXIT_SUCCESS;
+
+    for(int i = 0; i < argc; i++)
+    {
+        ReadReport report = {};
+        report.corruption_file = stdout;
+
+        Tree tree = ReadTree(argv[i], &report);
+
+        if(!tree.root)
+        {
+            printf("%s: can`t read\n", argv[i]);
+
+            status = EXIT_FAILURE;
+            continue;
+        }
+
+        printf("%s: %zu nodes, root %016" PRIx64 ", %zu hashed, %zu mismatched, %zu corrupted%s\n",
+               argv[i], report.nodes, tree.root->hash, report.hashed, report.mismatched, report.corrupted,
+               report.hashed ? "" : " (no stored hashes)");
+
+        if(report.mismatched) status = EXIT_FAILURE;
+
+        TreeDtor(&tree, tree.root);
+    }
+
+    return status;
+}
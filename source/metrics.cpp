@@ -0,0 +1,372 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "../include/metrics.h"
+#include "../include/log.h"
+#include "../include/constants.h"
+
+const int EXPORT_MIN_EXPONENT = 6;
+const int EXPORT_MAX_EXPONENT = 36;
+
+static const char *const OP_NAMES[OP_COUNT] =
+{
+    "read_tree", "get_answer", "tree_path", "add_answer", "text_dump", "tree_dot", "save",
+    "checkpoint_pause", "checkpoint_write", "replication_lag", "fuzzy_lookup"
+};
+
+static const char *const MEM_TAG_NAMES[MEM_TAG_COUNT] =
+{
+    "nodes", "labels", "stacks", "parser", "dump", "index"
+};
+
+#ifdef METRICS
+thread_local MetricsBlock *METRICS_BLOCK = NULL;
+
+static pthread_mutex_t METRICS_LOCK   = PTHREAD_MUTEX_INITIALIZER;
+static MetricsBlock   *METRICS_BLOCKS = NULL;
+
+// Must not LOG: LOG itself records into the thread block.
+MetricsBlock *MetricsThreadBlock(void)
+{
+    MetricsBlock *block = (MetricsBlock *)calloc(1, sizeof(MetricsBlock));
+    if(!block) return NULL;
+
+    pthread_mutex_lock(&METRICS_LOCK);
+
+    block->next    = METRICS_BLOCKS;
+    METRICS_BLOCKS = block;
+
+    pthread_mutex_unlock(&METRICS_LOCK);
+
+    METRICS_BLOCK = block;
+
+    return block;
+}
+
+static void MetricsMerge(MetricsBlock *total)
+{
+    pthread_mutex_lock(&METRICS_LOCK);
+
+    for(MetricsBlock *block = METRICS_BLOCKS; block; block = block->next)
+    {
+        for(int i = 0; i < COUNTER_COUNT; i++)
+        {
+            total->counters[i] += __atomic_load_n(&block->counters[i], __ATOMIC_RELAXED);
+        }
+
+        for(int tag = 0; tag < MEM_TAG_COUNT; tag++)
+        {
+            total->mem_live  [tag] += __atomic_load_n(&block->mem_live  [tag], __ATOMIC_RELAXED);
+            total->mem_peak  [tag] += __atomic_load_n(&block->mem_peak  [tag], __ATOMIC_RELAXED);
+            total->mem_allocs[tag] += __atomic_load_n(&block->mem_allocs[tag], __ATOMIC_RELAXED);
+            total->mem_frees [tag] += __atomic_load_n(&block->mem_frees [tag], __ATOMIC_RELAXED);
+        }
+
+        for(int op = 0; op < OP_COUNT; op++)
+        {
+            total->ops   [op] += __atomic_load_n(&block->ops   [op], __ATOMIC_RELAXED);
+            total->sum_ns[op] += __atomic_load_n(&block->sum_ns[op], __ATOMIC_RELAXED);
+
+            for(int bucket = 0; bucket < METRICS_BUCKETS; bucket++)
+            {
+                total->hist[op][bucket] += __atomic_load_n(&block->hist[op][bucket], __ATOMIC_RELAXED);
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&METRICS_LOCK);
+}
+
+static void WriteMemoryGauges(FILE *file, const MetricsBlock *total)
+{
+    fprintf(file, "# HELP akinator_memory_live_bytes Heap bytes held, by subsystem.\n"
+                  "# TYPE akinator_memory_live_bytes gauge\n");
+
+    for(int tag = 0; tag < MEM_TAG_COUNT; tag++)
+    {
+        fprintf(file, "akinator_memory_live_bytes{tag=\"%s\"} %lld\n", MEM_TAG_NAMES[tag], (long long)total->mem_live[tag]);
+    }
+
+    fprintf(file, "# HELP akinator_memory_peak_bytes Highest heap bytes held, by subsystem.\n"
+                  "# TYPE akinator_memory_peak_bytes gauge\n");
+
+    for(int tag = 0; tag < MEM_TAG_COUNT; tag++)
+    {
+        fprintf(file, "akinator_memory_peak_bytes{tag=\"%s\"} %lld\n", MEM_TAG_NAMES[tag], (long long)total->mem_peak[tag]);
+    }
+
+    fprintf(file, "# HELP akinator_memory_allocations_total Heap allocations, by subsystem.\n"
+                  "# TYPE akinator_memory_allocations_total counter\n");
+
+    for(int tag = 0; tag < MEM_TAG_COUNT; tag++)
+    {
+        fprintf(file, "akinator_memory_allocations_total{tag=\"%s\"} %lld\n", MEM_TAG_NAMES[tag], (long long)total->mem_allocs[tag]);
+    }
+}
+
+static double BucketMiddleNs(int bucket)
+{
+    if(bucket < METRICS_SUB_BUCKETS) return bucket;
+
+    int exponent = bucket / METRICS_SUB_BUCKETS + METRICS_SUB_BUCKETS_LOG - 1;
+    int sub      = bucket % METRICS_SUB_BUCKETS;
+
+    return (double)(uint64_t)(2 * (METRICS_SUB_BUCKETS + sub) + 1) *
+           (double)(1ull << (exponent - METRICS_SUB_BUCKETS_LOG)) / 2;
+}
+
+static double QuantileNs(const MetricsBlock *total, int op, double quantile)
+{
+    if(total->ops[op] == 0) return 0;
+
+    uint64_t rank = (uint64_t)(quantile * (double)(total->ops[op] - 1));
+    uint64_t seen = 0;
+
+    for(int bucket = 0; bucket < METRICS_BUCKETS; bucket++)
+    {
+        seen += total->hist[op][bucket];
+
+        if(seen > rank) return BucketMiddleNs(bucket);
+    }
+
+    return BucketMiddleNs(METRICS_BUCKETS - 1);
+}
+
+static void WriteHistograms(FILE *file, const MetricsBlock *total)
+{
+    fprintf(file, "# HELP akinator_op_duration_seconds Duration of tree and game operations.\n"
+                  "# TYPE akinator_op_duration_seconds histogram\n");
+
+    for(int op = 0; op < OP_COUNT; op++)
+    {
+        uint64_t cumulative = 0;
+        int      bucket     = 0;
+
+        // Sub-buckets never straddle a power of two, so these bounds are exact.
+        for(int exponent = EXPORT_MIN_EXPONENT; exponent <= EXPORT_MAX_EXPONENT; exponent++)
+        {
+            int limit = (exponent - METRICS_SUB_BUCKETS_LOG + 1) * METRICS_SUB_BUCKETS;
+
+            for(; bucket < limit; bucket++) cumulative += total->hist[op][bucket];
+
+            fprintf(file, "akinator_op_duration_seconds_bucket{op=\"%s\",le=\"%.9g\"} %llu\n",
+                          OP_NAMES[op], (double)(1ull << exponent) * 1e-9, (unsigned long long)cumulative);
+        }
+
+        fprintf(file, "akinator_op_duration_seconds_bucket{op=\"%s\",le=\"+Inf\"} %llu\n"
+                      "akinator_op_duration_seconds_sum{op=\"%s\"} %.9g\n"
+                      "akinator_op_duration_seconds_count{op=\"%s\"} %llu\n",
+                      OP_NAMES[op], (unsigned long long)total->ops[op],
+                      OP_NAMES[op], (double)total->sum_ns[op] * 1e-9,
+                      OP_NAMES[op], (unsigned long long)total->ops[op]);
+    }
+
+    fprintf(file, "# HELP akinator_op_duration_quantile_seconds Operation duration quantiles from the HDR histograms.\n"
+                  "# TYPE akinator_op_duration_quantile_seconds gauge\n");
+
+    static const double QUANTILES[] = {0.5, 0.9, 0.99, 0.999};
+
+    for(int op = 0; op < OP_COUNT; op++)
+    {
+        for(size_t i = 0; i < sizeof(QUANTILES) / sizeof(QUANTILES[0]); i++)
+        {
+            fprintf(file, "akinator_op_duration_quantile_seconds{op=\"%s\",quantile=\"%g\"} %.9g\n",
+                          OP_NAMES[op], QUANTILES[i], QuantileNs(total, op, QUANTILES[i]) * 1e-9);
+        }
+    }
+}
+
+int MetricsWrite(FILE *file)
+{
+    ASSERT(file, return EXIT_FAILURE);
+
+    MetricsBlock *total = (MetricsBlock *)calloc(1, sizeof(MetricsBlock));
+    ASSERT(total, return EXIT_FAILURE);
+
+    MetricsMerge(total);
+
+    fprintf(file, "# HELP akinator_log_writes_total Writes to the log file.\n"
+                  "# TYPE akinator_log_writes_total counter\n"
+                  "akinator_log_writes_total %lld\n"
+                  "# HELP akinator_log_bytes_total Bytes written to the log file.\n"
+                  "# TYPE akinator_log_bytes_total counter\n"
+                  "akinator_log_bytes_total %lld\n"
+                  "# HELP akinator_tree_nodes Live tree nodes.\n"
+                  "# TYPE akinator_tree_nodes gauge\n"
+                  "akinator_tree_nodes %lld\n"
+                  "# HELP akinator_label_bytes Bytes of labels owned by nodes.\n"
+                  "# TYPE akinator_label_bytes gauge\n"
+                  "akinator_label_bytes %lld\n"
+                  "# HELP akinator_arena_bytes Bytes in tree arenas (interned label pool).\n"
+                  "# TYPE akinator_arena_bytes gauge\n"
+                  "akinator_arena_bytes %lld\n"
+                  "# HELP akinator_query_cache_hits_total Definition and compare answers served from the cache.\n"
+                  "# TYPE akinator_query_cache_hits_total counter\n"
+                  "akinator_query_cache_hits_total %lld\n"
+                  "# HELP akinator_query_cache_misses_total Definition and compare answers missing from the cache or stale.\n"
+                  "# TYPE akinator_query_cache_misses_total counter\n"
+                  "akinator_query_cache_misses_total %lld\n",
+                  (long long)total->counters[COUNTER_LOG_WRITES],
+                  (long long)total->counters[COUNTER_LOG_BYTES],
+                  (long long)total->counters[COUNTER_NODES],
+                  (long long)total->counters[COUNTER_LABEL_BYTES],
+                  (long long)total->counters[COUNTER_ARENA_BYTES],
+                  (long long)total->counters[COUNTER_CACHE_HITS],
+                  (long long)total->counters[COUNTER_CACHE_MISSES]);
+
+    WriteMemoryGauges(file, total);
+    WriteHistograms(file, total);
+
+    free(total);
+
+    return EXIT_SUCCESS;
+}
+
+int MetricsMemoryWrite(FILE *file)
+{
+    ASSERT(file, return EXIT_FAILURE);
+
+    MetricsBlock *total = (MetricsBlock *)calloc(1, sizeof(MetricsBlock));
+    ASSERT(total, return EXIT_FAILURE);
+
+    MetricsMerge(total);
+
+    fprintf(file, "%-8s %14s %14s %12s %12s\n", "tag", "live bytes", "peak bytes", "live blocks", "allocs");
+
+    int64_t live = 0;
+    int64_t peak = 0;
+
+    for(int tag = 0; tag < MEM_TAG_COUNT; tag++)
+    {
+        fprintf(file, "%-8s %14lld %14lld %12lld %12lld\n", MEM_TAG_NAMES[tag],
+                      (long long)total->mem_live[tag], (long long)total->mem_peak[tag],
+                      (long long)(total->mem_allocs[tag] - total->mem_frees[tag]), (long long)total->mem_allocs[tag]);
+
+        live += total->mem_live[tag];
+        peak += total->mem_peak[tag];
+    }
+
+    // Tags peak at different moments, so the sum of the peaks bounds the real peak from above.
+    fprintf(file, "%-8s %14lld %14lld\n", "total", (long long)live, (long long)peak);
+
+    free(total);
+
+    return EXIT_SUCCESS;
+}
+#else
+int MetricsWrite(FILE *file)
+{
+    ASSERT(file, return EXIT_FAILURE);
+
+    fprintf(file, "# metrics are compiled out (NO_METRICS)\n");
+
+    (void)OP_NAMES;
+    (void)MEM_TAG_NAMES;
+    (void)EXPORT_MIN_EXPONENT;
+    (void)EXPORT_MAX_EXPONENT;
+
+    return EXIT_SUCCESS;
+}
+
+int MetricsMemoryWrite(FILE *file)
+{
+    ASSERT(file, return EXIT_FAILURE);
+
+    fprintf(file, "Memory accounting is compiled out (NO_METRICS).\n");
+
+    return EXIT_SUCCESS;
+}
+#endif
+
+
+static int SendToSocket(const char *const socket_path, const char *text, size_t size)
+{
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+
+    ASSERT(strlen(socket_path) < sizeof(addr.sun_path), return EXIT_FAILURE);
+    strcpy(addr.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    ASSERT(fd >= 0, return EXIT_FAILURE);
+
+    if(connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        LOG("Can`t connect to metrics socket \"%s\".\n", socket_path);
+
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    size_t sent = 0;
+    while(sent < size)
+    {
+        ssize_t written = send(fd, text + sent, size - sent, MSG_NOSIGNAL);
+        if(written <= 0) break;
+
+        sent += (size_t)written;
+    }
+
+    close(fd);
+
+    return (sent == size) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int MetricsExport(const char *const target)
+{
+    ASSERT(target, return EXIT_FAILURE);
+
+    char  *text = NULL;
+    size_t size = 0;
+
+    FILE *text_file = open_memstream(&text, &size);
+    ASSERT(text_file, return EXIT_FAILURE);
+
+    MetricsWrite(text_file);
+    fclose(text_file);
+
+    int status = EXIT_FAILURE;
+
+    if(strncmp(target, "unix:", 5) == 0)
+    {
+        status = SendToSocket(target + 5, text, size);
+    }
+    else
+    {
+        char tmp_name[MAX_STR_LEN] = {};
+        snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", target);
+
+        FILE *file = fopen(tmp_name, "wb");
+
+        if(file)
+        {
+            bool written = (fwrite(text, sizeof(char), size, file) == size);
+
+            if(fclose(file) == 0 && written && rename(tmp_name, target) == 0) status = EXIT_SUCCESS;
+        }
+
+        if(status != EXIT_SUCCESS) LOG("Can`t export metrics to \"%s\".\n", target);
+    }
+
+    free(text);
+
+    return status;
+}
+
+static void ExportAtExit(void)
+{
+    const char *target = getenv(METRICS_ENV);
+
+    if(target) MetricsExport(target);
+}
+
+int MetricsInit(void)
+{
+    if(getenv(METRICS_ENV)) return atexit(ExportAtExit);
+
+    return EXIT_SUCCESS;
+}
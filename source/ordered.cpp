@@ -0,0 +1,673 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "../include/ordered.h"
+#include "../include/memory.h"
+#include "../include/parallel.h"
+#include "../include/trace.h"
+
+
+// Works on any tree built with AUTO: equal labels go left there, and AVL rotations keep
+// them on either side of each other, so the first equal node found is as good as any.
+Node *OrderedSearch(Node *const root, const char *const val)
+{
+    ASSERT(val, return NULL);
+
+    Node *tree_node = root;
+
+    while(tree_node)
+    {
+        int cmp = strcmp(val, tree_node->data);
+        if(cmp == 0) return tree_node;
+
+        tree_node = (cmp < 0) ? tree_node->left : tree_node->right;
+    }
+
+    return NULL;
+}
+
+
+int TreeIterCtor(TreeIter *iter, Tree *const tree, const char *const from, const char *const to)
+{
+    ASSERT(iter && tree, return EXIT_FAILURE);
+    ASSERT(tree->balanced, return EXIT_FAILURE);
+
+    iter->depth = 0;
+    iter->to    = to;
+
+    for(Node *tree_node = tree->root; tree_node; )
+    {
+        if(from && strcmp(tree_node->data, from) < 0)
+        {
+            tree_node = tree_node->right;
+            continue;
+        }
+
+        ASSERT(iter->depth < TREE_ITER_DEPTH, return EXIT_FAILURE);
+
+        iter->stack[iter->depth++] = tree_node;
+        tree_node = tree_node->left;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+Node *TreeIterNext(TreeIter *iter)
+{
+    ASSERT(iter, return NULL);
+
+    if(!iter->depth) return NULL;
+
+    Node *node = iter->stack[--iter->depth];
+
+    if(iter->to && strcmp(node->data, iter->to) > 0)
+    {
+        iter->depth = 0;
+        return NULL;
+    }
+
+    for(Node *tree_node = node->right; tree_node; tree_node = tree_node->left)
+    {
+        ASSERT(iter->depth < TREE_ITER_DEPTH, return NULL);
+
+        iter->stack[iter->depth++] = tree_node;
+    }
+
+    return node;
+}
+
+
+// Takes the nodes in order either through pointers or as one block.
+static Node *BuildBalanced(Node **slots, Node *block, size_t count)
+{
+    if(!count) return NULL;
+
+    size_t mid  = count / 2;
+    Node  *node = slots ? slots[mid] : &block[mid];
+
+    node->left  = BuildBalanced(slots, block, mid);
+    node->right = BuildBalanced(slots ? slots + mid + 1 : NULL, block ? block + mid + 1 : NULL, count - mid - 1);
+
+    NodeRelink(node);
+
+    return node;
+}
+
+// Relinks the nodes of a tree whose labels are already in order into a perfectly balanced
+// one and keeps it balanced from then on. Trees that are out of order or share nodes with
+// other versions are left as they are.
+int TreeBalance(Tree *tree)
+{
+    TREE_VERIFICATION(tree, EXIT_FAILURE);
+
+    ASSERT(!tree->history && !tree->read_only, return EXIT_FAILURE);
+
+    TRACE_SPAN(span, "TreeBalance");
+
+    size_t size  = SubTreeSize(tree->root);
+    Node **nodes = (Node **)MemCalloc(MEM_STACKS, 2 * size, sizeof(Node *));
+    ASSERT(nodes, return EXIT_FAILURE);
+
+    Node **stack = nodes + size;
+
+    size_t count   = 0;
+    size_t depth   = 0;
+    bool   ordered = true;
+
+    for(Node *tree_node = tree->root; ordered && (tree_node || depth); )
+    {
+        if(tree_node)
+        {
+            stack[depth++] = tree_node;
+            tree_node = tree_node->left;
+            continue;
+        }
+
+        tree_node = stack[--depth];
+
+        ordered = !tree_node->refs && !(tree_node->flags & NODE_STATIC) &&
+                  (!count || strcmp(nodes[count - 1]->data, tree_node->data) <= 0);
+
+        nodes[count++] = tree_node;
+        tree_node = tree_node->right;
+    }
+
+    if(ordered)
+    {
+        tree->root     = BuildBalanced(nodes, NULL, count);
+        tree->balanced = true;
+    }
+    else
+    {
+        LOG("Balance skipped: the labels are out of order or the tree shares nodes.\n");
+    }
+
+    MemFree(MEM_STACKS, nodes);
+
+    TraceSpanInt(&span, "nodes", (long long)count);
+
+    return ordered ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+static int CompareLabels(const void *lhs, const void *rhs)
+{
+    return strcmp(*(const char *const *)lhs, *(const char *const *)rhs);
+}
+
+// Sorts [begin, end) when there is nowhere to merge to, merges [begin, mid) with [mid, end)
+// otherwise.
+struct SortTask
+{
+    const char **src;
+    const char **dst;
+
+    size_t begin;
+    size_t mid;
+    size_t end;
+};
+
+static void *SortTaskRun(void *arg)
+{
+    SortTask    *task = (SortTask *)arg;
+    const char **src  = task->src;
+    const char **dst  = task->dst;
+
+    if(!dst)
+    {
+        qsort(src + task->begin, task->end - task->begin, sizeof(const char *), CompareLabels);
+        return NULL;
+    }
+
+    size_t i = task->begin;
+    size_t j = task->mid;
+    size_t k = task->begin;
+
+    while(i < task->mid && j < task->end) dst[k++] = (strcmp(src[j], src[i]) < 0) ? src[j++] : src[i++];
+
+    while(i < task->mid) dst[k++] = src[i++];
+    while(j < task->end) dst[k++] = src[j++];
+
+    return NULL;
+}
+
+// The caller takes the first task, and any task a thread could not be started for.
+static void RunSortTasks(SortTask *tasks, size_t n_tasks)
+{
+    pthread_t threads[PARALLEL_MAX_THREADS] = {};
+    bool      started[PARALLEL_MAX_THREADS] = {};
+
+    for(size_t i = 1; i < n_tasks; i++) started[i] = (pthread_create(&threads[i], NULL, SortTaskRun, &tasks[i]) == 0);
+
+    for(size_t i = 0; i < n_tasks; i++)
+    {
+        if(!started[i]) SortTaskRun(&tasks[i]);
+    }
+
+    for(size_t i = 1; i < n_tasks; i++)
+    {
+        if(started[i]) pthread_join(threads[i], NULL);
+    }
+}
+
+// One part per thread is sorted on its own, then neighbouring parts are merged pairwise.
+static int SortLabels(const char **labels, const size_t count)
+{
+    size_t n_parts = ParallelThreads();
+
+    if(count < BULK_PARALLEL_SORT || n_parts < 2)
+    {
+        qsort(labels, count, sizeof(const char *), CompareLabels);
+        return EXIT_SUCCESS;
+    }
+
+    const char **buffer = (const char **)MemCalloc(MEM_PARSER, count, sizeof(const char *));
+    ASSERT(buffer, return EXIT_FAILURE);
+
+    size_t   bounds[PARALLEL_MAX_THREADS + 1] = {};
+    SortTask tasks [PARALLEL_MAX_THREADS]     = {};
+
+    for(size_t i = 0; i <= n_parts; i++) bounds[i] = count / n_parts * i + count % n_parts * i / n_parts;
+
+    for(size_t i = 0; i < n_parts; i++) tasks[i] = {labels, NULL, bounds[i], bounds[i + 1], bounds[i + 1]};
+
+    RunSortTasks(tasks, n_parts);
+
+    const char **src = labels;
+    const char **dst = buffer;
+
+    for(size_t width = 1; width < n_parts; width *= 2)
+    {
+        size_t n_tasks = 0;
+
+        for(size_t i = 0; i < n_parts; i += 2 * width)
+        {
+            size_t mid = (i +     width < n_parts) ? i +     width : n_parts;
+            size_t end = (i + 2 * width < n_parts) ? i + 2 * width : n_parts;
+
+            tasks[n_tasks++] = {src, dst, bounds[i], bounds[mid], bounds[end]};
+        }
+
+        RunSortTasks(tasks, n_tasks);
+
+        const char **swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    if(src != labels) memcpy(labels, src, count * sizeof(const char *));
+
+    MemFree(MEM_PARSER, buffer);
+
+    return EXIT_SUCCESS;
+}
+
+// Sorts the labels in place and builds a perfectly balanced tree of the distinct ones. Nodes
+// and labels are laid out in the tree arena in order, like a relayout does.
+Tree TreeBulkLoad(const char **labels, const size_t count, BulkReport *report)
+{
+    ASSERT(labels, return {});
+
+    if(!count)
+    {
+        LOG("Bulk load skipped: no labels.\n");
+        return {};
+    }
+
+    TRACE_SPAN(span, "TreeBulkLoad");
+
+    uint64_t start = MetricsNow();
+
+    if(SortLabels(labels, count) != EXIT_SUCCESS) return {};
+
+    uint64_t sorted = MetricsNow();
+
+    size_t unique      = 0;
+    size_t label_bytes = 0;
+
+    // Nodes keep MAX_DATA_LEN - 1 bytes of a label, so labels equal that far are one node.
+    // Sorting keeps them together, since any label between them shares the same prefix.
+    for(size_t i = 0; i < count; i++)
+    {
+        if(unique && strncmp(labels[unique - 1], labels[i], MAX_DATA_LEN - 1) == 0) continue;
+
+        labels[unique++] = labels[i];
+        label_bytes     += strnlen(labels[i], MAX_DATA_LEN - 1) + 1;
+    }
+
+    Tree tree = {};
+
+    tree.arena = ArenaCtor();
+    ASSERT(tree.arena, return {});
+
+    Node *nodes = (Node *)ArenaAllocAligned(tree.arena, unique * sizeof(Node), alignof(Node));
+    char *text  = (char *)ArenaAllocAligned(tree.arena, label_bytes, 1);
+    ASSERT(nodes && text, ArenaDtor(tree.arena); return {});
+
+    for(size_t i = 0; i < unique; i++)
+    {
+        size_t len = strnlen(labels[i], MAX_DATA_LEN - 1);
+
+        nodes[i]       = {};
+        nodes[i].data  = (char *)memcpy(text, labels[i], len);
+        nodes[i].flags = NODE_ARENA | NODE_SHARED_DATA;
+
+        text[len] = '\0';
+        text     += len + 1;
+    }
+
+    tree.root     = BuildBalanced(NULL, nodes, unique);
+    tree.size     = unique;
+    tree.balanced = true;
+
+    METRICS_ADD(COUNTER_NODES, (int64_t)unique);
+
+    if(report) *report = {count, unique, sorted - start, MetricsNow() - sorted};
+
+    TraceSpanInt(&span, "nodes", (long long)unique);
+
+    return tree;
+}
+
+// One label per line, empty lines skipped.
+Tree TreeBulkLoadFile(const char *const file_name, BulkReport *report)
+{
+    ASSERT(file_name, return {});
+
+    FILE *file = fopen(file_name, "rb");
+    if(!file)
+    {
+        LOG("No such file: \"%s\"", file_name);
+        return {};
+    }
+
+    struct stat file_info = {};
+    if(fstat(fileno(file), &file_info) != 0)
+    {
+        LOG("Can`t stat \"%s\".\n", file_name);
+
+        fclose(file);
+        return {};
+    }
+
+    size_t buf_size = (size_t)file_info.st_size;
+    char  *buffer   = (char *)MemCalloc(MEM_PARSER, buf_size + 1, sizeof(char));
+    ASSERT(buffer, fclose(file); return {});
+
+    size_t read = fread(buffer, sizeof(char), buf_size, file);
+    fclose(file);
+
+    size_t count = 0;
+
+    for(size_t i = 0; i < read; i++) count += (buffer[i] == '\n');
+
+    const char **labels = (const char **)MemCalloc(MEM_PARSER, count + 1, sizeof(const char *));
+    ASSERT(labels, MemFree(MEM_PARSER, buffer); return {});
+
+    count = 0;
+
+    for(char *line = buffer; line < buffer + read; )
+    {
+        char *end = (char *)memchr(line, '\n', (size_t)(buffer + read - line));
+        if(!end) end = buffer + read;
+
+        *end = '\0';
+        if(end > line && end[-1] == '\r') end[-1] = '\0';
+
+        if(*line) labels[count++] = line;
+
+        line = end + 1;
+    }
+
+    Tree tree = TreeBulkLoad(labels, count, report);
+
+    MemFree(MEM_PARSER, labels);
+    MemFree(MEM_PARSER, buffer);
+
+    return tree;
+}
+
+
+int RangeCommand(int argc, char *argv[])
+{
+    if(argc < 1 || argc > 3)
+    {
+        fprintf(stderr, "Usage: range <data_base> [from] [to]\n");
+        return EXIT_FAILURE;
+    }
+
+    Tree tree = ReadTree(argv[0]);
+    ASSERT(tree.root, return EXIT_FAILURE);
+
+    TreeIter iter = {};
+
+    int status = TreeBalance(&tree);
+
+    if(status == EXIT_SUCCESS)
+    {
+        status = TreeIterCtor(&iter, &tree, (argc > 1) ? argv[1] : NULL, (argc > 2) ? argv[2] : NULL);
+    }
+    else
+    {
+        fprintf(stderr, "\"%s\" is not an ordered tree.\n", argv[0]);
+    }
+
+    if(status == EXIT_SUCCESS)
+    {
+        for(Node *node = TreeIterNext(&iter); node; node = TreeIterNext(&iter)) puts(node->data);
+    }
+
+    TreeDtor(&tree, tree.root);
+
+    return status;
+}
+
+
+static void BenchLabel(char *label, size_t key)
+{
+    snprintf(label, FMT_STR_LEN, "label %09zu", key);
+}
+
+struct OrderedRun
+{
+    double insert_ns;
+    double search_ns;
+    double iter_ns;   // per node, balanced trees only
+
+    size_t max_depth;
+};
+
+static int RunOrdered(const size_t *keys, size_t n_keys, bool balanced, OrderedRun *run)
+{
+    char label[FMT_STR_LEN] = {};
+    BenchLabel(label, keys[0]);
+
+    Tree tree = TreeCtor(label);
+    ASSERT(tree.root, return EXIT_FAILURE);
+
+    tree.balanced = balanced;
+
+    int status = EXIT_SUCCESS;
+
+    uint64_t start = MetricsNow();
+
+    for(size_t i = 1; i < n_keys && status == EXIT_SUCCESS; i++)
+    {
+        BenchLabel(label, keys[i]);
+
+        if(!AddNode(&tree, tree.root, label, AUTO)) status = EXIT_FAILURE;
+    }
+
+    run->insert_ns = (double)(MetricsNow() - start) / (double)n_keys;
+
+    TreeStats stats = {};
+    if(status == EXIT_SUCCESS) status = SubTreeStats(tree.root, &stats);
+
+    run->max_depth = stats.max_depth;
+
+    start = MetricsNow();
+
+    for(size_t i = 0; i < n_keys && status == EXIT_SUCCESS; i++)
+    {
+        BenchLabel(label, i);
+
+        if(!OrderedSearch(tree.root, label)) status = EXIT_FAILURE;
+    }
+
+    run->search_ns = (double)(MetricsNow() - start) / (double)n_keys;
+
+    TreeIter iter = {};
+
+    if(balanced && status == EXIT_SUCCESS && TreeIterCtor(&iter, &tree) == EXIT_SUCCESS)
+    {
+        size_t      count = 0;
+        const char *prev  = "";
+
+        start = MetricsNow();
+
+        for(Node *node = TreeIterNext(&iter); node; node = TreeIterNext(&iter), count++)
+        {
+            if(strcmp(prev, node->data) > 0) status = EXIT_FAILURE;
+
+            prev = node->data;
+        }
+
+        run->iter_ns = (double)(MetricsNow() - start) / (double)n_keys;
+
+        if(count != n_keys) status = EXIT_FAILURE;
+    }
+
+    TreeDtor(&tree, tree.root);
+
+    return status;
+}
+
+// Insert timings include the PROTECT checks AddNode makes, which walk the whole tree.
+int BenchOrderedCommand(int argc, char *argv[])
+{
+    if(argc > 2)
+    {
+        fprintf(stderr, "Usage: bench-ordered [labels] [sorted|random]\n");
+        return EXIT_FAILURE;
+    }
+
+    size_t n_keys = (argc > 0) ? strtoul(argv[0], NULL, 10) : BENCH_ORDERED_NODES;
+    bool   sorted = (argc < 2) || strcmp(argv[1], "random") != 0;
+    ASSERT(n_keys, return EXIT_FAILURE);
+
+    size_t *keys = (size_t *)calloc(n_keys, sizeof(size_t));
+    ASSERT(keys, return EXIT_FAILURE);
+
+    for(size_t i = 0; i < n_keys; i++) keys[i] = i;
+
+    unsigned seed = 1;
+
+    for(size_t i = n_keys - 1; !sorted && i > 0; i--)
+    {
+        size_t j   = (size_t)rand_r(&seed) % (i + 1);
+        size_t key = keys[i];
+
+        keys[i] = keys[j];
+        keys[j] = key;
+    }
+
+    OrderedRun plain    = {};
+    OrderedRun balanced = {};
+
+    int status = RunOrdered(keys, n_keys, false, &plain);
+    if(status == EXIT_SUCCESS) status = RunOrdered(keys, n_keys, true, &balanced);
+
+    if(status == EXIT_SUCCESS)
+    {
+        printf("%zu %s labels\n", n_keys, sorted ? "sorted" : "random");
+        printf("plain:    max depth %zu, insert %.0f ns, search %.0f ns\n",
+               plain.max_depth, plain.insert_ns, plain.search_ns);
+        printf("balanced: max depth %zu, insert %.0f ns, search %.0f ns, ordered walk %.1f ns per label\n",
+               balanced.max_depth, balanced.insert_ns, balanced.search_ns, balanced.iter_ns);
+    }
+
+    free(keys);
+
+    return status;
+}
+
+
+static void PrintBulkReport(const BulkReport *report)
+{
+    printf("%zu labels, %zu distinct, sort %.3f s, build %.3f s, %.1f ns per label\n",
+           report->labels, report->unique, (double)report->sort_ns * 1e-9, (double)report->build_ns * 1e-9,
+           (double)(report->sort_ns + report->build_ns) / (double)report->labels);
+}
+
+int BulkLoadCommand(int argc, char *argv[])
+{
+    if(ParseThreads(&argc, &argv) != EXIT_SUCCESS || argc != 2)
+    {
+        fprintf(stderr, "Usage: bulk-load [--threads N] <labels> <data_base>\n");
+        return EXIT_FAILURE;
+    }
+
+    BulkReport report = {};
+
+    Tree tree = TreeBulkLoadFile(argv[0], &report);
+    ASSERT(tree.root, return EXIT_FAILURE);
+
+    FILE *db_file = fopen(argv[1], "wb");
+    int   status  = db_file ? TreeTextDump(&tree, db_file) : EXIT_FAILURE;
+
+    if(db_file) fclose(db_file);
+
+    if(status == EXIT_SUCCESS) PrintBulkReport(&report);
+    else                       fprintf(stderr, "Can`t write \"%s\".\n", argv[1]);
+
+    TreeDtor(&tree, tree.root);
+
+    return status;
+}
+
+// Keys are drawn with repeats, so about a third of the labels are duplicates.
+int BenchBulkCommand(int argc, char *argv[])
+{
+    if(ParseThreads(&argc, &argv) != EXIT_SUCCESS || argc > 2)
+    {
+        fprintf(stderr, "Usage: bench-bulk [--threads N] [labels] [incremental]\n");
+        return EXIT_FAILURE;
+    }
+
+    const size_t label_len = 16;  // "label %09zu"
+
+    size_t n_labels    = (argc > 0) ? strtoul(argv[0], NULL, 10) : BENCH_BULK_LABELS;
+    size_t incremental = (argc > 1) ? strtoul(argv[1], NULL, 10) : BENCH_BULK_INCREMENTAL;
+    ASSERT(n_labels && n_labels < 1000000000, return EXIT_FAILURE);
+
+    if(incremental > n_labels) incremental = n_labels;
+
+    char        *text   = (char        *)calloc(n_labels, label_len);
+    const char **labels = (const char **)calloc(n_labels, sizeof(const char *));
+    ASSERT(text && labels, free(text); free(labels); return EXIT_FAILURE);
+
+    unsigned seed = 1;
+
+    for(size_t i = 0; i < n_labels; i++)
+    {
+        snprintf(text + i * label_len, label_len, "label %09zu", (size_t)rand_r(&seed) % n_labels);
+
+        labels[i] = text + i * label_len;
+    }
+
+    BulkReport report = {};
+
+    Tree tree = TreeBulkLoad(labels, n_labels, &report);
+    ASSERT(tree.root, free(text); free(labels); return EXIT_FAILURE);
+
+    TreeStats stats = {};
+    TreeIter  iter  = {};
+
+    int status = SubTreeStats(tree.root, &stats);
+    if(status == EXIT_SUCCESS) status = TreeIterCtor(&iter, &tree);
+
+    size_t      count = 0;
+    const char *prev  = "";
+
+    for(Node *node = TreeIterNext(&iter); node && status == EXIT_SUCCESS; node = TreeIterNext(&iter), count++)
+    {
+        if(strcmp(prev, node->data) >= 0) status = EXIT_FAILURE;
+
+        prev = node->data;
+    }
+
+    if(count != report.unique) status = EXIT_FAILURE;
+
+    printf("bulk:        ");
+    PrintBulkReport(&report);
+    printf("             max depth %zu\n", stats.max_depth);
+
+    TreeDtor(&tree, tree.root);
+
+    if(status == EXIT_SUCCESS && incremental)
+    {
+        Tree added = TreeCtor(text);
+        ASSERT(added.root, free(text); free(labels); return EXIT_FAILURE);
+
+        added.balanced = true;
+
+        uint64_t start = MetricsNow();
+
+        for(size_t i = 1; i < incremental && status == EXIT_SUCCESS; i++)
+        {
+            if(!AddNode(&added, added.root, text + i * label_len, AUTO)) status = EXIT_FAILURE;
+        }
+
+        printf("incremental: %zu labels, %.1f ns per label\n", incremental,
+               (double)(MetricsNow() - start) / (double)incremental);
+
+        TreeDtor(&added, added.root);
+    }
+
+    free(text);
+    free(labels);
+
+    return status;
+}
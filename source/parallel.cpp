@@ -0,0 +1,693 @@
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../include/parallel.h"
+#include "../include/memory.h"
+#include "../include/metrics.h"
+
+struct FoldEntry
+{
+    Node  *node;
+    size_t depth;
+};
+
+struct FoldJob;
+
+struct FoldWorker
+{
+    FoldJob *job;
+    void    *acc;
+
+    FoldEntry *stack;       // entries [base, size) are pending, the bottom ones are the largest
+    size_t     base;
+    size_t     size;
+    size_t     capacity;
+
+    pthread_mutex_t lock;
+    FoldEntry       offer;  // a subtree handed off for any idle worker to take
+    bool            offered;
+};
+
+struct FoldJob
+{
+    const ParallelFold *fold;
+
+    FoldWorker *first;      // the caller's, in its frame
+    FoldWorker *helpers;    // n_workers - 1 of them, allocated once the pool takes the job
+    size_t      n_workers;
+
+    bool asked;             // the caller asked the pool for helpers, set once
+    bool pooled;            // and got it
+
+    size_t pending;         // tasks handed off or running
+    size_t idle;            // workers looking for a task
+
+    bool failed;
+};
+
+// Helpers live as long as the process, so a fold neither creates threads nor leaves
+// per-thread metrics and trace buffers behind. One fold at a time gets them.
+struct FoldPool
+{
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;
+    pthread_cond_t  done;
+
+    FoldJob *job;           // the one helpers may still join
+    bool     busy;          // until the helpers of the last job have left it
+    uint64_t round;         // bumped for every job, so a helper joins each one at most once
+    size_t   joined;        // helpers that took a worker of the job
+    size_t   running;       // of them, the ones still in it
+
+    size_t n_threads;
+};
+
+static FoldPool FOLD_POOL = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER,
+                             NULL, false, 0, 0, 0, 0};
+
+const size_t FOLD_INLINE_ACC = 1024;  // accumulators up to this size live in the caller's frame
+
+static size_t PARALLEL_THREADS = 0;
+
+static thread_local bool IN_FOLD = false;
+
+void ParallelSetThreads(size_t n_threads)
+{
+    PARALLEL_THREADS = (n_threads > PARALLEL_MAX_THREADS) ? PARALLEL_MAX_THREADS : n_threads;
+}
+
+size_t ParallelThreads(void)
+{
+    if(PARALLEL_THREADS) return PARALLEL_THREADS;
+
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return (online <= 0) ? 1 : ((size_t)online > PARALLEL_MAX_THREADS) ? PARALLEL_MAX_THREADS : (size_t)online;
+}
+
+
+static void FoldPush(FoldWorker *worker, Node *node, size_t depth)
+{
+    if(worker->size == worker->capacity)
+    {
+        size_t capacity = worker->capacity ? 2 * worker->capacity : 64;
+
+        FoldEntry *stack_r = (FoldEntry *)MemRealloc(MEM_STACKS, worker->stack, capacity * sizeof(FoldEntry));
+        ASSERT(stack_r, worker->job->failed = true; return);
+
+        worker->stack    = stack_r;
+        worker->capacity = capacity;
+    }
+
+    worker->stack[worker->size++] = {node, depth};
+}
+
+static FoldWorker *JobWorker(FoldJob *job, size_t index)
+{
+    return index ? &job->helpers[index - 1] : job->first;
+}
+
+static size_t WorkerIndex(const FoldWorker *worker)
+{
+    return (worker == worker->job->first) ? 0 : (size_t)(worker - worker->job->helpers) + 1;
+}
+
+static void FoldWorkerDtor(FoldWorker *worker, void *result)
+{
+    const ParallelFold *fold = worker->job->fold;
+
+    if(result && fold->acc_size && worker->acc && !worker->job->failed) fold->merge(result, worker->acc, fold->ctx);
+
+    MemFree(MEM_STACKS, worker->stack);
+    pthread_mutex_destroy(&worker->lock);
+}
+
+static void FoldHelpersDtor(FoldJob *job, void *result)
+{
+    if(!job->helpers) return;
+
+    for(size_t i = 0; i + 1 < job->n_workers; i++)
+    {
+        FoldWorkerDtor(&job->helpers[i], result);
+        free(job->helpers[i].acc);
+    }
+
+    free(job->helpers);
+    job->helpers = NULL;
+}
+
+static int FoldHelpersCtor(FoldJob *job)
+{
+    job->helpers = (FoldWorker *)calloc(job->n_workers - 1, sizeof(FoldWorker));
+    if(!job->helpers) return EXIT_FAILURE;
+
+    bool failed = false;
+
+    for(size_t i = 0; i + 1 < job->n_workers; i++)
+    {
+        job->helpers[i].job = job;
+        pthread_mutex_init(&job->helpers[i].lock, NULL);
+
+        if(job->fold->acc_size && !(job->helpers[i].acc = calloc(1, job->fold->acc_size))) failed = true;
+    }
+
+    if(failed) FoldHelpersDtor(job, NULL);
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static void *FoldHelper(void *);
+
+// Wakes the pool, starting the helpers this job needs on its first use. A fold that finds
+// the pool busy, or can`t get workers for it, walks without helpers.
+static void StartHelpers(FoldJob *job)
+{
+    job->asked = true;
+
+    pthread_mutex_lock(&FOLD_POOL.lock);
+
+    if(!FOLD_POOL.busy && FoldHelpersCtor(job) == EXIT_SUCCESS)
+    {
+        for(; FOLD_POOL.n_threads + 1 < job->n_workers; FOLD_POOL.n_threads++)
+        {
+            pthread_t thread = {};
+            if(pthread_create(&thread, NULL, FoldHelper, NULL) != 0) break;
+
+            pthread_detach(thread);
+        }
+
+        FOLD_POOL.job    = job;
+        FOLD_POOL.busy   = true;
+        FOLD_POOL.joined = 0;
+        FOLD_POOL.round++;
+
+        job->pooled = true;
+
+        pthread_cond_broadcast(&FOLD_POOL.wake);
+    }
+
+    pthread_mutex_unlock(&FOLD_POOL.lock);
+}
+
+// Waits for the helpers to leave the job, so its workers can be freed.
+static void StopHelpers(FoldJob *job)
+{
+    pthread_mutex_lock(&FOLD_POOL.lock);
+
+    FOLD_POOL.job = NULL;
+
+    while(FOLD_POOL.running) pthread_cond_wait(&FOLD_POOL.done, &FOLD_POOL.lock);
+
+    FOLD_POOL.busy = false;
+
+    pthread_mutex_unlock(&FOLD_POOL.lock);
+
+    job->pooled = false;
+}
+
+// The bottom of the stack is the right child of the shallowest pending branch, so it is
+// handed off only while some worker has nothing to do.
+static void FoldOffer(FoldWorker *worker)
+{
+    FoldJob *job = worker->job;
+
+    if(worker->size - worker->base < 2 || __atomic_load_n(&job->idle, __ATOMIC_RELAXED) == 0) return;
+
+    pthread_mutex_lock(&worker->lock);
+
+    if(!worker->offered)
+    {
+        __atomic_add_fetch(&job->pending, 1, __ATOMIC_RELAXED);
+
+        worker->offer   = worker->stack[worker->base++];
+        worker->offered = true;
+    }
+
+    pthread_mutex_unlock(&worker->lock);
+}
+
+static void FoldRun(FoldWorker *worker, FoldEntry task)
+{
+    FoldJob            *job  = worker->job;
+    const ParallelFold *fold = job->fold;
+
+    size_t visited = 0;
+
+    worker->base = 0;
+    worker->size = 0;
+
+    FoldPush(worker, task.node, task.depth);
+
+    while(worker->size > worker->base)
+    {
+        FoldEntry entry = worker->stack[--worker->size];
+
+        Node *left  = entry.node->left;
+        Node *right = entry.node->right;
+
+        if(fold->visit(entry.node, entry.depth, worker->acc, fold->ctx))
+        {
+            if(right) FoldPush(worker, right, entry.depth + 1);
+            if(left ) FoldPush(worker, left , entry.depth + 1);
+        }
+
+        if(++visited % PARALLEL_GRAIN != 0 || job->n_workers == 1) continue;
+
+        if(worker == job->first && !job->asked && visited >= PARALLEL_CUTOFF) StartHelpers(job);
+
+        FoldOffer(worker);
+    }
+}
+
+static bool FoldTake(FoldWorker *worker, FoldEntry *task)
+{
+    FoldJob *job = worker->job;
+
+    size_t self = WorkerIndex(worker);
+
+    for(size_t i = 0; i < job->n_workers; i++)
+    {
+        FoldWorker *victim = JobWorker(job, (self + i) % job->n_workers);
+
+        if(!__atomic_load_n(&victim->offered, __ATOMIC_RELAXED)) continue;
+
+        pthread_mutex_lock(&victim->lock);
+
+        bool taken = victim->offered;
+
+        if(taken)
+        {
+            *task            = victim->offer;
+            victim->offered = false;
+        }
+
+        pthread_mutex_unlock(&victim->lock);
+
+        if(taken) return true;
+    }
+
+    return false;
+}
+
+static void FoldSteal(FoldWorker *worker)
+{
+    FoldJob *job = worker->job;
+
+    bool idle = false;
+
+    while(true)
+    {
+        FoldEntry task = {};
+
+        if(FoldTake(worker, &task))
+        {
+            if(idle) __atomic_sub_fetch(&job->idle, 1, __ATOMIC_RELAXED);
+            idle = false;
+
+            FoldRun(worker, task);
+
+            __atomic_sub_fetch(&job->pending, 1, __ATOMIC_ACQ_REL);
+            continue;
+        }
+
+        if(__atomic_load_n(&job->pending, __ATOMIC_ACQUIRE) == 0) break;
+
+        if(!idle) __atomic_add_fetch(&job->idle, 1, __ATOMIC_RELAXED);
+        idle = true;
+
+        sched_yield();
+    }
+}
+
+static void *FoldHelper(void *)
+{
+    IN_FOLD = true;
+
+    uint64_t round = 0;
+
+    pthread_mutex_lock(&FOLD_POOL.lock);
+
+    while(true)
+    {
+        while(!FOLD_POOL.job || FOLD_POOL.round == round) pthread_cond_wait(&FOLD_POOL.wake, &FOLD_POOL.lock);
+
+        round = FOLD_POOL.round;
+
+        FoldJob *job = FOLD_POOL.job;
+        if(FOLD_POOL.joined + 1 >= job->n_workers) continue;
+
+        FoldWorker *worker = &job->helpers[FOLD_POOL.joined++];
+        FOLD_POOL.running++;
+
+        pthread_mutex_unlock(&FOLD_POOL.lock);
+
+        FoldSteal(worker);
+
+        pthread_mutex_lock(&FOLD_POOL.lock);
+
+        if(--FOLD_POOL.running == 0) pthread_cond_signal(&FOLD_POOL.done);
+    }
+
+    return NULL;
+}
+
+// The caller walks alone until it has seen PARALLEL_CUTOFF nodes, so small subtrees never
+// wake the pool or allocate workers for it. Folds nested in a visitor always run on the
+// calling thread.
+int SubTreeFold(Node *sub_tree, const ParallelFold *fold, void *result)
+{
+    ASSERT(fold && fold->visit, return EXIT_FAILURE);
+    ASSERT(!fold->acc_size || (fold->merge && result), return EXIT_FAILURE);
+
+    if(!sub_tree) return EXIT_SUCCESS;
+
+    alignas(max_align_t) unsigned char acc[FOLD_INLINE_ACC];
+
+    FoldJob    job   = {fold, NULL, NULL, IN_FOLD ? 1 : ParallelThreads(), false, false, 1, 0, false};
+    FoldWorker first = {};
+
+    first.job = &job;
+    first.acc = (fold->acc_size <= FOLD_INLINE_ACC) ? memset(acc, 0, fold->acc_size) : calloc(1, fold->acc_size);
+    ASSERT(first.acc, return EXIT_FAILURE);
+
+    pthread_mutex_init(&first.lock, NULL);
+    job.first = &first;
+
+    bool nested = IN_FOLD;
+    IN_FOLD = true;
+
+    FoldRun(&first, {sub_tree, 0});
+    __atomic_sub_fetch(&job.pending, 1, __ATOMIC_ACQ_REL);
+
+    if(job.pooled)
+    {
+        FoldSteal(&first);
+        StopHelpers(&job);
+    }
+
+    IN_FOLD = nested;
+
+    FoldWorkerDtor(&first, result);
+    if(first.acc != acc) free(first.acc);
+
+    FoldHelpersDtor(&job, result);
+
+    return job.failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+bool CountVisit(Node *, size_t, void *acc, void *)
+{
+    (*(size_t *)acc)++;
+
+    return true;
+}
+
+void SumMerge(void *result, const void *acc, void *)
+{
+    *(size_t *)result += *(const size_t *)acc;
+}
+
+
+static size_t DepthBin(size_t depth)
+{
+    return depth ? (size_t)(64 - __builtin_clzll((unsigned long long)depth)) : 0;
+}
+
+static bool StatsVisit(Node *node, size_t depth, void *acc, void *)
+{
+    TreeStats *stats = (TreeStats *)acc;
+
+    stats->nodes++;
+    stats->depth_bins[DepthBin(depth)]++;
+
+    if(depth > stats->max_depth) stats->max_depth = depth;
+
+    if(!node->left && !node->right)
+    {
+        stats->leaves++;
+        stats->leaf_depth_sum += depth;
+    }
+    else if(!node->left || !node->right)
+    {
+        stats->unary++;
+    }
+
+    return true;
+}
+
+static void StatsMerge(void *result, const void *acc, void *)
+{
+    TreeStats       *total = (TreeStats *)result;
+    const TreeStats *stats = (const TreeStats *)acc;
+
+    total->nodes          += stats->nodes;
+    total->leaves         += stats->leaves;
+    total->unary          += stats->unary;
+    total->leaf_depth_sum += stats->leaf_depth_sum;
+
+    if(stats->max_depth > total->max_depth) total->max_depth = stats->max_depth;
+
+    for(size_t i = 0; i < PARALLEL_DEPTH_BINS; i++) total->depth_bins[i] += stats->depth_bins[i];
+}
+
+int SubTreeStats(Node *sub_tree, TreeStats *stats)
+{
+    ASSERT(stats, return EXIT_FAILURE);
+
+    *stats = {};
+
+    ParallelFold fold = {StatsVisit, StatsMerge, sizeof(TreeStats), NULL};
+
+    return SubTreeFold(sub_tree, &fold, stats);
+}
+
+// A perfectly balanced tree has every leaf at depth log2(leaves), so the balance is 1 and
+// grows as the tree degenerates towards a list.
+void TreeStatsWrite(FILE *file, const TreeStats *stats)
+{
+    ASSERT(file && stats, return);
+
+    double mean_depth = stats->leaves ? (double)stats->leaf_depth_sum / (double)stats->leaves : 0;
+    double best_depth = (stats->leaves > 1) ? log2((double)stats->leaves) : 1;
+
+    fprintf(file, "nodes:            %zu\n"
+                  "leaves:           %zu\n"
+                  "one-child nodes:  %zu\n"
+                  "max depth:        %zu\n"
+                  "mean leaf depth:  %.2f\n"
+                  "balance:          %.2f\n"
+                  "depth histogram:\n",
+                  stats->nodes, stats->leaves, stats->unary, stats->max_depth, mean_depth, mean_depth / best_depth);
+
+    for(size_t i = 0; i < PARALLEL_DEPTH_BINS; i++)
+    {
+        if(!stats->depth_bins[i]) continue;
+
+        size_t from = i ? (size_t)1 << (i - 1) : 0;
+        size_t to   = i ? (size_t)1 << i       : 1;
+
+        fprintf(file, "  [%7zu, %7zu) %12zu\n", from, to, stats->depth_bins[i]);
+    }
+}
+
+int ParseThreads(int *argc, char **argv[])
+{
+    if(*argc >= 2 && strcmp((*argv)[0], "--threads") == 0)
+    {
+        long n_threads = strtol((*argv)[1], NULL, 10);
+        if(n_threads <= 0) return EXIT_FAILURE;
+
+        ParallelSetThreads((size_t)n_threads);
+
+        *argc -= 2;
+        *argv += 2;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int TreeStatsCommand(int argc, char *argv[])
+{
+    if(ParseThreads(&argc, &argv) != EXIT_SUCCESS || argc != 1)
+    {
+        fprintf(stderr, "Usage: tree-stats [--threads N] <data_base>\n");
+        return EXIT_FAILURE;
+    }
+
+    Tree tree = ReadTree(argv[0]);
+    ASSERT(tree.root, return EXIT_FAILURE);
+
+    TreeStats stats = {};
+    int status = SubTreeStats(tree.root, &stats);
+
+    if(status == EXIT_SUCCESS) TreeStatsWrite(stdout, &stats);
+
+    TreeDtor(&tree, tree.root);
+
+    return status;
+}
+
+
+enum BenchShape
+{
+    SHAPE_BALANCED,
+    SHAPE_SKEWED,       // every split sends nine tenths of the nodes left
+    SHAPE_RANDOM,       // uniformly random splits, like an unbalanced search tree
+    SHAPE_CATERPILLAR,  // a left spine with a leaf hanging off each node
+
+    SHAPE_COUNT
+};
+
+static const char *const SHAPE_NAMES[SHAPE_COUNT] = {"balanced", "skewed", "random", "caterpillar"};
+
+// Iterative, so a caterpillar of millions of nodes does not overflow the stack.
+static Node *BuildShape(BenchShape shape, size_t n_nodes, unsigned *seed)
+{
+    struct Pending
+    {
+        Node **slot;
+        size_t size;
+    };
+
+    Pending *pending = (Pending *)calloc(n_nodes + 1, sizeof(Pending));
+    ASSERT(pending, return NULL);
+
+    Node  *root    = NULL;
+    size_t count   = 0;
+    size_t n_pend  = 0;
+    char   label[MAX_DATA_LEN] = {};
+
+    pending[n_pend++] = {&root, n_nodes};
+
+    while(n_pend)
+    {
+        Pending task = pending[--n_pend];
+
+        snprintf(label, sizeof(label), "node %zu", count++);
+
+        Node *node = NodeCtor(label);
+        ASSERT(node, break);
+
+        *task.slot = node;
+
+        size_t rest = task.size - 1;
+        size_t left = 0;
+
+        switch(shape)
+        {
+            case SHAPE_BALANCED:    left = rest / 2;                                        break;
+            case SHAPE_SKEWED:      left = rest - rest / 10;                                break;
+            case SHAPE_RANDOM:      left = rest ? (size_t)rand_r(seed) % (rest + 1) : 0;    break;
+            case SHAPE_CATERPILLAR: left = rest ? rest - 1 : 0;                             break;
+            case SHAPE_COUNT:
+            default:                left = rest / 2;                                        break;
+        }
+
+        if(rest - left) pending[n_pend++] = {&node->right, rest - left};
+        if(left)        pending[n_pend++] = {&node->left , left};
+    }
+
+    free(pending);
+
+    return root;
+}
+
+static double BenchSeconds(uint64_t start)
+{
+    return (double)(MetricsNow() - start) * 1e-9;
+}
+
+static int BenchShapeRun(BenchShape shape, size_t n_nodes, const size_t *threads, size_t n_threads)
+{
+    unsigned seed = 42;
+
+    Tree tree = {BuildShape(shape, n_nodes, &seed), n_nodes};
+    ASSERT(tree.root, return EXIT_FAILURE);
+
+    TreeStats stats = {};
+    SubTreeStats(tree.root, &stats);
+
+    printf("%s: %zu nodes, max depth %zu, mean leaf depth %.1f\n", SHAPE_NAMES[shape], stats.nodes, stats.max_depth,
+           stats.leaves ? (double)stats.leaf_depth_sum / (double)stats.leaves : 0.0);
+
+    printf("  %7s %10s %10s %10s %10s %9s\n", "threads", "size s", "stats s", "search s", "valid s", "speedup");
+
+    double base_s = 0;
+
+    for(size_t i = 0; i < n_threads; i++)
+    {
+        ParallelSetThreads(threads[i]);
+
+        size_t       count = 0;
+        ParallelFold fold  = {CountVisit, SumMerge, sizeof(size_t), NULL};
+
+        uint64_t start = MetricsNow();
+        SubTreeFold(tree.root, &fold, &count);
+        double size_s = BenchSeconds(start);
+
+        start = MetricsNow();
+        SubTreeStats(tree.root, &stats);
+        double stats_s = BenchSeconds(start);
+
+        start = MetricsNow();
+        Node *found = TreeSearchVal(&tree, "no such label");
+        double search_s = BenchSeconds(start);
+
+        start = MetricsNow();
+        bool valid = IsTreeValid(&tree);
+        double valid_s = BenchSeconds(start);
+
+        ASSERT(count == n_nodes && !found && valid, ParallelSetThreads(0); TreeDtor(&tree, tree.root); return EXIT_FAILURE);
+
+        double total_s = size_s + stats_s + search_s + valid_s;
+        if(i == 0) base_s = total_s;
+
+        printf("  %7zu %10.4f %10.4f %10.4f %10.4f %8.2fx\n", threads[i], size_s, stats_s, search_s, valid_s, base_s / total_s);
+    }
+
+    ParallelSetThreads(threads[n_threads - 1]);
+
+    uint64_t start = MetricsNow();
+    TreeDtor(&tree, tree.root);
+
+    printf("  teardown with %zu threads: %.4f s\n", threads[n_threads - 1], BenchSeconds(start));
+
+    ParallelSetThreads(0);
+
+    return EXIT_SUCCESS;
+}
+
+int BenchParallelCommand(int argc, char *argv[])
+{
+    if(ParseThreads(&argc, &argv) != EXIT_SUCCESS || argc < 1 || argc > 2)
+    {
+        fprintf(stderr, "Usage: bench-parallel [--threads N] <nodes> [balanced|skewed|random|caterpillar]\n");
+        return EXIT_FAILURE;
+    }
+
+    size_t max_threads = ParallelThreads();
+
+    size_t n_nodes = strtoul(argv[0], NULL, 10);
+    ASSERT(n_nodes, return EXIT_FAILURE);
+
+    size_t threads[PARALLEL_MAX_THREADS] = {};
+    size_t n_threads = 0;
+
+    for(size_t count = 1; count < max_threads; count *= 2) threads[n_threads++] = count;
+    threads[n_threads++] = max_threads;
+
+    int status = EXIT_SUCCESS;
+
+    for(int shape = 0; shape < SHAPE_COUNT && status == EXIT_SUCCESS; shape++)
+    {
+        if(argc == 2 && strcmp(argv[1], SHAPE_NAMES[shape]) != 0) continue;
+
+        status = BenchShapeRun((BenchShape)shape, n_nodes, threads, n_threads);
+    }
+
+    return status;
+}
@@ -0,0 +1,557 @@
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#include "../include/profile.h"
+#include "../include/session.h"
+#include "../include/trace.h"
+
+const size_t BENCH_LAYOUT_ROUNDS = 10;
+
+static void ProfileFileName(char *file_name, const char *const data_base)
+{
+    snprintf(file_name, MAX_STR_LEN, "%s%s", data_base, PROFILE_SUFFIX);
+}
+
+// One line per visited node: the count, a tab and the path from the root in diff's n/y letters.
+// Learning only splits leaves, so the paths of an older tree still lead to the same questions.
+int ProfileLoad(Tree *tree, const char *const data_base)
+{
+    ASSERT(tree && tree->root, return EXIT_FAILURE);
+    ASSERT(data_base, return EXIT_FAILURE);
+
+    char file_name[MAX_STR_LEN] = {};
+    ProfileFileName(file_name, data_base);
+
+    FILE *file = fopen(file_name, "rb");
+    if(!file)
+    {
+        LOG("No profile \"%s\".\n", file_name);
+        return EXIT_FAILURE;
+    }
+
+    char  *line     = NULL;
+    size_t line_cap = 0;
+
+    size_t applied = 0;
+    size_t stale   = 0;
+
+    for(ssize_t len = 0; (len = getline(&line, &line_cap, file)) > 0; )
+    {
+        char    *path   = NULL;
+        uint64_t visits = strtoull(line, &path, 10);
+
+        Node *tree_node = (path != line && *path == '\t') ? tree->root : NULL;
+        if(tree_node) path++;
+
+        for(; tree_node && (*path == 'n' || *path == 'y'); path++)
+        {
+            tree_node = (*path == 'y') ? tree_node->right : tree_node->left;
+        }
+
+        if(tree_node && (*path == '\n' || *path == '\0') && !(tree_node->flags & NODE_STATIC))
+        {
+            tree_node->visits += visits;
+            applied++;
+        }
+        else
+        {
+            stale++;
+        }
+    }
+
+    free(line);
+    fclose(file);
+
+    LOG("Profile \"%s\": %zu nodes, %zu stale.\n", file_name, applied, stale);
+
+    return EXIT_SUCCESS;
+}
+
+struct ProfileDump
+{
+    FILE *file;
+    char *path;
+};
+
+// Every game that reaches a node passes its parent, so an unvisited node ends the walk.
+// A node`s depth is its frame index and its state counts the children gone into.
+static int SubTreeProfileDump(ProfileDump *dump, Node *const tree_node)
+{
+    if(!tree_node || !tree_node->visits) return EXIT_SUCCESS;
+
+    NodeStack stack  = {};
+    int       status = NodeStackPush(&stack, tree_node);
+
+    while(status == EXIT_SUCCESS && stack.size)
+    {
+        NodeFrame *frame = &stack.frames[stack.size - 1];
+        Node      *node  = frame->node;
+        size_t     depth = stack.size - 1;
+
+        if(frame->state == 0) fprintf(dump->file, "%" PRIu64 "\t%.*s\n", node->visits, (int)depth, dump->path);
+
+        if(frame->state == 2)
+        {
+            stack.size--;
+            continue;
+        }
+
+        dump->path[depth] = (frame->state++ == 0) ? 'n' : 'y';
+
+        Node *next = (frame->state == 1) ? node->left : node->right;
+
+        if(next && next->visits) status = NodeStackPush(&stack, next);
+    }
+
+    NodeStackDtor(&stack);
+
+    return status;
+}
+
+int ProfileSave(Tree *const tree, const char *const data_base)
+{
+    ASSERT(tree && tree->root, return EXIT_FAILURE);
+    ASSERT(data_base, return EXIT_FAILURE);
+
+    TRACE_SPAN(span, "ProfileSave");
+
+    char file_name[MAX_STR_LEN] = {};
+    char tmp_name [MAX_STR_LEN] = {};
+
+    ProfileFileName(file_name, data_base);
+    snprintf(tmp_name, sizeof(tmp_name), "%s%s.tmp", data_base, PROFILE_SUFFIX);
+
+    ProfileDump dump = {fopen(tmp_name, "wb"), (char *)calloc(tree->size + 1, sizeof(char))};
+    ASSERT(dump.path, if(dump.file) fclose(dump.file); return EXIT_FAILURE);
+
+    if(!dump.file)
+    {
+        LOG("Can`t write profile \"%s\".\n", file_name);
+
+        free(dump.path);
+        return EXIT_FAILURE;
+    }
+
+    int status = SubTreeProfileDump(&dump, tree->root);
+
+    free(dump.path);
+
+    if(fclose(dump.file) != 0 || status != EXIT_SUCCESS || rename(tmp_name, file_name) != 0)
+    {
+        LOG("Can`t write profile \"%s\".\n", file_name);
+
+        unlink(tmp_name);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+
+struct Relayout
+{
+    Node  *nodes;
+    size_t count;
+
+    char  *labels;
+    size_t labels_used;
+};
+
+// Shared nodes are reachable from other versions or sessions that would keep the old copies.
+static bool MeasureSubTree(Node *const tree_node, size_t *count, size_t *label_bytes)
+{
+    NodeStack stack      = {};
+    bool      measurable = true;
+
+    if(tree_node) ASSERT(NodeStackPush(&stack, tree_node) == EXIT_SUCCESS, return false);
+
+    while(measurable && stack.size)
+    {
+        Node *node = stack.frames[--stack.size].node;
+
+        if(node->refs || (node->flags & NODE_STATIC))
+        {
+            measurable = false;
+            break;
+        }
+
+        (*count)++;
+        *label_bytes += strlen(node->data) + 1;
+
+        if(node->left ) ASSERT(NodeStackPush(&stack, node->left ) == EXIT_SUCCESS, measurable = false);
+        if(node->right) ASSERT(NodeStackPush(&stack, node->right) == EXIT_SUCCESS, measurable = false);
+    }
+
+    NodeStackDtor(&stack);
+
+    return measurable;
+}
+
+// The copy keeps the original children until they are placed in turn.
+static Node *PlaceNode(Relayout *relayout, const Node *const tree_node)
+{
+    Node *copy = &relayout->nodes[relayout->count++];
+    *copy = *tree_node;
+
+    size_t len = strlen(tree_node->data) + 1;
+
+    copy->data = (char *)memcpy(relayout->labels + relayout->labels_used, tree_node->data, len);
+    relayout->labels_used += len;
+
+    copy->flags = NODE_ARENA | NODE_SHARED_DATA;
+    if(tree_node->right && NodeLikelyChild(tree_node) == tree_node->right) copy->flags |= NODE_HOT_RIGHT;
+
+    return copy;
+}
+
+// Preorder with the likely child first: every hot root-to-leaf path becomes one run
+// of nodes and one run of labels, and the likely next step is the next cache line.
+// State counts the children placed.
+static int PlaceSubTree(Relayout *relayout, const Node *const tree_node, Node **root)
+{
+    *root = PlaceNode(relayout, tree_node);
+
+    NodeStack stack  = {};
+    int       status = NodeStackPush(&stack, *root);
+
+    while(status == EXIT_SUCCESS && stack.size)
+    {
+        NodeFrame *frame = &stack.frames[stack.size - 1];
+        Node      *copy  = frame->node;
+
+        if(frame->state == 2)
+        {
+            stack.size--;
+            continue;
+        }
+
+        bool   hot_right = copy->flags & NODE_HOT_RIGHT;
+        Node **child     = ((frame->state++ == 0) == hot_right) ? &copy->right : &copy->left;
+
+        if(*child)
+        {
+            *child = PlaceNode(relayout, *child);
+            status = NodeStackPush(&stack, *child);
+        }
+    }
+
+    NodeStackDtor(&stack);
+
+    return status;
+}
+
+// Labels, hashes and generations are copied as they are, so cached paths stay valid.
+int TreeRelayout(Tree *tree)
+{
+    ASSERT(tree && tree->root, return EXIT_FAILURE);
+    ASSERT(!tree->history && !tree->read_only, return EXIT_FAILURE);
+
+    TRACE_SPAN(span, "TreeRelayout");
+
+    size_t count       = 0;
+    size_t label_bytes = 0;
+
+    if(!MeasureSubTree(tree->root, &count, &label_bytes))
+    {
+        LOG("Relayout skipped: the tree shares nodes.\n");
+        return EXIT_FAILURE;
+    }
+
+    if(!tree->arena) tree->arena = ArenaCtor();
+    ASSERT(tree->arena, return EXIT_FAILURE);
+
+    Relayout relayout = {};
+
+    relayout.nodes  = (Node *)ArenaAllocAligned(tree->arena, count * sizeof(Node), RELAYOUT_ALIGN);
+    relayout.labels = (char *)ArenaAllocAligned(tree->arena, label_bytes, 1);
+    ASSERT(relayout.nodes && relayout.labels, return EXIT_FAILURE);
+
+    Node *root = NULL;
+
+    // Nodes placed before a failure stay unused in the arena until it is freed.
+    ASSERT(PlaceSubTree(&relayout, tree->root, &root) == EXIT_SUCCESS, return EXIT_FAILURE);
+
+    METRICS_ADD(COUNTER_NODES, (int64_t)count);
+
+    SubTreeRelease(tree->root);
+    tree->root = root;
+
+    TraceSpanInt(&span, "nodes", (long long)count);
+
+    return EXIT_SUCCESS;
+}
+
+
+struct LayoutTrace
+{
+    Stack steps;  // directions of every recorded game, back to back
+    Stack ends;   // where each game ends in steps
+};
+
+struct TraceClient
+{
+    Stack path;
+    bool  asked;      // the last line the client got was a question
+    bool  uncertain;  // the game took a "probably" or "don't know", so it has no single path
+};
+
+static TraceClient *TraceClientAt(TraceClient **clients, size_t *n_clients, size_t id)
+{
+    if(id >= *n_clients)
+    {
+        size_t n_new = 2 * id + 1;
+
+        TraceClient *clients_r = (TraceClient *)realloc(*clients, n_new * sizeof(TraceClient));
+        ASSERT(clients_r, return NULL);
+
+        for(size_t i = *n_clients; i < n_new; i++) clients_r[i] = {StackCtor(), false, false};
+
+        *clients   = clients_r;
+        *n_clients = n_new;
+    }
+
+    return &(*clients)[id];
+}
+
+static void EndTraceGame(LayoutTrace *trace, TraceClient *client)
+{
+    if(client->path.size && !client->uncertain)
+    {
+        for(size_t i = 0; i < client->path.size; i++) PushStack(&trace->steps, client->path.data[i]);
+
+        PushStack(&trace->ends, (data_t)trace->steps.size);
+    }
+
+    client->path.size = 0;
+    client->uncertain = false;
+}
+
+// Takes the answers to QUESTION prompts from a "serve --record" file; a game ends at its guess.
+static int ReadLayoutTrace(const char *const record_name, LayoutTrace *trace)
+{
+    FILE *record = fopen(record_name, "rb");
+    if(!record)
+    {
+        fprintf(stderr, "Can`t open \"%s\".\n", record_name);
+        return EXIT_FAILURE;
+    }
+
+    TraceClient *clients   = NULL;
+    size_t       n_clients = 0;
+
+    char  *line     = NULL;
+    size_t line_cap = 0;
+
+    int status = EXIT_SUCCESS;
+
+    for(ssize_t len = 0; status == EXIT_SUCCESS && (len = getline(&line, &line_cap, record)) > 0; )
+    {
+        line[strcspn(line, "\n")] = '\0';
+
+        char  *text = NULL;
+        size_t id   = strtoul(line + 1, &text, 10);
+
+        if(*text == ' ') text++;
+
+        TraceClient *client = TraceClientAt(&clients, &n_clients, id);
+        ASSERT(client, status = EXIT_FAILURE; break);
+
+        switch(line[0])
+        {
+            case 'O':
+            {
+                bool is_question = (strncmp(text, "QUESTION ", 9) == 0);
+
+                if(!is_question && strncmp(text, "ERROR ", 6) != 0) EndTraceGame(trace, client);
+
+                client->asked = is_question;
+                break;
+            }
+            case 'I':
+            {
+                int likelihood = client->asked ? ParseLikelihood(text) : -1;
+
+                if(likelihood == 0 || likelihood == LIKELIHOOD_YES) PushStack(&client->path, likelihood == LIKELIHOOD_YES);
+                else if(likelihood > 0)                             client->uncertain = true;
+
+                client->asked = false;
+                break;
+            }
+            case 'D':
+            {
+                EndTraceGame(trace, client);
+                break;
+            }
+            default: break;
+        }
+    }
+
+    for(size_t i = 0; i < n_clients; i++) StackDtor(&clients[i].path);
+
+    free(clients);
+    free(line);
+    fclose(record);
+
+    return status;
+}
+
+enum WalkMode
+{
+    WALK_COUNT,
+    WALK_PLAIN,
+    WALK_PREFETCH
+};
+
+static volatile char LABEL_SINK = 0;
+
+// Every step reads the question label, as a game prints it before waiting for the answer.
+static uint64_t WalkLayoutTrace(Tree *tree, const LayoutTrace *trace, WalkMode mode)
+{
+    uint64_t steps = 0;
+    size_t   start = 0;
+
+    for(size_t game = 0; game < trace->ends.size; game++)
+    {
+        size_t end = (size_t)trace->ends.data[game];
+
+        Node *tree_node = tree->root;
+
+        for(size_t i = start; i <= end && tree_node; i++)
+        {
+            if(mode == WALK_COUNT)    NodeVisit(tree_node);
+            if(mode == WALK_PREFETCH) NodePrefetch(tree_node);
+
+            LABEL_SINK = tree_node->data[0];
+            steps++;
+
+            if(i == end) break;
+
+            tree_node = trace->steps.data[i] ? tree_node->right : tree_node->left;
+        }
+
+        start = end;
+    }
+
+    return steps;
+}
+
+// Hardware counters are often missing in containers and VMs; the bench then reports time only.
+static int OpenCacheMisses(void)
+{
+    perf_event_attr attr = {};
+
+    attr.type           = PERF_TYPE_HARDWARE;
+    attr.size           = sizeof(attr);
+    attr.config         = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled       = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+struct LayoutRun
+{
+    double ns_per_step;
+    double misses_per_step;  // negative without hardware counters
+};
+
+static LayoutRun RunLayout(Tree *tree, const LayoutTrace *trace, size_t rounds, WalkMode mode, int misses_fd)
+{
+    if(misses_fd >= 0)
+    {
+        ioctl(misses_fd, PERF_EVENT_IOC_RESET , 0);
+        ioctl(misses_fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    uint64_t steps = 0;
+    uint64_t start = MetricsNow();
+
+    for(size_t round = 0; round < rounds; round++) steps += WalkLayoutTrace(tree, trace, mode);
+
+    double elapsed = (double)(MetricsNow() - start);
+
+    uint64_t misses  = 0;
+    bool     counted = false;
+
+    if(misses_fd >= 0)
+    {
+        ioctl(misses_fd, PERF_EVENT_IOC_DISABLE, 0);
+
+        counted = (read(misses_fd, &misses, sizeof(misses)) == (ssize_t)sizeof(misses));
+    }
+
+    LayoutRun run = {elapsed / (double)steps, counted ? (double)misses / (double)steps : -1};
+
+    return run;
+}
+
+static void PrintLayoutRun(const char *const name, LayoutRun run)
+{
+    printf("%-10s ns per step:     %.1f\n", name, run.ns_per_step);
+
+    if(run.misses_per_step >= 0) printf("%-10s misses per step: %.3f\n", name, run.misses_per_step);
+    else                         printf("%-10s misses per step: n/a\n" , name);
+}
+
+int BenchLayoutCommand(int argc, char *argv[])
+{
+    if(argc != 2 && argc != 3)
+    {
+        fprintf(stderr, "Usage: bench-layout <data_base> <record> [rounds]\n");
+        return EXIT_FAILURE;
+    }
+
+    size_t rounds = (argc == 3) ? strtoul(argv[2], NULL, 10) : BENCH_LAYOUT_ROUNDS;
+    ASSERT(rounds, return EXIT_FAILURE);
+
+    Tree tree = ReadTree(argv[0]);
+    ASSERT(tree.root, return EXIT_FAILURE);
+
+    LayoutTrace trace = {StackCtor(), StackCtor()};
+
+    if(ReadLayoutTrace(argv[1], &trace) != EXIT_SUCCESS || trace.ends.size == 0)
+    {
+        fprintf(stderr, "No games in \"%s\".\n", argv[1]);
+
+        StackDtor(&trace.steps);
+        StackDtor(&trace.ends);
+        TreeDtor(&tree, tree.root);
+
+        return EXIT_FAILURE;
+    }
+
+    // One pass collects what the live counters would have, then the same trace is replayed.
+    uint64_t steps = WalkLayoutTrace(&tree, &trace, WALK_COUNT);
+
+    int misses_fd = OpenCacheMisses();
+
+    LayoutRun loaded   = RunLayout(&tree, &trace, rounds, WALK_PLAIN, misses_fd);
+    int       status   = TreeRelayout(&tree);
+    LayoutRun relayout = RunLayout(&tree, &trace, rounds, WALK_PLAIN   , misses_fd);
+    LayoutRun prefetch = RunLayout(&tree, &trace, rounds, WALK_PREFETCH, misses_fd);
+
+    if(misses_fd >= 0) close(misses_fd);
+
+    printf("games:                     %zu\n"
+           "steps per round:           %" PRIu64 "\n"
+           "rounds:                    %zu\n"
+           "tree size:                 %zu\n",
+           trace.ends.size, steps, rounds, tree.size);
+
+    PrintLayoutRun("loaded"  , loaded  );
+    PrintLayoutRun("relayout", relayout);
+    PrintLayoutRun("prefetch", prefetch);
+
+    StackDtor(&trace.steps);
+    StackDtor(&trace.ends);
+
+    TreeDtor(&tree, tree.root);
+
+    return status;
+}
@@ -0,0 +1,632 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/inotify.h>
+#include <sys/wait.h>
+
+#include "../include/replica.h"
+#include "../include/session.h"
+#include "../include/history.h"
+#include "../include/trace.h"
+
+const size_t FEED_CHUNK = 4096;
+
+// Wall clock, so a follower in another process can tell how old a record is.
+static uint64_t FeedNow(void)
+{
+    timespec now = {};
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+// Labels come from players, so a tab or a backslash in one is escaped.
+static void WriteLabel(FILE *file, const char *label)
+{
+    fputc('\t', file);
+
+    for(; *label; label++)
+    {
+        if     (*label == '\t') fputs("\\t" , file);
+        else if(*label == '\\') fputs("\\\\", file);
+        else                    fputc(*label, file);
+    }
+}
+
+static char *ReadLabel(char **cursor)
+{
+    char *label = *cursor;
+    char *out   = label;
+    char *in    = label;
+
+    for(; *in && *in != '\t'; in++)
+    {
+        if(*in == '\\' && (in[1] == 't' || in[1] == '\\')) *out++ = (*++in == 't') ? '\t' : '\\';
+        else                                                *out++ = *in;
+    }
+
+    *cursor = *in ? in + 1 : in;
+    *out    = '\0';
+
+    return label;
+}
+
+int FeedAppend(Feed *feed, FeedKind kind, uint64_t hash, const Stack *path, const char *const answer, const char *const property)
+{
+    ASSERT(feed, return EXIT_FAILURE);
+    ASSERT(kind != FEED_SPLIT || (path && answer && property), return EXIT_FAILURE);
+
+    char  *text = NULL;
+    size_t size = 0;
+
+    FILE *text_file = open_memstream(&text, &size);
+    ASSERT(text_file, return EXIT_FAILURE);
+
+    fprintf(text_file, "%c\t%" PRIu64 "\t%016" PRIx64 "\t%" PRIu64, (char)kind, feed->seq + 1, hash, FeedNow());
+
+    if(kind == FEED_SPLIT)
+    {
+        fputc('\t', text_file);
+        for(size_t i = 0; i < path->size; i++) fputc(path->data[i] ? '1' : '0', text_file);
+
+        WriteLabel(text_file, answer);
+        WriteLabel(text_file, property);
+    }
+
+    fputc('\n', text_file);
+
+    int status = (fclose(text_file) == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    // One write per record: appends to a regular file never interleave, so a follower
+    // only ever sees whole records or the start of the last one.
+    size_t written = 0;
+
+    while(status == EXIT_SUCCESS && written < size)
+    {
+        ssize_t got = write(feed->fd, text + written, size - written);
+
+        if(got < 0 && errno == EINTR) continue;
+        if(got <= 0) status = EXIT_FAILURE;
+        else         written += (size_t)got;
+    }
+
+    free(text);
+
+    if(status != EXIT_SUCCESS)
+    {
+        LOG("Can`t append to the change feed.\n");
+        return EXIT_FAILURE;
+    }
+
+    feed->seq++;
+
+    return EXIT_SUCCESS;
+}
+
+struct FeedHead
+{
+    char     kind;
+    uint64_t seq;
+    uint64_t hash;
+    uint64_t time_ns;
+};
+
+static bool ParseHead(char **cursor, FeedHead *head)
+{
+    int len = 0;
+
+    if(sscanf(*cursor, "%c\t%" SCNu64 "\t%" SCNx64 "\t%" SCNu64 "%n", &head->kind, &head->seq, &head->hash, &head->time_ns, &len) != 4)
+    {
+        return false;
+    }
+
+    *cursor += len;
+    if(**cursor == '\t') (*cursor)++;
+
+    return true;
+}
+
+// A restarted primary continues the sequence. It writes a base record first unless it starts
+// from the very tree the feed ends with, and a follower that is not there stops.
+Feed *FeedOpen(Tree *tree, const char *const file_name)
+{
+    ASSERT(tree && tree->root, return NULL);
+    ASSERT(file_name, return NULL);
+
+    TRACE_SPAN(span, "FeedOpen");
+    TraceSpanStr(&span, "file", file_name);
+
+    int fd = open(file_name, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(fd < 0)
+    {
+        LOG("Can`t open the change feed \"%s\".\n", file_name);
+        return NULL;
+    }
+
+    if(flock(fd, LOCK_EX | LOCK_NB) != 0)
+    {
+        LOG("\"%s\" is fed by another primary.\n", file_name);
+
+        close(fd);
+        return NULL;
+    }
+
+    Feed *feed = (Feed *)calloc(1, sizeof(Feed));
+    ASSERT(feed, close(fd); return NULL);
+
+    feed->fd = fd;
+
+    FILE  *file      = fopen(file_name, "rb");
+    char  *line      = NULL;
+    size_t capacity  = 0;
+    FeedHead last    = {};
+
+    while(file && getline(&line, &capacity, file) > 0)
+    {
+        char    *cursor = line;
+        FeedHead head   = {};
+
+        if(ParseHead(&cursor, &head)) last = head;
+    }
+
+    free(line);
+    if(file) fclose(file);
+
+    feed->seq = last.seq;
+
+    if((!last.seq || last.hash != tree->root->hash) && FeedAppend(feed, FEED_BASE, tree->root->hash) != EXIT_SUCCESS)
+    {
+        FeedClose(feed);
+        return NULL;
+    }
+
+    TraceSpanInt(&span, "seq", (long long)feed->seq);
+
+    tree->feed = feed;
+
+    return feed;
+}
+
+void FeedClose(Feed *feed)
+{
+    if(!feed) return;
+
+    close(feed->fd);
+    free(feed);
+}
+
+
+Follower *FollowerCtor(Tree *tree, const char *const feed_name)
+{
+    ASSERT(tree && tree->root, return NULL);
+    ASSERT(feed_name, return NULL);
+
+    Follower *follower = (Follower *)calloc(1, sizeof(Follower));
+    ASSERT(follower, return NULL);
+
+    follower->tree      = tree;
+    follower->feed_name = feed_name;
+
+    follower->fd       = open(feed_name, O_RDONLY | O_CREAT | O_CLOEXEC, 0644);
+    follower->watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if(follower->fd < 0 || follower->watch_fd < 0 || inotify_add_watch(follower->watch_fd, feed_name, IN_MODIFY) < 0)
+    {
+        LOG("Can`t follow the change feed \"%s\".\n", feed_name);
+
+        FollowerDtor(follower);
+        return NULL;
+    }
+
+    FollowerPoll(follower);
+
+    return follower;
+}
+
+void FollowerReport(const Follower *follower, FILE *out_file)
+{
+    ASSERT(follower && out_file, return);
+
+    const FollowerStats *stats = &follower->stats;
+
+    fprintf(out_file, "follower \"%s\": at %" PRIu64 "%s, %zu applied, %zu skipped, lag max %.3f ms, mean %.3f ms\n",
+                      follower->feed_name, follower->seq,
+                      follower->diverged ? " (diverged)" : follower->synced ? "" : " (not synced)",
+                      stats->applied, stats->skipped,
+                      (double)stats->max_lag_ns * 1e-6,
+                      stats->applied ? (double)stats->sum_lag_ns / (double)stats->applied * 1e-6 : 0.0);
+}
+
+void FollowerDtor(Follower *follower)
+{
+    if(!follower) return;
+
+    FollowerReport(follower, LOG_FILE);
+
+    if(follower->fd       >= 0) close(follower->fd);
+    if(follower->watch_fd >= 0) close(follower->watch_fd);
+
+    free(follower->line);
+    free(follower);
+}
+
+static int ApplySplit(Tree *tree, char *cursor)
+{
+    char *path_str = ReadLabel(&cursor);
+    char *answer   = ReadLabel(&cursor);
+    char *property = ReadLabel(&cursor);
+
+    if(!*answer || !*property) return EXIT_FAILURE;
+
+    Stack path = StackCtor();
+    ASSERT(path.data, return EXIT_FAILURE);
+
+    for(const char *step = path_str; *step; step++) PushStack(&path, *step == '1');
+
+    Node *leaf = TreeUnsharePath(tree, path.data, path.size);
+
+    int status = (leaf && !leaf->left && !leaf->right) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    if(status == EXIT_SUCCESS) AddAnswer(tree, &path, leaf, answer, property);
+
+    StackDtor(&path);
+
+    return status;
+}
+
+static void FollowerDiverged(Follower *follower, uint64_t seq, const char *reason)
+{
+    follower->diverged = true;
+
+    LOG("Follower of \"%s\" stopped at record %" PRIu64 ": %s.\n", follower->feed_name, seq, reason);
+}
+
+// Until the follower finds its snapshot in the feed it only skips records; the first one
+// that leaves the primary with the same root is where the snapshot was taken.
+static void FollowerApply(Follower *follower, char *line)
+{
+    Tree    *tree   = follower->tree;
+    char    *cursor = line;
+    FeedHead head   = {};
+
+    if(follower->diverged) return;
+
+    if(!ParseHead(&cursor, &head)) return FollowerDiverged(follower, follower->seq + 1, "unreadable record");
+
+    if(!follower->synced)
+    {
+        if(head.hash != tree->root->hash)
+        {
+            follower->stats.skipped++;
+            return;
+        }
+
+        follower->synced = true;
+        follower->seq    = head.seq;
+
+        return;
+    }
+
+    if(head.seq <= follower->seq) return;
+    if(head.seq != follower->seq + 1) return FollowerDiverged(follower, head.seq, "records are missing");
+
+    int status = EXIT_SUCCESS;
+
+    switch(head.kind)
+    {
+        case FEED_BASE:
+            break;
+        case FEED_SPLIT:
+            status = ApplySplit(tree, cursor);
+            break;
+        case FEED_UNDO:
+            status = tree->history ? HistoryUndo(tree) : EXIT_FAILURE;
+            break;
+        case FEED_REDO:
+            status = tree->history ? HistoryRedo(tree) : EXIT_FAILURE;
+            break;
+        default:
+            status = EXIT_FAILURE;
+            break;
+    }
+
+    if(status != EXIT_SUCCESS)           return FollowerDiverged(follower, head.seq, "the change does not apply");
+    if(tree->root->hash != head.hash)    return FollowerDiverged(follower, head.seq, "root hash differs");
+
+    uint64_t lag = FeedNow() - head.time_ns;
+
+    follower->seq = head.seq;
+    follower->stats.applied++;
+    follower->stats.sum_lag_ns += lag;
+
+    if(lag > follower->stats.max_lag_ns) follower->stats.max_lag_ns = lag;
+
+#ifdef METRICS
+    MetricsRecord(OP_REPLICATION_LAG, lag);
+#endif
+}
+
+static int GrowLine(Follower *follower, size_t size)
+{
+    if(size <= follower->line_capacity) return EXIT_SUCCESS;
+
+    size_t capacity = follower->line_capacity ? 2 * follower->line_capacity : FEED_CHUNK;
+    while(capacity < size) capacity *= 2;
+
+    char *line_r = (char *)realloc(follower->line, capacity);
+    ASSERT(line_r, return EXIT_FAILURE);
+
+    follower->line          = line_r;
+    follower->line_capacity = capacity;
+
+    return EXIT_SUCCESS;
+}
+
+// Reads whatever the feed gained since the last call; never blocks.
+int FollowerPoll(Follower *follower)
+{
+    ASSERT(follower, return EXIT_FAILURE);
+
+    char events[FEED_CHUNK] = {};
+    while(read(follower->watch_fd, events, sizeof(events)) > 0) {}
+
+    while(true)
+    {
+        if(GrowLine(follower, follower->line_len + FEED_CHUNK + 1) != EXIT_SUCCESS) return EXIT_FAILURE;
+
+        ssize_t got = read(follower->fd, follower->line + follower->line_len, FEED_CHUNK);
+        if(got < 0 && errno == EINTR) continue;
+        if(got <= 0) return (got == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+        follower->line_len += (size_t)got;
+        follower->line[follower->line_len] = '\0';
+
+        char *line = follower->line;
+        char *end  = NULL;
+
+        while((end = strchr(line, '\n')) != NULL)
+        {
+            *end = '\0';
+
+            FollowerApply(follower, line);
+
+            line = end + 1;
+        }
+
+        follower->line_len -= (size_t)(line - follower->line);
+        memmove(follower->line, line, follower->line_len);
+    }
+}
+
+
+struct ReplicaResult
+{
+    size_t   applied;
+    bool     diverged;
+    uint64_t p50_ns;
+    uint64_t p99_ns;
+    uint64_t max_ns;
+    double   apply_s;  // first to last applied record
+};
+
+static int CompareLags(const void *lhs, const void *rhs)
+{
+    uint64_t a = *(const uint64_t *)lhs;
+    uint64_t b = *(const uint64_t *)rhs;
+
+    return (a > b) - (a < b);
+}
+
+// A follower process: syncs on the base record, then records the lag of every change.
+static int RunBenchFollower(const char *const data_base, size_t changes, int ready_fd, int result_fd)
+{
+    Tree tree = ReadTree(data_base);
+    ASSERT(tree.root, return EXIT_FAILURE);
+
+    tree.read_only = true;
+
+    Follower *follower = FollowerCtor(&tree, REPLICATION_BENCH_FEED);
+    uint64_t *lags     = (uint64_t *)calloc(changes + 1, sizeof(uint64_t));
+
+    ReplicaResult result = {};
+    int           status = (follower && lags) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    if(status == EXIT_SUCCESS && write(ready_fd, "r", 1) != 1) status = EXIT_FAILURE;
+
+    uint64_t first_ns = 0;
+    uint64_t last_ns  = 0;
+
+    while(status == EXIT_SUCCESS && follower->stats.applied < changes && !follower->diverged)
+    {
+        pollfd watch = {follower->watch_fd, POLLIN, 0};
+        if(poll(&watch, 1, 5000) <= 0) break;
+
+        size_t   applied  = follower->stats.applied;
+        uint64_t lag_sum  = follower->stats.sum_lag_ns;
+
+        FollowerPoll(follower);
+
+        if(follower->stats.applied == applied) continue;
+
+        last_ns = FeedNow();
+        if(!first_ns) first_ns = last_ns;
+
+        // Records of one poll share their mean lag; a poll rarely picks up more than one.
+        uint64_t mean = (follower->stats.sum_lag_ns - lag_sum) / (follower->stats.applied - applied);
+
+        for(size_t i = applied; i < follower->stats.applied && i < changes; i++) lags[i] = mean;
+    }
+
+    if(follower)
+    {
+        result.applied  = follower->stats.applied;
+        result.diverged = follower->diverged;
+        result.max_ns   = follower->stats.max_lag_ns;
+        result.apply_s  = (double)(last_ns - first_ns) * 1e-9;
+
+        if(result.applied)
+        {
+            qsort(lags, result.applied, sizeof(uint64_t), CompareLags);
+
+            result.p50_ns = lags[result.applied / 2];
+            result.p99_ns = lags[(result.applied * 99) / 100];
+        }
+    }
+
+    if(write(result_fd, &result, sizeof(result)) != (ssize_t)sizeof(result)) status = EXIT_FAILURE;
+
+    free(lags);
+    FollowerDtor(follower);
+
+    tree.read_only = false;
+    TreeDtor(&tree, tree.root);
+
+    return status;
+}
+
+static Node *RandomLeaf(Tree *tree, Stack *path, unsigned *seed)
+{
+    Node *tree_node = tree->root;
+
+    path->size = 0;
+
+    while(tree_node->right)
+    {
+        bool right = rand_r(seed) & 1;
+
+        PushStack(path, right);
+        tree_node = right ? tree_node->right : tree_node->left;
+    }
+
+    return tree_node;
+}
+
+static int RunBenchPrimary(Tree *tree, size_t changes, double rate, double *elapsed_s)
+{
+    Stack path = StackCtor();
+    ASSERT(path.data, return EXIT_FAILURE);
+
+    unsigned seed  = 42;
+    uint64_t start = FeedNow();
+
+    char answer  [MAX_DATA_LEN] = {};
+    char property[MAX_DATA_LEN] = {};
+
+    for(size_t i = 0; i < changes; i++)
+    {
+        if(rate > 0)
+        {
+            uint64_t due = start + (uint64_t)((double)i / rate * 1e9);
+            uint64_t now = FeedNow();
+
+            if(due > now) usleep((useconds_t)((due - now) / 1000));
+        }
+
+        RandomLeaf(tree, &path, &seed);
+
+        Node *leaf = TreeUnsharePath(tree, path.data, path.size);
+        ASSERT(leaf, StackDtor(&path); return EXIT_FAILURE);
+
+        snprintf(answer  , sizeof(answer  ), "bench answer %zu"  , i);
+        snprintf(property, sizeof(property), "bench question %zu", i);
+
+        AddAnswer(tree, &path, leaf, answer, property);
+    }
+
+    *elapsed_s = (double)(FeedNow() - start) * 1e-9;
+
+    StackDtor(&path);
+
+    return EXIT_SUCCESS;
+}
+
+int BenchReplicationCommand(int argc, char *argv[])
+{
+    if(argc < 2 || argc > 4)
+    {
+        fprintf(stderr, "Usage: bench-replication <data_base> <changes> [followers] [changes_per_second]\n");
+        return EXIT_FAILURE;
+    }
+
+    size_t changes   = strtoul(argv[1], NULL, 10);
+    size_t followers = (argc > 2) ? strtoul(argv[2], NULL, 10) : 1;
+    double rate      = (argc > 3) ? strtod (argv[3], NULL)     : 0;
+
+    ASSERT(changes && followers, return EXIT_FAILURE);
+
+    unlink(REPLICATION_BENCH_FEED);
+
+    Tree tree = ReadTree(argv[0]);
+    ASSERT(tree.root, return EXIT_FAILURE);
+
+    Feed *feed = FeedOpen(&tree, REPLICATION_BENCH_FEED);
+    ASSERT(feed, TreeDtor(&tree, tree.root); return EXIT_FAILURE);
+
+    int ready [2] = {-1, -1};
+    int result[2] = {-1, -1};
+    ASSERT(pipe(ready) == 0 && pipe(result) == 0, FeedClose(feed); TreeDtor(&tree, tree.root); return EXIT_FAILURE);
+
+    fflush(NULL);
+
+    size_t started = 0;
+
+    for(; started < followers; started++)
+    {
+        pid_t pid = fork();
+        if(pid < 0) break;
+
+        if(pid == 0)
+        {
+            close(ready[0]);
+            close(result[0]);
+
+            tree.feed = NULL;
+            FeedClose(feed);
+            TreeDtor(&tree, tree.root);
+
+            exit(RunBenchFollower(argv[0], changes, ready[1], result[1]));
+        }
+    }
+
+    close(ready[1]);
+    close(result[1]);
+
+    char byte = 0;
+    for(size_t i = 0; i < started; i++) ASSERT(read(ready[0], &byte, 1) == 1, break);
+
+    double elapsed_s = 0;
+    int    status    = RunBenchPrimary(&tree, changes, rate, &elapsed_s);
+
+    printf("primary: %zu changes to %zu nodes in %.3f s, %.0f changes/s\n",
+           changes, tree.size, elapsed_s, (double)changes / elapsed_s);
+
+    for(size_t i = 0; i < started; i++)
+    {
+        ReplicaResult replica = {};
+        if(read(result[0], &replica, sizeof(replica)) != (ssize_t)sizeof(replica)) break;
+
+        printf("follower: %zu applied%s, lag p50 %.3f ms, p99 %.3f ms, max %.3f ms, %.0f changes/s\n",
+               replica.applied, replica.diverged ? " (diverged)" : "",
+               (double)replica.p50_ns * 1e-6, (double)replica.p99_ns * 1e-6, (double)replica.max_ns * 1e-6,
+               replica.apply_s > 0 ? (double)replica.applied / replica.apply_s : 0.0);
+
+        if(replica.applied != changes) status = EXIT_FAILURE;
+    }
+
+    while(wait(NULL) > 0) {}
+
+    close(ready[0]);
+    close(result[0]);
+
+    tree.feed = NULL;
+    FeedClose(feed);
+    TreeDtor(&tree, tree.root);
+
+    return status;
+}
@@ -0,0 +1,793 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "../include/server.h"
+#include "../include/session.h"
+#include "../include/akinator.h"
+#include "../include/history.h"
+#include "../include/checkpoint.h"
+#include "../include/profile.h"
+#include "../include/replica.h"
+
+const int MAX_EVENTS = 256;
+
+struct Client
+{
+    int    fd;
+    size_t id;
+
+    GameSession game;
+    Tree        view;  // read-only version the game runs on, if opened
+
+    size_t in_len;
+    char   in[MAX_DATA_LEN];
+
+    size_t out_len;
+    char  *out;
+
+    Client *prev;
+    Client *next;
+};
+
+struct Server
+{
+    Tree *tree;
+
+    int epoll_fd;
+    int listen_fd;
+
+    Client *clients;
+
+    size_t games;
+    size_t learned;
+
+    size_t next_id;
+    FILE  *record;
+
+    size_t beam_width;
+};
+
+static volatile sig_atomic_t STOP_SERVER    = 0;
+static volatile sig_atomic_t EXPORT_METRICS = 0;
+
+static void StopServer(int)
+{
+    STOP_SERVER = 1;
+}
+
+static void RequestMetrics(int)
+{
+    EXPORT_METRICS = 1;
+}
+
+
+static int WatchClient(Server *server, Client *client, bool want_write)
+{
+    epoll_event event = {};
+    event.events   = want_write ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+    event.data.ptr = client;
+
+    return epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, client->fd, &event);
+}
+
+static int FlushClient(Server *server, Client *client)
+{
+    size_t sent = 0;
+
+    while(sent < client->out_len)
+    {
+        ssize_t written = send(client->fd, client->out + sent, client->out_len - sent, MSG_NOSIGNAL);
+        if(written < 0)
+        {
+            if(errno == EAGAIN) break;
+
+            return EXIT_FAILURE;
+        }
+
+        sent += (size_t)written;
+    }
+
+    memmove(client->out, client->out + sent, client->out_len - sent);
+    client->out_len -= sent;
+
+    return WatchClient(server, client, client->out_len != 0);
+}
+
+__attribute__((format(printf, 3, 4)))
+static int SendLine(Server *server, Client *client, const char *fmt, ...)
+{
+    char line[2 * MAX_STR_LEN] = {};
+
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(line, sizeof(line) - 1, fmt, args);
+    va_end(args);
+
+    ASSERT(len >= 0, return EXIT_FAILURE);
+    if((size_t)len > sizeof(line) - 2) len = (int)sizeof(line) - 2;
+
+    if(server->record) fprintf(server->record, "O %zu %.*s\n", client->id, len, line);
+
+    line[len++] = '\n';
+
+    if(client->out_len == 0)
+    {
+        ssize_t written = send(client->fd, line, (size_t)len, MSG_NOSIGNAL);
+        if(written == len) return EXIT_SUCCESS;
+
+        if(written < 0)
+        {
+            if(errno != EAGAIN) return EXIT_FAILURE;
+
+            written = 0;
+        }
+
+        memmove(line, line + written, (size_t)(len - written));
+        len -= (int)written;
+    }
+
+    char *out_r = (char *)realloc(client->out, client->out_len + (size_t)len);
+    ASSERT(out_r, return EXIT_FAILURE);
+
+    client->out = out_r;
+    memcpy(client->out + client->out_len, line, (size_t)len);
+    client->out_len += (size_t)len;
+
+    return WatchClient(server, client, true);
+}
+
+static int SendPrompt(Server *server, Client *client)
+{
+    Prompt prompt = GamePrompt(&client->game);
+
+    switch(prompt.kind)
+    {
+        case PROMPT_QUESTION:
+            return SendLine(server, client, "QUESTION %s", prompt.subject);
+        case PROMPT_GUESS:
+            return SendLine(server, client, "GUESS %s", prompt.subject);
+        case PROMPT_CORRECT_ANSWER:
+            return SendLine(server, client, "ANSWER %s", prompt.subject);
+        case PROMPT_PROPERTY:
+            return SendLine(server, client, "PROPERTY %s\t%s", prompt.subject, prompt.object);
+        default:
+            return EXIT_FAILURE;
+    }
+}
+
+static int StartClientGame(Server *server, Client *client)
+{
+    client->game = GameSessionCtor(client->view.root ? &client->view : server->tree, server->beam_width);
+    ASSERT(client->game.handle, return EXIT_FAILURE);
+
+    server->games++;
+
+    return SendPrompt(server, client);
+}
+
+
+static void CloseClient(Server *server, Client *client)
+{
+    if(server->record) fprintf(server->record, "D %zu\n", client->id);
+
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+    close(client->fd);
+
+    GameSessionDtor(&client->game);
+
+    if(client->view.root) HistoryClose(&client->view);
+
+    if(client->prev) client->prev->next = client->next;
+    else             server->clients    = client->next;
+
+    if(client->next) client->next->prev = client->prev;
+
+    free(client->out);
+    free(client);
+}
+
+static void AcceptClients(Server *server)
+{
+    while(true)
+    {
+        int fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd < 0) return;
+
+        Client *client = (Client *)calloc(1, sizeof(Client));
+        ASSERT(client, close(fd); continue);
+
+        client->fd   = fd;
+        client->id   = server->next_id++;
+        client->next = server->clients;
+
+        if(server->record) fprintf(server->record, "C %zu\n", client->id);
+
+        if(server->clients) server->clients->prev = client;
+        server->clients = client;
+
+        epoll_event event = {};
+        event.events   = EPOLLIN;
+        event.data.ptr = client;
+
+        if(epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0 ||
+           StartClientGame(server, client) != EXIT_SUCCESS)
+        {
+            CloseClient(server, client);
+        }
+    }
+}
+
+
+// "/undo", "/redo" and "/versions" act on the shared tree, "/version N" restarts
+// the client's game on a read-only copy of version N until that game ends.
+static int HandleVersionCommand(Server *server, Client *client, const char *command)
+{
+    Tree *tree = server->tree;
+
+    if(!tree->history) return SendLine(server, client, "ERROR Versions are off.");
+
+    if(strcmp(command, "/undo") == 0 || strcmp(command, "/redo") == 0)
+    {
+        int status = (command[1] == 'u') ? HistoryUndo(tree) : HistoryRedo(tree);
+
+        if(status != EXIT_SUCCESS) return SendLine(server, client, "ERROR Nothing to %s.", command + 1);
+
+        return SendLine(server, client, "VERSION %zu", HistoryCurrent(tree));
+    }
+
+    if(strcmp(command, "/versions") == 0)
+    {
+        const History *history = tree->history;
+
+        return SendLine(server, client, "VERSIONS %zu %zu %zu", history->first,
+                        history->first + history->count - 1, HistoryCurrent(tree));
+    }
+
+    char  *end     = NULL;
+    size_t version = (strncmp(command, "/version ", 9) == 0) ? strtoul(command + 9, &end, 10) : 0;
+
+    if(!end || *end != '\0') return SendLine(server, client, "ERROR Unknown command.");
+
+    Tree view = HistoryOpen(tree, version);
+    if(!view.root) return SendLine(server, client, "ERROR There is no version %zu.", version);
+
+    GameSessionDtor(&client->game);
+    if(client->view.root) HistoryClose(&client->view);
+
+    client->view = view;
+    client->game = GameSessionCtor(&client->view, server->beam_width);
+    ASSERT(client->game.handle, return EXIT_FAILURE);
+
+    server->games++;
+
+    return SendLine(server, client, "VERSION %zu", version);
+}
+
+static int HandleLine(Server *server, Client *client, char *line)
+{
+    size_t len = strlen(line);
+    if(len && line[len - 1] == '\r') line[len - 1] = '\0';
+
+    if(server->record) fprintf(server->record, "I %zu %s\n", client->id, line);
+
+    if(line[0] == '/')
+    {
+        if(HandleVersionCommand(server, client, line) != EXIT_SUCCESS) return EXIT_FAILURE;
+
+        return SendPrompt(server, client);
+    }
+
+    if(!GameAnswer(&client->game, line))
+    {
+        if(SendLine(server, client, "ERROR Try again.") != EXIT_SUCCESS) return EXIT_FAILURE;
+
+        return SendPrompt(server, client);
+    }
+
+    if(!IsGameOver(&client->game)) return SendPrompt(server, client);
+
+    GameResult result = GameSessionResult(&client->game);
+    GameSessionDtor(&client->game);
+
+    if(result == GAME_LEARNED) server->learned++;
+
+    if(client->view.root) HistoryClose(&client->view);
+
+    const char *outcome = (result == GAME_GUESSED) ? "GG" : (result == GAME_LOST) ? "LOST" : "LEARNED";
+
+    if(SendLine(server, client, "RESULT %s", outcome) != EXIT_SUCCESS) return EXIT_FAILURE;
+
+    return StartClientGame(server, client);
+}
+
+static int ReadClient(Server *server, Client *client)
+{
+    while(true)
+    {
+        ssize_t got = recv(client->fd, client->in + client->in_len, sizeof(client->in) - client->in_len - 1, 0);
+        if(got == 0) return EXIT_FAILURE;
+        if(got <  0) return (errno == EAGAIN) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+        client->in_len += (size_t)got;
+        client->in[client->in_len] = '\0';
+
+        char *line = client->in;
+        char *end  = NULL;
+
+        while((end = strchr(line, '\n')) != NULL)
+        {
+            *end = '\0';
+
+            if(HandleLine(server, client, line) != EXIT_SUCCESS) return EXIT_FAILURE;
+
+            line = end + 1;
+        }
+
+        client->in_len -= (size_t)(line - client->in);
+        memmove(client->in, line, client->in_len);
+
+        if(client->in_len == sizeof(client->in) - 1)
+        {
+            client->in_len = 0;
+
+            if(SendLine(server, client, "ERROR Line is too long.") != EXIT_SUCCESS) return EXIT_FAILURE;
+        }
+    }
+}
+
+
+static int ListenSocket(const char *const socket_path)
+{
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+
+    ASSERT(strlen(socket_path) < sizeof(addr.sun_path), return -1);
+    strcpy(addr.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    ASSERT(fd >= 0, return -1);
+
+    unlink(socket_path);
+
+    if(bind(fd, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0)
+    {
+        LOG("Can`t listen on \"%s\".\n", socket_path);
+
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int Serve(Tree *tree, const char *const socket_path, FILE *record, Checkpointer *checkpointer, size_t beam_width,
+          Follower *follower, bool save)
+{
+    TREE_VERIFICATION(tree, EXIT_FAILURE);
+
+    ASSERT(socket_path, return EXIT_FAILURE);
+
+    Server server = {tree, epoll_create1(EPOLL_CLOEXEC), ListenSocket(socket_path), NULL, 0, 0, 0, record, beam_width};
+    ASSERT(server.epoll_fd >= 0 && server.listen_fd >= 0, close(server.epoll_fd);
+                                                          close(server.listen_fd); return EXIT_FAILURE);
+
+    epoll_event event = {};
+    event.events   = EPOLLIN;
+    event.data.ptr = NULL;
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.listen_fd, &event);
+
+    if(follower)
+    {
+        event.data.ptr = follower;
+        epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, follower->watch_fd, &event);
+    }
+
+    struct sigaction action = {};
+    action.sa_handler = StopServer;
+    sigaction(SIGINT , &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    action.sa_handler = RequestMetrics;
+    sigaction(SIGUSR1, &action, NULL);
+
+    epoll_event events[MAX_EVENTS] = {};
+
+    while(!STOP_SERVER)
+    {
+        int timeout  = checkpointer ? CheckpointTimeoutMs(checkpointer) : -1;
+        int n_events = epoll_wait(server.epoll_fd, events, MAX_EVENTS, timeout);
+
+        if(EXPORT_METRICS)
+        {
+            EXPORT_METRICS = 0;
+
+            const char *target = getenv(METRICS_ENV);
+            if(target) MetricsExport(target);
+        }
+
+        for(int i = 0; i < n_events; i++)
+        {
+            if(follower && events[i].data.ptr == follower)
+            {
+                FollowerPoll(follower);
+                continue;
+            }
+
+            Client *client = (Client *)events[i].data.ptr;
+
+            if(!client)
+            {
+                AcceptClients(&server);
+                continue;
+            }
+
+            int status = EXIT_SUCCESS;
+
+            if(events[i].events & (EPOLLERR | EPOLLHUP)) status = EXIT_FAILURE;
+            if(status == EXIT_SUCCESS && (events[i].events & EPOLLOUT)) status = FlushClient(&server, client);
+            if(status == EXIT_SUCCESS && (events[i].events & EPOLLIN )) status = ReadClient (&server, client);
+
+            if(status != EXIT_SUCCESS) CloseClient(&server, client);
+        }
+
+        if(checkpointer) CheckpointTick(checkpointer);
+    }
+
+    while(server.clients) CloseClient(&server, server.clients);
+
+    close(server.listen_fd);
+    close(server.epoll_fd);
+    unlink(socket_path);
+
+    LOG("Server stopped: %zu games, %zu learned.\n", server.games, server.learned);
+
+    if(server.learned && save) SaveProgress(tree);
+
+    return EXIT_SUCCESS;
+}
+
+int ServeCommand(int argc, char *argv[])
+{
+    AkinatorOptions options = {};
+
+    const char *record_path = NULL;
+
+    if(argc >= 2 && strcmp(argv[0], "--record") == 0)
+    {
+        record_path = argv[1];
+
+        argc -= 2;
+        argv += 2;
+    }
+
+    if(ParseAkinatorOptions(&argc, &argv, &options) != EXIT_SUCCESS || argc != 2)
+    {
+        fprintf(stderr, "Usage: serve [--record <file>] [options] <data_base> <socket_path>\n");
+        return EXIT_FAILURE;
+    }
+
+    FILE *record = NULL;
+
+    if(record_path)
+    {
+        record = fopen(record_path, "wb");
+        ASSERT(record, return EXIT_FAILURE);
+    }
+
+    Tree tree = LoadKnowledgeBase(argv[0], &options);
+    ASSERT(tree.root, if(record) fclose(record); return EXIT_FAILURE);
+
+    Checkpointer *checkpointer = options.checkpoint ? CheckpointerCtor(&tree, &options) : NULL;
+
+    Feed     *feed     = options.feed   ? FeedOpen    (&tree, options.feed  ) : NULL;
+    Follower *follower = options.follow ? FollowerCtor(&tree, options.follow) : NULL;
+
+    if(follower) tree.read_only = true;
+
+    int status = Serve(&tree, argv[1], record, checkpointer, options.beam_width ? options.beam_width : BEAM_DEFAULT_WIDTH,
+                       follower, !options.no_save);
+
+    FollowerDtor(follower);
+    tree.read_only = false;
+
+    tree.feed = NULL;
+    FeedClose(feed);
+
+    if(options.profile && !IsReadOnlyDataBase(argv[0])) ProfileSave(&tree, argv[0]);
+
+    CheckpointerDtor(checkpointer);
+
+    TreeDtor(&tree, tree.root);
+
+    if(record) fclose(record);
+
+    return status;
+}
+
+
+static int CompareDoubles(const void *lhs, const void *rhs)
+{
+    double a = *(const double *)lhs;
+    double b = *(const double *)rhs;
+
+    return (a > b) - (a < b);
+}
+
+static const char *BenchAnswer(Prompt prompt, size_t step, char *buf)
+{
+    switch(prompt.kind)
+    {
+        case PROMPT_QUESTION:
+            return (rand() % 2) ? "y" : "n";
+        case PROMPT_GUESS:
+            return (rand() % 64) ? "y" : "n";
+        case PROMPT_CORRECT_ANSWER:
+            sprintf(buf, "bench answer %zu", step);
+            return buf;
+        case PROMPT_PROPERTY:
+            sprintf(buf, "bench property %zu", step);
+            return buf;
+        default:
+            return "y";
+    }
+}
+
+int BenchSessionsCommand(int argc, char *argv[])
+{
+    if(argc != 3)
+    {
+        fprintf(stderr, "Usage: bench-sessions <data_base> <sessions> <answers>\n");
+        return EXIT_FAILURE;
+    }
+
+    size_t n_sessions = strtoul(argv[1], NULL, 10);
+    size_t n_answers  = strtoul(argv[2], NULL, 10);
+    ASSERT(n_sessions && n_answers, return EXIT_FAILURE);
+
+    Tree tree = ReadTree(argv[0]);
+    ASSERT(tree.root, return EXIT_FAILURE);
+
+    GameSession *sessions  = (GameSession *)calloc(n_sessions, sizeof(GameSession));
+    double      *latencies = (double      *)calloc(n_answers , sizeof(double));
+    ASSERT(sessions && latencies, free(sessions); free(latencies); TreeDtor(&tree, tree.root); return EXIT_FAILURE);
+
+    for(size_t i = 0; i < n_sessions; i++) sessions[i] = GameSessionCtor(&tree);
+
+    size_t frames_bytes = GameSessionsBytes();
+    size_t games        = n_sessions;
+
+    char buf[FMT_STR_LEN] = {};
+    srand(0);
+
+    uint64_t start = MetricsNow();
+
+    for(size_t step = 0; step < n_answers; step++)
+    {
+        GameSession *session = &sessions[step % n_sessions];
+
+        if(IsGameOver(session))
+        {
+            GameSessionDtor(session);
+            *session = GameSessionCtor(&tree);
+            games++;
+        }
+
+        const char *answer = BenchAnswer(GamePrompt(session), step, buf);
+
+        uint64_t answer_start = MetricsNow();
+        GameAnswer(session, answer);
+        latencies[step] = (double)(MetricsNow() - answer_start);
+    }
+
+    double elapsed = (double)(MetricsNow() - start);
+
+    qsort(latencies, n_answers, sizeof(double), CompareDoubles);
+
+    printf("sessions:            %zu\n"
+           "answers:             %zu\n"
+           "games:               %zu\n"
+           "tree size:           %zu\n"
+           "bytes per session:   %zu\n"
+           "answers per second:  %.0f\n"
+           "p50 latency, ns:     %.0f\n"
+           "p99 latency, ns:     %.0f\n"
+           "max latency, ns:     %.0f\n",
+           n_sessions, n_answers, games, tree.size,
+           frames_bytes / n_sessions + sizeof(Client),
+           (double)n_answers / elapsed * 1e9,
+           latencies[n_answers / 2], latencies[n_answers * 99 / 100], latencies[n_answers - 1]);
+
+    for(size_t i = 0; i < n_sessions; i++) GameSessionDtor(&sessions[i]);
+
+    free(sessions);
+    free(latencies);
+
+    TreeDtor(&tree, tree.root);
+
+    return EXIT_SUCCESS;
+}
+
+
+const size_t BENCH_BEAM_WIDTHS[] = {1, 2, 4, 8, 16, 32};
+const double BENCH_BEAM_UNSURE   = 0.3;
+const double BENCH_BEAM_GUT      = 0.7;  // an unsure player still leans the right way this often
+
+struct BeamTarget
+{
+    const Node **questions;  // the questions on the way to the leaf
+    bool        *answers;
+    size_t       depth;
+
+    const Node *leaf;
+};
+
+// A random walk from the root, so shallow answers come up as often as a real audience picks them.
+static void PickBeamTarget(Node *const root, BeamTarget *target, unsigned *seed)
+{
+    const Node *tree_node = root;
+
+    target->depth = 0;
+
+    while(tree_node->left && tree_node->right)
+    {
+        bool answer = rand_r(seed) % 2;
+
+        target->questions[target->depth] = tree_node;
+        target->answers  [target->depth] = answer;
+        target->depth++;
+
+        tree_node = answer ? tree_node->right : tree_node->left;
+    }
+
+    target->leaf = tree_node;
+}
+
+// Questions off the way to the leaf get "don't know": the player has no ground truth for them.
+static const char *BeamPlayerAnswer(const BeamTarget *target, Prompt prompt, double unsure, unsigned *seed)
+{
+    if(prompt.kind == PROMPT_GUESS) return (strcmp(prompt.subject, target->leaf->data) == 0) ? "y" : "n";
+
+    for(size_t i = 0; i < target->depth; i++)
+    {
+        if(strcmp(prompt.subject, target->questions[i]->data) != 0) continue;
+
+        bool truth = target->answers[i];
+
+        if((double)rand_r(seed) / RAND_MAX >= unsure) return truth ? "y" : "n";
+
+        bool gut = ((double)rand_r(seed) / RAND_MAX < BENCH_BEAM_GUT) ? truth : !truth;
+
+        return gut ? "p" : "u";
+    }
+
+    return "d";
+}
+
+struct BeamRun
+{
+    size_t top1;
+    size_t guessed;  // found within BEAM_MAX_GUESSES
+    size_t questions;
+
+    double *latencies;
+    size_t  capacity;
+};
+
+static int RunBeamGames(Tree *tree, size_t width, size_t games, double unsure, BeamTarget *target, BeamRun *run)
+{
+    unsigned target_seed = 1;
+    unsigned answer_seed = 2;
+
+    run->top1      = 0;
+    run->guessed   = 0;
+    run->questions = 0;
+
+    for(size_t game = 0; game < games; game++)
+    {
+        PickBeamTarget(tree->root, target, &target_seed);
+
+        GameSession session = GameSessionCtor(tree, width);
+        ASSERT(session.handle, return EXIT_FAILURE);
+
+        size_t guesses = 0;
+
+        while(!IsGameOver(&session))
+        {
+            Prompt prompt = GamePrompt(&session);
+
+            const char *answer = BeamPlayerAnswer(target, prompt, unsure, &answer_seed);
+
+            if(prompt.kind == PROMPT_GUESS)
+            {
+                guesses++;
+                GameAnswer(&session, answer);
+
+                continue;
+            }
+
+            if(run->questions == run->capacity)
+            {
+                size_t capacity = 2 * run->capacity + 1024;
+
+                double *latencies = (double *)realloc(run->latencies, capacity * sizeof(double));
+                ASSERT(latencies, GameSessionDtor(&session); return EXIT_FAILURE);
+
+                run->latencies = latencies;
+                run->capacity  = capacity;
+            }
+
+            uint64_t start = MetricsNow();
+            GameAnswer(&session, answer);
+            run->latencies[run->questions++] = (double)(MetricsNow() - start);
+        }
+
+        if(GameSessionResult(&session) == GAME_GUESSED)
+        {
+            run->guessed++;
+            if(guesses == 1) run->top1++;
+        }
+
+        GameSessionDtor(&session);
+    }
+
+    qsort(run->latencies, run->questions, sizeof(double), CompareDoubles);
+
+    return EXIT_SUCCESS;
+}
+
+int BenchBeamCommand(int argc, char *argv[])
+{
+    if(argc != 2 && argc != 3)
+    {
+        fprintf(stderr, "Usage: bench-beam <data_base> <games> [unsure share]\n");
+        return EXIT_FAILURE;
+    }
+
+    size_t games  = strtoul(argv[1], NULL, 10);
+    double unsure = (argc == 3) ? strtod(argv[2], NULL) : BENCH_BEAM_UNSURE;
+    ASSERT(games, return EXIT_FAILURE);
+
+    Tree tree = ReadTree(argv[0]);
+    ASSERT(tree.root, return EXIT_FAILURE);
+
+    // Wrong guesses end the game instead of learning, so every width plays the same tree.
+    tree.read_only = true;
+
+    BeamTarget target = {(const Node **)calloc(tree.size, sizeof(Node *)), (bool *)calloc(tree.size, sizeof(bool)), 0, NULL};
+    BeamRun    run    = {};
+
+    int status = (target.questions && target.answers) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    printf("games:      %zu\n"
+           "tree size:  %zu\n"
+           "unsure:     %.2f\n"
+           "width  top-1    top-%zu    questions  p50 ns  p99 ns\n",
+           games, tree.size, unsure, BEAM_MAX_GUESSES);
+
+    for(size_t i = 0; status == EXIT_SUCCESS && i < sizeof(BENCH_BEAM_WIDTHS) / sizeof(BENCH_BEAM_WIDTHS[0]); i++)
+    {
+        status = RunBeamGames(&tree, BENCH_BEAM_WIDTHS[i], games, unsure, &target, &run);
+        if(status != EXIT_SUCCESS || run.questions == 0) break;
+
+        printf("%-5zu  %5.1f%%   %5.1f%%   %9.2f  %6.0f  %6.0f\n", BENCH_BEAM_WIDTHS[i],
+               100.0 * (double)run.top1 / (double)games, 100.0 * (double)run.guessed / (double)games,
+               (double)run.questions / (double)games,
+               run.latencies[run.questions / 2], run.latencies[run.questions * 99 / 100]);
+    }
+
+    free(run.latencies);
+    free(target.questions);
+    free(target.answers);
+
+    tree.read_only = false;
+    TreeDtor(&tree, tree.root);
+
+    return status;
+}
@@ -0,0 +1,361 @@
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/session.h"
+#include "../include/history.h"
+#include "../include/replica.h"
+
+static size_t FRAMES_BYTES = 0;
+
+void *GameSession::promise_type::operator new(size_t size)
+{
+    void *frame = malloc(size);
+    ASSERT(frame, abort());
+
+    FRAMES_BYTES += size;
+
+    return frame;
+}
+
+void GameSession::promise_type::operator delete(void *frame, size_t size)
+{
+    FRAMES_BYTES -= size;
+
+    free(frame);
+}
+
+GameSession::promise_type::~promise_type()
+{
+    free(learned);
+
+    if(path.data) StackDtor(&path);
+
+    if(beam.entries) FRAMES_BYTES -= 3 * beam.width * sizeof(BeamEntry);
+    free(beam.entries);
+
+    SubTreeRelease(pinned);
+}
+
+void GameSession::promise_type::unhandled_exception(void)
+{
+    LOG("Unhandled exception in game session.\n");
+
+    abort();
+}
+
+size_t GameSessionsBytes(void)
+{
+    return FRAMES_BYTES;
+}
+
+
+int ParseYesNo(const char *const answer)
+{
+    ASSERT(answer, return -1);
+
+    if(answer[0] == '\0' || answer[1] != '\0') return -1;
+
+    switch(tolower(answer[0]))
+    {
+        case 'y': return 1;
+        case 'n': return 0;
+        default : return -1;
+    }
+}
+
+// "p" is probably yes, "u" is probably not (unlikely), "d" is don't know.
+int ParseLikelihood(const char *const answer)
+{
+    ASSERT(answer, return -1);
+
+    if(answer[0] == '\0' || answer[1] != '\0') return -1;
+
+    switch(tolower(answer[0]))
+    {
+        case 'y': return LIKELIHOOD_YES;
+        case 'n': return 0;
+        case 'p': return LIKELIHOOD_PROBABLY;
+        case 'u': return LIKELIHOOD_YES - LIKELIHOOD_PROBABLY;
+        case 'd': return LIKELIHOOD_YES / 2;
+        default : return -1;
+    }
+}
+
+
+struct Self
+{
+    GameSession::promise_type *promise;
+
+    bool await_ready(void) const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<GameSession::promise_type> handle) noexcept
+    {
+        promise = &handle.promise();
+
+        return false;
+    }
+
+    GameSession::promise_type *await_resume(void) const noexcept { return promise; }
+};
+
+static void BeamCtor(Beam *beam, size_t width)
+{
+    beam->width   = width ? width : 1;
+    beam->size    = 0;
+    beam->entries = (BeamEntry *)calloc(3 * beam->width, sizeof(BeamEntry));
+    ASSERT(beam->entries, abort());
+
+    FRAMES_BYTES += 3 * beam->width * sizeof(BeamEntry);
+}
+
+static void BeamReset(Beam *beam, Node *start)
+{
+    beam->entries[0] = {start, 1};
+    beam->size       = 1;
+}
+
+// Asking stops once the heaviest candidate is a leaf: lighter ones would only delay its guess.
+static Node *BeamQuestion(const Beam *beam)
+{
+    Node *top = beam->entries[0].node;
+
+    return top->right ? top : NULL;
+}
+
+static int CompareBeamEntries(const void *lhs, const void *rhs)
+{
+    double a = ((const BeamEntry *)lhs)->weight;
+    double b = ((const BeamEntry *)rhs)->weight;
+
+    return (a < b) - (a > b);
+}
+
+// Every candidate at a question with the same text takes the answer; the rest wait for theirs.
+static void BeamAnswer(Beam *beam, const Node *const question, int likelihood)
+{
+    BeamEntry *next = beam->entries + beam->width;
+    size_t     size = 0;
+
+    for(size_t i = 0; i < beam->size; i++)
+    {
+        BeamEntry entry = beam->entries[i];
+
+        bool asked = entry.node->right && (entry.node == question || strcmp(entry.node->data, question->data) == 0);
+
+        if(!asked)
+        {
+            next[size++] = entry;
+            continue;
+        }
+
+        double yes = entry.weight * likelihood / LIKELIHOOD_YES;
+        double no  = entry.weight - yes;
+
+        if(yes > 0)                     next[size++] = {entry.node->right, yes};
+        if(no  > 0 && entry.node->left) next[size++] = {entry.node->left , no };
+    }
+
+    qsort(next, size, sizeof(BeamEntry), CompareBeamEntries);
+
+    if(size > beam->width) size = beam->width;
+
+    double total = 0;
+    for(size_t i = 0; i < size; i++) total += next[i].weight;
+
+    for(size_t i = 0; i < size; i++) beam->entries[i] = {next[i].node, next[i].weight / total};
+
+    beam->size = size;
+}
+
+void AddAnswer(Tree *tree, const Stack *path, Node *prev_answer, const char *const answer, const char *const property)
+{
+    METRICS_TIME(OP_ADD_ANSWER);
+
+    AddNode(tree, prev_answer, prev_answer->data, LEFT );
+    AddNode(tree, prev_answer, answer           , RIGHT);
+
+    NodeRelabel(prev_answer, property);
+
+    TreeRehashPath(tree, path->data, path->size);
+
+    if(tree->history) HistoryCommit(tree);
+    if(tree->feed   ) FeedAppend(tree->feed, FEED_SPLIT, tree->root->hash, path, answer, property);
+}
+
+// A held root is shared, so learning copies the path instead of editing nodes under
+// other sessions, and undo, pruning or a finished checkpoint only free what nobody holds.
+static Node *PinRoot(Tree *tree, GameSession::promise_type *self)
+{
+    if(self->pinned == tree->root) return tree->root;
+
+    SubTreeRelease(self->pinned);
+
+    self->pinned = tree->root;
+    NodeHold(self->pinned);
+
+    return tree->root;
+}
+
+// The path is gone only if an undo dropped the question it went through.
+static Node *RestartPath(Tree *tree, GameSession::promise_type *self)
+{
+    self->path.size = 0;
+
+    return PinRoot(tree, self);
+}
+
+// The coroutine lowering emits its own state switch without a default label.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wswitch-default"
+static GameSession Game(Tree *tree, size_t beam_width)
+{
+    GameSession::promise_type *self = co_await Self{NULL};
+
+    BeamCtor(&self->beam, beam_width);
+
+    Node *cur_pos = PinRoot(tree, self);
+
+    while(true)
+    {
+        // While every answer is certain the beam holds one candidate and the path is tracked as usual.
+        bool exact = true;
+
+        BeamReset(&self->beam, cur_pos);
+
+        for(Node *question = BeamQuestion(&self->beam); question; question = BeamQuestion(&self->beam))
+        {
+            NodeVisit(question);
+            NodePrefetch(question);
+
+            int likelihood = ParseLikelihood(co_yield {PROMPT_QUESTION, question->data, NULL});
+
+            exact = exact && (likelihood == 0 || likelihood == LIKELIHOOD_YES);
+            if(exact) PushStack(&self->path, likelihood == LIKELIHOOD_YES);
+
+            BeamAnswer(&self->beam, question, likelihood);
+        }
+
+        // Candidates still at a question are skipped: the player is only asked about answers.
+        for(size_t i = 0, guesses = 0; i < self->beam.size && guesses < BEAM_MAX_GUESSES; i++)
+        {
+            Node *guess = self->beam.entries[i].node;
+            if(guess->right) continue;
+
+            NodeVisit(guess);
+            guesses++;
+
+            if(ParseYesNo(co_yield {PROMPT_GUESS, guess->data, NULL})) co_return GAME_GUESSED;
+        }
+
+        if(tree->read_only) co_return GAME_LOST;
+
+        // Learning goes under the best ranked leaf, which tops the beam.
+        cur_pos = self->beam.entries[0].node;
+
+        // The beam keeps no paths, so once an answer was uncertain the leaf is found from the pinned root.
+        if(!exact)
+        {
+            self->path.size = 0;
+            SubTreePathTo(self->pinned, cur_pos, &self->path);
+        }
+
+        // Another session could have split this leaf or copied its path while we were waiting for the answer.
+        PinRoot(tree, self);
+
+        cur_pos = TreeFollowPath(tree, self->path.data, self->path.size);
+        if(!cur_pos)
+        {
+            cur_pos = RestartPath(tree, self);
+            continue;
+        }
+
+        if(cur_pos->right != NULL) continue;
+
+        free(self->learned);
+        self->learned = strndup(co_yield {PROMPT_CORRECT_ANSWER, cur_pos->data, NULL}, MAX_DATA_LEN - 1);
+
+        const char *property = co_yield {PROMPT_PROPERTY, self->learned, cur_pos->data};
+
+        cur_pos = TreeUnsharePath(tree, self->path.data, self->path.size);
+        if(!cur_pos)
+        {
+            cur_pos = RestartPath(tree, self);
+            continue;
+        }
+
+        PinRoot(tree, self);
+
+        if(cur_pos->right != NULL) continue;
+
+        AddAnswer(tree, &self->path, cur_pos, self->learned, property);
+
+        co_return GAME_LEARNED;
+    }
+}
+#pragma GCC diagnostic pop
+
+
+GameSession GameSessionCtor(Tree *tree, size_t beam_width)
+{
+    ASSERT(tree && tree->root, return {});
+
+    return Game(tree, beam_width);
+}
+
+void GameSessionDtor(GameSession *session)
+{
+    ASSERT(session, return);
+
+    if(session->handle) session->handle.destroy();
+
+    session->handle = {};
+}
+
+bool IsGameOver(const GameSession *session)
+{
+    ASSERT(session && session->handle, return true);
+
+    return session->handle.done();
+}
+
+Prompt GamePrompt(const GameSession *session)
+{
+    ASSERT(session && session->handle, return {});
+
+    return session->handle.promise().prompt;
+}
+
+GameResult GameSessionResult(const GameSession *session)
+{
+    ASSERT(session && session->handle, return GAME_RUNNING);
+
+    return session->handle.promise().result;
+}
+
+bool GameAnswer(GameSession *session, const char *const answer)
+{
+    ASSERT(session && session->handle, return false);
+    ASSERT(answer, return false);
+    ASSERT(!session->handle.done(), return false);
+
+    GameSession::promise_type &promise = session->handle.promise();
+
+    if(promise.prompt.kind == PROMPT_QUESTION && ParseLikelihood(answer) < 0) return false;
+    if(promise.prompt.kind == PROMPT_GUESS    && ParseYesNo     (answer) < 0) return false;
+
+#ifdef METRICS
+    bool     is_yes_no = (promise.prompt.kind == PROMPT_QUESTION || promise.prompt.kind == PROMPT_GUESS);
+    uint64_t start     = MetricsNow();
+#endif
+
+    promise.answer = answer;
+    session->handle.resume();
+    promise.answer = NULL;
+
+#ifdef METRICS
+    if(is_yes_no) MetricsRecord(OP_GET_ANSWER, MetricsNow() - start);
+#endif
+
+    return true;
+}
@@ -0,0 +1,289 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../include/shared.h"
+#include "../include/trace.h"
+
+static size_t AlignUp(size_t size, size_t align)
+{
+    return (size + align - 1) / align * align;
+}
+
+struct SharedWriter
+{
+    Node  *nodes;
+    size_t count;
+
+    char  *labels;
+    size_t labels_used;
+};
+
+// In preorder, with copies[i] written for the node in frames[i]. A node`s state is 1 while
+// its left subtree is written and 2 for the right one.
+static int WriteSharedSubTree(SharedWriter *writer, Node *const tree_node)
+{
+    NodeStack stack  = {};
+    NodeStack copies = {};
+
+    int status = NodeStackPush(&stack, tree_node);
+
+    while(status == EXIT_SUCCESS && stack.size)
+    {
+        NodeFrame *frame = &stack.frames[stack.size - 1];
+        Node      *node  = frame->node;
+
+        if(frame->state == 0)
+        {
+            Node *copy = &writer->nodes[writer->count++];
+
+            size_t len = strlen(node->data) + 1;
+
+            copy->data  = (char *)memcpy(writer->labels + writer->labels_used, node->data, len);
+            copy->flags = NODE_STATIC | NODE_SHARED_DATA;
+            copy->hash  = node->hash;
+
+            writer->labels_used += len;
+
+            if(copies.size)
+            {
+                NodeFrame *parent = &copies.frames[copies.size - 1];
+
+                if(stack.frames[stack.size - 2].state == 1) parent->node->left  = copy;
+                else                                        parent->node->right = copy;
+            }
+
+            status = NodeStackPush(&copies, copy);
+        }
+        else if(frame->state == 2)
+        {
+            stack.size--;
+            copies.size--;
+            continue;
+        }
+
+        Node *next = (++frame->state == 1) ? node->left : node->right;
+
+        if(status == EXIT_SUCCESS && next) status = NodeStackPush(&stack, next);
+    }
+
+    NodeStackDtor(&stack);
+    NodeStackDtor(&copies);
+
+    return status;
+}
+
+// Written under a temporary name and renamed, so a process never maps a half-written base.
+int SharedPublish(Tree *const tree, const char *const file_name)
+{
+    ASSERT(tree && tree->root, return EXIT_FAILURE);
+    ASSERT(file_name, return EXIT_FAILURE);
+
+    TRACE_SPAN(span, "SharedPublish");
+
+    SharedHeader header = {SHARED_MAGIC, 0, 0, SubTreeSize(tree->root), 0, 0};
+
+    header.nodes_offset  = AlignUp(sizeof(SharedHeader), SHARED_ALIGN);
+    header.labels_offset = header.nodes_offset + header.nodes * sizeof(Node);
+    header.size          = header.labels_offset + SubTreeLabelBytes(tree->root);
+
+    char tmp_name[MAX_STR_LEN] = {};
+    snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", file_name);
+
+    int fd = open(tmp_name, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0)
+    {
+        LOG("Can`t create \"%s\".\n", tmp_name);
+        return EXIT_FAILURE;
+    }
+
+    char *map = (ftruncate(fd, (off_t)header.size) == 0) ?
+                (char *)mmap((void *)SHARED_BASE_HINT, header.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) :
+                (char *)MAP_FAILED;
+
+    close(fd);
+
+    if(map == MAP_FAILED)
+    {
+        LOG("Can`t map \"%s\".\n", tmp_name);
+
+        unlink(tmp_name);
+        return EXIT_FAILURE;
+    }
+
+    header.base = (uintptr_t)map;
+
+    SharedWriter writer = {(Node *)(map + header.nodes_offset), 0, map + header.labels_offset, 0};
+
+    int status = WriteSharedSubTree(&writer, tree->root);
+    memcpy(map, &header, sizeof(header));
+
+    if(munmap(map, header.size) != 0 || (status == EXIT_SUCCESS && rename(tmp_name, file_name) != 0)) status = EXIT_FAILURE;
+
+    if(status != EXIT_SUCCESS)
+    {
+        LOG("Can`t publish \"%s\".\n", file_name);
+
+        unlink(tmp_name);
+    }
+
+    TraceSpanInt(&span, "nodes", (long long)header.nodes);
+
+    return status;
+}
+
+
+static bool IsSharedHeaderValid(const SharedHeader *header, size_t file_size)
+{
+    return header->magic == SHARED_MAGIC && header->size == file_size &&
+           header->nodes && header->nodes_offset >= sizeof(SharedHeader) &&
+           header->nodes_offset % SHARED_ALIGN == 0 &&
+           header->labels_offset == header->nodes_offset + header->nodes * sizeof(Node) &&
+           header->labels_offset < header->size;
+}
+
+// Every link has to land on a node after its parent, which rules out cycles, and every
+// label inside the pool, which ends with a NUL.
+static bool AreSharedNodesValid(const char *map, const SharedHeader *header)
+{
+    uintptr_t nodes_start  = (uintptr_t)map + header->nodes_offset;
+    uintptr_t labels_start = (uintptr_t)map + header->labels_offset;
+    uintptr_t end          = (uintptr_t)map + header->size;
+
+    if(map[header->size - 1] != '\0') return false;
+
+    const Node *nodes = (const Node *)nodes_start;
+
+    for(size_t i = 0; i < header->nodes; i++)
+    {
+        uintptr_t links[2] = {(uintptr_t)nodes[i].left, (uintptr_t)nodes[i].right};
+
+        for(size_t j = 0; j < 2; j++)
+        {
+            if(!links[j]) continue;
+
+            if(links[j] <= (uintptr_t)&nodes[i] || links[j] >= labels_start ||
+               (links[j] - nodes_start) % sizeof(Node) != 0) return false;
+        }
+
+        uintptr_t data = (uintptr_t)nodes[i].data;
+
+        if(data < labels_start || data >= end || !(nodes[i].flags & NODE_STATIC)) return false;
+    }
+
+    return true;
+}
+
+static Node *RelocateLink(Node *link, uintptr_t delta)
+{
+    return link ? (Node *)((uintptr_t)link + delta) : NULL;
+}
+
+// Only the node pages become private: the labels keep being shared with the other processes.
+static char *MapRelocated(int fd, const SharedHeader *header)
+{
+    char *map = (char *)mmap(NULL, header->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if(map == MAP_FAILED) return NULL;
+
+    uintptr_t delta = (uintptr_t)map - (uintptr_t)header->base;
+
+    Node *nodes = (Node *)(map + header->nodes_offset);
+
+    for(size_t i = 0; i < header->nodes; i++)
+    {
+        nodes[i].data  = (char *)((uintptr_t)nodes[i].data + delta);
+        nodes[i].left  = RelocateLink(nodes[i].left , delta);
+        nodes[i].right = RelocateLink(nodes[i].right, delta);
+    }
+
+    mprotect(map, header->size, PROT_READ);
+
+    return map;
+}
+
+// The segment stays mapped for the life of the process, like the compiled-in base.
+Tree SharedTree(const char *const file_name)
+{
+    ASSERT(file_name, return {});
+
+    TRACE_SPAN(span, "SharedTree");
+    TraceSpanStr(&span, "file", file_name);
+
+    int fd = open(file_name, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        LOG("No such file: \"%s\"", file_name);
+        return {};
+    }
+
+    struct stat file_info = {};
+    SharedHeader header   = {};
+
+    if(fstat(fd, &file_info) != 0 || pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+       !IsSharedHeaderValid(&header, (size_t)file_info.st_size))
+    {
+        LOG("\"%s\" is not a published base.\n", file_name);
+
+        close(fd);
+        return {};
+    }
+
+    char *map = (char *)mmap((void *)header.base, header.size, PROT_READ,
+                             MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+
+    // Kernels before 4.17 take the address as a hint only.
+    if(map != MAP_FAILED && (uintptr_t)map != header.base)
+    {
+        munmap(map, header.size);
+        map = (char *)MAP_FAILED;
+    }
+
+    if(map == MAP_FAILED)
+    {
+        LOG("Address %p is taken, relocating \"%s\".\n", (void *)header.base, file_name);
+
+        map = MapRelocated(fd, &header);
+    }
+
+    close(fd);
+
+    ASSERT(map, return {});
+
+    if(!AreSharedNodesValid(map, &header))
+    {
+        LOG("\"%s\" is damaged.\n", file_name);
+
+        munmap(map, header.size);
+        return {};
+    }
+
+    Tree tree = {(Node *)(map + header.nodes_offset), header.nodes};
+
+    TraceSpanInt(&span, "nodes", (long long)tree.size);
+
+    return tree;
+}
+
+
+int PublishCommand(int argc, char *argv[])
+{
+    if(argc != 2)
+    {
+        fprintf(stderr, "Usage: publish <data_base> <file>\n");
+        return EXIT_FAILURE;
+    }
+
+    Tree tree = ReadTree(argv[0]);
+    ASSERT(tree.root, return EXIT_FAILURE);
+
+    int status = SharedPublish(&tree, argv[1]);
+
+    if(status == EXIT_SUCCESS) printf("Published %zu nodes to \"%s\".\n", tree.size, argv[1]);
+
+    TreeDtor(&tree, tree.root);
+
+    return status;
+}
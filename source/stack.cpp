@@ -3,6 +3,7 @@
 #include <limits.h>
 
 #include "../include/stack.h"
+#include "../include/memory.h"
 
 Stack StackCtor(const size_t capacity)
 {
@@ -16,7 +17,7 @@ Stack StackCtor(const size_t capacity)
 
     stack.capacity = capacity;
 
-    stack.data     = (data_t *)calloc(capacity * sizeof(data_t), sizeof(char));
+    stack.data     = (data_t *)MemCalloc(MEM_STACKS, capacity * sizeof(data_t), sizeof(char));
     ASSERT(stack.data, return {});
 
     return stack;
@@ -30,7 +31,7 @@ int StackDtor(Stack *stack)
     stack->size     = 0;
     stack->capacity = 0;
 
-    free(stack->data);
+    MemFree(MEM_STACKS, stack->data);
     stack->data = NULL;
 
     return EXIT_SUCCESS;
@@ -41,7 +42,7 @@ static int StackExpand(Stack *stack)
 {
     if(stack->size == stack->capacity)
     {
-        data_t *data_r = (data_t *)realloc(stack->data, sizeof(data_t) * stack->capacity * 2);
+        data_t *data_r = (data_t *)MemRealloc(MEM_STACKS, stack->data, sizeof(data_t) * stack->capacity * 2);
         ASSERT(data_r, return EXIT_FAILURE);
 
         stack->capacity *= 2;
@@ -58,7 +59,7 @@ static int StackShrink(Stack *stack)
 {
     if(stack->size * 4 == stack->capacity)
     {
-        data_t *data_r = (data_t *)realloc(stack->data, sizeof(data_t) * stack->capacity / 2);
+        data_t *data_r = (data_t *)MemRealloc(MEM_STACKS, stack->data, sizeof(data_t) * stack->capacity / 2);
         ASSERT(data_r, return EXIT_FAILURE);
 
         stack->capacity /= 2;
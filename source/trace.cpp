@@ -0,0 +1,218 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "../include/trace.h"
+#include "../include/log.h"
+#include "../include/constants.h"
+
+bool TRACE_ENABLED = false;
+
+static thread_local TraceBuffer *TRACE_BUFFER = NULL;
+
+static pthread_mutex_t TRACE_LOCK    = PTHREAD_MUTEX_INITIALIZER;
+static TraceBuffer    *TRACE_BUFFERS = NULL;
+
+// The lock is taken once per thread, recording itself only touches the thread's own buffer.
+static TraceBuffer *TraceThreadBuffer(void)
+{
+    TraceBuffer *buffer = (TraceBuffer *)calloc(1, sizeof(TraceBuffer));
+    if(!buffer) return NULL;
+
+    buffer->tid = (pid_t)syscall(SYS_gettid);
+
+    pthread_mutex_lock(&TRACE_LOCK);
+
+    buffer->next  = TRACE_BUFFERS;
+    TRACE_BUFFERS = buffer;
+
+    pthread_mutex_unlock(&TRACE_LOCK);
+
+    TRACE_BUFFER = buffer;
+
+    return buffer;
+}
+
+static TraceChunk *TraceThreadChunk(TraceBuffer *buffer)
+{
+    TraceChunk *chunk = (TraceChunk *)calloc(1, sizeof(TraceChunk));
+    if(!chunk) return NULL;
+
+    if(buffer->tail) __atomic_store_n(&buffer->tail->next, chunk, __ATOMIC_RELEASE);
+    else             __atomic_store_n(&buffer->head      , chunk, __ATOMIC_RELEASE);
+
+    buffer->tail = chunk;
+
+    return chunk;
+}
+
+TraceEvent *TraceBegin(const char *name)
+{
+    TraceBuffer *buffer = TRACE_BUFFER ? TRACE_BUFFER : TraceThreadBuffer();
+    if(!buffer) return NULL;
+
+    TraceChunk *chunk = buffer->tail;
+
+    if(!chunk || chunk->size == TRACE_CHUNK_EVENTS) chunk = TraceThreadChunk(buffer);
+    if(!chunk) return NULL;
+
+    TraceEvent *event = &chunk->events[chunk->size];
+
+    event->name     = name;
+    event->dur_ns   = TRACE_OPEN;
+    event->start_ns = MetricsNow();
+
+    __atomic_store_n(&chunk->size, chunk->size + 1, __ATOMIC_RELEASE);
+
+    return event;
+}
+
+void TraceEnd(TraceEvent *event)
+{
+    __atomic_store_n(&event->dur_ns, MetricsNow() - event->start_ns, __ATOMIC_RELEASE);
+}
+
+void TraceSpanStr(TraceSpan *span, const char *key, const char *value)
+{
+    if(!span->event) return;
+
+    TraceEvent *event = span->event;
+
+    size_t len = strnlen(value, TRACE_ARG_LEN - 1);
+
+    // Do not cut a UTF-8 sequence in half: the trace must stay valid JSON.
+    if(len == TRACE_ARG_LEN - 1)
+    {
+        while(len && ((unsigned char)value[len] & 0xC0) == 0x80) len--;
+    }
+
+    memcpy(event->str_value, value, len);
+    event->str_value[len] = '\0';
+    event->str_key        = key;
+}
+
+
+static void WriteJsonString(FILE *file, const char *str)
+{
+    fputc('"', file);
+
+    for(; *str; str++)
+    {
+        unsigned char ch = (unsigned char)*str;
+
+        if     (ch == '"' || ch == '\\') fprintf(file, "\\%c", ch);
+        else if(ch < 0x20)               fprintf(file, "\\u%04x", ch);
+        else                             fputc(ch, file);
+    }
+
+    fputc('"', file);
+}
+
+static void WriteEvent(FILE *file, const TraceEvent *event, uint64_t dur_ns, pid_t tid, bool *first)
+{
+    fprintf(file, "%s\n{\"name\":\"%s\",\"cat\":\"akinator\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d",
+                  *first ? "" : ",", event->name, (double)event->start_ns / 1e3, (double)dur_ns / 1e3, getpid(), tid);
+
+    *first = false;
+
+    if(event->int_key || event->str_key)
+    {
+        fprintf(file, ",\"args\":{");
+
+        if(event->int_key) fprintf(file, "\"%s\":%lld", event->int_key, event->int_value);
+
+        if(event->str_key)
+        {
+            fprintf(file, "%s\"%s\":", event->int_key ? "," : "", event->str_key);
+            WriteJsonString(file, event->str_value);
+        }
+
+        fputc('}', file);
+    }
+
+    fputc('}', file);
+}
+
+int TraceWrite(const char *const file_name)
+{
+    ASSERT(file_name, return EXIT_FAILURE);
+
+    char tmp_name[MAX_STR_LEN] = {};
+    snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", file_name);
+
+    FILE *file = fopen(tmp_name, "wb");
+    if(!file)
+    {
+        LOG("Can`t write trace to \"%s\".\n", file_name);
+        return EXIT_FAILURE;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+    bool first = true;
+
+    pthread_mutex_lock(&TRACE_LOCK);
+
+    for(TraceBuffer *buffer = TRACE_BUFFERS; buffer; buffer = buffer->next)
+    {
+        TraceChunk *chunk = __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE);
+
+        for(; chunk; chunk = __atomic_load_n(&chunk->next, __ATOMIC_ACQUIRE))
+        {
+            size_t size = __atomic_load_n(&chunk->size, __ATOMIC_ACQUIRE);
+
+            for(size_t i = 0; i < size; i++)
+            {
+                uint64_t dur_ns = __atomic_load_n(&chunk->events[i].dur_ns, __ATOMIC_ACQUIRE);
+
+                if(dur_ns != TRACE_OPEN) WriteEvent(file, &chunk->events[i], dur_ns, buffer->tid, &first);
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&TRACE_LOCK);
+
+    fprintf(file, "\n]}\n");
+
+    if(fclose(file) != 0 || rename(tmp_name, file_name) != 0)
+    {
+        LOG("Can`t write trace to \"%s\".\n", file_name);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static void WriteAtExit(void)
+{
+    const char *file_name = getenv(TRACE_ENV);
+
+    if(file_name) TraceWrite(file_name);
+}
+
+int TraceInit(void)
+{
+    if(!getenv(TRACE_ENV)) return EXIT_SUCCESS;
+
+    TRACE_ENABLED = true;
+
+    return atexit(WriteAtExit);
+}
+
+
+int TracedSystem(const char *const command)
+{
+    ASSERT(command, return -1);
+
+    TRACE_SPAN(span, "system");
+    TraceSpanStr(&span, "command", command);
+
+    int status = system(command);
+
+    TraceSpanInt(&span, "status", status);
+
+    return status;
+}
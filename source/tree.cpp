@@ -1,3 +1,5 @@
+#include <ctype.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -5,6 +7,11 @@
 #include <sys/stat.h>
 
 #include "../include/tree.h"
+#include "../include/trace.h"
+#include "../include/history.h"
+#include "../include/memory.h"
+#include "../include/parallel.h"
+#include "../include/ordered.h"
 
 Tree TreeCtor(char *init_val)
 {
@@ -19,16 +26,369 @@ Tree TreeCtor(char *init_val)
 }
 
 
+static uint64_t NODE_GENERATION = 0;
+
+static uint64_t NextGeneration(void)
+{
+    return __atomic_add_fetch(&NODE_GENERATION, 1, __ATOMIC_RELAXED);
+}
+
+uint64_t NodeGeneration(void)
+{
+    return __atomic_load_n(&NODE_GENERATION, __ATOMIC_RELAXED);
+}
+
+
+size_t SubTreeSize(Node *const tree_node)
+{
+    size_t size = 0;
+
+    ParallelFold fold = {CountVisit, SumMerge, sizeof(size_t), NULL};
+    SubTreeFold(tree_node, &fold, &size);
+
+    return size;
+}
+
+static bool LabelBytesVisit(Node *node, size_t, void *acc, void *)
+{
+    *(size_t *)acc += strlen(node->data) + 1;
+
+    return true;
+}
+
+size_t SubTreeLabelBytes(Node *const tree_node)
+{
+    size_t bytes = 0;
+
+    ParallelFold fold = {LabelBytesVisit, SumMerge, sizeof(size_t), NULL};
+    SubTreeFold(tree_node, &fold, &bytes);
+
+    return bytes;
+}
+
+
+static uint64_t HashMix(uint64_t hash)
+{
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDull;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ull;
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+static uint64_t LabelHash(const char *label)
+{
+    uint64_t hash = 14695981039346656037ull;
+
+    for(; *label; label++)
+    {
+        hash ^= (unsigned char)*label;
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+static uint64_t NodeHash(const char *label, const Node *const left, const Node *const right)
+{
+    uint64_t hash = LabelHash(label);
+
+    hash = HashMix(hash ^ (left ? left->hash : 0));
+    hash = HashMix(hash + (right ? right->hash : 0) * 0x9E3779B97F4A7C15ull);
+
+    return hash;
+}
+
+const size_t LABEL_SLOTS = 4096;
+
+// Labels share slots by hash, so a label can look changed when another one in its slot was.
+static uint64_t LABEL_GENERATION[LABEL_SLOTS] = {};
+
+static void TouchLabel(const Node *const node)
+{
+    __atomic_store_n(&LABEL_GENERATION[LabelHash(node->data) % LABEL_SLOTS], node->gen, __ATOMIC_RELAXED);
+}
+
+uint64_t LabelGeneration(const char *const label)
+{
+    ASSERT(label, return 0);
+
+    return __atomic_load_n(&LABEL_GENERATION[LabelHash(label) % LABEL_SLOTS], __ATOMIC_RELAXED);
+}
+
+void NodeRehash(Node *node)
+{
+    ASSERT(node, return);
+
+    node->hash = NodeHash(node->data, node->left, node->right);
+}
+
+int NodeStackPush(NodeStack *stack, Node *const node, const int state)
+{
+    ASSERT(stack, return EXIT_FAILURE);
+
+    if(stack->size == stack->capacity)
+    {
+        size_t capacity = stack->capacity ? 2 * stack->capacity : 64;
+
+        NodeFrame *frames_r = (NodeFrame *)MemRealloc(MEM_STACKS, stack->frames, capacity * sizeof(NodeFrame));
+        ASSERT(frames_r, return EXIT_FAILURE);
+
+        stack->frames   = frames_r;
+        stack->capacity = capacity;
+    }
+
+    stack->frames[stack->size++] = {node, state};
+
+    return EXIT_SUCCESS;
+}
+
+void NodeStackDtor(NodeStack *stack)
+{
+    ASSERT(stack, return);
+
+    MemFree(MEM_STACKS, stack->frames);
+
+    *stack = {};
+}
+
+static unsigned NodeHeight(const Node *const node)
+{
+    return node ? node->height : 0;
+}
+
+// For a node whose children were just replaced.
+void NodeRelink(Node *node)
+{
+    ASSERT(node, return);
+
+    unsigned left  = NodeHeight(node->left );
+    unsigned right = NodeHeight(node->right);
+
+    node->height = (left > right ? left : right) + 1;
+    node->gen    = NextGeneration();
+
+    NodeRehash(node);
+}
+
+typedef bool (*NodeMatch)(const Node *const node, const void *const key);
+
+// Leaves the nodes from tree_node down to the first match in preorder on trail, each
+// ancestor with state 1 if the match is on its left and 2 if on its right.
+static bool SubTreeTrail(Node *const tree_node, NodeMatch match, const void *const key, NodeStack *trail)
+{
+    if(!tree_node || NodeStackPush(trail, tree_node) != EXIT_SUCCESS) return false;
+
+    while(trail->size)
+    {
+        NodeFrame *frame = &trail->frames[trail->size - 1];
+        Node      *node  = frame->node;
+
+        if(frame->state == 0 && match(node, key)) return true;
+
+        if(frame->state == 2)
+        {
+            trail->size--;
+            continue;
+        }
+
+        Node *next = (++frame->state == 1) ? node->left : node->right;
+
+        if(next && NodeStackPush(trail, next) != EXIT_SUCCESS) return false;
+    }
+
+    return false;
+}
+
+static bool IsNode(const Node *const node, const void *const target)
+{
+    return node == target;
+}
+
+bool SubTreePathTo(Node *const sub_tree, const Node *const target, Stack *path)
+{
+    ASSERT(path, return false);
+
+    NodeStack trail = {};
+
+    bool found = SubTreeTrail(sub_tree, IsNode, target, &trail);
+
+    for(size_t i = 0; found && i + 1 < trail.size; i++) PushStack(path, trail.frames[i].state == 2);
+
+    NodeStackDtor(&trail);
+
+    return found;
+}
+
+// Rehashes target and every node above it; a search, since nodes do not know their parents.
+static bool SubTreeRehashTo(Node *const tree_node, Node *const target)
+{
+    NodeStack trail = {};
+
+    bool found = SubTreeTrail(tree_node, IsNode, target, &trail);
+
+    while(found && trail.size) NodeRehash(trail.frames[--trail.size].node);
+
+    NodeStackDtor(&trail);
+
+    return found;
+}
+
+int TreeRehashPath(Tree *tree, const data_t *const path, const size_t depth)
+{
+    ASSERT(tree, return EXIT_FAILURE);
+    ASSERT(path || depth == 0, return EXIT_FAILURE);
+
+    NodeStack trail = {};
+    int       status = EXIT_SUCCESS;
+
+    Node *tree_node = tree->root;
+
+    for(size_t i = 0; tree_node && status == EXIT_SUCCESS; i++)
+    {
+        status = NodeStackPush(&trail, tree_node);
+
+        tree_node = (i < depth) ? (path[i] ? tree_node->right : tree_node->left) : NULL;
+    }
+
+    while(status == EXIT_SUCCESS && trail.size) NodeRehash(trail.frames[--trail.size].node);
+
+    NodeStackDtor(&trail);
+
+    return status;
+}
+
+void TreeRehash(Tree *tree)
+{
+    ASSERT(tree, return);
+
+    NodeStack stack = {};
+
+    if(tree->root && NodeStackPush(&stack, tree->root) != EXIT_SUCCESS) return;
+
+    // Children first: state 1 once they are pushed.
+    while(stack.size)
+    {
+        NodeFrame *frame = &stack.frames[stack.size - 1];
+        Node      *node  = frame->node;
+
+        if(frame->state)
+        {
+            NodeRehash(node);
+            stack.size--;
+            continue;
+        }
+
+        frame->state = 1;
+
+        if((node->right && NodeStackPush(&stack, node->right) != EXIT_SUCCESS) ||
+           (node->left  && NodeStackPush(&stack, node->left ) != EXIT_SUCCESS)) break;
+    }
+
+    NodeStackDtor(&stack);
+}
+
+
+static bool IsShared(const Node *const node)
+{
+    return node->refs || (node->flags & NODE_STATIC);
+}
+
+void NodeHold(Node *node)
+{
+    ASSERT(node, return);
+
+    if(!(node->flags & NODE_STATIC)) node->refs++;
+}
+
+static void NodeDrop(Node *node)
+{
+    if(!(node->flags & NODE_STATIC)) node->refs--;
+}
+
+
+// Counts are a hint, not state: compiled-in nodes are read-only and simply go uncounted.
+void NodeVisit(Node *node)
+{
+    ASSERT(node, return);
+
+    if(!(node->flags & NODE_STATIC)) node->visits++;
+}
+
+Node *NodeLikelyChild(const Node *const node)
+{
+    ASSERT(node, return NULL);
+
+    if(!node->left || !node->right) return node->left ? node->left : node->right;
+
+    return (node->right->visits > node->left->visits) ? node->right : node->left;
+}
+
+// Reads the hint from the node itself, so neither child is loaded to pick one.
+void NodePrefetch(const Node *const node)
+{
+    ASSERT(node, return);
+
+    const Node *next = (node->flags & NODE_HOT_RIGHT) ? node->right : node->left;
+
+    if(next) __builtin_prefetch(next);
+}
+
+
+// A node reached through its last parent belongs to the visitor; every other parent only
+// drops its reference. Parents are torn down concurrently, so the decision is a CAS.
+static bool NodeRelease(Node *node)
+{
+    if(node->flags & NODE_STATIC) return false;
+
+    size_t refs = __atomic_load_n(&node->refs, __ATOMIC_ACQUIRE);
+
+    while(refs)
+    {
+        if(__atomic_compare_exchange_n(&node->refs, &refs, refs - 1, true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) return false;
+    }
+
+    return true;
+}
+
+// Counts the nodes the tree loses. The size of a shared subtree is taken before its
+// reference is dropped, while no other parent can own it yet.
+static bool ReleaseVisit(Node *node, size_t, void *acc, void *ctx)
+{
+    size_t size = (ctx && IsShared(node)) ? SubTreeSize(node) : 1;
+
+    if(!NodeRelease(node))
+    {
+        *(size_t *)acc += size;
+
+        return false;
+    }
+
+    NodeDtor(node);
+    (*(size_t *)acc)++;
+
+    return true;
+}
+
 static void SubTreeDtor(Tree *tree, Node *sub_tree)
 {
-    if(!sub_tree) return;
+    size_t removed = 0;
 
-    SubTreeDtor(tree, sub_tree->left );
-    SubTreeDtor(tree, sub_tree->right);
+    ParallelFold fold = {ReleaseVisit, SumMerge, sizeof(size_t), tree};
+    SubTreeFold(sub_tree, &fold, &removed);
 
-    NodeDtor(sub_tree);
+    tree->size -= removed;
+}
 
-    tree->size--;
+int SubTreeRelease(Node *sub_tree)
+{
+    size_t removed = 0;
+
+    ParallelFold fold = {ReleaseVisit, SumMerge, sizeof(size_t), NULL};
+
+    return SubTreeFold(sub_tree, &fold, &removed);
 }
 
 int TreeDtor(Tree *tree, Node *root)
@@ -36,43 +396,166 @@ int TreeDtor(Tree *tree, Node *root)
     TREE_VERIFICATION(tree, EXIT_FAILURE);
 
     ASSERT(root, return EXIT_FAILURE);
+    ASSERT(!tree->read_only, return EXIT_FAILURE);
     ASSERT(root == tree->root || (TreeSearchParent(tree, root) != NULL), return EXIT_FAILURE);
 
-    SubTreeDtor(tree, root->left);
-    root->left  = NULL;
-
-    SubTreeDtor(tree, root->right);
-    root->right = NULL;
-
     if(root == tree->root)
     {
-        tree->root = NULL;
+        HistoryDtor(tree->history);
+        tree->history = NULL;
     }
-    else
+
+    if(root != tree->root)
     {
         Node *parent = TreeSearchParent(tree, root);
         if(parent->left == root) parent->left  = NULL;
         else                     parent->right = NULL;
+
+        parent->gen = NextGeneration();
+
+        SubTreeRehashTo(tree->root, parent);
     }
 
-    NodeDtor(root);
+    if(IsShared(root))
+    {
+        SubTreeDtor(tree, root);
+    }
+    else
+    {
+        SubTreeDtor(tree, root->left);
+        root->left  = NULL;
 
-    tree->size--;
+        SubTreeDtor(tree, root->right);
+        root->right = NULL;
+
+        NodeDtor(root);
+
+        tree->size--;
+    }
+
+    if(root == tree->root)
+    {
+        tree->root = NULL;
+    }
+
+    if(!tree->root)
+    {
+        ArenaDtor(tree->arena);
+        tree->arena = NULL;
+    }
 
     return EXIT_SUCCESS;
 }
 
 
+// Only nodes on the insertion path take part in a rotation, and those are unshared on the
+// way down, so subtrees other versions hold are moved between parents but never changed.
+static Node *RotateLeft(Node *tree_node)
+{
+    Node *top = tree_node->right;
+
+    tree_node->right = top->left;
+    top->left        = tree_node;
+
+    NodeRelink(tree_node);
+    NodeRelink(top);
+
+    return top;
+}
+
+static Node *RotateRight(Node *tree_node)
+{
+    Node *top = tree_node->left;
+
+    tree_node->left = top->right;
+    top->right      = tree_node;
+
+    NodeRelink(tree_node);
+    NodeRelink(top);
+
+    return top;
+}
+
+static Node *NodeBalance(Node *tree_node)
+{
+    NodeRelink(tree_node);
+
+    int balance = (int)NodeHeight(tree_node->left) - (int)NodeHeight(tree_node->right);
+
+    if(balance > 1)
+    {
+        if(NodeHeight(tree_node->left->left) < NodeHeight(tree_node->left->right))
+            tree_node->left = RotateLeft(tree_node->left);
+
+        return RotateRight(tree_node);
+    }
+
+    if(balance < -1)
+    {
+        if(NodeHeight(tree_node->right->right) < NodeHeight(tree_node->right->left))
+            tree_node->right = RotateRight(tree_node->right);
+
+        return RotateLeft(tree_node);
+    }
+
+    return tree_node;
+}
+
+static Node *SubTreeInsertBalanced(Node *tree_node, const char *const val, Node **added)
+{
+    if(!tree_node) return (*added = NodeCtor(val));
+
+    if(IsShared(tree_node))
+    {
+        Node *copy = NodeCopy(tree_node);
+        ASSERT(copy, return tree_node);
+
+        NodeDrop(tree_node);
+        tree_node = copy;
+    }
+
+    if(strcmp(val, tree_node->data) <= 0) tree_node->left  = SubTreeInsertBalanced(tree_node->left , val, added);
+    else                                  tree_node->right = SubTreeInsertBalanced(tree_node->right, val, added);
+
+    return NodeBalance(tree_node);
+}
+
+// Rehashes every node from the root down to the new one, so the tree hash stays right
+// wherever below the root the node is added.
 Node *AddNode(Tree *tree, Node *tree_node, const char *const val, PlacePref pref)
 {
     TREE_VERIFICATION(tree, NULL);
 
     ASSERT(val, return NULL);
-    ASSERT(tree_node == tree->root || (TreeSearchParent(tree, tree_node) != NULL), return NULL);
 
-    Node **next = &tree_node;
+    if(tree->balanced)
+    {
+        ASSERT(pref == AUTO && tree_node == tree->root, return NULL);
+
+        Node *added = NULL;
+        tree->root = SubTreeInsertBalanced(tree->root, val, &added);
+
+        if(added)
+        {
+            TouchLabel(added);
+            tree->size++;
+        }
+
+        return added;
+    }
+
+    NodeStack trail  = {};
+    Node     *parent = NULL;
+    Node    **next   = &tree_node;
+
+    ASSERT(SubTreeTrail(tree->root, IsNode, tree_node, &trail), NodeStackDtor(&trail); return NULL);
+    trail.size--;
+
     while(*next)
     {
+        parent = *next;
+        ASSERT(NodeStackPush(&trail, parent) == EXIT_SUCCESS, NodeStackDtor(&trail); return NULL);
+
         switch(pref)
         {
             case LEFT:
@@ -85,12 +568,19 @@ Node *AddNode(Tree *tree, Node *tree_node, const char *const val, PlacePref pref
                 if(strcmp(val, (*next)->data) <= 0) next = &((*next)->left );
                 else                                next = &((*next)->right);
                 break;
-            default: return NULL;
+            default: NodeStackDtor(&trail); return NULL;
         }
     }
 
     (*next) = NodeCtor(val);
-    ASSERT((*next), return NULL);
+    ASSERT((*next), NodeStackDtor(&trail); return NULL);
+
+    TouchLabel(*next);
+
+    if(parent) parent->gen = NextGeneration();
+
+    while(trail.size) NodeRehash(trail.frames[--trail.size].node);
+    NodeStackDtor(&trail);
 
     tree->size++;
 
@@ -102,14 +592,20 @@ Node *NodeCtor(const char *const val, Node *const left, Node *const right)
 {
     ASSERT(val, return NULL);
 
-    Node *node = (Node *)calloc(1, sizeof(Node));
+    Node *node = (Node *)MemCalloc(MEM_NODES, 1, sizeof(Node));
     ASSERT(node, return NULL);
 
-    node->data = strndup(val, MAX_DATA_LEN - 1);
-    ASSERT(node->data, free(node); return NULL);
+    node->data = MemStrndup(MEM_LABELS, val, MAX_DATA_LEN - 1);
+    ASSERT(node->data, MemFree(MEM_NODES, node); return NULL);
+
+    METRICS_ADD(COUNTER_NODES, 1);
+    METRICS_ADD(COUNTER_LABEL_BYTES, (int64_t)(strlen(node->data) + 1));
 
     node->left  = left;
     node->right = right;
+    node->hash   = NodeHash(node->data, left, right);
+    node->gen    = NextGeneration();
+    node->height = 1;
 
     return node;
 }
@@ -118,56 +614,128 @@ int NodeDtor(Node *node)
 {
     ASSERT(node, return EXIT_FAILURE);
 
-    free(node->data);
-    free(node);
+    if(!(node->flags & NODE_SHARED_DATA))
+    {
+        METRICS_ADD(COUNTER_LABEL_BYTES, -(int64_t)(strlen(node->data) + 1));
+
+        MemFree(MEM_LABELS, node->data);
+    }
+
+    if(!(node->flags & NODE_ARENA)) MemFree(MEM_NODES, node);
+
+    METRICS_ADD(COUNTER_NODES, -1);
 
     return EXIT_SUCCESS;
 }
 
+Node *NodeCopy(Node *const node)
+{
+    ASSERT(node, return NULL);
+
+    Node *copy = (Node *)MemCalloc(MEM_NODES, 1, sizeof(Node));
+    ASSERT(copy, return NULL);
+
+    copy->flags  = node->flags & ~(unsigned)(NODE_STATIC | NODE_ARENA);
+    copy->hash   = node->hash;
+    copy->gen    = node->gen;
+    copy->visits = node->visits;
+    copy->height = node->height;
+    copy->data  = (node->flags & NODE_SHARED_DATA) ? node->data : MemStrndup(MEM_LABELS, node->data, MAX_DATA_LEN - 1);
+    ASSERT(copy->data, MemFree(MEM_NODES, copy); return NULL);
+
+    METRICS_ADD(COUNTER_NODES, 1);
+    if(!(node->flags & NODE_SHARED_DATA)) METRICS_ADD(COUNTER_LABEL_BYTES, (int64_t)(strlen(copy->data) + 1));
+
+    copy->left  = node->left;
+    copy->right = node->right;
+
+    if(copy->left ) NodeHold(copy->left );
+    if(copy->right) NodeHold(copy->right);
+
+    return copy;
+}
 
-static Node *SubTreeSearchVal(Node *const tree_node, const char *const val)
+int NodeRelabel(Node *node, const char *const val)
 {
-    if(!tree_node) return NULL;
-    else if(strncmp(tree_node->data, val, MAX_DATA_LEN) == 0) return tree_node;
+    ASSERT(node, return EXIT_FAILURE);
+    ASSERT(val , return EXIT_FAILURE);
+
+    char *data = MemStrndup(MEM_LABELS, val, MAX_DATA_LEN - 1);
+    ASSERT(data, return EXIT_FAILURE);
+
+    if(!(node->flags & NODE_SHARED_DATA))
+    {
+        METRICS_ADD(COUNTER_LABEL_BYTES, -(int64_t)(strlen(node->data) + 1));
+
+        MemFree(MEM_LABELS, node->data);
+    }
+
+    METRICS_ADD(COUNTER_LABEL_BYTES, (int64_t)(strlen(data) + 1));
 
-    Node *find  = SubTreeSearchVal(tree_node->left , val);
+    node->data   = data;
+    node->flags &= ~(unsigned)NODE_SHARED_DATA;
+    node->gen    = NextGeneration();
 
-    return (find ? find : SubTreeSearchVal(tree_node->right, val));
+    NodeRehash(node);
+    TouchLabel(node);
+
+    return EXIT_SUCCESS;
+}
+
+
+static bool IsLabel(const Node *const node, const void *const val)
+{
+    return strncmp(node->data, (const char *)val, MAX_DATA_LEN - 1) == 0;
 }
 
+// Walks alone, so the first match in preorder wins when labels repeat, the same node
+// TreePath and the cached paths find.
 Node *TreeSearchVal(Tree *const tree, const char *const val)
 {
     TREE_VERIFICATION(tree, NULL);
 
     ASSERT(val, return NULL);
 
-    return SubTreeSearchVal(tree->root, val);
-}
+    if(tree->balanced) return OrderedSearch(tree->root, val);
+
+    NodeStack trail = {};
 
+    Node *found = SubTreeTrail(tree->root, IsLabel, val, &trail) ? trail.frames[trail.size - 1].node : NULL;
 
+    NodeStackDtor(&trail);
+
+    return found;
+}
+
+// Pushes the directions leaf end first.
 static bool SubTreePath(Node *const tree_node, const char *const val, Stack *path)
 {
-    if(!tree_node) return false;
-    else if(strncmp(tree_node->data, val, MAX_DATA_LEN - 1) == 0) return true;
+    NodeStack trail = {};
 
-    if(SubTreePath(tree_node->left, val, path))
-    {
-        PushStack(path, 0);
+    bool found = SubTreeTrail(tree_node, IsLabel, val, &trail);
 
-        return true;
-    }
-    else if(SubTreePath(tree_node->right, val, path))
+    if(found)
     {
-        PushStack(path, 1);
+        NodeVisit(trail.frames[--trail.size].node);
 
-        return true;
+        while(trail.size)
+        {
+            NodeFrame *frame = &trail.frames[--trail.size];
+
+            PushStack(path, frame->state == 2);
+            NodeVisit(frame->node);
+        }
     }
 
-    return false;
+    NodeStackDtor(&trail);
+
+    return found;
 }
 
 Stack TreePath(Tree *const tree, const char *const val)
 {
+    METRICS_TIME(OP_TREE_PATH);
+
     TREE_VERIFICATION(tree, {});
 
     ASSERT(val, return {});
@@ -187,15 +755,20 @@ Stack TreePath(Tree *const tree, const char *const val)
 }
 
 
+static bool IsParent(const Node *const node, const void *const child)
+{
+    return node->left == child || node->right == child;
+}
+
 static Node *SubTreeSearchParent(Node *const tree_node, Node *const search_node)
 {
-    if(!tree_node) return NULL;
-    else if(tree_node->left  == search_node ||
-            tree_node->right == search_node) return tree_node;
+    NodeStack trail = {};
+
+    Node *find = SubTreeTrail(tree_node, IsParent, search_node, &trail) ? trail.frames[trail.size - 1].node : NULL;
 
-    Node *find  = SubTreeSearchParent(tree_node->left , search_node);
+    NodeStackDtor(&trail);
 
-    return (find ? find : SubTreeSearchParent(tree_node->right, search_node));
+    return find;
 }
 
 Node *TreeSearchParent(Tree *const tree, Node *const search_node)
@@ -208,14 +781,126 @@ Node *TreeSearchParent(Tree *const tree, Node *const search_node)
 }
 
 
-static Node *ReadSubTree(char *buf, size_t *counter)
+Node *TreeFollowPath(Tree *const tree, const data_t *const path, const size_t depth)
 {
-    static char *buffer = buf;
-    static int offset   = 0;
-    static char ch      = 0;
+    ASSERT(tree, return NULL);
+    ASSERT(path || depth == 0, return NULL);
+
+    Node *tree_node = tree->root;
+
+    for(size_t i = 0; i < depth && tree_node; i++)
+    {
+        tree_node = (path[i] ? tree_node->right : tree_node->left);
+    }
+
+    return tree_node;
+}
+
+Node *TreeUnsharePath(Tree *tree, const data_t *const path, const size_t depth)
+{
+    TREE_VERIFICATION(tree, NULL);
 
-    sscanf(buffer, " %c%n", &ch, &offset);
-    buffer += offset;
+    ASSERT(path || depth == 0, return NULL);
+
+    Node **link = &tree->root;
+
+    for(size_t i = 0; ; i++)
+    {
+        Node *tree_node = *link;
+        if(!tree_node) return NULL;
+
+        // Copying a shared node shares its children, so every node below it is copied as well.
+        if(IsShared(tree_node))
+        {
+            Node *copy = NodeCopy(tree_node);
+            ASSERT(copy, return NULL);
+
+            NodeDrop(tree_node);
+            *link = tree_node = copy;
+        }
+
+        if(i == depth) return tree_node;
+
+        link = (path[i] ? &tree_node->right : &tree_node->left);
+    }
+}
+
+
+struct ReadState
+{
+    const char *start;
+
+    ReadReport report;
+};
+
+static size_t LineOf(const char *start, const char *pos)
+{
+    size_t line = 1;
+
+    for(; start < pos; start++) line += (*start == '\n');
+
+    return line;
+}
+
+static void CheckStoredHash(ReadState *state, Node *node, uint64_t stored, const char *label_pos,
+                            bool children_bad, bool *bad)
+{
+    state->report.hashed++;
+
+    if(node->hash == stored) return;
+
+    state->report.mismatched++;
+    *bad = true;
+
+    // A damaged label also breaks the hashes of all its ancestors; report only where it starts.
+    if(children_bad) return;
+
+    state->report.corrupted++;
+
+    if(state->report.corruption_file)
+    {
+        fprintf(state->report.corruption_file, "line %zu: <%s>: stored %016" PRIx64 ", computed %016" PRIx64 "\n",
+                                        LineOf(state->start, label_pos), node->data, stored, node->hash);
+    }
+    else
+    {
+        LOG("Hash mismatch at line %zu: <%s>.\n", LineOf(state->start, label_pos), node->data);
+    }
+}
+
+// sscanf measures the whole remaining buffer on every call, which made loading quadratic.
+static char NextChar(char **buffer)
+{
+    while(isspace((unsigned char)**buffer)) (*buffer)++;
+
+    return **buffer ? *(*buffer)++ : '\0';
+}
+
+static bool ReadLabel(char **buffer, char *data)
+{
+    while(isspace((unsigned char)**buffer)) (*buffer)++;
+
+    size_t len = 0;
+
+    for(; **buffer && **buffer != '>'; (*buffer)++)
+    {
+        if(len < MAX_DATA_LEN - 1) data[len++] = **buffer;
+    }
+
+    if(!**buffer || len == 0) return false;
+
+    (*buffer)++;
+
+    return true;
+}
+
+static Node *ReadSubTree(char **buffer, ReadState *state, size_t depth, bool *bad)
+{
+    TRACE_SPAN(span, (depth < TRACE_READ_DEPTH) ? "ReadSubTree" : NULL);
+
+    size_t start_count = state->report.nodes;
+
+    char ch = NextChar(buffer);
 
     switch(ch)
     {
@@ -223,8 +908,9 @@ static Node *ReadSubTree(char *buf, size_t *counter)
         {
             char data[MAX_DATA_LEN] = {};
 
-            sscanf(buffer, " %c%n", &ch, &offset);
-            buffer += offset;
+            ch = NextChar(buffer);
+
+            const char *label_pos = *buffer - 1;
 
             if(ch != '<')
             {
@@ -232,22 +918,31 @@ static Node *ReadSubTree(char *buf, size_t *counter)
                 return NULL;
             }
 
-            bool is_scaned = sscanf(buffer, " %[^>]%*c%n", data, &offset);
-            buffer += offset;
-
-            if(!is_scaned)
+            if(!ReadLabel(buffer, data))
             {
                 LOG("Invalid data.\n");
                 return NULL;
             }
 
-            Node *left  = ReadSubTree(buffer, counter);
-            Node *right = ReadSubTree(buffer, counter);
+            bool     has_hash = false;
+            uint64_t stored   = 0;
+
+            if(**buffer == '#')
+            {
+                char *hash_end = NULL;
+                stored = strtoull(*buffer + 1, &hash_end, 16);
+
+                has_hash = (hash_end != *buffer + 1);
+                *buffer  = hash_end;
+            }
+
+            bool left_bad  = false;
+            bool right_bad = false;
 
-            sscanf(buffer, " %c%n", &ch, &offset);
-            buffer += offset;
+            Node *left  = ReadSubTree(buffer, state, depth + 1, &left_bad );
+            Node *right = ReadSubTree(buffer, state, depth + 1, &right_bad);
 
-            if(ch != ')')
+            if(NextChar(buffer) != ')')
             {
                 LOG("Invalid data.\n");
 
@@ -257,9 +952,18 @@ static Node *ReadSubTree(char *buf, size_t *counter)
                 return NULL;
             }
 
-            (*counter)++;
+            state->report.nodes++;
 
-            return NodeCtor(data, left, right);
+            TraceSpanInt(&span, "nodes", (long long)(state->report.nodes - start_count));
+            TraceSpanStr(&span, "label", data);
+
+            Node *node = NodeCtor(data, left, right);
+
+            *bad = left_bad || right_bad;
+
+            if(node && has_hash) CheckStoredHash(state, node, stored, label_pos, *bad, bad);
+
+            return node;
         }
         case '*':
         {
@@ -282,10 +986,15 @@ static size_t FileSize(const char *const file_name)
     return (size_t)file_info.st_size;
 }
 
-Tree ReadTree(const char *const file_name)
+Tree ReadTree(const char *const file_name, ReadReport *report)
 {
+    METRICS_TIME(OP_READ_TREE);
+
     ASSERT(file_name, return {});
 
+    TRACE_SPAN(span, "ReadTree");
+    TraceSpanStr(&span, "file", file_name);
+
     FILE *file = fopen(file_name, "rb");
     if(!file)
     {
@@ -294,70 +1003,137 @@ Tree ReadTree(const char *const file_name)
     }
 
     size_t buf_size = FileSize(file_name);
-    char *buffer = (char *)calloc(buf_size + 1, sizeof(char));
+    char *buffer = (char *)MemCalloc(MEM_PARSER, buf_size + 1, sizeof(char));
     ASSERT(buffer, fclose(file); return {});
 
     fread(buffer, buf_size, sizeof(char), file);
     fclose(file);
 
-    size_t counter = 0;
-    Tree tree      = {};
+    ReadState state = {buffer, {}};
+    Tree      tree  = {};
 
-    tree.root = ReadSubTree(buffer, &counter);
-    tree.size = counter;
+    if(report) state.report.corruption_file = report->corruption_file;
 
-    free(buffer);
+    char *cursor = buffer;
+    bool  bad    = false;
+
+    tree.root = ReadSubTree(&cursor, &state, 0, &bad);
+    tree.size = state.report.nodes;
+
+    TraceSpanInt(&span, "nodes", (long long)tree.size);
+
+    if(report) *report = state.report;
+
+    MemFree(MEM_PARSER, buffer);
 
     return tree;
 }
 
 
-static void SubTreeTextDump(Node *const tree_node, FILE *dump_file)
+// State counts the children written so far. Fails if the stack can`t grow, with the
+// subtree written only in part.
+static int SubTreeTextDump(Node *const tree_node, FILE *dump_file)
 {
-    if(!tree_node) {fputc('*', dump_file); return;}
+    if(!tree_node) {fputc('*', dump_file); return EXIT_SUCCESS;}
 
-    fprintf(dump_file, "\n\t(");
+    NodeStack stack  = {};
+    int       status = NodeStackPush(&stack, tree_node);
+
+    if(status != EXIT_SUCCESS) return status;
+
+    while(stack.size)
+    {
+        NodeFrame *frame = &stack.frames[stack.size - 1];
+        Node      *node  = frame->node;
 
-    fprintf(dump_file, "<%s>", tree_node->data);
+        if(frame->state == 0)
+        {
+            fprintf(dump_file, "\n\t(");
+
+            fprintf(dump_file, "<%s>#%016" PRIx64, node->data, node->hash);
+        }
+        else if(frame->state == 2)
+        {
+            fputc(')', dump_file);
+
+            stack.size--;
+            continue;
+        }
 
-    SubTreeTextDump(tree_node->left , dump_file);
-    SubTreeTextDump(tree_node->right, dump_file);
+        Node *next = (frame->state++ == 0) ? node->left : node->right;
 
-    fputc(')', dump_file);
+        if(!next) fputc('*', dump_file);
+        else if((status = NodeStackPush(&stack, next)) != EXIT_SUCCESS) break;
+    }
+
+    NodeStackDtor(&stack);
+
+    return status;
 }
 
-void TreeTextDump(Tree *const tree, FILE *dump_file)
+int TreeTextDump(Tree *const tree, FILE *dump_file)
 {
-    ASSERT(dump_file, return);
-
-    fprintf(dump_file, "TREE[%p]:\n", tree);
+    METRICS_TIME(OP_TEXT_DUMP);
 
-    if(!tree) return;
+    ASSERT(dump_file, return EXIT_FAILURE);
 
     if(dump_file == LOG_FILE)
     {
+        LOG("TREE[%p]:\n", tree);
+
+        if(!tree) return EXIT_FAILURE;
+
         LOG("\troot: %p \n"
             "\tsize: %zu\n", tree->root, tree->size);
     }
 
-    if(!tree->root) return;
+    if(!tree) return EXIT_FAILURE;
+
+    if(!tree->root) return EXIT_SUCCESS;
 
-    SubTreeTextDump(tree->root, dump_file);
+    int status = SubTreeTextDump(tree->root, dump_file);
     fputc('\n', dump_file);
+
+    return status;
 }
 
 
-static void DotTreeCtor(Node *const node, Node *const node_next, const char *direction, FILE *file)
+// The root has a record of its own, so only the nodes below it are written. A node`s state
+// is 1 while its left subtree is written and 2 for the right one.
+static void DotTreeCtor(Node *const root, FILE *file)
 {
-    if(!node_next) return;
+    NodeStack stack = {};
+
+    if(NodeStackPush(&stack, root) != EXIT_SUCCESS) return;
+
+    while(stack.size)
+    {
+        NodeFrame *frame = &stack.frames[stack.size - 1];
+        Node      *node  = frame->node;
 
-    fprintf(file, "node%p[label = \"{<data> data: %s | {<left> NO | <right> YES}}\"];\n",
-                                                             node_next, node_next->data);
+        if(frame->state == 0 && stack.size > 1)
+        {
+            const NodeFrame *parent = &stack.frames[stack.size - 2];
 
-    fprintf(file, "node%p:<%s>:s -> node%p:<data>:n;\n", node, direction, node_next);
+            fprintf(file, "node%p[label = \"{<data> data: %s | {<left> NO | <right> YES}}\"];\n",
+                                                                       node, node->data);
 
-    DotTreeCtor(node_next, node_next->left , "left" , file);
-    DotTreeCtor(node_next, node_next->right, "right", file);
+            fprintf(file, "node%p:<%s>:s -> node%p:<data>:n;\n", parent->node,
+                                                               (parent->state == 1) ? "left" : "right", node);
+        }
+
+        if(frame->state == 2)
+        {
+            stack.size--;
+            continue;
+        }
+
+        Node *next = (++frame->state == 1) ? node->left : node->right;
+
+        if(next && NodeStackPush(&stack, next) != EXIT_SUCCESS) break;
+    }
+
+    NodeStackDtor(&stack);
 }
 
 static void TreeDotGeneral(Tree *const tree, FILE *dot_file)
@@ -377,16 +1153,20 @@ static void TreeDotGeneral(Tree *const tree, FILE *dot_file)
 
 void TreeDot(Tree *const tree, const char *png_file_name)
 {
+    METRICS_TIME(OP_TREE_DOT);
+
     ASSERT(png_file_name, return);
 
     if(!(tree && tree->root)) return;
 
+    TRACE_SPAN(span, "TreeDot");
+    TraceSpanInt(&span, "nodes", (long long)tree->size);
+
     FILE *dot_file = fopen("tree.dot", "wb");
     ASSERT(dot_file, return);
 
     TreeDotGeneral(tree, dot_file);
-    DotTreeCtor(tree->root, tree->root->left , "left" , dot_file);
-    DotTreeCtor(tree->root, tree->root->right, "right", dot_file);
+    DotTreeCtor(tree->root, dot_file);
 
     fprintf(dot_file, "}\n");
 
@@ -394,7 +1174,7 @@ void TreeDot(Tree *const tree, const char *png_file_name)
 
     char sys_cmd[MAX_STR_LEN] = {};
     sprintf(sys_cmd, "dot tree.dot -T png -o %s", png_file_name);
-    system(sys_cmd);
+    TracedSystem(sys_cmd);
 
     remove("tree.dot");
 }
@@ -402,14 +1182,17 @@ void TreeDot(Tree *const tree, const char *png_file_name)
 
 static void MakeDumpDir(void)
 {
-    system("rm -rf dump_tree");
-    system("mkdir dump_tree");
+    TracedSystem("rm -rf dump_tree");
+    TracedSystem("mkdir dump_tree");
 }
 
 void TreeDump(Tree *tree, const char *func, const int line)
 {
     static int num = 0;
 
+    TRACE_SPAN(span, "TreeDump");
+    TraceSpanStr(&span, "caller", func);
+
     if(num == 0) MakeDumpDir();
 
     char file_name[MAX_STR_LEN] = {};
@@ -423,14 +1206,21 @@ void TreeDump(Tree *tree, const char *func, const int line)
 }
 
 #ifdef PROTECT
-static void TreeSizeValidation(Tree *const tree, Node *const tree_node, size_t *counter)
+struct SizeCtx
+{
+    size_t limit;
+    size_t counted;  // flushed by every worker each PARALLEL_GRAIN nodes
+};
+
+// Counting stops once the limit is reached, so a cycle cannot keep the walk going forever.
+static bool SizeVisit(Node *, size_t, void *acc, void *ctx)
 {
-    if(!tree_node || (*counter) >= tree->size) return;
+    SizeCtx *size  = (SizeCtx *)ctx;
+    size_t  *local = (size_t *)acc;
 
-    (*counter)++;
+    if(++(*local) % PARALLEL_GRAIN == 0) __atomic_add_fetch(&size->counted, PARALLEL_GRAIN, __ATOMIC_RELAXED);
 
-    TreeSizeValidation(tree, tree_node->left , counter);
-    TreeSizeValidation(tree, tree_node->right, counter);
+    return __atomic_load_n(&size->counted, __ATOMIC_RELAXED) + (*local) % PARALLEL_GRAIN < size->limit;
 }
 
 bool IsTreeValid(Tree *const tree)
@@ -438,10 +1228,12 @@ bool IsTreeValid(Tree *const tree)
     ASSERT(tree && tree->root   , return false);
     ASSERT(tree->size <= INT_MAX, return false);
 
-    size_t counter = 0;
-    TreeSizeValidation(tree, tree->root, &counter);
+    size_t       counter = 0;
+    SizeCtx      size    = {tree->size, 0};
+    ParallelFold fold    = {SizeVisit, SumMerge, sizeof(size_t), &size};
 
-    ASSERT(counter == tree->size, return false);
+    ASSERT(SubTreeFold(tree->root, &fold, &counter) == EXIT_SUCCESS, return false);
+    ASSERT(counter >= tree->size, return false);
 
     return true;
 }
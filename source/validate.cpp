@@ -0,0 +1,1143 @@
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../include/validate.h"
+#include "../include/constants.h"
+#include "../include/log.h"
+#include "../include/memory.h"
+#include "../include/parallel.h"
+
+const uint64_t LABEL_HASH_BASE = 0x100000001b3ull;
+const size_t   LABEL_READ      = 4096;
+
+// What ReadTree expects next, as far as single bytes tell. Chunks start in the middle of the
+// file, so each one is first run from every state to learn where the next one starts.
+enum LexState
+{
+    LEX_OUT,
+    LEX_AFTER_LABEL,  // right after '>', where '#' starts a hash
+    LEX_HASH_EMPTY,
+    LEX_HASH,
+    LEX_LABEL_BLANK,  // whitespace ReadLabel skips
+    LEX_LABEL,
+
+    LEX_STATE_COUNT
+};
+
+enum TokenKind
+{
+    TOKEN_OPEN,
+    TOKEN_LABEL,
+    TOKEN_NIL,
+    TOKEN_CLOSE,
+    TOKEN_NODE,   // a node closed inside a chunk, now a child of a frame opened before it
+};
+
+struct TextPos
+{
+    uint64_t offset;
+    size_t   line;
+    size_t   column;
+};
+
+struct Token
+{
+    TokenKind kind;
+    TextPos   pos;
+    uint64_t  hash;  // of a label, partial when a chunk ends inside it
+};
+
+// A node between its '(' and ')'. The bottom frame of the stitching pass is the file itself,
+// which holds the root.
+struct Frame
+{
+    TextPos open;
+    TextPos label;
+
+    uint64_t label_hash;
+    size_t   children;
+
+    bool file;
+    bool has_label;
+    bool node_child;
+};
+
+// A label or a hash, which a chunk boundary may cut.
+struct Run
+{
+    LexState kind;  // LEX_OUT for none, LEX_LABEL or LEX_HASH
+    TextPos  pos;   // of the '<' or '#'
+
+    uint64_t hash;  // of the label bytes after the leading whitespace
+    size_t   len;
+};
+
+struct ValidateError
+{
+    TextPos     pos;
+    const char *message;
+};
+
+struct LeafRecord
+{
+    uint64_t hash;
+    uint64_t offset;  // of the '<'
+    size_t   line;
+};
+
+struct Machine
+{
+    Frame *frames;
+    size_t depth;
+    size_t frames_capacity;
+
+    Token *outer;  // tokens for the frames a chunk did not open, replayed by the stitching pass
+    size_t n_outer;
+    size_t outer_capacity;
+    size_t outer_closes;
+
+    bool opened;
+    long max_depth;  // of a node opened in a chunk, counted from the chunk start, less the outer closes
+
+    ValidateError *errors;
+    size_t         n_errors;
+    size_t         errors_capacity;
+    size_t         errors_total;
+
+    LeafRecord *leaves;
+    size_t      n_leaves;
+    size_t      leaves_capacity;
+    bool        duplicates;
+
+    size_t nodes;
+    size_t leaf_count;
+
+    bool no_memory;
+};
+
+struct Chunk
+{
+    int      fd;
+    uint64_t begin;
+    uint64_t end;
+
+    unsigned char exits[LEX_STATE_COUNT];  // the state the chunk ends in for each one it may start in
+    size_t        newlines;
+    size_t        tail_columns;            // codepoints after the last line break
+
+    LexState start;
+    TextPos  base;    // of the byte before the chunk
+    TextPos  finish;  // past its last byte
+
+    Machine machine;
+
+    Run  lead;         // what the chunk adds to a run started before it
+    bool lead_closed;
+    Run  tail;         // a run started in the chunk and still open at its end
+
+    bool failed;
+};
+
+typedef void *(*ChunkRun)(void *arg);
+
+const size_t LEX_MAPS = 16;  // start to current state maps a chunk can reach, LexTableInit finds them
+
+static unsigned char  LEX_TABLE[LEX_STATE_COUNT][256]           = {};
+static unsigned char  LEX_MAP_STATES[LEX_MAPS][LEX_STATE_COUNT] = {};
+static unsigned char  LEX_MAP_TABLE[LEX_MAPS][256]              = {};
+static pthread_once_t LEX_TABLE_ONCE                            = PTHREAD_ONCE_INIT;
+
+// isspace of the "C" locale, which is what the loader runs in.
+static bool IsBlank(unsigned char ch)
+{
+    return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\v' || ch == '\f' || ch == '\r';
+}
+
+static bool IsHex(unsigned char ch)
+{
+    return (ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'f') || (ch >= 'A' && ch <= 'F');
+}
+
+static LexState OutState(unsigned char ch)
+{
+    return (ch == '<') ? LEX_LABEL_BLANK : LEX_OUT;
+}
+
+static LexState NextState(LexState state, unsigned char ch)
+{
+    switch(state)
+    {
+        case LEX_OUT:         return OutState(ch);
+        case LEX_AFTER_LABEL: return (ch == '#') ? LEX_HASH_EMPTY : OutState(ch);
+        case LEX_HASH_EMPTY:
+        case LEX_HASH:        return IsHex(ch) ? LEX_HASH : OutState(ch);
+        case LEX_LABEL_BLANK: return (ch == '>') ? LEX_AFTER_LABEL : (IsBlank(ch) || ch == '\0') ? LEX_LABEL_BLANK : LEX_LABEL;
+        case LEX_LABEL:       return (ch == '>') ? LEX_AFTER_LABEL : LEX_LABEL;
+        case LEX_STATE_COUNT:
+        default:              return LEX_OUT;
+    }
+}
+
+static uint32_t MapKey(size_t map)
+{
+    uint32_t key = 0;
+    for(size_t state = 0; state < LEX_STATE_COUNT; state++) key = key << 4 | LEX_MAP_STATES[map][state];
+
+    return key;
+}
+
+static void LexTableInit(void)
+{
+    for(size_t state = 0; state < LEX_STATE_COUNT; state++)
+    {
+        for(size_t ch = 0; ch < 256; ch++) LEX_TABLE[state][ch] = (unsigned char)NextState((LexState)state, (unsigned char)ch);
+    }
+
+    // Scanning a chunk from all states at once then takes one lookup per byte.
+    size_t n_maps = 1;
+    for(size_t state = 0; state < LEX_STATE_COUNT; state++) LEX_MAP_STATES[0][state] = (unsigned char)state;
+
+    for(size_t map = 0; map < n_maps; map++)
+    {
+        for(size_t ch = 0; ch < 256; ch++)
+        {
+            uint32_t next = 0;
+            for(size_t state = 0; state < LEX_STATE_COUNT; state++) next = next << 4 | LEX_TABLE[LEX_MAP_STATES[map][state]][ch];
+
+            size_t found = 0;
+            while(found < n_maps && MapKey(found) != next) found++;
+
+            if(found == n_maps)
+            {
+                ASSERT(n_maps < LEX_MAPS, return);
+
+                for(size_t state = LEX_STATE_COUNT; state-- > 0; next >>= 4) LEX_MAP_STATES[n_maps][state] = (unsigned char)(next & 0xF);
+
+                n_maps++;
+            }
+
+            LEX_MAP_TABLE[map][ch] = (unsigned char)found;
+        }
+    }
+}
+
+static uint64_t Power(uint64_t base, size_t exp)
+{
+    uint64_t result = 1;
+
+    for(; exp; exp >>= 1, base *= base)
+    {
+        if(exp & 1) result *= base;
+    }
+
+    return result;
+}
+
+// Returns array if count still fits, the grown array otherwise, NULL if out of memory.
+static void *Grow(void *array, size_t *capacity, const size_t count, const size_t size)
+{
+    if(count <= *capacity) return array;
+
+    size_t capacity_r = *capacity ? *capacity * 2 : 16;
+    void  *array_r    = MemRealloc(MEM_PARSER, array, capacity_r * size);
+
+    if(array_r) *capacity = capacity_r;
+
+    return array_r;
+}
+
+static void MachineDtor(Machine *machine)
+{
+    MemFree(MEM_PARSER, machine->frames);
+    MemFree(MEM_PARSER, machine->outer);
+    MemFree(MEM_PARSER, machine->errors);
+    MemFree(MEM_PARSER, machine->leaves);
+
+    *machine = {};
+}
+
+static void Report(Machine *machine, TextPos pos, const char *const message)
+{
+    machine->errors_total++;
+
+    if(machine->n_errors >= VALIDATE_MAX_ERRORS) return;
+
+    ValidateError *errors_r = (ValidateError *)Grow(machine->errors, &machine->errors_capacity,
+                                                    machine->n_errors + 1, sizeof(ValidateError));
+    if(!errors_r)
+    {
+        machine->no_memory = true;
+        return;
+    }
+
+    machine->errors = errors_r;
+    machine->errors[machine->n_errors++] = {pos, message};
+}
+
+static Frame *Push(Machine *machine)
+{
+    Frame *frames_r = (Frame *)Grow(machine->frames, &machine->frames_capacity, machine->depth + 1, sizeof(Frame));
+
+    if(!frames_r)
+    {
+        machine->no_memory = true;
+        return NULL;
+    }
+
+    machine->frames = frames_r;
+    machine->frames[machine->depth] = {};
+
+    return &machine->frames[machine->depth++];
+}
+
+static void PassOut(Machine *machine, const Token *const token)
+{
+    Token *outer_r = (Token *)Grow(machine->outer, &machine->outer_capacity, machine->n_outer + 1, sizeof(Token));
+
+    if(!outer_r)
+    {
+        machine->no_memory = true;
+        return;
+    }
+
+    machine->outer = outer_r;
+    machine->outer[machine->n_outer++] = *token;
+
+    if(token->kind == TOKEN_CLOSE) machine->outer_closes++;
+}
+
+static void AddLeaf(Machine *machine, const Frame *const frame)
+{
+    machine->leaf_count++;
+
+    if(!machine->duplicates) return;
+
+    LeafRecord *leaves_r = (LeafRecord *)Grow(machine->leaves, &machine->leaves_capacity,
+                                              machine->n_leaves + 1, sizeof(LeafRecord));
+    if(!leaves_r)
+    {
+        machine->no_memory = true;
+        return;
+    }
+
+    machine->leaves = leaves_r;
+    machine->leaves[machine->n_leaves++] = {frame->label_hash, frame->label.offset, frame->label.line};
+}
+
+static void AddChild(Machine *machine, Frame *frame, const Token *const token)
+{
+    if(frame->file)
+    {
+        if(frame->children)                  Report(machine, token->pos, "data after the root");
+        else if(token->kind == TOKEN_NIL)    Report(machine, token->pos, "the tree is empty");
+
+        frame->children = 1;
+        return;
+    }
+
+    if(frame->children == 2)
+    {
+        Report(machine, token->pos, "a third child");
+        return;
+    }
+
+    frame->children++;
+
+    if(token->kind == TOKEN_NODE) frame->node_child = true;
+}
+
+static void Apply(Machine *machine, const Token *const token)
+{
+    if(token->kind == TOKEN_OPEN)
+    {
+        Frame *frame = Push(machine);
+        if(!frame) return;
+
+        frame->open = token->pos;
+
+        long depth = (long)machine->depth - (long)machine->outer_closes;
+
+        if(!machine->opened || depth > machine->max_depth) machine->max_depth = depth;
+
+        machine->opened = true;
+        machine->nodes++;
+
+        return;
+    }
+
+    if(!machine->depth)
+    {
+        PassOut(machine, token);
+        return;
+    }
+
+    Frame *top = &machine->frames[machine->depth - 1];
+
+    switch(token->kind)
+    {
+        case TOKEN_LABEL:
+        {
+            if(top->file)           Report(machine, token->pos, "label outside of a node");
+            else if(top->has_label) Report(machine, token->pos, "second label of a node");
+            else if(top->children)  Report(machine, token->pos, "label after the children");
+            else
+            {
+                top->has_label  = true;
+                top->label      = token->pos;
+                top->label_hash = token->hash;
+            }
+
+            break;
+        }
+
+        case TOKEN_NIL:
+        case TOKEN_NODE:
+        {
+            AddChild(machine, top, token);
+            break;
+        }
+
+        case TOKEN_CLOSE:
+        {
+            if(top->file)
+            {
+                Report(machine, token->pos, "unmatched ')'");
+                break;
+            }
+
+            if(!top->has_label)        Report(machine, top->open, "node without a label");
+            else if(top->children < 2) Report(machine, token->pos, "node with less than two children");
+            else if(!top->node_child)  AddLeaf(machine, top);
+
+            Token node = {TOKEN_NODE, top->open, 0};
+
+            machine->depth--;
+            Apply(machine, &node);
+
+            break;
+        }
+
+        case TOKEN_OPEN:
+        default:
+        {
+            break;
+        }
+    }
+}
+
+static void CheckRun(Machine *machine, const Run *const run)
+{
+    if(run->kind == LEX_LABEL)
+    {
+        if(run->len == 0)                 Report(machine, run->pos, "empty label");
+        else if(run->len >= MAX_DATA_LEN) Report(machine, run->pos, "label longer than the loader keeps");
+    }
+    else
+    {
+        if(run->len == 0)                      Report(machine, run->pos, "'#' without a hash");
+        else if(run->len > VALIDATE_HASH_LEN)  Report(machine, run->pos, "hash longer than 16 digits");
+    }
+}
+
+static void FinishRun(Chunk *chunk, Run *run, bool *carried)
+{
+    if(*carried)
+    {
+        chunk->lead        = *run;
+        chunk->lead_closed = true;
+
+        *carried = false;
+    }
+    else
+    {
+        CheckRun(&chunk->machine, run);
+
+        if(run->kind == LEX_LABEL)
+        {
+            Token label = {TOKEN_LABEL, run->pos, run->hash};
+            Apply(&chunk->machine, &label);
+        }
+    }
+
+    *run = {};
+}
+
+static void LexOut(Chunk *chunk, Run *run, TextPos pos, unsigned char ch, uint64_t *bad_end)
+{
+    Token token = {TOKEN_OPEN, pos, 0};
+
+    switch(ch)
+    {
+        case '(': token.kind = TOKEN_OPEN;  break;
+        case ')': token.kind = TOKEN_CLOSE; break;
+        case '*': token.kind = TOKEN_NIL;   break;
+
+        case '<':
+        {
+            *run = {LEX_LABEL, pos, 0, 0};
+            return;
+        }
+
+        default:
+        {
+            if(IsBlank(ch)) return;
+
+            // A run of bad bytes, such as a stray word, is one error.
+            if(pos.offset != *bad_end)
+            {
+                Report(&chunk->machine, pos, (ch == '\0') ? "NUL byte, the loader stops there" :
+                                             (ch == '#' ) ? "hash without a label"             :
+                                             (ch == '>' ) ? "'>' without a label"              :
+                                                            "unexpected character");
+            }
+
+            *bad_end = pos.offset + 1;
+            return;
+        }
+    }
+
+    Apply(&chunk->machine, &token);
+}
+
+static bool ReadBlock(int fd, unsigned char *block, uint64_t at, uint64_t end, size_t *got)
+{
+    size_t  want  = (end - at < VALIDATE_BLOCK) ? end - at : VALIDATE_BLOCK;
+    ssize_t got_r = pread(fd, block, want, (off_t)at);
+
+    if(got_r <= 0) return false;
+
+    *got = (size_t)got_r;
+
+    return true;
+}
+
+static void *ScanChunk(void *arg)
+{
+    Chunk *chunk = (Chunk *)arg;
+
+    unsigned char *block = (unsigned char *)MemCalloc(MEM_PARSER, VALIDATE_BLOCK, 1);
+
+    if(!block)
+    {
+        chunk->failed = true;
+        return NULL;
+    }
+
+    size_t map = 0;
+
+    size_t got = 0;
+
+    for(uint64_t at = chunk->begin; at < chunk->end; at += got)
+    {
+        if(!ReadBlock(chunk->fd, block, at, chunk->end, &got))
+        {
+            chunk->failed = true;
+            break;
+        }
+
+        for(size_t i = 0; i < got; i++) map = LEX_MAP_TABLE[map][block[i]];
+
+        unsigned char *line = block;
+
+        for(unsigned char *eol = block; (eol = (unsigned char *)memchr(eol, '\n', got - (size_t)(eol - block))); eol++)
+        {
+            chunk->newlines++;
+            chunk->tail_columns = 0;
+
+            line = eol + 1;
+        }
+
+        for(; line < block + got; line++) chunk->tail_columns += ((*line & 0xC0) != 0x80);
+    }
+
+    memcpy(chunk->exits, LEX_MAP_STATES[map], sizeof(chunk->exits));
+
+    MemFree(MEM_PARSER, block);
+
+    return NULL;
+}
+
+static void *CheckChunk(void *arg)
+{
+    Chunk   *chunk   = (Chunk *)arg;
+    Machine *machine = &chunk->machine;
+
+    unsigned char *block = (unsigned char *)MemCalloc(MEM_PARSER, VALIDATE_BLOCK, 1);
+
+    if(!block)
+    {
+        chunk->failed = true;
+        return NULL;
+    }
+
+    LexState state   = chunk->start;
+    TextPos  pos     = chunk->base;
+    Run      run     = {};
+    bool     carried = false;
+    uint64_t bad_end = UINT64_MAX;
+
+    if(state == LEX_HASH_EMPTY  || state == LEX_HASH)  run.kind = LEX_HASH;
+    if(state == LEX_LABEL_BLANK || state == LEX_LABEL) run.kind = LEX_LABEL;
+
+    carried = (run.kind != LEX_OUT);
+
+    // Outside after any other byte means the chunk starts inside a run of bad bytes.
+    unsigned char before = ' ';
+
+    if(state == LEX_OUT && chunk->begin && pread(chunk->fd, &before, 1, (off_t)(chunk->begin - 1)) == 1 &&
+       !IsBlank(before) && before != '(' && before != ')' && before != '*')
+    {
+        bad_end = chunk->begin;
+    }
+
+    size_t got = 0;
+
+    for(uint64_t at = chunk->begin; at < chunk->end; at += got)
+    {
+        if(!ReadBlock(chunk->fd, block, at, chunk->end, &got))
+        {
+            chunk->failed = true;
+            break;
+        }
+
+        for(size_t i = 0; i < got; i++)
+        {
+            unsigned char ch   = block[i];
+            LexState      next = (LexState)LEX_TABLE[state][ch];
+
+            if((ch & 0xC0) != 0x80) pos.column++;
+
+            switch(state)
+            {
+                case LEX_LABEL_BLANK:
+                case LEX_LABEL:
+                {
+                    if(ch == '>')
+                    {
+                        FinishRun(chunk, &run, &carried);
+                    }
+                    else if(ch == '\0')
+                    {
+                        Report(machine, pos, "NUL byte, the loader stops there");
+                    }
+                    else if(next == LEX_LABEL)
+                    {
+                        run.hash = run.hash * LABEL_HASH_BASE + ch + 1;
+                        run.len++;
+                    }
+
+                    break;
+                }
+
+                case LEX_HASH_EMPTY:
+                case LEX_HASH:
+                {
+                    if(next == LEX_HASH)
+                    {
+                        run.len++;
+                        break;
+                    }
+
+                    FinishRun(chunk, &run, &carried);
+                    LexOut(chunk, &run, pos, ch, &bad_end);
+
+                    break;
+                }
+
+                case LEX_AFTER_LABEL:
+                {
+                    if(ch == '#') run = {LEX_HASH, pos, 0, 0};
+                    else          LexOut(chunk, &run, pos, ch, &bad_end);
+
+                    break;
+                }
+
+                case LEX_OUT:
+                case LEX_STATE_COUNT:
+                default:
+                {
+                    LexOut(chunk, &run, pos, ch, &bad_end);
+                    break;
+                }
+            }
+
+            state = next;
+
+            if(ch == '\n')
+            {
+                pos.line++;
+                pos.column = 0;
+            }
+
+            pos.offset++;
+        }
+    }
+
+    if(carried)
+    {
+        chunk->lead = run;
+    }
+    else if(run.kind != LEX_OUT)
+    {
+        chunk->tail = run;
+
+        if(run.kind == LEX_LABEL)
+        {
+            Token label = {TOKEN_LABEL, run.pos, run.hash};
+            Apply(machine, &label);
+        }
+    }
+
+    chunk->finish = pos;
+
+    MemFree(MEM_PARSER, block);
+
+    return NULL;
+}
+
+static void RunChunks(Chunk *chunks, size_t n_chunks, size_t n_threads, ChunkRun run)
+{
+    pthread_t threads[PARALLEL_MAX_THREADS] = {};
+    bool      started[PARALLEL_MAX_THREADS] = {};
+
+    for(size_t first = 0; first < n_chunks; first += n_threads)
+    {
+        size_t count = (n_chunks - first < n_threads) ? n_chunks - first : n_threads;
+
+        for(size_t i = 1; i < count; i++) started[i] = (pthread_create(&threads[i], NULL, run, &chunks[first + i]) == 0);
+
+        for(size_t i = 0; i < count; i++)
+        {
+            if(i == 0 || !started[i]) run(&chunks[first + i]);
+        }
+
+        for(size_t i = 1; i < count; i++)
+        {
+            if(started[i]) pthread_join(threads[i], NULL);
+
+            started[i] = false;
+        }
+    }
+}
+
+// Replays what every chunk left to the frames opened before it, in file order.
+static void Stitch(Chunk *chunks, size_t n_chunks, Machine *stitch, ValidateReport *report)
+{
+    Frame *file = Push(stitch);
+    if(!file) return;
+
+    file->file = true;
+
+    Run carry = {};
+
+    for(size_t i = 0; i < n_chunks; i++)
+    {
+        Chunk   *chunk   = &chunks[i];
+        Machine *machine = &chunk->machine;
+
+        if(carry.kind != LEX_OUT)
+        {
+            carry.hash = carry.hash * Power(LABEL_HASH_BASE, chunk->lead.len) + chunk->lead.hash;
+            carry.len += chunk->lead.len;
+
+            if(chunk->lead_closed)
+            {
+                CheckRun(stitch, &carry);
+
+                Frame *top = &stitch->frames[stitch->depth - 1];
+
+                if(carry.kind == LEX_LABEL && top->has_label && top->label.offset == carry.pos.offset)
+                {
+                    top->label_hash = carry.hash;
+                }
+
+                carry = {};
+            }
+        }
+
+        long start_depth = (long)stitch->depth - 1;
+
+        for(size_t t = 0; t < machine->n_outer; t++) Apply(stitch, &machine->outer[t]);
+
+        if(machine->opened && start_depth + machine->max_depth - 1 > (long)report->max_depth)
+        {
+            report->max_depth = (size_t)(start_depth + machine->max_depth - 1);
+        }
+
+        for(size_t f = 0; f < machine->depth; f++)
+        {
+            Frame *frame = Push(stitch);
+            if(!frame) return;
+
+            *frame = machine->frames[f];
+        }
+
+        if(chunk->tail.kind != LEX_OUT) carry = chunk->tail;
+
+        report->nodes  += machine->nodes;
+        report->leaves += machine->leaf_count;
+
+        MemFree(MEM_PARSER, machine->frames);
+        MemFree(MEM_PARSER, machine->outer);
+
+        machine->frames = NULL;
+        machine->outer  = NULL;
+    }
+
+    if(carry.kind == LEX_LABEL) Report(stitch, carry.pos, "label without '>'");
+    if(carry.kind == LEX_HASH)  CheckRun(stitch, &carry);
+
+    for(size_t f = stitch->depth - 1; f > 0; f--) Report(stitch, stitch->frames[f].open, "'(' without ')'");
+
+    if(!stitch->frames[0].children) Report(stitch, {0, 1, 1}, "no tree in the file");
+
+    report->leaves += stitch->leaf_count;
+}
+
+static int CompareErrors(const void *first, const void *second)
+{
+    const ValidateError *a = (const ValidateError *)first;
+    const ValidateError *b = (const ValidateError *)second;
+
+    if(a->pos.offset != b->pos.offset) return (a->pos.offset > b->pos.offset) - (a->pos.offset < b->pos.offset);
+
+    return strcmp(a->message, b->message);
+}
+
+static int CompareLeaves(const void *first, const void *second)
+{
+    const LeafRecord *a = (const LeafRecord *)first;
+    const LeafRecord *b = (const LeafRecord *)second;
+
+    if(a->hash != b->hash) return (a->hash > b->hash) - (a->hash < b->hash);
+
+    return (a->offset > b->offset) - (a->offset < b->offset);
+}
+
+static void PrintErrors(const char *const file_name, Chunk *chunks, size_t n_chunks, Machine *stitch, FILE *out)
+{
+    size_t         capacity = (n_chunks + 1) * VALIDATE_MAX_ERRORS;
+    ValidateError *errors   = (ValidateError *)MemCalloc(MEM_PARSER, capacity, sizeof(ValidateError));
+    ASSERT(errors, return);
+
+    size_t n_errors = 0;
+
+    for(size_t i = 0; i <= n_chunks; i++)
+    {
+        Machine *machine = (i < n_chunks) ? &chunks[i].machine : stitch;
+
+        if(machine->n_errors) memcpy(errors + n_errors, machine->errors, machine->n_errors * sizeof(ValidateError));
+        n_errors += machine->n_errors;
+    }
+
+    qsort(errors, n_errors, sizeof(ValidateError), CompareErrors);
+
+    for(size_t i = 0; i < n_errors && i < VALIDATE_MAX_ERRORS; i++)
+    {
+        fprintf(out, "%s:%zu:%zu: byte %" PRIu64 ": %s\n", file_name,
+                errors[i].pos.line, errors[i].pos.column, errors[i].pos.offset, errors[i].message);
+    }
+
+    MemFree(MEM_PARSER, errors);
+}
+
+// The label as ReadLabel stores it.
+static bool ReadLabelAt(int fd, uint64_t offset, char *label)
+{
+    char   block[LABEL_READ] = {};
+    size_t len               = 0;
+    bool   blank             = true;
+
+    for(offset++; ; offset += LABEL_READ)
+    {
+        ssize_t got = pread(fd, block, LABEL_READ, (off_t)offset);
+        if(got <= 0) return false;
+
+        for(ssize_t i = 0; i < got; i++)
+        {
+            if(block[i] == '>')
+            {
+                label[len] = '\0';
+                return true;
+            }
+
+            if(blank && IsBlank((unsigned char)block[i])) continue;
+
+            blank = false;
+
+            if(len < MAX_DATA_LEN - 1) label[len++] = block[i];
+        }
+    }
+}
+
+// Moves the records with the label of the first one to the front, both parts still in
+// file order, and returns how many there are. An unreadable first label is a group of one.
+static size_t SameLabel(int fd, LeafRecord *leaves, size_t n_leaves, char *label, char *other)
+{
+    if(!ReadLabelAt(fd, leaves[0].offset, label)) return 1;
+
+    size_t same = 1;
+
+    for(size_t i = 1; i < n_leaves; i++)
+    {
+        if(!ReadLabelAt(fd, leaves[i].offset, other) || strcmp(label, other) != 0) continue;
+
+        LeafRecord leaf = leaves[same];
+        leaves[same++]  = leaves[i];
+        leaves[i]       = leaf;
+    }
+
+    qsort(leaves + 1   , same - 1       , sizeof(LeafRecord), CompareLeaves);
+    qsort(leaves + same, n_leaves - same, sizeof(LeafRecord), CompareLeaves);
+
+    return same;
+}
+
+// Equal 64-bit hashes only make equal labels likely, so the labels of a hash group are
+// read back and the group is split by their text.
+static void PrintDuplicates(int fd, Chunk *chunks, size_t n_chunks, Machine *stitch, FILE *out, ValidateReport *report)
+{
+    Machine *first = &chunks[0].machine;
+
+    size_t n_leaves = stitch->n_leaves;
+    for(size_t i = 0; i < n_chunks; i++) n_leaves += chunks[i].machine.n_leaves;
+
+    // The first chunk's records grow in place, so the others are copied once.
+    LeafRecord *leaves = (LeafRecord *)MemRealloc(MEM_PARSER, first->leaves, (n_leaves + 1) * sizeof(LeafRecord));
+    char       *label  = (char *)MemCalloc(MEM_PARSER, MAX_DATA_LEN, 1);
+    char       *other  = (char *)MemCalloc(MEM_PARSER, MAX_DATA_LEN, 1);
+
+    if(leaves) first->leaves = leaves;
+
+    if(!leaves || !label || !other)
+    {
+        fprintf(out, "no memory to look for duplicate labels\n");
+
+        MemFree(MEM_PARSER, label);
+        MemFree(MEM_PARSER, other);
+
+        return;
+    }
+
+    n_leaves = first->n_leaves;
+
+    for(size_t i = 1; i <= n_chunks; i++)
+    {
+        Machine *machine = (i < n_chunks) ? &chunks[i].machine : stitch;
+
+        if(machine->n_leaves) memcpy(leaves + n_leaves, machine->leaves, machine->n_leaves * sizeof(LeafRecord));
+        n_leaves += machine->n_leaves;
+
+        MemFree(MEM_PARSER, machine->leaves);
+        machine->leaves = NULL;
+    }
+
+    qsort(leaves, n_leaves, sizeof(LeafRecord), CompareLeaves);
+
+    for(size_t i = 0, next = 0; i < n_leaves; i = next)
+    {
+        for(next = i + 1; next < n_leaves && leaves[next].hash == leaves[i].hash; next++) {}
+
+        for(size_t begin = i, same = 0; next - begin >= 2; begin += same)
+        {
+            same = SameLabel(fd, leaves + begin, next - begin, label, other);
+            if(same < 2) continue;
+
+            fprintf(out, "duplicate leaf <%s> on lines %zu", label, leaves[begin].line);
+
+            for(size_t j = begin + 1; j < begin + same && j < begin + VALIDATE_MAX_PLACES; j++) fprintf(out, ", %zu", leaves[j].line);
+
+            fprintf(out, "%s (%zu times)\n", (same > VALIDATE_MAX_PLACES) ? ", ..." : "", same);
+
+            report->duplicates++;
+        }
+    }
+
+    MemFree(MEM_PARSER, label);
+    MemFree(MEM_PARSER, other);
+}
+
+static size_t SplitFile(Chunk *chunks, int fd, uint64_t size, const ValidateOptions *options, size_t n_threads)
+{
+    uint64_t chunk_size = options->chunk;
+
+    if(!chunk_size)
+    {
+        size_t n_chunks = size / VALIDATE_MIN_CHUNK;
+
+        if(n_chunks > n_threads) n_chunks = n_threads;
+        if(n_chunks < 1)         n_chunks = 1;
+
+        chunk_size = (size + n_chunks - 1) / n_chunks;
+    }
+
+    if(!chunk_size) chunk_size = 1;
+
+    size_t n_chunks = (size + chunk_size - 1) / chunk_size;
+    if(n_chunks < 1) n_chunks = 1;
+
+    if(chunks)
+    {
+        for(size_t i = 0; i < n_chunks; i++)
+        {
+            chunks[i].fd    = fd;
+            chunks[i].begin = i * chunk_size;
+            chunks[i].end   = (i + 1 == n_chunks) ? size : (i + 1) * chunk_size;
+
+            chunks[i].machine.duplicates = options->duplicates;
+        }
+    }
+
+    return n_chunks;
+}
+
+int ValidateFile(const char *const file_name, const ValidateOptions *options, FILE *out, ValidateReport *report)
+{
+    ASSERT(file_name, return EXIT_FAILURE);
+    ASSERT(options,   return EXIT_FAILURE);
+    ASSERT(out,       return EXIT_FAILURE);
+    ASSERT(report,    return EXIT_FAILURE);
+
+    pthread_once(&LEX_TABLE_ONCE, LexTableInit);
+
+    *report = {};
+
+    int fd = open(file_name, O_RDONLY);
+
+    struct stat file_stat = {};
+
+    if(fd < 0 || fstat(fd, &file_stat) != 0)
+    {
+        fprintf(out, "%s: can`t read\n", file_name);
+
+        if(fd >= 0) close(fd);
+
+        return EXIT_FAILURE;
+    }
+
+    size_t n_threads = options->threads ? options->threads : ParallelThreads();
+    if(n_threads > PARALLEL_MAX_THREADS) n_threads = PARALLEL_MAX_THREADS;
+
+    uint64_t size     = (uint64_t)file_stat.st_size;
+    size_t   n_chunks = SplitFile(NULL, fd, size, options, n_threads);
+    Chunk   *chunks   = (Chunk *)MemCalloc(MEM_PARSER, n_chunks, sizeof(Chunk));
+
+    if(!chunks)
+    {
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    SplitFile(chunks, fd, size, options, n_threads);
+
+    if(n_chunks > 1) RunChunks(chunks, n_chunks, n_threads, ScanChunk);
+
+    TextPos base = {0, 1, 0};
+
+    for(size_t i = 0; i < n_chunks; i++)
+    {
+        chunks[i].start = i ? (LexState)chunks[i - 1].exits[chunks[i - 1].start] : LEX_OUT;
+        chunks[i].base  = base;
+
+        base.offset = chunks[i].end;
+        base.line  += chunks[i].newlines;
+        base.column = chunks[i].newlines ? chunks[i].tail_columns : base.column + chunks[i].tail_columns;
+    }
+
+    RunChunks(chunks, n_chunks, n_threads, CheckChunk);
+
+    Machine stitch = {};
+    stitch.duplicates = options->duplicates;
+
+    bool failed = false;
+
+    for(size_t i = 0; i < n_chunks; i++) failed |= chunks[i].failed || chunks[i].machine.no_memory;
+
+    if(!failed)
+    {
+        Stitch(chunks, n_chunks, &stitch, report);
+
+        report->errors = stitch.errors_total;
+        for(size_t i = 0; i < n_chunks; i++) report->errors += chunks[i].machine.errors_total;
+
+        PrintErrors(file_name, chunks, n_chunks, &stitch, out);
+
+        if(options->duplicates && !stitch.no_memory) PrintDuplicates(fd, chunks, n_chunks, &stitch, out, report);
+
+        failed = stitch.no_memory;
+    }
+
+    if(failed) fprintf(out, "%s: can`t read or out of memory\n", file_name);
+
+    report->bytes  = size;
+    TextPos finish = chunks[n_chunks - 1].finish;
+
+    report->lines  = finish.column ? finish.line : finish.line - 1;
+    report->chunks = n_chunks;
+
+    MachineDtor(&stitch);
+
+    for(size_t i = 0; i < n_chunks; i++) MachineDtor(&chunks[i].machine);
+
+    MemFree(MEM_PARSER, chunks);
+    close(fd);
+
+    return (failed || report->errors) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int ValidateCommand(int argc, char *argv[])
+{
+    ValidateOptions options = {0, 0, true};
+
+    bool usage = (ParseThreads(&argc, &argv) != EXIT_SUCCESS);
+
+    while(!usage && argc > 1 && argv[0][0] == '-')
+    {
+        if(strcmp(argv[0], "--no-duplicates") == 0)
+        {
+            options.duplicates = false;
+
+            argc--;
+            argv++;
+        }
+        else if(strcmp(argv[0], "--chunk") == 0)
+        {
+            long long chunk = strtoll(argv[1], NULL, 10);
+
+            usage = (chunk <= 0);
+            options.chunk = (size_t)chunk;
+
+            argc -= 2;
+            argv += 2;
+        }
+        else
+        {
+            usage = true;
+        }
+    }
+
+    if(usage || argc != 1)
+    {
+        fprintf(stderr, "Usage: validate [--threads N] [--chunk bytes] [--no-duplicates] <data_base>\n");
+        return EXIT_FAILURE;
+    }
+
+    ValidateReport report = {};
+
+    uint64_t start  = MetricsNow();
+    int      status = ValidateFile(argv[0], &options, stdout, &report);
+    double   time   = (double)(MetricsNow() - start) * 1e-9;
+
+    printf("%s: %zu nodes, %zu leaves, max depth %zu, %zu errors, %zu duplicate leaf labels\n",
+           argv[0], report.nodes, report.leaves, report.max_depth, report.errors, report.duplicates);
+
+    printf("%" PRIu64 " bytes, %zu lines, %zu chunks, %.3f s, %.1f MB/s\n",
+           report.bytes, report.lines, report.chunks, time, (time > 0) ? (double)report.bytes / time * 1e-6 : 0.0);
+
+    return status;
+}